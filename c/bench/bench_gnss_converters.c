@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/* Replays RTCM3 captures through rtcm2sbp_decode_frame and reports the
+ * conversion throughput as JSON on stdout.
+ *
+ * Usage: bench_gnss_converters [-n iterations] [file ...]
+ *
+ * Without files, every capture in the unit test corpus is replayed. */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "rtcm3_sbp_internal.h"
+
+#define DEFAULT_ITERATIONS 20
+#define MAX_FILES 64
+#define MAX_PATH_LENGTH 512
+#define NUM_MSG_TYPES 4096
+
+struct frame {
+  u32 offset;
+  u16 size;
+  u16 msg_type;
+};
+
+struct capture {
+  char path[MAX_PATH_LENGTH];
+  u8 *data;
+  u32 size;
+  struct frame *frames;
+  u32 n_frames;
+};
+
+struct msg_type_stats {
+  u64 count;
+  u64 ns;
+};
+
+static struct rtcm3_sbp_state state;
+static struct capture captures[MAX_FILES];
+static u32 n_captures = 0;
+static struct msg_type_stats msg_type_stats[NUM_MSG_TYPES];
+
+#ifdef BENCH_COUNT_ALLOCS
+/* The allocator is wrapped at link time, only allocations made while the
+ * converter is running are counted */
+static bool count_allocs = false;
+static u64 n_allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+  n_allocs += count_allocs;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+  n_allocs += count_allocs;
+  return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  n_allocs += count_allocs;
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) { __real_free(ptr); }
+
+static void set_count_allocs(bool enabled) { count_allocs = enabled; }
+#else
+static void set_count_allocs(bool enabled) { (void)enabled; }
+#endif
+
+static void sbp_callback_null(u16 msg_id,
+                              u8 length,
+                              u8 *buffer,
+                              u16 sender_id) {
+  (void)msg_id;
+  (void)length;
+  (void)buffer;
+  (void)sender_id;
+}
+
+static u64 now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000u + (u64)ts.tv_nsec;
+}
+
+/* Find the CRC checked frames of the capture so that the timed loops only
+ * measure the conversion */
+static void index_frames(struct capture *capture) {
+  u32 max_frames = capture->size / (RTCM3_HEADER_SIZE + RTCM3_CRC_SIZE) + 1;
+  capture->frames = malloc(sizeof(struct frame) * max_frames);
+  if (NULL == capture->frames) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+
+  u32 index = 0;
+  while (index + RTCM3_HEADER_SIZE <= capture->size) {
+    const u8 *frame = &capture->data[index];
+    if (frame[0] != RTCM3_PREAMBLE) {
+      index++;
+      continue;
+    }
+    u16 message_size = ((frame[1] & 0x3) << 8) | frame[2];
+    u32 frame_size = RTCM3_HEADER_SIZE + message_size + RTCM3_CRC_SIZE;
+    if (message_size < 2 || index + frame_size > capture->size) {
+      index++;
+      continue;
+    }
+    const u8 *crc = &frame[RTCM3_HEADER_SIZE + message_size];
+    u32 frame_crc = ((u32)crc[0] << 16) | ((u32)crc[1] << 8) | crc[2];
+    if (crc24q(frame, RTCM3_HEADER_SIZE + message_size, 0) != frame_crc) {
+      index++;
+      continue;
+    }
+
+    struct frame *entry = &capture->frames[capture->n_frames++];
+    entry->offset = index;
+    entry->size = frame_size;
+    entry->msg_type = (frame[3] << 4) | ((frame[4] >> 4) & 0xf);
+    index += frame_size;
+  }
+}
+
+static void load_capture(const char *path) {
+  if (n_captures >= MAX_FILES) {
+    fprintf(stderr, "Too many input files, ignoring %s\n", path);
+    return;
+  }
+
+  FILE *fp = fopen(path, "rb");
+  if (NULL == fp) {
+    fprintf(stderr, "Can't open input file! %s\n", path);
+    exit(1);
+  }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  struct capture *capture = &captures[n_captures++];
+  snprintf(capture->path, sizeof(capture->path), "%s", path);
+  capture->size = (u32)size;
+  capture->data = malloc(size > 0 ? (size_t)size : 1);
+  if (NULL == capture->data ||
+      fread(capture->data, 1, capture->size, fp) != capture->size) {
+    fprintf(stderr, "Can't read input file! %s\n", path);
+    exit(1);
+  }
+  fclose(fp);
+
+  index_frames(capture);
+}
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static void load_corpus(void) {
+  const char *corpus = RELATIVE_PATH_PREFIX "/data";
+  DIR *dir = opendir(corpus);
+  if (NULL == dir) {
+    fprintf(stderr, "Can't open corpus directory! %s\n", corpus);
+    exit(1);
+  }
+
+  char *names[MAX_FILES];
+  u32 n_names = 0;
+  struct dirent *entry;
+  while (NULL != (entry = readdir(dir)) && n_names < MAX_FILES) {
+    if (entry->d_name[0] != '.') {
+      names[n_names++] = strdup(entry->d_name);
+    }
+  }
+  closedir(dir);
+
+  /* replay the captures in a stable order */
+  qsort(names, n_names, sizeof(names[0]), compare_names);
+  for (u32 i = 0; i < n_names; i++) {
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/%s", corpus, names[i]);
+    load_capture(path);
+    free(names[i]);
+  }
+}
+
+static void reset_converter(void) {
+  gps_time_sec_t current_time = {.wn = 1945, .tow = 211190};
+  rtcm2sbp_init(&state, sbp_callback_null, NULL);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_leap_second(18, &state);
+}
+
+static void replay(const struct capture *capture) {
+  for (u32 i = 0; i < capture->n_frames; i++) {
+    const struct frame *frame = &capture->frames[i];
+    rtcm2sbp_decode_frame(&capture->data[frame->offset], frame->size, &state);
+  }
+}
+
+/* Replay once more timing every frame, this adds the clock overhead to each
+ * frame so is kept out of the throughput figures */
+static void replay_per_msg_type(const struct capture *capture) {
+  for (u32 i = 0; i < capture->n_frames; i++) {
+    const struct frame *frame = &capture->frames[i];
+    u64 start = now_ns();
+    rtcm2sbp_decode_frame(&capture->data[frame->offset], frame->size, &state);
+    u64 end = now_ns();
+    msg_type_stats[frame->msg_type].count++;
+    msg_type_stats[frame->msg_type].ns += end - start;
+  }
+}
+
+/* Print a string as a JSON string literal */
+static void print_json_string(const char *string) {
+  putchar('"');
+  for (const char *c = string; '\0' != *c; c++) {
+    if ('"' == *c || '\\' == *c) {
+      printf("\\%c", *c);
+    } else if ((unsigned char)*c < 0x20) {
+      printf("\\u%04x", (unsigned char)*c);
+    } else {
+      putchar(*c);
+    }
+  }
+  putchar('"');
+}
+
+int main(int argc, char **argv) {
+  u32 iterations = DEFAULT_ITERATIONS;
+  int arg = 1;
+  if (arg + 1 < argc && 0 == strcmp(argv[arg], "-n")) {
+    iterations = (u32)strtoul(argv[arg + 1], NULL, 10);
+    arg += 2;
+  }
+  if (0 == iterations) {
+    fprintf(stderr, "Usage: %s [-n iterations] [file ...]\n", argv[0]);
+    return 1;
+  }
+
+  if (arg < argc) {
+    for (; arg < argc; arg++) {
+      load_capture(argv[arg]);
+    }
+  } else {
+    load_corpus();
+  }
+
+  u64 total_frames = 0;
+  u64 total_bytes = 0;
+  u64 total_ns = 0;
+
+  printf("{\n  \"iterations\": %u,\n  \"files\": [", iterations);
+  for (u32 i = 0; i < n_captures; i++) {
+    const struct capture *capture = &captures[i];
+    u64 bytes = 0;
+    for (u32 j = 0; j < capture->n_frames; j++) {
+      bytes += capture->frames[j].size;
+    }
+
+    /* each iteration starts from a fresh converter, the reset is not timed */
+    u64 elapsed = 0;
+    for (u32 j = 0; j < iterations; j++) {
+      reset_converter();
+      set_count_allocs(true);
+      u64 start = now_ns();
+      replay(capture);
+      elapsed += now_ns() - start;
+      set_count_allocs(false);
+    }
+    reset_converter();
+    set_count_allocs(true);
+    replay_per_msg_type(capture);
+    set_count_allocs(false);
+
+    total_frames += (u64)capture->n_frames * iterations;
+    total_bytes += bytes * iterations;
+    total_ns += elapsed;
+
+    double seconds = elapsed > 0 ? elapsed * 1e-9 : 1e-9;
+    printf("%s\n    {\"file\": ", i > 0 ? "," : "");
+    print_json_string(capture->path);
+    printf(", \"frames\": %u, \"bytes\": %llu, "
+           "\"frames_per_s\": %.1f, \"mb_per_s\": %.3f}",
+           capture->n_frames,
+           (unsigned long long)bytes,
+           (double)capture->n_frames * iterations / seconds,
+           (double)bytes * iterations / seconds / 1e6);
+  }
+
+  double seconds = total_ns > 0 ? total_ns * 1e-9 : 1e-9;
+  printf("\n  ],\n  \"total\": {\"frames\": %llu, \"bytes\": %llu, "
+         "\"seconds\": %.6f, \"frames_per_s\": %.1f, \"mb_per_s\": %.3f},\n",
+         (unsigned long long)total_frames,
+         (unsigned long long)total_bytes,
+         seconds,
+         total_frames / seconds,
+         total_bytes / seconds / 1e6);
+
+  printf("  \"msg_types\": {");
+  bool first = true;
+  for (u32 i = 0; i < NUM_MSG_TYPES; i++) {
+    if (0 == msg_type_stats[i].count) {
+      continue;
+    }
+    printf("%s\n    \"%u\": {\"count\": %llu, \"ns_per_msg\": %.1f}",
+           first ? "" : ",",
+           i,
+           (unsigned long long)msg_type_stats[i].count,
+           (double)msg_type_stats[i].ns / msg_type_stats[i].count);
+    first = false;
+  }
+  printf("\n  },\n");
+
+#ifdef BENCH_COUNT_ALLOCS
+  printf("  \"allocations\": %llu\n}\n", (unsigned long long)n_allocs);
+#else
+  printf("  \"allocations\": null\n}\n");
+#endif
+
+  for (u32 i = 0; i < n_captures; i++) {
+    free(captures[i].frames);
+    free(captures[i].data);
+  }
+  return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef GNSS_CONVERTERS_RTCM3_RTCM3_INTERFACE_H
+#define GNSS_CONVERTERS_RTCM3_RTCM3_INTERFACE_H
+
+#include <rtcm3_sbp.h>
+
+/* Station ID setting that leaves the station IDs of the input as they are */
+#define RTCM2RTCM_KEEP_STATION_ID (0xFFFFu)
+
+struct rtcm3_rtcm3_state {
+  void (*cb_rtcm_out)(const u8 *frame, u16 length, void *context);
+  void *context;
+  /* Message types dropped, bit i of the words for message number
+     RTCM3_MSG_TYPE_MIN + i */
+  u32 drop_mask[(RTCM3_NUM_MSG_TYPES + 31) / 32];
+  /* Whether the message types outside of the drop mask are dropped */
+  bool drop_other;
+  /* Station ID written into the output, or RTCM2RTCM_KEEP_STATION_ID */
+  u16 station_id;
+  bool msm7_to_msm4;
+  struct rtcm3_frame_reader reader;
+  /* Output frame of the rewritten messages, including the transport layer
+     header and CRC */
+  u8 frame[RTCM3_MAX_FRAME_SIZE];
+};
+
+/* Normalises an RTCM3 stream: drops unwanted message types, rewrites the
+ * station IDs and converts MSM7 observations into the smaller MSM4. Each
+ * output frame is handed to the cb_rtcm_out callback.
+ *
+ * A frame that needs no change is passed on as the original bytes, without
+ * being decoded, and without being copied when the whole frame is within
+ * the input chunk. Only the frames that change are rewritten.
+ */
+void rtcm2rtcm_init(struct rtcm3_rtcm3_state *state,
+                    void (*cb_rtcm_out)(const u8 *frame,
+                                        u16 length,
+                                        void *context),
+                    void *context);
+
+bool rtcm2rtcm_set_msg_dropped(u16 msg_type,
+                               bool dropped,
+                               struct rtcm3_rtcm3_state *state);
+
+void rtcm2rtcm_set_other_msgs_dropped(bool dropped,
+                                      struct rtcm3_rtcm3_state *state);
+
+void rtcm2rtcm_set_station_id(u16 station_id,
+                              struct rtcm3_rtcm3_state *state);
+
+void rtcm2rtcm_set_msm7_to_msm4(bool enabled,
+                                struct rtcm3_rtcm3_state *state);
+
+void rtcm2rtcm_process_frame(const u8 *frame,
+                             u16 length,
+                             struct rtcm3_rtcm3_state *state);
+
+void rtcm2rtcm_process_bytes(const u8 *buf,
+                             u32 len,
+                             struct rtcm3_rtcm3_state *state);
+
+#endif /* GNSS_CONVERTERS_RTCM3_RTCM3_INTERFACE_H */
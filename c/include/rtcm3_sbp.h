@@ -16,6 +16,7 @@
 #include <libsbp/gnss.h>
 #include <libsbp/logging.h>
 #include <libsbp/observation.h>
+#include <libsbp/ssr.h>
 #include <rtcm3_messages.h>
 
 /* This is the maximum number of SBP observations possible per epoch:
@@ -31,7 +32,43 @@
 #define MAX_OBS_IN_SBP \
   ((SBP_FRAMING_MAX_PAYLOAD_SIZE - SBP_HDR_SIZE) / SBP_OBS_SIZE)
 #define MAX_OBS_PER_EPOCH (SBP_MAX_OBS_SEQ * MAX_OBS_IN_SBP)
-#define OBS_BUFFER_SIZE (SBP_HDR_SIZE + MAX_OBS_PER_EPOCH * SBP_OBS_SIZE)
+
+/* The SBP output buffer is laid out as SBP_MAX_OBS_SEQ consecutive
+   SBP_MSG_OBS payloads, each with room for its header in front of
+   MAX_OBS_IN_SBP observations, so that a whole epoch can be packed into it */
+#define SBP_OBS_MSG_SIZE (SBP_HDR_SIZE + MAX_OBS_IN_SBP * SBP_OBS_SIZE)
+#define OBS_BUFFER_SIZE (SBP_MAX_OBS_SEQ * SBP_OBS_MSG_SIZE)
+
+/* Signals tracked in an epoch to find duplicate observations: every SBP code
+   below RTCM3_SIGNAL_CODES, and for each code the satellites of its
+   constellation. The PRNs of a constellation span fewer than
+   RTCM3_SIGNAL_SATS values, so the PRN modulo RTCM3_SIGNAL_SATS identifies the
+   satellite. */
+#define RTCM3_SIGNAL_CODES (48u)
+#define RTCM3_SIGNAL_SATS (64u)
+
+/* Constellations of the MSM messages, indexed by the librtcm
+   constellation_t, and the mask converting all the SBP codes of one */
+#define RTCM3_MSM_CONSTELLATIONS (6u)
+#define RTCM3_ALL_CODES (~(u64)0)
+
+/* RTCM3 transport layer framing: preamble, 6 reserved bits, 10 bit message
+   length, message and a 24 bit CRC-24Q */
+#define RTCM3_PREAMBLE 0xD3
+#define RTCM3_HEADER_SIZE (3u)
+#define RTCM3_CRC_SIZE (3u)
+#define RTCM3_MAX_MSG_SIZE (1023u)
+#define RTCM3_MAX_FRAME_SIZE \
+  (RTCM3_HEADER_SIZE + RTCM3_MAX_MSG_SIZE + RTCM3_CRC_SIZE)
+
+/* Partial RTCM3 frame kept between chunks of an input stream */
+struct rtcm3_frame_reader {
+  u8 frame_buffer[RTCM3_MAX_FRAME_SIZE];
+  u16 frame_len;
+  /* Running CRC over the first frame_crc_len bytes of frame_buffer */
+  u32 frame_crc;
+  u16 frame_crc_len;
+};
 
 #define INVALID_TIME 0xFFFF
 #define MAX_WN (INT16_MAX)
@@ -46,28 +83,469 @@ typedef enum {
   UNSUPPORTED_CODE_MAX
 } unsupported_code_t;
 
-struct rtcm3_sbp_state {
-  gps_time_sec_t time_from_rover_obs;
-  s8 leap_seconds;
-  bool leap_second_known;
+/* Bounds of the batch handed to the batch callback: a full observation epoch
+   plus room for the base position, bias and log messages received alongside
+   it */
+#define SBP_BATCH_MAX_MSGS (SBP_MAX_OBS_SEQ + 17u)
+#define SBP_BATCH_BUFFER_SIZE (16u * SBP_FRAMING_MAX_PAYLOAD_SIZE)
+
+/* SBP message handed out as part of a batch */
+struct rtcm3_sbp_batch_msg {
+  u16 msg_id;
+  u16 sender_id;
+  u8 len;
+  const u8 *payload;
+};
+
+/* SBP framing around a payload: preamble, message type, sender ID and
+   length before it and the CRC-16-CCITT after it */
+#define SBP_FRAME_PREAMBLE (0x55u)
+#define SBP_FRAME_HEADER_SIZE (6u)
+#define SBP_FRAME_CRC_SIZE (2u)
+#define SBP_FRAME_MAX_SIZE \
+  (SBP_FRAME_HEADER_SIZE + SBP_FRAMING_MAX_PAYLOAD_SIZE + SBP_FRAME_CRC_SIZE)
+
+/* Caller provided ring buffer of framed SBP output, see
+   rtcm2sbp_set_frame_ring. A frame is never split across the end of the
+   buffer: when it does not fit before the end it goes to the start, and the
+   reader wraps around at wrap_end. */
+struct rtcm3_sbp_ring {
+  u8 *buffer;
+  u32 size;
+  /* Offset of the next frame written */
+  u32 write;
+  /* Offset of the next byte read */
+  u32 read;
+  /* End of the frames before the start of the buffer when the writer has
+     wrapped around and the reader has not */
+  u32 wrap_end;
+  /* Open reservation, see rtcm2sbp_ring_reserve */
+  bool reserved;
+  u32 reserved_offset;
+  u8 reserved_len;
+  /* Frames that did not fit */
+  u32 dropped;
+};
+
+/* Range of RTCM message numbers that can have a handler */
+#define RTCM3_MSG_TYPE_MIN (1001u)
+#define RTCM3_MSG_TYPE_MAX (1300u)
+#define RTCM3_NUM_MSG_TYPES (RTCM3_MSG_TYPE_MAX - RTCM3_MSG_TYPE_MIN + 1)
+
+struct rtcm3_sbp_state;
+
+/* Handler converting an RTCM message, msg points to the message following the
+   frame header */
+typedef void (*rtcm2sbp_msg_handler_t)(const uint8_t *msg,
+                                       struct rtcm3_sbp_state *state);
+
+struct rtcm3_msg_handler {
+  rtcm2sbp_msg_handler_t handler;
+  bool enabled;
+};
+
+/* GLO code-phase biases of a receiver type, applied to the stations whose
+   1033 receiver descriptor contains the pattern */
+struct rtcm2sbp_glo_bias_entry {
+  const char *pattern;
+  u8 mask;
+  double l1ca_bias_m;
+  double l1p_bias_m;
+  double l2ca_bias_m;
+  double l2p_bias_m;
+};
+
+/* Total number of receiver bias entries, built in and caller provided */
+#define RTCM3_MAX_GLO_BIAS_ENTRIES (64u)
+#define RTCM3_GLO_BIAS_NONE (0xFFu)
+
+/* Receiver descriptor matcher. The entries are in priority order and each
+   descriptor byte indexes the chain of entries whose pattern starts with it,
+   so a descriptor is matched in a single pass over its characters. */
+struct rtcm3_glo_bias_matcher {
+  const struct rtcm2sbp_glo_bias_entry *entries[RTCM3_MAX_GLO_BIAS_ENTRIES];
+  u8 pattern_len[RTCM3_MAX_GLO_BIAS_ENTRIES];
+  u8 n_entries;
+  /* First entry and next entry of the chain, RTCM3_GLO_BIAS_NONE ends it */
+  u8 first[256];
+  u8 next[RTCM3_MAX_GLO_BIAS_ENTRIES];
+};
+
+/* Stream events counted in the converter statistics */
+typedef enum {
+  /* Legacy observation message ignored because its epoch was already sent
+     out */
+  RTCM2SBP_EVENT_LEGACY_MSG_DROPPED = 0,
+  /* MSM epoch sent out before its final message arrived */
+  RTCM2SBP_EVENT_MSM_INCOMPLETE,
+  /* Epoch sent out because its deadline passed, see
+     rtcm2sbp_set_epoch_deadline */
+  RTCM2SBP_EVENT_EPOCH_DEADLINE,
+  /* MSM observation of a signal that is not converted, see
+     rtcm2sbp_set_msm_code_mask */
+  RTCM2SBP_EVENT_UNSUPPORTED_SIGNAL,
+  /* Observations dropped because the epoch buffer was full */
+  RTCM2SBP_EVENT_BUFFER_FULL,
+  /* Merged epoch sent out before all the stations arrived, see
+     rtcm2sbp_set_epoch_merger */
+  RTCM2SBP_EVENT_MERGE_INCOMPLETE,
+  /* Station epoch that arrived after its merged epoch was sent out, it is
+     sent out on its own */
+  RTCM2SBP_EVENT_MERGE_LATE,
+  /* Observation of a signal already in the epoch, the one from the most
+     precise message is kept */
+  RTCM2SBP_EVENT_DUPLICATE_SIGNAL,
+  /* Ephemeris not sent out because it is the one last sent for the
+     satellite */
+  RTCM2SBP_EVENT_EPH_UNCHANGED,
+  /* MSM1-3 observation dropped because the whole milliseconds of its range
+     are unknown, see rtcm2sbp_set_orbit_store */
+  RTCM2SBP_EVENT_MSM_NO_RANGE,
+  /* SBP frame dropped because the output ring was full */
+  RTCM2SBP_EVENT_OUTPUT_FULL,
+  RTCM2SBP_EVENT_COUNT
+} rtcm2sbp_event_t;
+
+/* Histogram of the conversion time of a frame. Below 8 ns each bucket is 1 ns
+   wide, above that every power of two is split into 8 buckets, giving a
+   resolution of 12.5%. The last bucket also counts everything above its
+   range of about 134 ms. */
+#define RTCM2SBP_LATENCY_SUB_BUCKET_BITS (3u)
+#define RTCM2SBP_LATENCY_BUCKETS (200u)
+
+struct rtcm2sbp_latency_histogram {
+  u32 counts[RTCM2SBP_LATENCY_BUCKETS];
+};
+
+/* Statistics of one reference station. All the counters are u32 so that
+   they can be copied a word at a time. */
+struct rtcm2sbp_station_stats {
+  u32 frames;
+  u32 events[RTCM2SBP_EVENT_COUNT];
+  struct rtcm2sbp_latency_histogram latency;
+};
+
+/* Statistics of the converter, over all stations */
+struct rtcm2sbp_stats {
+  /* Frames and frames that failed to decode, indexed by message number -
+     RTCM3_MSG_TYPE_MIN */
+  u32 frames[RTCM3_NUM_MSG_TYPES];
+  u32 decode_errors[RTCM3_NUM_MSG_TYPES];
+  /* Frames with a message number outside of the range above */
+  u32 frames_other;
+  u32 events[RTCM2SBP_EVENT_COUNT];
+  struct rtcm2sbp_latency_histogram latency;
+};
+
+/* Observations of an epoch, kept as one array per field indexed by
+   observation so that they can be sorted, filtered and read without walking
+   packed structures. The values are in the SBP observation units; the SBP
+   messages are only packed when the epoch is sent out. In-process consumers
+   can read the values in physical units with the rtcm2sbp_obs_* accessors. */
+struct rtcm3_obs_epoch {
+  sbp_gps_time_t t;
+  u8 n_obs;
+  sbp_gnss_signal_t sid[MAX_OBS_PER_EPOCH];
+  /* Pseudorange [2 cm] */
+  u32 P[MAX_OBS_PER_EPOCH];
+  /* Carrier phase, whole cycles and 1/256th fraction */
+  s32 L_i[MAX_OBS_PER_EPOCH];
+  u8 L_f[MAX_OBS_PER_EPOCH];
+  /* Doppler, whole Hz and 1/256th fraction */
+  s16 D_i[MAX_OBS_PER_EPOCH];
+  u8 D_f[MAX_OBS_PER_EPOCH];
+  /* Carrier to noise ratio [0.25 dB-Hz] */
+  u8 cn0[MAX_OBS_PER_EPOCH];
+  /* Lock time indicator, see DF402 */
+  u8 lock[MAX_OBS_PER_EPOCH];
+  /* SBP observation flags */
+  u8 flags[MAX_OBS_PER_EPOCH];
+};
+
+/* Conversion state kept for each reference station */
+struct rtcm3_station_state {
+  u16 stn_id;
+  bool in_use;
+  /* Value of the state's station_use_count on the last access, for LRU
+     eviction */
+  u32 last_used;
   u16 sender_id;
   gps_time_sec_t last_gps_time;
   gps_time_sec_t last_glo_time;
   gps_time_sec_t last_1230_received;
   gps_time_sec_t last_msm_received;
+  /* Receiver descriptor of the last 1033 message and the bias entry it
+     matched, so that repeated 1033 messages skip the matching */
+  u8 rcv_descriptor_len;
+  char rcv_descriptor[RTCM_MAX_STRING_LEN];
+  u8 glo_bias_index;
+  bool glo_bias_cached;
+  /* Antenna reference point of the last 1005/1006 message [m] */
+  double base_pos_ecef[3];
+  bool base_pos_known;
+  struct rtcm2sbp_station_stats stats;
+  /* Legacy observation messages received for the epoch at epoch.t, one
+     bit per message number from 1001, and their count. The expected ones
+     are what the last expected_msgs_count epochs of the station contained. */
+  u16 epoch_msgs;
+  u8 epoch_n_msgs;
+  u16 expected_msgs;
+  u8 expected_n_msgs;
+  u8 expected_msgs_count;
+  /* Epoch being collected */
+  struct rtcm3_obs_epoch epoch;
+  /* Signals in the epoch being collected, a bit per satellite for each code,
+     valid while the epoch has observations. For a set bit signal_obs gives
+     the index of the observation, and obs_precision ranks the message it was
+     converted from. */
+  u64 epoch_signals[RTCM3_SIGNAL_CODES];
+  u8 signal_obs[RTCM3_SIGNAL_CODES][RTCM3_SIGNAL_SATS];
+  u8 obs_precision[MAX_OBS_PER_EPOCH];
+};
+
+/* Most stations the epoch merger can wait for in an epoch */
+#define RTCM3_MERGER_MAX_STATIONS (32u)
+
+/* Epoch of one station held by the merger */
+struct rtcm3_merger_entry {
+  u16 sender_id;
+  struct rtcm3_obs_epoch epoch;
+};
+
+/* Slot of the merger ring, holding the epochs of all the stations for one
+   epoch time */
+struct rtcm3_merger_slot {
+  sbp_gps_time_t t;
+  u8 n_entries;
+  struct rtcm3_merger_entry *entries;
+};
+
+/* Epoch merger, see rtcm2sbp_set_epoch_merger. The slots in use form a ring
+   ordered by epoch time, starting at the oldest one. */
+struct rtcm3_epoch_merger {
+  struct rtcm3_merger_slot *slots;
+  u8 n_slots;
+  u8 head;
+  u8 n_used;
+  u8 max_stations;
+  u16 deadline_ms;
+  /* Sender IDs of the stations expected in every epoch */
+  u16 stations[RTCM3_MERGER_MAX_STATIONS];
+  u8 n_stations;
+  /* Time of the newest epoch received and of the last one sent out, in ms
+     since the start of GPS time */
+  s64 newest_ms;
+  s64 released_ms;
+  bool released;
+};
+
+/* Constellations with ephemeris conversion, with their own dense index rather
+   than rtcm_constellation_t, and satellites of each indexed by the 6 bit
+   satellite ID */
+#define RTCM3_EPH_GPS (0u)
+#define RTCM3_EPH_GLO (1u)
+#define RTCM3_EPH_GAL (2u)
+#define RTCM3_EPH_BDS (3u)
+#define RTCM3_EPH_CONSTELLATIONS (4u)
+/* The last sent ephemerides are kept per constellation, and the Galileo
+   F/NAV ones in a row of their own as they are sent apart from I/NAV */
+#define RTCM3_EPH_GAL_FNAV RTCM3_EPH_CONSTELLATIONS
+#define RTCM3_EPH_KEYS (RTCM3_EPH_CONSTELLATIONS + 1)
+#define RTCM3_EPH_MAX_SATS (64u)
+
+/* Identity of the last ephemeris sent out for a satellite, in the raw RTCM
+   units, and the rover time it was sent at */
+struct rtcm3_eph_key {
+  bool valid;
+  u8 health_bits;
+  u16 wn;
+  u32 toe;
+  u16 iode;
+  u16 iodc;
+  u32 sent_s;
+};
+
+/* Orbit of a satellite from its last broadcast ephemeris, in SI units */
+struct rtcm3_kepler_orbit {
+  double sqrta;
+  double ecc;
+  double m0;
+  double dn;
+  double omega0;
+  double omegadot;
+  double w;
+  double inc;
+  double inc_dot;
+};
+
+struct rtcm3_glo_orbit {
+  double pos[3];
+  double vel[3];
+  double acc[3];
+};
+
+struct rtcm3_orbit {
+  bool valid;
+  gps_time_sec_t toe;
+  /* Satellite clock offset from GPS time [s] */
+  double clock_s;
+  union {
+    struct rtcm3_kepler_orbit kepler;
+    struct rtcm3_glo_orbit glo;
+  } data;
+};
+
+/* Satellite orbits, see rtcm2sbp_set_orbit_store */
+struct rtcm3_orbit_store {
+  struct rtcm3_orbit sats[RTCM3_EPH_CONSTELLATIONS][RTCM3_EPH_MAX_SATS];
+};
+
+/* Constellations with SSR conversion, with their own dense index rather than
+   rtcm_constellation_t, and satellites of each indexed by the satellite ID */
+#define RTCM3_SSR_GPS (0u)
+#define RTCM3_SSR_GLO (1u)
+#define RTCM3_SSR_CONSTELLATIONS (2u)
+#define RTCM3_SSR_MAX_SATS (64u)
+
+/* Phase biases of a satellite that fit in one SBP message */
+#define RTCM3_SSR_MAX_PHASE_BIASES                                   \
+  ((SBP_FRAMING_MAX_PAYLOAD_SIZE - sizeof(msg_ssr_phase_biases_t)) / \
+   sizeof(phase_biases_content_t))
+
+/* Sizes of the SBP bias payloads kept for a satellite */
+#define RTCM3_SSR_CODE_BIASES_SIZE \
+  (sizeof(msg_ssr_code_biases_t) + \
+   MAX_SSR_SIGNALS * sizeof(code_biases_content_t))
+#define RTCM3_SSR_PHASE_BIASES_SIZE \
+  (sizeof(msg_ssr_phase_biases_t) + \
+   RTCM3_SSR_MAX_PHASE_BIASES * sizeof(phase_biases_content_t))
+
+/* SSR message kinds of an SSR epoch */
+#define RTCM3_SSR_ORBIT_CLOCK (1u << 0)
+#define RTCM3_SSR_CODE_BIASES (1u << 1)
+#define RTCM3_SSR_PHASE_BIASES (1u << 2)
+
+/* Latest corrections of a satellite, as the SBP payloads they are sent out
+   in. A length of 0 means there are no biases of that kind. */
+struct rtcm3_ssr_sat {
+  /* Set when a correction of the satellite arrived in the open epoch */
+  bool updated;
+  bool has_orbit_clock;
+  u8 code_biases_len;
+  u8 phase_biases_len;
+  msg_ssr_orbit_clock_t orbit_clock;
+  u8 code_biases[RTCM3_SSR_CODE_BIASES_SIZE];
+  u8 phase_biases[RTCM3_SSR_PHASE_BIASES_SIZE];
+};
+
+/* SSR epoch of a constellation being collected. The kinds are bit sets of
+   the RTCM3_SSR_* message kinds: the ones received in the epoch, the ones
+   whose last message arrived, and the ones the previous epoch contained. */
+struct rtcm3_ssr_epoch {
+  u32 epoch_time;
+  bool open;
+  /* Set once the corrections of epoch_time were sent out */
+  bool sent;
+  u8 kinds;
+  u8 kinds_done;
+  u8 expected_kinds;
+};
+
+/* Per satellite correction store, see rtcm2sbp_set_ssr_store */
+struct rtcm3_ssr_store {
+  struct rtcm3_ssr_epoch epochs[RTCM3_SSR_CONSTELLATIONS];
+  struct rtcm3_ssr_sat sats[RTCM3_SSR_CONSTELLATIONS][RTCM3_SSR_MAX_SATS];
+};
+
+/* Rover time kept in the form the message times are resolved against, so
+   that a message time only takes a subtraction and a comparison. Updated
+   with the rover time and the leap seconds. */
+struct rtcm3_time_anchor {
+  bool valid;
+  u16 wn;
+  s32 tow;
+  /* Start of the GPS day of the rover time [s of week] */
+  s32 day_start;
+  /* GPS time of week of the GLONASS time of day 0 in the day of the rover
+     time [s], valid with the leap seconds */
+  s32 glo_day_start;
+};
+
+struct rtcm3_sbp_state {
+  gps_time_sec_t time_from_rover_obs;
+  s8 leap_seconds;
+  bool leap_second_known;
+  struct rtcm3_time_anchor time_anchor;
   void (*cb_rtcm_to_sbp)(u16 msg_id, u8 len, u8 *buff, u16 sender_id);
   void (*cb_base_obs_invalid)(double time_diff);
-  u8 obs_buffer[OBS_BUFFER_SIZE];
+  /* Optional batch output, see rtcm2sbp_set_batch_callback */
+  void (*cb_batch)(const struct rtcm3_sbp_batch_msg *msgs,
+                   u8 n_msgs,
+                   void *context);
+  void *batch_context;
+  struct rtcm3_sbp_batch_msg batch[SBP_BATCH_MAX_MSGS];
+  u8 batch_n_msgs;
+  /* Copies of the batched messages that are not observations */
+  u8 batch_buffer[SBP_BATCH_BUFFER_SIZE];
+  u16 batch_buffer_used;
+  /* Optional framed output, see rtcm2sbp_set_frame_ring */
+  struct rtcm3_sbp_ring *frame_ring;
+  /* Optional output of the observation epochs without SBP packing, see
+     rtcm2sbp_set_epoch_callback */
+  void (*cb_epoch)(const struct rtcm3_obs_epoch *epoch,
+                   u16 sender_id,
+                   void *context);
+  void *epoch_context;
+  /* SBP_MSG_OBS payloads of the epochs being sent out, and the part of it
+     the batched messages point into */
+  u8 obs_msg_buffer[OBS_BUFFER_SIZE];
+  u16 obs_msg_used;
+  /* How long after the epoch time a buffered epoch is sent out, 0 to wait
+     for the epoch to complete */
+  u16 epoch_deadline_ms;
+  /* Optional merger of the epochs of several stations */
+  struct rtcm3_epoch_merger merger;
   bool sent_msm_warning;
+  /* SBP codes converted from MSM, a bit per code for each constellation */
+  u64 msm_code_mask[RTCM3_MSM_CONSTELLATIONS];
   bool sent_code_warning[UNSUPPORTED_CODE_MAX];
   /* GLO FCN map, indexed by 1-based PRN */
   u8 glo_sv_id_fcn_map[GLO_LAST_PRN + 1];
+  /* Last ephemeris sent out for each satellite */
+  struct rtcm3_eph_key eph_sent[RTCM3_EPH_KEYS][RTCM3_EPH_MAX_SATS];
+  /* Optional caller provided store of the satellite orbits */
+  struct rtcm3_orbit_store *orbit_store;
+  /* Optional caller provided store of the SSR corrections */
+  struct rtcm3_ssr_store *ssr_store;
+  /* Receiver bias lookup for the 1033 message, see
+     rtcm2sbp_set_glo_bias_table */
+  struct rtcm3_glo_bias_matcher glo_bias_matcher;
+  /* Message handlers, indexed by message number - RTCM3_MSG_TYPE_MIN */
+  struct rtcm3_msg_handler msg_handlers[RTCM3_NUM_MSG_TYPES];
+  /* State shared by all stations when no station pool is set, a change of
+     station flushes the current epoch */
+  struct rtcm3_station_state station;
+  /* Optional caller provided pool for multi-station streams, see
+     rtcm2sbp_set_station_pool */
+  struct rtcm3_station_state *stations;
+  u8 max_stations;
+  u32 station_use_count;
+  /* Statistics, guarded by a sequence count that is odd while a frame is
+     being decoded, see rtcm2sbp_get_stats */
+  u32 stats_seq;
+  struct rtcm2sbp_stats stats;
+  /* Partial frame kept between calls to rtcm2sbp_process_bytes */
+  struct rtcm3_frame_reader reader;
 };
 
 void rtcm2sbp_decode_frame(const uint8_t *frame,
                            uint32_t frame_length,
                            struct rtcm3_sbp_state *state);
 
+void rtcm2sbp_process_bytes(const uint8_t *buf,
+                            uint32_t len,
+                            struct rtcm3_sbp_state *state);
+
 void rtcm2sbp_set_gps_time(const gps_time_sec_t *current_time,
                            struct rtcm3_sbp_state *state);
 
@@ -77,9 +555,124 @@ void rtcm2sbp_set_glo_fcn(sbp_gnss_signal_t sid,
                           u8 fcn,
                           struct rtcm3_sbp_state *state);
 
+/* All the converter state lives in struct rtcm3_sbp_state and the library
+ * keeps no mutable globals of its own, so separate instances are fully
+ * independent and can be used concurrently from different threads without
+ * locking. A single instance must not be used from several threads at once.
+ * Log messages from librtcm are sent out through the callback of the instance
+ * whose frame was being decoded. */
 void rtcm2sbp_init(
     struct rtcm3_sbp_state *state,
     void (*cb_rtcm_to_sbp)(u16 msg_id, u8 length, u8 *buffer, u16 sender_id),
     void (*cb_base_obs_invalid)(double time_diff));
 
+void rtcm2sbp_set_station_pool(struct rtcm3_station_state *stations,
+                               u8 max_stations,
+                               struct rtcm3_sbp_state *state);
+
+void rtcm2sbp_set_batch_callback(
+    void (*cb_batch)(const struct rtcm3_sbp_batch_msg *msgs,
+                     u8 n_msgs,
+                     void *context),
+    void *context,
+    struct rtcm3_sbp_state *state);
+
+void rtcm2sbp_flush_batch(struct rtcm3_sbp_state *state);
+
+void rtcm2sbp_ring_init(struct rtcm3_sbp_ring *ring, u8 *buffer, u32 size);
+
+void rtcm2sbp_set_frame_ring(struct rtcm3_sbp_ring *ring,
+                             struct rtcm3_sbp_state *state);
+
+u8 *rtcm2sbp_ring_reserve(struct rtcm3_sbp_ring *ring, u8 max_len);
+
+void rtcm2sbp_ring_commit(struct rtcm3_sbp_ring *ring,
+                          u16 msg_id,
+                          u16 sender_id,
+                          u8 len);
+
+bool rtcm2sbp_ring_write(struct rtcm3_sbp_ring *ring,
+                         u16 msg_id,
+                         u16 sender_id,
+                         u8 len,
+                         const u8 *payload);
+
+u32 rtcm2sbp_ring_peek(struct rtcm3_sbp_ring *ring, const u8 **data);
+
+void rtcm2sbp_ring_consume(struct rtcm3_sbp_ring *ring, u32 len);
+
+void rtcm2sbp_set_epoch_callback(
+    void (*cb_epoch)(const struct rtcm3_obs_epoch *epoch,
+                     u16 sender_id,
+                     void *context),
+    void *context,
+    struct rtcm3_sbp_state *state);
+
+bool rtcm2sbp_obs_pseudorange_m(const struct rtcm3_obs_epoch *epoch,
+                                u8 index,
+                                double *pseudorange_m);
+bool rtcm2sbp_obs_carrier_phase_cyc(const struct rtcm3_obs_epoch *epoch,
+                                    u8 index,
+                                    double *carrier_phase_cyc);
+bool rtcm2sbp_obs_doppler_hz(const struct rtcm3_obs_epoch *epoch,
+                             u8 index,
+                             double *doppler_hz);
+double rtcm2sbp_obs_cn0_dbhz(const struct rtcm3_obs_epoch *epoch, u8 index);
+double rtcm2sbp_obs_lock_time_s(const struct rtcm3_obs_epoch *epoch,
+                                u8 index);
+bool rtcm2sbp_obs_half_cycle_known(const struct rtcm3_obs_epoch *epoch,
+                                   u8 index);
+
+bool rtcm2sbp_set_msg_handler(u16 msg_type,
+                              rtcm2sbp_msg_handler_t handler,
+                              struct rtcm3_sbp_state *state);
+
+rtcm2sbp_msg_handler_t rtcm2sbp_get_default_msg_handler(u16 msg_type);
+
+bool rtcm2sbp_set_msg_enabled(u16 msg_type,
+                              bool enabled,
+                              struct rtcm3_sbp_state *state);
+
+bool rtcm2sbp_set_msm_code_mask(u8 constellation,
+                                u64 code_mask,
+                                struct rtcm3_sbp_state *state);
+
+void rtcm2sbp_set_epoch_deadline(u16 deadline_ms,
+                                 struct rtcm3_sbp_state *state);
+
+bool rtcm2sbp_set_epoch_merger(struct rtcm3_merger_slot *slots,
+                               u8 n_slots,
+                               struct rtcm3_merger_entry *entries,
+                               u8 max_stations,
+                               u16 deadline_ms,
+                               struct rtcm3_sbp_state *state);
+
+void rtcm2sbp_flush_epoch_merger(struct rtcm3_sbp_state *state);
+
+void rtcm2sbp_set_orbit_store(struct rtcm3_orbit_store *store,
+                              struct rtcm3_sbp_state *state);
+
+void rtcm2sbp_set_ssr_store(struct rtcm3_ssr_store *store,
+                            struct rtcm3_sbp_state *state);
+
+void rtcm2sbp_flush_ssr_store(struct rtcm3_sbp_state *state);
+
+bool rtcm2sbp_set_glo_bias_table(const struct rtcm2sbp_glo_bias_entry *entries,
+                                 u8 n_entries,
+                                 struct rtcm3_sbp_state *state);
+
+/* The statistics can be read from any thread while another one is decoding,
+ * without locking. The snapshot is consistent as of the end of a frame. */
+void rtcm2sbp_get_stats(const struct rtcm3_sbp_state *state,
+                        struct rtcm2sbp_stats *stats);
+
+bool rtcm2sbp_get_station_stats(u16 stn_id,
+                                const struct rtcm3_sbp_state *state,
+                                struct rtcm2sbp_station_stats *stats);
+
+void rtcm2sbp_reset_stats(struct rtcm3_sbp_state *state);
+
+u32 rtcm2sbp_latency_percentile_ns(
+    const struct rtcm2sbp_latency_histogram *histogram, double percentile);
+
 #endif /* GNSS_CONVERTERS_RTCM3_SBP_INTERFACE_H */
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef GNSS_CONVERTERS_SBP_RTCM3_INTERFACE_H
+#define GNSS_CONVERTERS_SBP_RTCM3_INTERFACE_H
+
+#include <libsbp/gnss.h>
+#include <libsbp/observation.h>
+#include <rtcm3_messages.h>
+#include <rtcm3_sbp.h>
+
+/* RTCM observation messages generated from the SBP observations */
+typedef enum {
+  /* 1004 for GPS and 1012 for GLO */
+  SBP2RTCM_OUT_LEGACY = 0,
+  SBP2RTCM_OUT_MSM4,
+  SBP2RTCM_OUT_MSM7
+} sbp2rtcm_out_mode_t;
+
+struct sbp_rtcm3_state {
+  void (*cb_sbp_to_rtcm)(u8 *buffer, u16 length, void *context);
+  void *context;
+  sbp2rtcm_out_mode_t out_mode;
+  s8 leap_seconds;
+  bool leap_second_known;
+  /* GLO FCN map in RTCM representation, indexed by 1-based PRN */
+  u8 glo_sv_id_fcn_map[GLO_LAST_PRN + 1];
+  /* Epoch being reassembled from the SBP_MSG_OBS sequence */
+  sbp_gps_time_t obs_time;
+  u16 sender_id;
+  u8 next_seq;
+  u8 n_obs;
+  packed_obs_content_t obs[MAX_OBS_PER_EPOCH];
+  /* Output frame, including the transport layer header and CRC */
+  u8 frame[RTCM3_MAX_FRAME_SIZE];
+};
+
+/* Converts SBP messages into RTCM3 frames, the complement of the rtcm2sbp
+ * converter. Each completed frame is handed to the cb_sbp_to_rtcm callback.
+ *
+ * Observations are collected until the last message of the SBP_MSG_OBS
+ * sequence arrives, then the whole epoch is sent out. The RTCM station ID is
+ * the lower 12 bits of the SBP sender ID.
+ */
+void sbp2rtcm_init(struct sbp_rtcm3_state *state,
+                   void (*cb_sbp_to_rtcm)(u8 *buffer, u16 length, void *context),
+                   void *context);
+
+void sbp2rtcm_set_rtcm_out_mode(sbp2rtcm_out_mode_t out_mode,
+                                struct sbp_rtcm3_state *state);
+
+void sbp2rtcm_set_leap_second(s8 leap_seconds, struct sbp_rtcm3_state *state);
+
+void sbp2rtcm_set_glo_fcn(sbp_gnss_signal_t sid,
+                          u8 sbp_fcn,
+                          struct sbp_rtcm3_state *state);
+
+void sbp2rtcm_sbp_obs_cb(u16 sender_id,
+                         u8 len,
+                         const u8 msg[],
+                         struct sbp_rtcm3_state *state);
+
+void sbp2rtcm_base_pos_ecef_cb(u16 sender_id,
+                               u8 len,
+                               const u8 msg[],
+                               struct sbp_rtcm3_state *state);
+
+void sbp2rtcm_glo_biases_cb(u16 sender_id,
+                            u8 len,
+                            const u8 msg[],
+                            struct sbp_rtcm3_state *state);
+
+#endif /* GNSS_CONVERTERS_SBP_RTCM3_INTERFACE_H */
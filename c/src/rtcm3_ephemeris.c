@@ -0,0 +1,514 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <rtcm3_msm_utils.h>
+#include <string.h>
+#include "rtcm3_sbp_internal.h"
+
+/* Value of pi used in the GPS, Galileo and BeiDou orbit parameters */
+#define EPH_PI 3.1415926535898
+
+/* Time of ephemeris resolutions [s] */
+#define GPS_TOE_RESOLUTION 16
+#define GAL_TOE_RESOLUTION 60
+#define BDS_TOE_RESOLUTION 8
+
+/* Week number ranges of the messages, and the GPS week of their week 0 */
+#define GPS_WEEK_RANGE 1024
+#define GAL_WEEK_RANGE 4096
+#define GAL_WEEK_TO_GPS_WEEK 1024
+#define BDS_WEEK_RANGE 8192
+#define BDS_WEEK_TO_GPS_WEEK 1356
+
+/* Fit intervals of the constellations with a fixed one [s] */
+#define GAL_FIT_INTERVAL_SEC (4 * SEC_IN_HOUR)
+#define BDS_FIT_INTERVAL_SEC (3 * SEC_IN_HOUR)
+
+/* GPS week closest to the rover week, from a week number modulo week_range */
+static u16 closest_week(u32 wn, u16 week_range, u16 rover_wn) {
+  s32 diff = ((s32)wn - rover_wn) % week_range;
+  if (diff >= week_range / 2) {
+    diff -= week_range;
+  } else if (diff < -week_range / 2) {
+    diff += week_range;
+  }
+  return rover_wn + diff;
+}
+
+/* Time of the clock parameters, in the week of the time of ephemeris that
+ * is closest to it */
+static void toc_near_toe(u32 toc_tow,
+                         const gps_time_sec_t *toe,
+                         gps_time_sec_t *toc) {
+  toc->wn = toe->wn;
+  toc->tow = toc_tow;
+  s32 diff = (s32)toc_tow - (s32)toe->tow;
+  if (diff > SEC_IN_WEEK / 2) {
+    toc->wn--;
+  } else if (diff < -SEC_IN_WEEK / 2) {
+    toc->wn++;
+  }
+}
+
+/* BeiDou time to GPS time within the week */
+static void bds_to_gps_time(gps_time_sec_t *t) {
+  t->tow += BDS_SECOND_TO_GPS_SECOND;
+  if (t->tow >= SEC_IN_WEEK) {
+    t->tow -= SEC_IN_WEEK;
+    t->wn++;
+  }
+}
+
+/* User range accuracy [m] of a GPS or BeiDou URA index, see the GPS ICD
+ * 20.3.3.3.1.3 */
+static float gps_ura(u8 ura_index) {
+  switch (ura_index) {
+    case 1:
+      return 2.8f;
+    case 3:
+      return 5.7f;
+    case 5:
+      return 11.3f;
+    case 15:
+      return 6144.0f;
+    default:
+      break;
+  }
+  if (ura_index <= 6) {
+    return powf(2.0f, 1.0f + ura_index / 2.0f);
+  }
+  if (ura_index < 15) {
+    return powf(2.0f, ura_index - 2.0f);
+  }
+  return -1.0f;
+}
+
+/* Accuracy [m] of a GLONASS F_T word, see the GLONASS ICD table 4.4 */
+static float glo_ura(u8 ft) {
+  static const float ura_m[] = {
+      1, 2, 2.5, 4, 5, 7, 10, 12, 14, 16, 32, 64, 128, 256, 512};
+  if (ft < sizeof(ura_m) / sizeof(ura_m[0])) {
+    return ura_m[ft];
+  }
+  return -1.0f;
+}
+
+/* Signal in space accuracy [m] of a Galileo SISA index, see the Galileo
+ * OS SIS ICD 5.1.12 */
+static float gal_sisa(u8 sisa) {
+  if (sisa < 50) {
+    return sisa * 0.01f;
+  }
+  if (sisa < 75) {
+    return 0.5f + (sisa - 50) * 0.02f;
+  }
+  if (sisa < 100) {
+    return 1.0f + (sisa - 75) * 0.04f;
+  }
+  if (sisa < 126) {
+    return 2.0f + (sisa - 100) * 0.16f;
+  }
+  /* spare values and no accuracy prediction available */
+  return -1.0f;
+}
+
+/* Fit interval [s] from the GPS fit interval flag and IODC, see the GPS ICD
+ * 20.3.4.4 */
+static u32 gps_fit_interval(u32 fit_interval_flag, u16 iodc) {
+  if (0 == fit_interval_flag) {
+    return 4 * SEC_IN_HOUR;
+  }
+  if (iodc >= 240 && iodc <= 247) {
+    return 8 * SEC_IN_HOUR;
+  }
+  if ((iodc >= 248 && iodc <= 255) || iodc == 496) {
+    return 14 * SEC_IN_HOUR;
+  }
+  if ((iodc >= 497 && iodc <= 503) || (iodc >= 1021 && iodc <= 1023)) {
+    return 26 * SEC_IN_HOUR;
+  }
+  if (iodc >= 504 && iodc <= 510) {
+    return 50 * SEC_IN_HOUR;
+  }
+  if (iodc == 511 || (iodc >= 752 && iodc <= 756)) {
+    return 74 * SEC_IN_HOUR;
+  }
+  if (iodc == 757) {
+    return 98 * SEC_IN_HOUR;
+  }
+  return 6 * SEC_IN_HOUR;
+}
+
+/* Fit interval [s] from the GLONASS P1 word, see the GLONASS ICD table 4.3,
+ * with 10 minutes of margin */
+static u32 glo_fit_interval(u32 p1) {
+  switch (p1) {
+    case 1:
+      return (30 + 10) * SEC_IN_MINUTE;
+    case 2:
+      return (45 + 10) * SEC_IN_MINUTE;
+    default:
+      return (60 + 10) * SEC_IN_MINUTE;
+  }
+}
+
+static void kepler_to_sbp_common(const rtcm_msg_eph *msg_eph,
+                                 code_t code,
+                                 const gps_time_sec_t *toe,
+                                 ephemeris_common_content_t *common) {
+  common->sid.sat = msg_eph->sat_id;
+  common->sid.code = code;
+  common->toe = *toe;
+  common->valid = 1;
+  common->health_bits = msg_eph->health_bits;
+}
+
+/** Convert a GPS ephemeris (1019).
+ *
+ * \param msg_eph Decoded ephemeris
+ * \param sbp_gps_eph Converted ephemeris
+ * \param state Converter state, giving the week number
+ * \return false if the rover time is not known
+ */
+bool rtcm3_gps_eph_to_sbp(const rtcm_msg_eph *msg_eph,
+                          msg_ephemeris_gps_t *sbp_gps_eph,
+                          const struct rtcm3_sbp_state *state) {
+  const ephemeris_kepler_raw_t *kepler = &msg_eph->data.kepler;
+  if (INVALID_TIME == state->time_from_rover_obs.wn) {
+    return false;
+  }
+  gps_time_sec_t toe;
+  toe.wn = closest_week(
+      msg_eph->wn, GPS_WEEK_RANGE, state->time_from_rover_obs.wn);
+  toe.tow = msg_eph->toe * GPS_TOE_RESOLUTION;
+
+  memset(sbp_gps_eph, 0, sizeof(*sbp_gps_eph));
+  kepler_to_sbp_common(msg_eph, CODE_GPS_L1CA, &toe, &sbp_gps_eph->common);
+  sbp_gps_eph->common.ura = gps_ura(msg_eph->ura);
+  sbp_gps_eph->common.fit_interval =
+      gps_fit_interval(msg_eph->fit_interval, kepler->iodc);
+  /* the IODE is the 8 least significant bits of the IODC of the same data */
+  sbp_gps_eph->common.valid = ((kepler->iodc & 0xFF) == kepler->iode);
+
+  sbp_gps_eph->tgd = ldexp(kepler->tgd_gps_s, -31);
+  sbp_gps_eph->c_rs = ldexp(kepler->crs, -5);
+  sbp_gps_eph->c_rc = ldexp(kepler->crc, -5);
+  sbp_gps_eph->c_uc = ldexp(kepler->cuc, -29);
+  sbp_gps_eph->c_us = ldexp(kepler->cus, -29);
+  sbp_gps_eph->c_ic = ldexp(kepler->cic, -29);
+  sbp_gps_eph->c_is = ldexp(kepler->cis, -29);
+  sbp_gps_eph->dn = ldexp(kepler->dn, -43) * EPH_PI;
+  sbp_gps_eph->m0 = ldexp(kepler->m0, -31) * EPH_PI;
+  sbp_gps_eph->ecc = ldexp(kepler->ecc, -33);
+  sbp_gps_eph->sqrta = ldexp(kepler->sqrta, -19);
+  sbp_gps_eph->omega0 = ldexp(kepler->omega0, -31) * EPH_PI;
+  sbp_gps_eph->omegadot = ldexp(kepler->omegadot, -43) * EPH_PI;
+  sbp_gps_eph->w = ldexp(kepler->w, -31) * EPH_PI;
+  sbp_gps_eph->inc = ldexp(kepler->inc, -31) * EPH_PI;
+  sbp_gps_eph->inc_dot = ldexp(kepler->inc_dot, -43) * EPH_PI;
+  sbp_gps_eph->af0 = ldexp(kepler->af0, -31);
+  sbp_gps_eph->af1 = ldexp(kepler->af1, -43);
+  sbp_gps_eph->af2 = ldexp(kepler->af2, -55);
+  toc_near_toe(kepler->toc * GPS_TOE_RESOLUTION, &toe, &sbp_gps_eph->toc);
+  sbp_gps_eph->iode = kepler->iode;
+  sbp_gps_eph->iodc = kepler->iodc;
+  return true;
+}
+
+/** Convert a Galileo ephemeris (1045 F/NAV or 1046 I/NAV).
+ *
+ * \param msg_eph Decoded ephemeris
+ * \param source GAL_SOURCE_INAV or GAL_SOURCE_FNAV
+ * \param sbp_gal_eph Converted ephemeris
+ * \param state Converter state, giving the week number
+ * \return false if the rover time is not known
+ */
+bool rtcm3_gal_eph_to_sbp(const rtcm_msg_eph *msg_eph,
+                          u8 source,
+                          msg_ephemeris_gal_t *sbp_gal_eph,
+                          const struct rtcm3_sbp_state *state) {
+  const ephemeris_kepler_raw_t *kepler = &msg_eph->data.kepler;
+  if (INVALID_TIME == state->time_from_rover_obs.wn) {
+    return false;
+  }
+  gps_time_sec_t toe;
+  toe.wn = closest_week(msg_eph->wn + GAL_WEEK_TO_GPS_WEEK,
+                        GAL_WEEK_RANGE,
+                        state->time_from_rover_obs.wn);
+  toe.tow = msg_eph->toe * GAL_TOE_RESOLUTION;
+
+  memset(sbp_gal_eph, 0, sizeof(*sbp_gal_eph));
+  /* the source field tells the F/NAV and I/NAV ephemerides apart */
+  kepler_to_sbp_common(msg_eph, CODE_GAL_E1B, &toe, &sbp_gal_eph->common);
+  sbp_gal_eph->common.ura = gal_sisa(msg_eph->ura);
+  sbp_gal_eph->common.fit_interval = GAL_FIT_INTERVAL_SEC;
+
+  sbp_gal_eph->bgd_e1e5a = ldexp(kepler->tgd_gal_s[0], -32);
+  sbp_gal_eph->bgd_e1e5b = ldexp(kepler->tgd_gal_s[1], -32);
+  sbp_gal_eph->c_rs = ldexp(kepler->crs, -5);
+  sbp_gal_eph->c_rc = ldexp(kepler->crc, -5);
+  sbp_gal_eph->c_uc = ldexp(kepler->cuc, -29);
+  sbp_gal_eph->c_us = ldexp(kepler->cus, -29);
+  sbp_gal_eph->c_ic = ldexp(kepler->cic, -29);
+  sbp_gal_eph->c_is = ldexp(kepler->cis, -29);
+  sbp_gal_eph->dn = ldexp(kepler->dn, -43) * EPH_PI;
+  sbp_gal_eph->m0 = ldexp(kepler->m0, -31) * EPH_PI;
+  sbp_gal_eph->ecc = ldexp(kepler->ecc, -33);
+  sbp_gal_eph->sqrta = ldexp(kepler->sqrta, -19);
+  sbp_gal_eph->omega0 = ldexp(kepler->omega0, -31) * EPH_PI;
+  sbp_gal_eph->omegadot = ldexp(kepler->omegadot, -43) * EPH_PI;
+  sbp_gal_eph->w = ldexp(kepler->w, -31) * EPH_PI;
+  sbp_gal_eph->inc = ldexp(kepler->inc, -31) * EPH_PI;
+  sbp_gal_eph->inc_dot = ldexp(kepler->inc_dot, -43) * EPH_PI;
+  sbp_gal_eph->af0 = ldexp(kepler->af0, -34);
+  sbp_gal_eph->af1 = ldexp(kepler->af1, -46);
+  sbp_gal_eph->af2 = ldexp(kepler->af2, -59);
+  toc_near_toe(kepler->toc * GAL_TOE_RESOLUTION, &toe, &sbp_gal_eph->toc);
+  /* Galileo has a single issue of data for the navigation data */
+  sbp_gal_eph->iode = kepler->iode;
+  sbp_gal_eph->iodc = kepler->iode;
+  sbp_gal_eph->source = source;
+  return true;
+}
+
+/** Convert a BeiDou ephemeris (1042).
+ *
+ * \param msg_eph Decoded ephemeris
+ * \param sbp_bds_eph Converted ephemeris
+ * \param state Converter state, giving the week number
+ * \return false if the rover time is not known
+ */
+bool rtcm3_bds_eph_to_sbp(const rtcm_msg_eph *msg_eph,
+                          msg_ephemeris_bds_t *sbp_bds_eph,
+                          const struct rtcm3_sbp_state *state) {
+  const ephemeris_kepler_raw_t *kepler = &msg_eph->data.kepler;
+  if (INVALID_TIME == state->time_from_rover_obs.wn) {
+    return false;
+  }
+  gps_time_sec_t toe;
+  toe.wn = closest_week(msg_eph->wn + BDS_WEEK_TO_GPS_WEEK,
+                        BDS_WEEK_RANGE,
+                        state->time_from_rover_obs.wn);
+  toe.tow = msg_eph->toe * BDS_TOE_RESOLUTION;
+  gps_time_sec_t bdt_toe = toe;
+  bds_to_gps_time(&toe);
+
+  memset(sbp_bds_eph, 0, sizeof(*sbp_bds_eph));
+  kepler_to_sbp_common(msg_eph, CODE_BDS2_B1, &toe, &sbp_bds_eph->common);
+  sbp_bds_eph->common.ura = gps_ura(msg_eph->ura);
+  sbp_bds_eph->common.fit_interval = BDS_FIT_INTERVAL_SEC;
+
+  /* group delays are in units of 0.1 ns */
+  sbp_bds_eph->tgd1 = kepler->tgd_bds_s[0] * 1e-10;
+  sbp_bds_eph->tgd2 = kepler->tgd_bds_s[1] * 1e-10;
+  sbp_bds_eph->c_rs = ldexp(kepler->crs, -6);
+  sbp_bds_eph->c_rc = ldexp(kepler->crc, -6);
+  sbp_bds_eph->c_uc = ldexp(kepler->cuc, -31);
+  sbp_bds_eph->c_us = ldexp(kepler->cus, -31);
+  sbp_bds_eph->c_ic = ldexp(kepler->cic, -31);
+  sbp_bds_eph->c_is = ldexp(kepler->cis, -31);
+  sbp_bds_eph->dn = ldexp(kepler->dn, -43) * EPH_PI;
+  sbp_bds_eph->m0 = ldexp(kepler->m0, -31) * EPH_PI;
+  sbp_bds_eph->ecc = ldexp(kepler->ecc, -33);
+  sbp_bds_eph->sqrta = ldexp(kepler->sqrta, -19);
+  sbp_bds_eph->omega0 = ldexp(kepler->omega0, -31) * EPH_PI;
+  sbp_bds_eph->omegadot = ldexp(kepler->omegadot, -43) * EPH_PI;
+  sbp_bds_eph->w = ldexp(kepler->w, -31) * EPH_PI;
+  sbp_bds_eph->inc = ldexp(kepler->inc, -31) * EPH_PI;
+  sbp_bds_eph->inc_dot = ldexp(kepler->inc_dot, -43) * EPH_PI;
+  sbp_bds_eph->af0 = ldexp(kepler->af0, -33);
+  sbp_bds_eph->af1 = ldexp(kepler->af1, -50);
+  sbp_bds_eph->af2 = ldexp(kepler->af2, -66);
+  toc_near_toe(
+      kepler->toc * BDS_TOE_RESOLUTION, &bdt_toe, &sbp_bds_eph->toc);
+  bds_to_gps_time(&sbp_bds_eph->toc);
+  /* age of data of the ephemeris and of the clock */
+  sbp_bds_eph->iode = kepler->iode;
+  sbp_bds_eph->iodc = kepler->iodc;
+  return true;
+}
+
+/** Convert a GLONASS ephemeris (1020).
+ *
+ * \param msg_eph Decoded ephemeris
+ * \param sbp_glo_eph Converted ephemeris
+ * \param state Converter state, giving the day and the leap seconds
+ * \return false if the rover time or the leap seconds are not known
+ */
+bool rtcm3_glo_eph_to_sbp(const rtcm_msg_eph *msg_eph,
+                          msg_ephemeris_glo_t *sbp_glo_eph,
+                          const struct rtcm3_sbp_state *state) {
+  const ephemeris_glo_raw_t *glo = &msg_eph->data.glo;
+  if (!state->time_anchor.valid || !state->leap_second_known) {
+    return false;
+  }
+
+  /* t_b is the Moscow time of day in 15 minute units */
+  gps_time_sec_t toe;
+  rtcm3_glo_tod_to_gps_time(glo->t_b * 15 * SEC_IN_MINUTE, &toe, state);
+
+  memset(sbp_glo_eph, 0, sizeof(*sbp_glo_eph));
+  sbp_glo_eph->common.sid.sat = msg_eph->sat_id;
+  sbp_glo_eph->common.sid.code = CODE_GLO_L1OF;
+  sbp_glo_eph->common.toe = toe;
+  sbp_glo_eph->common.ura = glo_ura(msg_eph->ura);
+  sbp_glo_eph->common.fit_interval = glo_fit_interval(msg_eph->fit_interval);
+  sbp_glo_eph->common.valid = 1;
+  sbp_glo_eph->common.health_bits = msg_eph->health_bits;
+
+  sbp_glo_eph->gamma = ldexp(glo->gamma, -40);
+  sbp_glo_eph->tau = ldexp(glo->tau, -30);
+  sbp_glo_eph->d_tau = ldexp(glo->d_tau, -30);
+  for (u8 i = 0; i < 3; i++) {
+    /* km, km/s and km/s^2 to meters */
+    sbp_glo_eph->pos[i] = ldexp(glo->pos[i], -11) * 1000;
+    sbp_glo_eph->vel[i] = ldexp(glo->vel[i], -20) * 1000;
+    sbp_glo_eph->acc[i] = ldexp(glo->acc[i], -30) * 1000;
+  }
+  /* the RTCM frequency channel is FCN + 7, SBP has FCN + 8 */
+  sbp_glo_eph->fcn = glo->fcn + 1;
+  sbp_glo_eph->iod = (glo->t_b * 15 * SEC_IN_MINUTE) & 0x7F;
+  return true;
+}
+
+/* Index of a constellation in the ephemeris and orbit stores,
+ * RTCM3_EPH_CONSTELLATIONS if its ephemerides are not converted */
+static u8 eph_index(u8 constellation) {
+  switch (constellation) {
+    case RTCM_CONSTELLATION_GPS:
+      return RTCM3_EPH_GPS;
+    case RTCM_CONSTELLATION_GLO:
+      return RTCM3_EPH_GLO;
+    case RTCM_CONSTELLATION_GAL:
+      return RTCM3_EPH_GAL;
+    case RTCM_CONSTELLATION_BDS:
+      return RTCM3_EPH_BDS;
+    default:
+      return RTCM3_EPH_CONSTELLATIONS;
+  }
+}
+
+/* Whether the ephemeris is the one last sent for the satellite and that was
+ * in the current EPH_REPEAT_SEC slot. The key is updated to the ephemeris
+ * otherwise, so that it is only sent again when it changes or once per
+ * slot. */
+static bool eph_unchanged(const rtcm_msg_eph *msg_eph,
+                          struct rtcm3_eph_key *sent,
+                          struct rtcm3_sbp_state *state) {
+  struct rtcm3_eph_key key;
+  memset(&key, 0, sizeof(key));
+  key.valid = true;
+  key.health_bits = msg_eph->health_bits;
+  key.wn = msg_eph->wn;
+  if (RTCM_CONSTELLATION_GLO == msg_eph->constellation) {
+    key.toe = msg_eph->data.glo.t_b;
+    key.iode = msg_eph->data.glo.iod;
+  } else {
+    key.toe = msg_eph->toe;
+    key.iode = msg_eph->data.kepler.iode;
+    key.iodc = msg_eph->data.kepler.iodc;
+  }
+  const gps_time_sec_t *now = &state->time_from_rover_obs;
+  key.sent_s = now->wn * SEC_IN_WEEK + now->tow;
+
+  if (sent->valid && sent->health_bits == key.health_bits &&
+      sent->wn == key.wn && sent->toe == key.toe && sent->iode == key.iode &&
+      sent->iodc == key.iodc &&
+      key.sent_s / EPH_REPEAT_SEC == sent->sent_s / EPH_REPEAT_SEC) {
+    return true;
+  }
+  *sent = key;
+  return false;
+}
+
+/* Send out an ephemeris unless it was sent recently */
+void rtcm3_send_eph(const rtcm_msg_eph *msg_eph,
+                    u16 msg_type,
+                    struct rtcm3_sbp_state *state) {
+  u8 index = eph_index(msg_eph->constellation);
+  if (index >= RTCM3_EPH_CONSTELLATIONS ||
+      msg_eph->sat_id >= RTCM3_EPH_MAX_SATS) {
+    return;
+  }
+  /* without the rover time the week of the ephemeris is unknown */
+  if (INVALID_TIME == state->time_from_rover_obs.wn) {
+    return;
+  }
+  u8 key_index =
+      (RTCM3_EPH_GAL == index && 1045 == msg_type) ? RTCM3_EPH_GAL_FNAV : index;
+  struct rtcm3_eph_key *sent = &state->eph_sent[key_index][msg_eph->sat_id];
+  if (eph_unchanged(msg_eph, sent, state)) {
+    rtcm3_count_state_event(RTCM2SBP_EVENT_EPH_UNCHANGED, state);
+    return;
+  }
+
+  switch (msg_eph->constellation) {
+    case RTCM_CONSTELLATION_GPS: {
+      msg_ephemeris_gps_t sbp_gps_eph;
+      if (rtcm3_gps_eph_to_sbp(msg_eph, &sbp_gps_eph, state)) {
+        send_sbp_message(SBP_MSG_EPHEMERIS_GPS,
+                         (u8)sizeof(sbp_gps_eph),
+                         (u8 *)&sbp_gps_eph,
+                         GLOBAL_SENDER_ID,
+                         state);
+        rtcm3_store_gps_orbit(&sbp_gps_eph, state);
+      }
+      break;
+    }
+    case RTCM_CONSTELLATION_GLO: {
+      msg_ephemeris_glo_t sbp_glo_eph;
+      if (rtcm3_glo_eph_to_sbp(msg_eph, &sbp_glo_eph, state)) {
+        send_sbp_message(SBP_MSG_EPHEMERIS_GLO,
+                         (u8)sizeof(sbp_glo_eph),
+                         (u8 *)&sbp_glo_eph,
+                         GLOBAL_SENDER_ID,
+                         state);
+        rtcm3_store_glo_orbit(&sbp_glo_eph, state);
+      } else {
+        /* send it once the leap seconds are known */
+        sent->valid = false;
+      }
+      break;
+    }
+    case RTCM_CONSTELLATION_BDS: {
+      msg_ephemeris_bds_t sbp_bds_eph;
+      if (rtcm3_bds_eph_to_sbp(msg_eph, &sbp_bds_eph, state)) {
+        send_sbp_message(SBP_MSG_EPHEMERIS_BDS,
+                         (u8)sizeof(sbp_bds_eph),
+                         (u8 *)&sbp_bds_eph,
+                         GLOBAL_SENDER_ID,
+                         state);
+        rtcm3_store_bds_orbit(&sbp_bds_eph, state);
+      }
+      break;
+    }
+    case RTCM_CONSTELLATION_GAL: {
+      msg_ephemeris_gal_t sbp_gal_eph;
+      u8 source = (1045 == msg_type) ? GAL_SOURCE_FNAV : GAL_SOURCE_INAV;
+      if (rtcm3_gal_eph_to_sbp(msg_eph, source, &sbp_gal_eph, state)) {
+        send_sbp_message(SBP_MSG_EPHEMERIS_GAL,
+                         (u8)sizeof(sbp_gal_eph),
+                         (u8 *)&sbp_gal_eph,
+                         GLOBAL_SENDER_ID,
+                         state);
+        rtcm3_store_gal_orbit(&sbp_gal_eph, state);
+      }
+      break;
+    }
+    case RTCM_CONSTELLATION_QZS:
+    case RTCM_CONSTELLATION_SBAS:
+    default:
+      break;
+  }
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "rtcm3_sbp_internal.h"
+
+/* CRC-24Q lookup table, polynomial 0x1864CFB */
+static const u32 crc24qtab[256] = {
+    0x000000, 0x864CFB, 0x8AD50D, 0x0C99F6, 0x93E6E1, 0x15AA1A, 0x1933EC,
+    0x9F7F17, 0xA18139, 0x27CDC2, 0x2B5434, 0xAD18CF, 0x3267D8, 0xB42B23,
+    0xB8B2D5, 0x3EFE2E, 0xC54E89, 0x430272, 0x4F9B84, 0xC9D77F, 0x56A868,
+    0xD0E493, 0xDC7D65, 0x5A319E, 0x64CFB0, 0xE2834B, 0xEE1ABD, 0x685646,
+    0xF72951, 0x7165AA, 0x7DFC5C, 0xFBB0A7, 0x0CD1E9, 0x8A9D12, 0x8604E4,
+    0x00481F, 0x9F3708, 0x197BF3, 0x15E205, 0x93AEFE, 0xAD50D0, 0x2B1C2B,
+    0x2785DD, 0xA1C926, 0x3EB631, 0xB8FACA, 0xB4633C, 0x322FC7, 0xC99F60,
+    0x4FD39B, 0x434A6D, 0xC50696, 0x5A7981, 0xDC357A, 0xD0AC8C, 0x56E077,
+    0x681E59, 0xEE52A2, 0xE2CB54, 0x6487AF, 0xFBF8B8, 0x7DB443, 0x712DB5,
+    0xF7614E, 0x19A3D2, 0x9FEF29, 0x9376DF, 0x153A24, 0x8A4533, 0x0C09C8,
+    0x00903E, 0x86DCC5, 0xB822EB, 0x3E6E10, 0x32F7E6, 0xB4BB1D, 0x2BC40A,
+    0xAD88F1, 0xA11107, 0x275DFC, 0xDCED5B, 0x5AA1A0, 0x563856, 0xD074AD,
+    0x4F0BBA, 0xC94741, 0xC5DEB7, 0x43924C, 0x7D6C62, 0xFB2099, 0xF7B96F,
+    0x71F594, 0xEE8A83, 0x68C678, 0x645F8E, 0xE21375, 0x15723B, 0x933EC0,
+    0x9FA736, 0x19EBCD, 0x8694DA, 0x00D821, 0x0C41D7, 0x8A0D2C, 0xB4F302,
+    0x32BFF9, 0x3E260F, 0xB86AF4, 0x2715E3, 0xA15918, 0xADC0EE, 0x2B8C15,
+    0xD03CB2, 0x567049, 0x5AE9BF, 0xDCA544, 0x43DA53, 0xC596A8, 0xC90F5E,
+    0x4F43A5, 0x71BD8B, 0xF7F170, 0xFB6886, 0x7D247D, 0xE25B6A, 0x641791,
+    0x688E67, 0xEEC29C, 0x3347A4, 0xB50B5F, 0xB992A9, 0x3FDE52, 0xA0A145,
+    0x26EDBE, 0x2A7448, 0xAC38B3, 0x92C69D, 0x148A66, 0x181390, 0x9E5F6B,
+    0x01207C, 0x876C87, 0x8BF571, 0x0DB98A, 0xF6092D, 0x7045D6, 0x7CDC20,
+    0xFA90DB, 0x65EFCC, 0xE3A337, 0xEF3AC1, 0x69763A, 0x578814, 0xD1C4EF,
+    0xDD5D19, 0x5B11E2, 0xC46EF5, 0x42220E, 0x4EBBF8, 0xC8F703, 0x3F964D,
+    0xB9DAB6, 0xB54340, 0x330FBB, 0xAC70AC, 0x2A3C57, 0x26A5A1, 0xA0E95A,
+    0x9E1774, 0x185B8F, 0x14C279, 0x928E82, 0x0DF195, 0x8BBD6E, 0x872498,
+    0x016863, 0xFAD8C4, 0x7C943F, 0x700DC9, 0xF64132, 0x693E25, 0xEF72DE,
+    0xE3EB28, 0x65A7D3, 0x5B59FD, 0xDD1506, 0xD18CF0, 0x57C00B, 0xC8BF1C,
+    0x4EF3E7, 0x426A11, 0xC426EA, 0x2AE476, 0xACA88D, 0xA0317B, 0x267D80,
+    0xB90297, 0x3F4E6C, 0x33D79A, 0xB59B61, 0x8B654F, 0x0D29B4, 0x01B042,
+    0x87FCB9, 0x1883AE, 0x9ECF55, 0x9256A3, 0x141A58, 0xEFAAFF, 0x69E604,
+    0x657FF2, 0xE33309, 0x7C4C1E, 0xFA00E5, 0xF69913, 0x70D5E8, 0x4E2BC6,
+    0xC8673D, 0xC4FECB, 0x42B230, 0xDDCD27, 0x5B81DC, 0x57182A, 0xD154D1,
+    0x26359F, 0xA07964, 0xACE092, 0x2AAC69, 0xB5D37E, 0x339F85, 0x3F0673,
+    0xB94A88, 0x87B4A6, 0x01F85D, 0x0D61AB, 0x8B2D50, 0x145247, 0x921EBC,
+    0x9E874A, 0x18CBB1, 0xE37B16, 0x6537ED, 0x69AE1B, 0xEFE2E0, 0x709DF7,
+    0xF6D10C, 0xFA48FA, 0x7C0401, 0x42FA2F, 0xC4B6D4, 0xC82F22, 0x4E63D9,
+    0xD11CCE, 0x575035, 0x5BC9C3, 0xDD8538};
+
+/** Calculate the CRC-24Q of a buffer, continuing from a previous value.
+ *
+ * \param buf Buffer to calculate the CRC over
+ * \param len Number of bytes in the buffer
+ * \param crc CRC of the preceding data, 0 for a new calculation
+ * \return Updated 24-bit CRC
+ */
+u32 crc24q(const u8 *buf, u32 len, u32 crc) {
+  for (u32 i = 0; i < len; i++) {
+    crc = ((crc << 8) & 0xFFFFFF) ^ crc24qtab[((crc >> 16) ^ buf[i]) & 0xff];
+  }
+  return crc;
+}
+
+static u16 rtcm3_message_size(const u8 *frame) {
+  return ((frame[1] & 0x3) << 8) | frame[2];
+}
+
+static u32 rtcm3_frame_crc(const u8 *frame, u16 message_size) {
+  const u8 *crc = &frame[RTCM3_HEADER_SIZE + message_size];
+  return ((u32)crc[0] << 16) | ((u32)crc[1] << 8) | crc[2];
+}
+
+/* Drop the first `skip` bytes of the partial frame and realign the buffer to
+ * the next preamble candidate, if any */
+static void framer_skip(struct rtcm3_frame_reader *reader, u16 skip) {
+  assert(skip <= reader->frame_len);
+  const u8 *start = &reader->frame_buffer[skip];
+  const u8 *next = memchr(start, RTCM3_PREAMBLE, reader->frame_len - skip);
+  if (NULL == next) {
+    reader->frame_len = 0;
+  } else {
+    reader->frame_len -= next - reader->frame_buffer;
+    memmove(reader->frame_buffer, next, reader->frame_len);
+  }
+  /* the CRC has to be recomputed over the realigned data */
+  reader->frame_crc = 0;
+  reader->frame_crc_len = 0;
+}
+
+/* Extend the running CRC over the newly buffered part of the frame */
+static void framer_update_crc(struct rtcm3_frame_reader *reader) {
+  u16 crc_end = reader->frame_len;
+  if (reader->frame_len >= RTCM3_HEADER_SIZE) {
+    u16 payload_end =
+        RTCM3_HEADER_SIZE + rtcm3_message_size(reader->frame_buffer);
+    if (crc_end > payload_end) {
+      crc_end = payload_end;
+    }
+  }
+  if (crc_end > reader->frame_crc_len) {
+    reader->frame_crc = crc24q(&reader->frame_buffer[reader->frame_crc_len],
+                               crc_end - reader->frame_crc_len,
+                               reader->frame_crc);
+    reader->frame_crc_len = crc_end;
+  }
+}
+
+/* Hand on all the complete frames held in the partial frame buffer */
+static void framer_process_buffer(struct rtcm3_frame_reader *reader,
+                                  void (*cb_frame)(const u8 *frame,
+                                                   u16 length,
+                                                   void *context),
+                                  void *context) {
+  while (reader->frame_len >= RTCM3_HEADER_SIZE) {
+    u16 message_size = rtcm3_message_size(reader->frame_buffer);
+    if (0 == message_size) {
+      framer_skip(reader, 1);
+      continue;
+    }
+
+    u16 frame_size = RTCM3_HEADER_SIZE + message_size + RTCM3_CRC_SIZE;
+    if (reader->frame_len < frame_size) {
+      /* wait for the rest of the frame */
+      framer_update_crc(reader);
+      return;
+    }
+
+    framer_update_crc(reader);
+    if (reader->frame_crc !=
+        rtcm3_frame_crc(reader->frame_buffer, message_size)) {
+      /* CRC failure, look for the next frame inside the rejected one */
+      framer_skip(reader, 1);
+      continue;
+    }
+
+    cb_frame(reader->frame_buffer, frame_size, context);
+    framer_skip(reader, frame_size);
+  }
+}
+
+void rtcm3_frame_reader_init(struct rtcm3_frame_reader *reader) {
+  reader->frame_len = 0;
+  reader->frame_crc = 0;
+  reader->frame_crc_len = 0;
+}
+
+/** Find the RTCM3 frames in a chunk of a raw byte stream.
+ *
+ * Each CRC checked frame is handed to the callback. The stream can be split
+ * into chunks arbitrarily, partial frames are kept in the reader until the
+ * rest of the frame arrives. Frames that are entirely within the chunk are
+ * passed on without being copied.
+ *
+ * \param buf Chunk of the RTCM3 stream
+ * \param len Number of bytes in the chunk
+ * \param reader Partial frame of the stream
+ * \param cb_frame Callback taking each frame, including the transport layer
+ *                 header and CRC
+ * \param context Context of the callback
+ */
+void rtcm3_read_frames(const u8 *buf,
+                       u32 len,
+                       struct rtcm3_frame_reader *reader,
+                       void (*cb_frame)(const u8 *frame,
+                                        u16 length,
+                                        void *context),
+                       void *context) {
+  while (len > 0) {
+    if (0 == reader->frame_len) {
+      /* hunt for the start of the next frame */
+      const u8 *preamble = memchr(buf, RTCM3_PREAMBLE, len);
+      if (NULL == preamble) {
+        return;
+      }
+      len -= preamble - buf;
+      buf = preamble;
+
+      /* fast path: hand on frames that are entirely within the chunk without
+       * copying them, and jump straight to the end of the frame */
+      if (len >= RTCM3_HEADER_SIZE) {
+        u16 message_size = rtcm3_message_size(buf);
+        u16 frame_size = RTCM3_HEADER_SIZE + message_size + RTCM3_CRC_SIZE;
+        if (message_size > 0 && len >= frame_size) {
+          if (crc24q(buf, RTCM3_HEADER_SIZE + message_size, 0) ==
+              rtcm3_frame_crc(buf, message_size)) {
+            cb_frame(buf, frame_size, context);
+            buf += frame_size;
+            len -= frame_size;
+          } else {
+            buf++;
+            len--;
+          }
+          continue;
+        }
+      }
+    }
+
+    /* buffer the partial frame: the header first, then the rest of the frame
+     * once its length is known */
+    u16 wanted = RTCM3_HEADER_SIZE;
+    if (reader->frame_len >= RTCM3_HEADER_SIZE) {
+      wanted += rtcm3_message_size(reader->frame_buffer) + RTCM3_CRC_SIZE;
+    }
+    assert(wanted > reader->frame_len);
+    assert(wanted <= RTCM3_MAX_FRAME_SIZE);
+
+    u32 count = wanted - reader->frame_len;
+    if (count > len) {
+      count = len;
+    }
+    memcpy(&reader->frame_buffer[reader->frame_len], buf, count);
+    reader->frame_len += count;
+    buf += count;
+    len -= count;
+
+    framer_process_buffer(reader, cb_frame, context);
+  }
+}
+
+static void decode_frame_cb(const u8 *frame, u16 length, void *context) {
+  rtcm2sbp_decode_frame(frame, length, (struct rtcm3_sbp_state *)context);
+}
+
+/** Feed a chunk of a raw RTCM3 byte stream into the converter.
+ *
+ * Frames are found in the stream, CRC checked and passed on to
+ * rtcm2sbp_decode_frame. The stream can be split into chunks arbitrarily,
+ * partial frames are kept in the state until the rest of the frame arrives.
+ *
+ * \param buf Chunk of the RTCM3 stream
+ * \param len Number of bytes in the chunk
+ * \param state Converter state
+ */
+void rtcm2sbp_process_bytes(const uint8_t *buf,
+                            uint32_t len,
+                            struct rtcm3_sbp_state *state) {
+  rtcm3_read_frames(buf, len, &state->reader, decode_frame_cb, state);
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "rtcm3_sbp_internal.h"
+
+/* The merger holds the epochs the stations send out until every expected
+ * station has sent the same epoch, then sends them all out together. The
+ * expected stations are learned: a station is added when it first sends an
+ * epoch and dropped when an epoch is sent out without it. An epoch is sent
+ * out early when the deadline passes or when its slot is needed for a newer
+ * epoch, the epochs always go out in time order. */
+
+static s64 epoch_ms(const sbp_gps_time_t *t) {
+  return (s64)t->wn * SEC_IN_WEEK * SECS_MS + t->tow;
+}
+
+static struct rtcm3_merger_slot *merger_slot(struct rtcm3_epoch_merger *merger,
+                                             u8 index) {
+  assert(index < merger->n_used);
+  return &merger->slots[(merger->head + index) % merger->n_slots];
+}
+
+static struct rtcm3_merger_entry *slot_entry(
+    const struct rtcm3_merger_slot *slot, u16 sender_id) {
+  for (u8 i = 0; i < slot->n_entries; i++) {
+    if (slot->entries[i].sender_id == sender_id) {
+      return &slot->entries[i];
+    }
+  }
+  return NULL;
+}
+
+static bool slot_has_station(const struct rtcm3_merger_slot *slot,
+                             u16 sender_id) {
+  return NULL != slot_entry(slot, sender_id);
+}
+
+static bool slot_complete(const struct rtcm3_epoch_merger *merger,
+                          const struct rtcm3_merger_slot *slot) {
+  for (u8 i = 0; i < merger->n_stations; i++) {
+    if (!slot_has_station(slot, merger->stations[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void learn_station(struct rtcm3_epoch_merger *merger, u16 sender_id) {
+  for (u8 i = 0; i < merger->n_stations; i++) {
+    if (merger->stations[i] == sender_id) {
+      return;
+    }
+  }
+  if (merger->n_stations < merger->max_stations) {
+    merger->stations[merger->n_stations++] = sender_id;
+  }
+}
+
+/* Stop waiting for the stations that are missing from the slot */
+static void forget_missing_stations(struct rtcm3_epoch_merger *merger,
+                                    const struct rtcm3_merger_slot *slot) {
+  u8 n_stations = 0;
+  for (u8 i = 0; i < merger->n_stations; i++) {
+    if (slot_has_station(slot, merger->stations[i])) {
+      merger->stations[n_stations++] = merger->stations[i];
+    }
+  }
+  merger->n_stations = n_stations;
+}
+
+/* Send out the oldest epoch */
+static void release_head(struct rtcm3_sbp_state *state) {
+  struct rtcm3_epoch_merger *merger = &state->merger;
+  struct rtcm3_merger_slot *slot = merger_slot(merger, 0);
+
+  if (!slot_complete(merger, slot)) {
+    rtcm3_count_state_event(RTCM2SBP_EVENT_MERGE_INCOMPLETE, state);
+    forget_missing_stations(merger, slot);
+  }
+  for (u8 i = 0; i < slot->n_entries; i++) {
+    struct rtcm3_merger_entry *entry = &slot->entries[i];
+    rtcm3_send_obs_epoch(&entry->epoch, entry->sender_id, state);
+  }
+  merger->released_ms = epoch_ms(&slot->t);
+  merger->released = true;
+
+  slot->n_entries = 0;
+  merger->head = (merger->head + 1) % merger->n_slots;
+  merger->n_used--;
+
+  /* all the stations of the epoch go out in a single batch where possible */
+  rtcm2sbp_flush_batch(state);
+}
+
+/* Send out the epochs that are older than the deadline */
+static void release_expired(s64 now_ms, struct rtcm3_sbp_state *state) {
+  struct rtcm3_epoch_merger *merger = &state->merger;
+  while (merger->n_used > 0 && 0 != merger->deadline_ms &&
+         now_ms - epoch_ms(&merger_slot(merger, 0)->t) >=
+             merger->deadline_ms) {
+    release_head(state);
+  }
+}
+
+/* Find the slot of the epoch, taking a new one if needed */
+static struct rtcm3_merger_slot *get_slot(const sbp_gps_time_t *t,
+                                          struct rtcm3_sbp_state *state) {
+  struct rtcm3_epoch_merger *merger = &state->merger;
+  s64 t_ms = epoch_ms(t);
+
+  /* slots are ordered by time, find where the epoch belongs */
+  u8 index = merger->n_used;
+  while (index > 0 && epoch_ms(&merger_slot(merger, index - 1)->t) >= t_ms) {
+    index--;
+  }
+  if (index < merger->n_used &&
+      epoch_ms(&merger_slot(merger, index)->t) == t_ms) {
+    return merger_slot(merger, index);
+  }
+
+  if (merger->n_used == merger->n_slots) {
+    if (0 == index) {
+      /* the ring is full of newer epochs */
+      return NULL;
+    }
+    /* make room by sending out the oldest epoch */
+    release_head(state);
+    index--;
+  }
+
+  /* insert the slot by shifting the newer ones, which only moves the slot
+   * headers and not their entries */
+  merger->n_used++;
+  struct rtcm3_merger_slot free_slot = *merger_slot(merger, merger->n_used - 1);
+  for (u8 i = merger->n_used - 1; i > index; i--) {
+    *merger_slot(merger, i) = *merger_slot(merger, i - 1);
+  }
+  struct rtcm3_merger_slot *slot = merger_slot(merger, index);
+  *slot = free_slot;
+  slot->t = *t;
+  slot->n_entries = 0;
+  return slot;
+}
+
+/* Take over the buffered epoch of a station */
+void rtcm3_merger_add(struct rtcm3_station_state *station,
+                      struct rtcm3_sbp_state *state) {
+  struct rtcm3_epoch_merger *merger = &state->merger;
+  const struct rtcm3_obs_epoch *epoch = &station->epoch;
+  s64 t_ms = epoch_ms(&epoch->t);
+  assert(epoch->n_obs > 0);
+
+  struct rtcm3_merger_slot *slot = NULL;
+  struct rtcm3_merger_entry *entry = NULL;
+  if (!merger->released || t_ms > merger->released_ms) {
+    slot = get_slot(&epoch->t, state);
+  }
+  /* a station arriving too late is still waited for from the next epoch on,
+   * it may always send its epochs just after the others */
+  learn_station(merger, station->sender_id);
+  if (NULL != slot) {
+    entry = slot_entry(slot, station->sender_id);
+  }
+  if (NULL == slot ||
+      (NULL == entry && slot->n_entries >= merger->max_stations)) {
+    /* too late to be merged, send it out on its own */
+    rtcm3_count_event(RTCM2SBP_EVENT_MERGE_LATE, station, state);
+    rtcm3_send_obs_epoch(epoch, station->sender_id, state);
+    return;
+  }
+
+  if (NULL != entry) {
+    /* the station flushed this epoch before, such as early when its MSM
+     * messages were incomplete, the rest joins the same entry */
+    rtcm3_obs_epoch_merge(&entry->epoch, epoch);
+  } else {
+    entry = &slot->entries[slot->n_entries++];
+    entry->sender_id = station->sender_id;
+    rtcm3_obs_epoch_copy(&entry->epoch, epoch);
+  }
+
+  if (t_ms > merger->newest_ms) {
+    merger->newest_ms = t_ms;
+  }
+
+  /* send out the epoch once all the stations are in, along with any older
+   * epochs still waiting so that the output stays in time order */
+  if (slot_complete(merger, slot)) {
+    s64 complete_ms = epoch_ms(&slot->t);
+    while (merger->n_used > 0 &&
+           epoch_ms(&merger_slot(merger, 0)->t) <= complete_ms) {
+      release_head(state);
+    }
+  }
+  release_expired(merger->newest_ms, state);
+}
+
+/* Send out the epochs that are older than the deadline at the rover time */
+void rtcm3_merger_expire(struct rtcm3_sbp_state *state) {
+  const gps_time_sec_t *now = &state->time_from_rover_obs;
+  release_expired(((s64)now->wn * SEC_IN_WEEK + now->tow) * SECS_MS, state);
+}
+
+/** Merge the epochs of several stations.
+ *
+ * The observations of all the stations for an epoch are held back until
+ * every station has sent that epoch, then sent out together, one SBP_MSG_OBS
+ * sequence per station. With a batch callback the whole merged epoch is
+ * handed out in one batch when it fits. The stations to wait for are learned
+ * from the stream: a station is expected from its first epoch on, until an
+ * epoch is sent out without it. An epoch is also sent out when the newest
+ * epoch or the rover time is deadline_ms past it, or when its slot is needed
+ * for a newer epoch. Epochs arriving after their epoch was sent out are sent
+ * on their own.
+ *
+ * The storage is provided by the caller, nothing is allocated while
+ * converting. The previous merger is flushed first. Passing NULL slots turns
+ * the merger off.
+ *
+ * \param slots Ring of n_slots epoch slots
+ * \param n_slots Number of epochs that can be held at a time
+ * \param entries Storage for n_slots * max_stations station epochs
+ * \param max_stations Most stations in an epoch, up to
+ *        RTCM3_MERGER_MAX_STATIONS
+ * \param deadline_ms How long after its time an epoch is sent out, 0 to wait
+ *        until it is complete or its slot is needed
+ * \param state Converter state
+ * \return false if the parameters are invalid
+ */
+bool rtcm2sbp_set_epoch_merger(struct rtcm3_merger_slot *slots,
+                               u8 n_slots,
+                               struct rtcm3_merger_entry *entries,
+                               u8 max_stations,
+                               u16 deadline_ms,
+                               struct rtcm3_sbp_state *state) {
+  if (NULL != slots &&
+      (0 == n_slots || NULL == entries || 0 == max_stations ||
+       max_stations > RTCM3_MERGER_MAX_STATIONS)) {
+    return false;
+  }
+  rtcm2sbp_flush_epoch_merger(state);
+
+  struct rtcm3_epoch_merger *merger = &state->merger;
+  memset(merger, 0, sizeof(*merger));
+  if (NULL == slots) {
+    return true;
+  }
+  merger->slots = slots;
+  merger->n_slots = n_slots;
+  merger->max_stations = max_stations;
+  merger->deadline_ms = deadline_ms;
+  for (u8 i = 0; i < n_slots; i++) {
+    slots[i].n_entries = 0;
+    slots[i].entries = &entries[i * max_stations];
+  }
+  return true;
+}
+
+/** Send out all the epochs held by the epoch merger.
+ *
+ * \param state Converter state
+ */
+void rtcm2sbp_flush_epoch_merger(struct rtcm3_sbp_state *state) {
+  while (state->merger.n_used > 0) {
+    release_head(state);
+  }
+}
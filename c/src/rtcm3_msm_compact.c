@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <bits.h>
+#include <math.h>
+#include <rtcm3_msm_utils.h>
+#include <string.h>
+#include "rtcm3_sbp_internal.h"
+
+/* MSM1-3 only carry the ranges modulo one millisecond (DF398), the decoded
+ * pseudoranges and carrier phases below are within the millisecond. The
+ * whole milliseconds are added by the converter, see rtcm3_msm_compact_ms. */
+
+/* Bit offset of the satellite mask, after the MSM header fields */
+#define MSM_SAT_MASK_BIT_OFFSET 73
+
+/* Invalid values and resolutions of the fine pseudorange DF400 and fine
+ * phase range DF401 */
+#define MSM_FINE_PR_BITS 15
+#define MSM_FINE_PR_INVALID (-(1 << 14))
+#define MSM_FINE_PR_RES_MS (1.0 / (1 << 24))
+#define MSM_FINE_CP_BITS 22
+#define MSM_FINE_CP_INVALID (-(1 << 21))
+#define MSM_FINE_CP_RES_MS (1.0 / (1 << 29))
+
+/* Resolution of the rough range modulo 1 ms DF398 */
+#define MSM_ROUGH_RANGE_RES_MS (1.0 / 1024)
+
+static u32 decode_msm_header(const uint8_t *buff, rtcm_msm_header *header) {
+  u32 bit = 0;
+  header->msg_num = (u16)getbitu(buff, bit, 12);
+  bit += 12;
+  header->stn_id = (u16)getbitu(buff, bit, 12);
+  bit += 12;
+  if (CONSTELLATION_GLO == to_constellation(header->msg_num)) {
+    /* the day of week is handled by the time conversion */
+    bit += 3;
+    header->tow_ms = getbitu(buff, bit, 27);
+    bit += 27;
+  } else {
+    header->tow_ms = getbitu(buff, bit, 30);
+    bit += 30;
+  }
+  header->multiple = (u8)getbitu(buff, bit, 1);
+  bit += 1;
+  header->iods = (u8)getbitu(buff, bit, 3);
+  bit += 3;
+  header->reserved = (u8)getbitu(buff, bit, 7);
+  bit += 7;
+  header->steering = (u8)getbitu(buff, bit, 2);
+  bit += 2;
+  header->ext_clock = (u8)getbitu(buff, bit, 2);
+  bit += 2;
+  header->div_free = (u8)getbitu(buff, bit, 1);
+  bit += 1;
+  header->smooth = (u8)getbitu(buff, bit, 3);
+  bit += 3;
+  assert(MSM_SAT_MASK_BIT_OFFSET == bit);
+
+  for (u8 i = 0; i < MSM_SATELLITE_MASK_SIZE; i++) {
+    header->satellite_mask[i] = getbitu(buff, bit++, 1);
+  }
+  for (u8 i = 0; i < MSM_SIGNAL_MASK_SIZE; i++) {
+    header->signal_mask[i] = getbitu(buff, bit++, 1);
+  }
+  return bit;
+}
+
+/** Decode an MSM1, MSM2 or MSM3 message.
+ *
+ * Same as the librtcm MSM4-7 decoders, except that the satellite rough
+ * ranges only have their part within the millisecond, and so do the
+ * pseudoranges and carrier phases of the cells.
+ *
+ * \param buff Message, starting at the message number
+ * \param glo_sv_id_fcn_map GLONASS frequency channels by satellite ID
+ * \param msg Decoded message
+ * \return RC_OK, RC_MESSAGE_TYPE_MISMATCH for another message type or
+ *         RC_INVALID_MESSAGE for too many cells
+ */
+rtcm3_rc rtcm3_decode_msm1_3(const uint8_t *buff,
+                             const uint8_t glo_sv_id_fcn_map[],
+                             rtcm_msm_message *msg) {
+  rtcm_msm_header *header = &msg->header;
+  u32 bit = decode_msm_header(buff, header);
+  msm_enum msm_type = to_msm_type(header->msg_num);
+  if (MSM1 != msm_type && MSM2 != msm_type && MSM3 != msm_type) {
+    return RC_MESSAGE_TYPE_MISMATCH;
+  }
+
+  u8 num_sats =
+      count_mask_values(MSM_SATELLITE_MASK_SIZE, header->satellite_mask);
+  u8 num_sigs = count_mask_values(MSM_SIGNAL_MASK_SIZE, header->signal_mask);
+  u16 num_cells_max = (u16)num_sats * num_sigs;
+  if (num_cells_max > MSM_MAX_CELLS) {
+    return RC_INVALID_MESSAGE;
+  }
+  u8 num_cells = 0;
+  for (u8 i = 0; i < num_cells_max; i++) {
+    header->cell_mask[i] = getbitu(buff, bit++, 1);
+    num_cells += header->cell_mask[i] ? 1 : 0;
+  }
+
+  for (u8 sat = 0; sat < num_sats; sat++) {
+    rtcm_msm_sat_data *sat_data = &msg->sats[sat];
+    sat_data->rough_range_ms = getbitu(buff, bit, 10) * MSM_ROUGH_RANGE_RES_MS;
+    bit += 10;
+    sat_data->rough_range_rate_m_s = 0;
+    sat_data->glo_fcn = MSM_GLO_FCN_UNKNOWN;
+    if (CONSTELLATION_GLO == to_constellation(header->msg_num)) {
+      u8 prn = msm_sat_to_prn(header, sat);
+      if (PRN_INVALID != prn) {
+        sat_data->glo_fcn = glo_sv_id_fcn_map[prn];
+      }
+    }
+  }
+
+  /* the fields come one after the other, each for all the cells */
+  s32 fine_pr[MSM_MAX_CELLS];
+  s32 fine_cp[MSM_MAX_CELLS];
+  u8 lock[MSM_MAX_CELLS];
+  bool hca[MSM_MAX_CELLS];
+  if (MSM2 != msm_type) {
+    for (u8 i = 0; i < num_cells; i++) {
+      fine_pr[i] = getbits(buff, bit, MSM_FINE_PR_BITS);
+      bit += MSM_FINE_PR_BITS;
+    }
+  }
+  if (MSM1 != msm_type) {
+    for (u8 i = 0; i < num_cells; i++) {
+      fine_cp[i] = getbits(buff, bit, MSM_FINE_CP_BITS);
+      bit += MSM_FINE_CP_BITS;
+    }
+    for (u8 i = 0; i < num_cells; i++) {
+      lock[i] = (u8)getbitu(buff, bit, 4);
+      bit += 4;
+    }
+    for (u8 i = 0; i < num_cells; i++) {
+      hca[i] = getbitu(buff, bit, 1);
+      bit += 1;
+    }
+  }
+
+  u8 cell = 0;
+  for (u8 sat = 0; sat < num_sats; sat++) {
+    const rtcm_msm_sat_data *sat_data = &msg->sats[sat];
+    for (u8 sig = 0; sig < num_sigs; sig++) {
+      if (!header->cell_mask[sat * num_sigs + sig]) {
+        continue;
+      }
+      rtcm_msm_signal_data *data = &msg->signals[cell];
+      memset(data, 0, sizeof(*data));
+
+      if (MSM2 != msm_type && MSM_FINE_PR_INVALID != fine_pr[cell]) {
+        data->pseudorange_m =
+            (sat_data->rough_range_ms + fine_pr[cell] * MSM_FINE_PR_RES_MS) *
+            RANGE_MS;
+        data->flags.valid_pr = 1;
+      }
+      if (MSM1 != msm_type) {
+        bool glo_fcn_valid = MSM_GLO_FCN_UNKNOWN != sat_data->glo_fcn;
+        double freq =
+            msm_signal_frequency(header, sig, sat_data->glo_fcn, glo_fcn_valid);
+        if (MSM_FINE_CP_INVALID != fine_cp[cell] && freq > 0) {
+          data->carrier_phase_cyc =
+              (sat_data->rough_range_ms + fine_cp[cell] * MSM_FINE_CP_RES_MS) *
+              MS_TO_S * freq;
+          data->flags.valid_cp = 1;
+        }
+        data->lock_time_s =
+            (0 == lock[cell]) ? 0 : (double)(1u << (lock[cell] + 4)) * MS_TO_S;
+        data->flags.valid_lock = 1;
+        data->hca_indicator = hca[cell];
+      }
+      cell++;
+    }
+  }
+  return RC_OK;
+}
+
+static s8 orbit_constellation(constellation_t cons) {
+  switch (cons) {
+    case CONSTELLATION_GPS:
+      return RTCM3_EPH_GPS;
+    case CONSTELLATION_GLO:
+      return RTCM3_EPH_GLO;
+    case CONSTELLATION_BDS2:
+      return RTCM3_EPH_BDS;
+    case CONSTELLATION_GAL:
+      return RTCM3_EPH_GAL;
+    case CONSTELLATION_INVALID:
+    case CONSTELLATION_SBAS:
+    case CONSTELLATION_QZS:
+    case CONSTELLATION_COUNT:
+    default:
+      return -1;
+  }
+}
+
+/** Find the whole milliseconds of the rough ranges of an MSM1-3 message.
+ *
+ * The approximate pseudorange of each satellite from the station position
+ * less its rough range within the millisecond leaves a whole number of
+ * milliseconds plus the receiver clock offset, common to all satellites.
+ * The offset is taken as the circular mean of the fractional parts, and the
+ * rest is rounded.
+ *
+ * \param msg MSM1-3 message
+ * \param station Station of the message, at the epoch of the message
+ * \param state Converter state
+ * \param whole_ms Whole milliseconds of each satellite of the message, 0 when
+ *                 unknown
+ */
+void rtcm3_msm_compact_ms(const rtcm_msm_message *msg,
+                          const struct rtcm3_station_state *station,
+                          const struct rtcm3_sbp_state *state,
+                          u8 whole_ms[]) {
+  const rtcm_msm_header *header = &msg->header;
+  const u8 num_sats =
+      count_mask_values(MSM_SATELLITE_MASK_SIZE, header->satellite_mask);
+  memset(whole_ms, 0, num_sats);
+
+  s8 cons = orbit_constellation(to_constellation(header->msg_num));
+  if (cons < 0 || !station->base_pos_known) {
+    return;
+  }
+
+  double diff_ms[MSM_SATELLITE_MASK_SIZE];
+  bool known[MSM_SATELLITE_MASK_SIZE];
+  double sum_sin = 0;
+  double sum_cos = 0;
+  for (u8 sat = 0; sat < num_sats; sat++) {
+    double pseudorange_ms;
+    known[sat] = rtcm3_sat_pseudorange_ms((u8)cons,
+                                          msm_sat_to_prn(header, sat),
+                                          &station->epoch.t,
+                                          station->base_pos_ecef,
+                                          state,
+                                          &pseudorange_ms);
+    if (known[sat]) {
+      diff_ms[sat] = pseudorange_ms - msg->sats[sat].rough_range_ms;
+      sum_sin += sin(2 * M_PI * diff_ms[sat]);
+      sum_cos += cos(2 * M_PI * diff_ms[sat]);
+    }
+  }
+  if (0 == sum_sin && 0 == sum_cos) {
+    return;
+  }
+
+  double clock_ms = atan2(sum_sin, sum_cos) / (2 * M_PI);
+  for (u8 sat = 0; sat < num_sats; sat++) {
+    if (!known[sat]) {
+      continue;
+    }
+    double ms = round(diff_ms[sat] - clock_ms);
+    if (ms >= 1 && ms <= UINT8_MAX) {
+      whole_ms[sat] = (u8)ms;
+    }
+  }
+}
@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "rtcm3_sbp_internal.h"
+
+/* Copy the observations of an epoch, only the used part of the arrays */
+void rtcm3_obs_epoch_copy(struct rtcm3_obs_epoch *dst,
+                          const struct rtcm3_obs_epoch *src) {
+  const u8 n_obs = src->n_obs;
+  dst->t = src->t;
+  dst->n_obs = n_obs;
+  memcpy(dst->sid, src->sid, n_obs * sizeof(src->sid[0]));
+  memcpy(dst->P, src->P, n_obs * sizeof(src->P[0]));
+  memcpy(dst->L_i, src->L_i, n_obs * sizeof(src->L_i[0]));
+  memcpy(dst->L_f, src->L_f, n_obs * sizeof(src->L_f[0]));
+  memcpy(dst->D_i, src->D_i, n_obs * sizeof(src->D_i[0]));
+  memcpy(dst->D_f, src->D_f, n_obs * sizeof(src->D_f[0]));
+  memcpy(dst->cn0, src->cn0, n_obs * sizeof(src->cn0[0]));
+  memcpy(dst->lock, src->lock, n_obs * sizeof(src->lock[0]));
+  memcpy(dst->flags, src->flags, n_obs * sizeof(src->flags[0]));
+}
+
+/* Add the signals of src that dst does not have yet, as far as they fit */
+void rtcm3_obs_epoch_merge(struct rtcm3_obs_epoch *dst,
+                           const struct rtcm3_obs_epoch *src) {
+  const u8 n_dst = dst->n_obs;
+  for (u8 i = 0; i < src->n_obs && dst->n_obs < MAX_OBS_PER_EPOCH; i++) {
+    bool found = false;
+    for (u8 j = 0; j < n_dst && !found; j++) {
+      found = dst->sid[j].sat == src->sid[i].sat &&
+              dst->sid[j].code == src->sid[i].code;
+    }
+    if (found) {
+      continue;
+    }
+    u8 k = dst->n_obs++;
+    dst->sid[k] = src->sid[i];
+    dst->P[k] = src->P[i];
+    dst->L_i[k] = src->L_i[i];
+    dst->L_f[k] = src->L_f[i];
+    dst->D_i[k] = src->D_i[i];
+    dst->D_f[k] = src->D_f[i];
+    dst->cn0[k] = src->cn0[i];
+    dst->lock[k] = src->lock[i];
+    dst->flags[k] = src->flags[i];
+  }
+}
+
+/* Pack the observations from first on into an SBP_MSG_OBS payload */
+static void pack_obs(const struct rtcm3_obs_epoch *epoch,
+                     u8 first,
+                     u8 obs_count,
+                     msg_obs_t *sbp_obs) {
+  for (u8 j = 0; j < obs_count; j++) {
+    const u8 i = first + j;
+    packed_obs_content_t *obs = &sbp_obs->obs[j];
+    obs->P = epoch->P[i];
+    obs->L.i = epoch->L_i[i];
+    obs->L.f = epoch->L_f[i];
+    obs->D.i = epoch->D_i[i];
+    obs->D.f = epoch->D_f[i];
+    obs->cn0 = epoch->cn0[i];
+    obs->lock = epoch->lock[i];
+    obs->flags = epoch->flags[i];
+    obs->sid = epoch->sid[i];
+  }
+}
+
+/* Pack the observation messages of the epoch straight into the frames of
+ * the output ring */
+static void send_obs_frames(const struct rtcm3_obs_epoch *epoch,
+                            u8 total_messages,
+                            u16 sender_id,
+                            struct rtcm3_sbp_state *state) {
+  for (u8 msg_num = 0; msg_num < total_messages; ++msg_num) {
+    u8 obs_count = epoch->n_obs - msg_num * MAX_OBS_IN_SBP;
+    if (obs_count > MAX_OBS_IN_SBP) {
+      obs_count = MAX_OBS_IN_SBP;
+    }
+    u8 len = SBP_HDR_SIZE + obs_count * SBP_OBS_SIZE;
+    msg_obs_t *sbp_obs =
+        (msg_obs_t *)rtcm2sbp_ring_reserve(state->frame_ring, len);
+    if (NULL == sbp_obs) {
+      rtcm3_count_state_event(RTCM2SBP_EVENT_OUTPUT_FULL, state);
+      continue;
+    }
+    sbp_obs->header.t = epoch->t;
+    sbp_obs->header.n_obs = (total_messages << 4) + msg_num;
+    pack_obs(epoch, msg_num * MAX_OBS_IN_SBP, obs_count, sbp_obs);
+    rtcm2sbp_ring_commit(state->frame_ring, SBP_MSG_OBS, sender_id, len);
+  }
+}
+
+/* Send out an epoch, split into as many SBP messages as needed */
+void rtcm3_send_obs_epoch(const struct rtcm3_obs_epoch *epoch,
+                          u16 sender_id,
+                          struct rtcm3_sbp_state *state) {
+  const u8 n_obs = epoch->n_obs;
+  assert(n_obs > 0);
+  assert(n_obs <= MAX_OBS_PER_EPOCH);
+
+  if (NULL != state->cb_epoch) {
+    state->cb_epoch(epoch, sender_id, state->epoch_context);
+    return;
+  }
+
+  /* We want the ceiling of n_obs divided by max obs in a single message to get
+   * total number of messages needed */
+  const u8 total_messages = 1 + ((n_obs - 1) / MAX_OBS_IN_SBP);
+  assert(total_messages <= SBP_MAX_OBS_SEQ);
+
+  if (NULL != state->frame_ring) {
+    send_obs_frames(epoch, total_messages, sender_id, state);
+    return;
+  }
+
+  /* batched messages point into the output buffer until the batch goes out,
+   * so further epochs are packed after them while there is room */
+  const u16 size = total_messages * SBP_OBS_MSG_SIZE;
+  u16 offset = 0;
+  if (NULL != state->cb_batch) {
+    if (state->obs_msg_used + size > OBS_BUFFER_SIZE) {
+      rtcm2sbp_flush_batch(state);
+    }
+    offset = state->obs_msg_used;
+    state->obs_msg_used += size;
+  }
+  u8 *msg_buffer = &state->obs_msg_buffer[offset];
+
+  for (u8 msg_num = 0; msg_num < total_messages; ++msg_num) {
+    msg_obs_t *sbp_obs = (msg_obs_t *)&msg_buffer[msg_num * SBP_OBS_MSG_SIZE];
+
+    sbp_obs->header.t = epoch->t;
+    /* Note: SBP n_obs puts total messages in the first nibble and msg_num in
+     * the second. This differs from all the other instances of n_obs in this
+     * module where it is used as observation count. */
+    sbp_obs->header.n_obs = (total_messages << 4) + msg_num;
+
+    u8 obs_count = n_obs - msg_num * MAX_OBS_IN_SBP;
+    if (obs_count > MAX_OBS_IN_SBP) {
+      obs_count = MAX_OBS_IN_SBP;
+    }
+    pack_obs(epoch, msg_num * MAX_OBS_IN_SBP, obs_count, sbp_obs);
+
+    u16 len = SBP_HDR_SIZE + obs_count * SBP_OBS_SIZE;
+    assert(len <= SBP_FRAMING_MAX_PAYLOAD_SIZE);
+
+    if (NULL != state->cb_batch) {
+      /* hand out the message in place as part of the epoch batch */
+      if (state->batch_n_msgs >= SBP_BATCH_MAX_MSGS) {
+        rtcm2sbp_flush_batch(state);
+        /* the rest of the epoch is still to be handed out */
+        state->obs_msg_used = offset + size;
+      }
+      struct rtcm3_sbp_batch_msg *msg = &state->batch[state->batch_n_msgs++];
+      msg->msg_id = SBP_MSG_OBS;
+      msg->sender_id = sender_id;
+      msg->len = len;
+      msg->payload = (u8 *)sbp_obs;
+    } else {
+      state->cb_rtcm_to_sbp(SBP_MSG_OBS, len, (u8 *)sbp_obs, sender_id);
+    }
+  }
+}
+
+/** Pseudorange of an observation.
+ *
+ * \param epoch Observation epoch
+ * \param index Index of the observation, below epoch->n_obs
+ * \param pseudorange_m Output pseudorange [m]
+ * \return false if the observation has no valid pseudorange
+ */
+bool rtcm2sbp_obs_pseudorange_m(const struct rtcm3_obs_epoch *epoch,
+                                u8 index,
+                                double *pseudorange_m) {
+  assert(index < epoch->n_obs);
+  *pseudorange_m = epoch->P[index] / MSG_OBS_P_MULTIPLIER;
+  return 0 != (epoch->flags[index] & MSG_OBS_FLAGS_CODE_VALID);
+}
+
+/** Carrier phase of an observation.
+ *
+ * \param epoch Observation epoch
+ * \param index Index of the observation, below epoch->n_obs
+ * \param carrier_phase_cyc Output carrier phase [cycles]
+ * \return false if the observation has no valid carrier phase
+ */
+bool rtcm2sbp_obs_carrier_phase_cyc(const struct rtcm3_obs_epoch *epoch,
+                                    u8 index,
+                                    double *carrier_phase_cyc) {
+  assert(index < epoch->n_obs);
+  *carrier_phase_cyc =
+      epoch->L_i[index] + epoch->L_f[index] / MSG_OBS_LF_MULTIPLIER;
+  return 0 != (epoch->flags[index] & MSG_OBS_FLAGS_PHASE_VALID);
+}
+
+/** Doppler of an observation, in the SBP sign convention.
+ *
+ * \param epoch Observation epoch
+ * \param index Index of the observation, below epoch->n_obs
+ * \param doppler_hz Output Doppler [Hz]
+ * \return false if the observation has no valid Doppler
+ */
+bool rtcm2sbp_obs_doppler_hz(const struct rtcm3_obs_epoch *epoch,
+                             u8 index,
+                             double *doppler_hz) {
+  assert(index < epoch->n_obs);
+  *doppler_hz = epoch->D_i[index] + epoch->D_f[index] / MSG_OBS_DF_MULTIPLIER;
+  return 0 != (epoch->flags[index] & MSG_OBS_FLAGS_DOPPLER_VALID);
+}
+
+/** Carrier to noise ratio of an observation, 0 if unknown.
+ *
+ * \param epoch Observation epoch
+ * \param index Index of the observation, below epoch->n_obs
+ * \return Carrier to noise ratio [dB-Hz]
+ */
+double rtcm2sbp_obs_cn0_dbhz(const struct rtcm3_obs_epoch *epoch, u8 index) {
+  assert(index < epoch->n_obs);
+  return epoch->cn0[index] / MSG_OBS_CN0_MULTIPLIER;
+}
+
+/** Minimum lock time of an observation.
+ *
+ * \param epoch Observation epoch
+ * \param index Index of the observation, below epoch->n_obs
+ * \return Lock time [s]
+ */
+double rtcm2sbp_obs_lock_time_s(const struct rtcm3_obs_epoch *epoch,
+                                u8 index) {
+  assert(index < epoch->n_obs);
+  return decode_lock_time(epoch->lock[index]);
+}
+
+/** Whether the half cycle ambiguity of the carrier phase is resolved.
+ *
+ * \param epoch Observation epoch
+ * \param index Index of the observation, below epoch->n_obs
+ * \return true if the half cycle ambiguity is known
+ */
+bool rtcm2sbp_obs_half_cycle_known(const struct rtcm3_obs_epoch *epoch,
+                                   u8 index) {
+  assert(index < epoch->n_obs);
+  return 0 != (epoch->flags[index] & MSG_OBS_FLAGS_HALF_CYCLE_KNOWN);
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include "rtcm3_sbp_internal.h"
+
+/* The orbits are only used to find the whole milliseconds of the MSM1-3
+ * ranges, which needs the range to within a few tens of kilometers. The
+ * harmonic corrections, the clock drifts, the GLONASS J2 term and the signal
+ * travel time are left out, they are all well below that. */
+
+/* WGS84 and PZ-90 constants */
+#define GM_WGS84 3.986005e14
+#define GM_PZ90 3.9860044e14
+#define OMEGA_EARTH 7.2921151467e-5
+
+/* Longest extrapolation from the time of ephemeris [s] */
+#define KEPLER_MAX_AGE_SEC (4 * SEC_IN_HOUR)
+#define GLO_MAX_AGE_SEC SEC_IN_HOUR
+
+/* Step of the GLONASS orbit integration [s] */
+#define GLO_STEP_SEC 60.0
+
+/* The BeiDou GEO satellites use a rotated frame for their orbit */
+#define BDS_GEO_INCLINATION_RAD (-5.0 * M_PI / 180.0)
+
+#define KEPLER_FROM_SBP(kepler, eph)      \
+  do {                                    \
+    (kepler)->sqrta = (eph)->sqrta;       \
+    (kepler)->ecc = (eph)->ecc;           \
+    (kepler)->m0 = (eph)->m0;             \
+    (kepler)->dn = (eph)->dn;             \
+    (kepler)->omega0 = (eph)->omega0;     \
+    (kepler)->omegadot = (eph)->omegadot; \
+    (kepler)->w = (eph)->w;               \
+    (kepler)->inc = (eph)->inc;           \
+    (kepler)->inc_dot = (eph)->inc_dot;   \
+  } while (0)
+
+static struct rtcm3_orbit *orbit_slot(u8 constellation,
+                                      const ephemeris_common_content_t *common,
+                                      struct rtcm3_sbp_state *state) {
+  if (NULL == state->orbit_store || common->sid.sat >= RTCM3_EPH_MAX_SATS) {
+    return NULL;
+  }
+  struct rtcm3_orbit *orbit =
+      &state->orbit_store->sats[constellation][common->sid.sat];
+  orbit->valid = true;
+  orbit->toe = common->toe;
+  return orbit;
+}
+
+void rtcm3_store_gps_orbit(const msg_ephemeris_gps_t *eph,
+                           struct rtcm3_sbp_state *state) {
+  struct rtcm3_orbit *orbit =
+      orbit_slot(RTCM3_EPH_GPS, &eph->common, state);
+  if (NULL != orbit) {
+    KEPLER_FROM_SBP(&orbit->data.kepler, eph);
+    orbit->clock_s = eph->af0;
+  }
+}
+
+void rtcm3_store_gal_orbit(const msg_ephemeris_gal_t *eph,
+                           struct rtcm3_sbp_state *state) {
+  struct rtcm3_orbit *orbit =
+      orbit_slot(RTCM3_EPH_GAL, &eph->common, state);
+  if (NULL != orbit) {
+    KEPLER_FROM_SBP(&orbit->data.kepler, eph);
+    orbit->clock_s = eph->af0;
+  }
+}
+
+void rtcm3_store_bds_orbit(const msg_ephemeris_bds_t *eph,
+                           struct rtcm3_sbp_state *state) {
+  struct rtcm3_orbit *orbit =
+      orbit_slot(RTCM3_EPH_BDS, &eph->common, state);
+  if (NULL != orbit) {
+    KEPLER_FROM_SBP(&orbit->data.kepler, eph);
+    orbit->clock_s = eph->af0;
+  }
+}
+
+void rtcm3_store_glo_orbit(const msg_ephemeris_glo_t *eph,
+                           struct rtcm3_sbp_state *state) {
+  struct rtcm3_orbit *orbit =
+      orbit_slot(RTCM3_EPH_GLO, &eph->common, state);
+  if (NULL != orbit) {
+    for (u8 i = 0; i < 3; i++) {
+      orbit->data.glo.pos[i] = eph->pos[i];
+      orbit->data.glo.vel[i] = eph->vel[i];
+      orbit->data.glo.acc[i] = eph->acc[i];
+    }
+    orbit->clock_s = -eph->tau;
+  }
+}
+
+static bool bds_geo(u8 sat_id) {
+  return sat_id <= 5 || sat_id >= 59;
+}
+
+/* Satellite position from a Keplerian orbit, dt seconds from the time of
+ * ephemeris toe_s, itself in seconds of the week of the constellation */
+static void kepler_position(const struct rtcm3_kepler_orbit *kepler,
+                            double toe_s,
+                            double dt,
+                            bool geo,
+                            double pos[3]) {
+  double a = kepler->sqrta * kepler->sqrta;
+  double n = sqrt(GM_WGS84 / (a * a * a)) + kepler->dn;
+  double ma = kepler->m0 + n * dt;
+
+  /* eccentric anomaly, a few Newton steps are plenty for the small
+   * eccentricities of navigation satellites */
+  double ea = ma;
+  for (u8 i = 0; i < 5; i++) {
+    ea -= (ea - kepler->ecc * sin(ea) - ma) / (1.0 - kepler->ecc * cos(ea));
+  }
+
+  double nu = atan2(sqrt(1.0 - kepler->ecc * kepler->ecc) * sin(ea),
+                    cos(ea) - kepler->ecc);
+  double u = nu + kepler->w;
+  double r = a * (1.0 - kepler->ecc * cos(ea));
+  double inc = kepler->inc + kepler->inc_dot * dt;
+  double x_orb = r * cos(u);
+  double y_orb = r * sin(u);
+
+  double omega =
+      kepler->omega0 + kepler->omegadot * dt - OMEGA_EARTH * toe_s;
+  if (!geo) {
+    omega -= OMEGA_EARTH * dt;
+  }
+  double x = x_orb * cos(omega) - y_orb * cos(inc) * sin(omega);
+  double y = x_orb * sin(omega) + y_orb * cos(inc) * cos(omega);
+  double z = y_orb * sin(inc);
+  if (!geo) {
+    pos[0] = x;
+    pos[1] = y;
+    pos[2] = z;
+    return;
+  }
+
+  /* rotate the GEO orbit frame into ECEF */
+  double sin_x = sin(BDS_GEO_INCLINATION_RAD);
+  double cos_x = cos(BDS_GEO_INCLINATION_RAD);
+  double sin_z = sin(OMEGA_EARTH * dt);
+  double cos_z = cos(OMEGA_EARTH * dt);
+  double y_rot = y * cos_x + z * sin_x;
+  pos[0] = x * cos_z + y_rot * sin_z;
+  pos[1] = -x * sin_z + y_rot * cos_z;
+  pos[2] = -y * sin_x + z * cos_x;
+}
+
+/* Derivative of the GLONASS state vector in the rotating PZ-90 frame */
+static void glo_derivative(const double state_vec[6],
+                           const double acc[3],
+                           double derivative[6]) {
+  const double *pos = state_vec;
+  const double *vel = &state_vec[3];
+  double r2 = pos[0] * pos[0] + pos[1] * pos[1] + pos[2] * pos[2];
+  double gm_r3 = GM_PZ90 / (r2 * sqrt(r2));
+  double omega2 = OMEGA_EARTH * OMEGA_EARTH;
+
+  derivative[0] = vel[0];
+  derivative[1] = vel[1];
+  derivative[2] = vel[2];
+  derivative[3] = -gm_r3 * pos[0] + omega2 * pos[0] +
+                  2.0 * OMEGA_EARTH * vel[1] + acc[0];
+  derivative[4] = -gm_r3 * pos[1] + omega2 * pos[1] -
+                  2.0 * OMEGA_EARTH * vel[0] + acc[1];
+  derivative[5] = -gm_r3 * pos[2] + acc[2];
+}
+
+/* Satellite position from a GLONASS orbit, integrated dt seconds from the
+ * time of ephemeris with Runge-Kutta steps */
+static void glo_position(const struct rtcm3_glo_orbit *glo,
+                         double dt,
+                         double pos[3]) {
+  double state_vec[6];
+  for (u8 i = 0; i < 3; i++) {
+    state_vec[i] = glo->pos[i];
+    state_vec[i + 3] = glo->vel[i];
+  }
+
+  u8 n_steps = (u8)ceil(fabs(dt) / GLO_STEP_SEC);
+  double h = (n_steps > 0) ? dt / n_steps : 0.0;
+  for (u8 step = 0; step < n_steps; step++) {
+    double k1[6], k2[6], k3[6], k4[6], tmp[6];
+    glo_derivative(state_vec, glo->acc, k1);
+    for (u8 i = 0; i < 6; i++) {
+      tmp[i] = state_vec[i] + 0.5 * h * k1[i];
+    }
+    glo_derivative(tmp, glo->acc, k2);
+    for (u8 i = 0; i < 6; i++) {
+      tmp[i] = state_vec[i] + 0.5 * h * k2[i];
+    }
+    glo_derivative(tmp, glo->acc, k3);
+    for (u8 i = 0; i < 6; i++) {
+      tmp[i] = state_vec[i] + h * k3[i];
+    }
+    glo_derivative(tmp, glo->acc, k4);
+    for (u8 i = 0; i < 6; i++) {
+      state_vec[i] += h / 6.0 * (k1[i] + 2.0 * k2[i] + 2.0 * k3[i] + k4[i]);
+    }
+  }
+  pos[0] = state_vec[0];
+  pos[1] = state_vec[1];
+  pos[2] = state_vec[2];
+}
+
+/** Approximate pseudorange of a satellite from a position, without the
+ * receiver clock offset.
+ *
+ * \param constellation RTCM3_EPH_* index of the constellation
+ * \param sat_id Satellite ID of the ephemeris
+ * \param t Time of the observation
+ * \param pos_ecef Receiver position [m]
+ * \param state Converter state
+ * \param pseudorange_ms Output pseudorange [ms]
+ * \return false if there is no recent orbit of the satellite
+ */
+bool rtcm3_sat_pseudorange_ms(u8 constellation,
+                              u8 sat_id,
+                              const sbp_gps_time_t *t,
+                              const double pos_ecef[3],
+                              const struct rtcm3_sbp_state *state,
+                              double *pseudorange_ms) {
+  if (NULL == state->orbit_store ||
+      constellation >= RTCM3_EPH_CONSTELLATIONS ||
+      sat_id >= RTCM3_EPH_MAX_SATS) {
+    return false;
+  }
+  const struct rtcm3_orbit *orbit =
+      &state->orbit_store->sats[constellation][sat_id];
+  if (!orbit->valid) {
+    return false;
+  }
+
+  double dt = ((double)t->wn - orbit->toe.wn) * SEC_IN_WEEK +
+              t->tow * MS_TO_S - orbit->toe.tow;
+  double sat_pos[3];
+  switch (constellation) {
+    case RTCM3_EPH_GLO:
+      if (fabs(dt) > GLO_MAX_AGE_SEC) {
+        return false;
+      }
+      glo_position(&orbit->data.glo, dt, sat_pos);
+      break;
+    case RTCM3_EPH_BDS:
+      if (fabs(dt) > KEPLER_MAX_AGE_SEC) {
+        return false;
+      }
+      /* the orbit is referenced to the BeiDou time of ephemeris */
+      kepler_position(&orbit->data.kepler,
+                      (double)orbit->toe.tow - BDS_SECOND_TO_GPS_SECOND,
+                      dt,
+                      bds_geo(sat_id),
+                      sat_pos);
+      break;
+    case RTCM3_EPH_GPS:
+    case RTCM3_EPH_GAL:
+      if (fabs(dt) > KEPLER_MAX_AGE_SEC) {
+        return false;
+      }
+      kepler_position(&orbit->data.kepler, orbit->toe.tow, dt, false, sat_pos);
+      break;
+    default:
+      return false;
+  }
+
+  double dx = sat_pos[0] - pos_ecef[0];
+  double dy = sat_pos[1] - pos_ecef[1];
+  double dz = sat_pos[2] - pos_ecef[2];
+  double range_m = sqrt(dx * dx + dy * dy + dz * dz);
+  *pseudorange_ms = range_m / RANGE_MS - orbit->clock_s * S_TO_MS;
+  return true;
+}
+
+/** Keep the satellite orbits of the converted ephemerides.
+ *
+ * The MSM1-3 messages only carry their ranges modulo one millisecond. The
+ * whole milliseconds are found from the approximate range between the
+ * station position of the 1005/1006 messages and the satellite position from
+ * its ephemeris, so MSM1-3 observations are only converted with an orbit
+ * store. Every ephemeris is sent out again after the store is set, so that
+ * the store fills up as the ephemerides arrive.
+ *
+ * The storage is provided by the caller, nothing is allocated while
+ * converting. Passing NULL turns the store off.
+ *
+ * \param store Orbit store
+ * \param state Converter state
+ */
+void rtcm2sbp_set_orbit_store(struct rtcm3_orbit_store *store,
+                              struct rtcm3_sbp_state *state) {
+  if (NULL != store) {
+    memset(store, 0, sizeof(*store));
+    memset(state->eph_sent, 0, sizeof(state->eph_sent));
+  }
+  state->orbit_store = store;
+}
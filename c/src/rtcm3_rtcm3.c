@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <bits.h>
+#include <math.h>
+#include <rtcm3_msm_utils.h>
+#include <string.h>
+#include "rtcm3_rtcm3.h"
+#include "rtcm3_sbp_internal.h"
+
+/* Bit offset of the satellite mask, after the MSM header fields */
+#define MSM_SAT_MASK_BIT_OFFSET 73
+
+/* Bits of the satellite and signal fields of MSM7 and MSM4. MSM4 has the
+ * integer milliseconds and the rough range modulo 1 ms of MSM7, without the
+ * extended satellite information and the rough phase range rate. Its fine
+ * ranges are the MSM7 ones at a coarser resolution over the same span. */
+#define MSM7_SAT_BITS (8 + 4 + 10 + 14)
+#define MSM7_SIGNAL_BITS (20 + 24 + 10 + 1 + 10 + 15)
+#define MSM4_SAT_BITS (8 + 10)
+#define MSM4_SIGNAL_BITS (15 + 22 + 4 + 1 + 6)
+
+/* The extended lock time indicator DF407 values above this are reserved */
+#define MSM_LOCK_EX_MAX 704
+
+#define RTCM3_MSG_INDEX(msg_type) ((msg_type)-RTCM3_MSG_TYPE_MIN)
+
+/* Bits of the MSM header up to the cell mask */
+#define MSM_CELL_MASK_BIT_OFFSET \
+  (MSM_SAT_MASK_BIT_OFFSET + MSM_SATELLITE_MASK_SIZE + MSM_SIGNAL_MASK_SIZE)
+
+/* Bits up to the end of the reference station ID */
+#define STATION_ID_BIT_END 24
+
+/* Message numbers of the MSM messages, GPS MSM1 to NavIC MSM7 */
+#define MSM_MSG_NUM_MIN 1071
+#define MSM_MSG_NUM_MAX 1137
+
+static msm_enum msg_msm_type(u16 msg_num) {
+  if (msg_num < MSM_MSG_NUM_MIN || msg_num > MSM_MSG_NUM_MAX) {
+    return MSM_UNKNOWN;
+  }
+  return to_msm_type(msg_num);
+}
+
+/* Messages carrying the reference station ID DF003 right after the message
+ * number: the observations, station descriptions and text messages */
+static bool has_station_id(u16 msg_num) {
+  return (msg_num >= 1001 && msg_num <= 1013) || 1029 == msg_num ||
+         1032 == msg_num || 1033 == msg_num || 1230 == msg_num ||
+         MSM_UNKNOWN != msg_msm_type(msg_num);
+}
+
+static bool msg_dropped(u16 msg_num, const struct rtcm3_rtcm3_state *state) {
+  if (msg_num < RTCM3_MSG_TYPE_MIN || msg_num > RTCM3_MSG_TYPE_MAX) {
+    return state->drop_other;
+  }
+  u16 index = RTCM3_MSG_INDEX(msg_num);
+  return (state->drop_mask[index / 32] >> (index % 32)) & 1;
+}
+
+/* Copy a span of bits between two messages */
+static void copy_bits(const u8 *in, u32 in_bit, u8 *out, u32 out_bit, u32 n) {
+  while (n > 0) {
+    u8 len = (n > 32) ? 32 : (u8)n;
+    setbitu(out, out_bit, len, getbitu(in, in_bit, len));
+    in_bit += len;
+    out_bit += len;
+    n -= len;
+  }
+}
+
+/* Reduce the resolution of a signed field, keeping its invalid value (only
+ * the sign bit set) and making out of range values invalid */
+static s32 reduce_signed(s32 value, u8 in_bits, u8 out_bits, u8 shift) {
+  s32 out_limit = (s32)(1u << (out_bits - 1));
+  if (-(s32)(1u << (in_bits - 1)) == value) {
+    return -out_limit;
+  }
+  double scaled = round(ldexp(value, -shift));
+  if (scaled <= -out_limit || scaled >= out_limit) {
+    return -out_limit;
+  }
+  return (s32)scaled;
+}
+
+/* Lock time indicator DF402 of MSM4 for the minimum lock time of an extended
+ * lock time indicator DF407 of MSM7 */
+static u8 lock_ex_to_lock(u16 lock_ex) {
+  if (lock_ex > MSM_LOCK_EX_MAX) {
+    lock_ex = MSM_LOCK_EX_MAX;
+  }
+  u32 lock_time_ms = lock_ex;
+  if (lock_ex >= 64) {
+    /* each doubling of the lock time above 64 ms covers 32 values */
+    u8 doublings = lock_ex / 32 - 1;
+    lock_time_ms = (u32)(lock_ex - 32 * doublings) << doublings;
+  }
+  u8 lock = 0;
+  while (lock < 15 && lock_time_ms >= (32u << lock)) {
+    lock++;
+  }
+  return lock;
+}
+
+/* Rewrite an MSM7 message as the MSM4 message of the same observations.
+ * Returns the MSM4 message size, 0 if the message is not a consistent MSM7
+ * message. */
+static u16 msm7_to_msm4(const u8 *in, u16 in_size, u8 *out) {
+  if (in_size * 8u < MSM_CELL_MASK_BIT_OFFSET) {
+    return 0;
+  }
+  u32 bit = MSM_SAT_MASK_BIT_OFFSET;
+  u8 n_sats = 0;
+  for (u8 i = 0; i < MSM_SATELLITE_MASK_SIZE; i++) {
+    n_sats += getbitu(in, bit++, 1);
+  }
+  u8 n_sigs = 0;
+  for (u8 i = 0; i < MSM_SIGNAL_MASK_SIZE; i++) {
+    n_sigs += getbitu(in, bit++, 1);
+  }
+  u16 cell_mask_size = (u16)n_sats * n_sigs;
+  if (cell_mask_size > MSM_MAX_CELLS ||
+      (bit + cell_mask_size + 7) / 8 > in_size) {
+    return 0;
+  }
+  u8 n_cells = 0;
+  for (u8 i = 0; i < cell_mask_size; i++) {
+    n_cells += getbitu(in, bit++, 1);
+  }
+  const u32 header_bits = bit;
+  if (header_bits + n_sats * MSM7_SAT_BITS + n_cells * MSM7_SIGNAL_BITS >
+      in_size * 8u) {
+    return 0;
+  }
+
+  u16 out_size =
+      (header_bits + n_sats * MSM4_SAT_BITS + n_cells * MSM4_SIGNAL_BITS + 7) /
+      8;
+  memset(out, 0, out_size);
+  copy_bits(in, 0, out, 0, header_bits);
+  setbitu(out, 0, 12, getbitu(in, 0, 12) - 3);
+
+  /* satellite data: integer milliseconds and rough range modulo 1 ms */
+  u32 in_bit = header_bits;
+  u32 out_bit = header_bits;
+  copy_bits(in, in_bit, out, out_bit, n_sats * 8);
+  in_bit += n_sats * (8 + 4);
+  out_bit += n_sats * 8;
+  copy_bits(in, in_bit, out, out_bit, n_sats * 10);
+  in_bit += n_sats * (10 + 14);
+  out_bit += n_sats * 10;
+
+  /* signal data, each field for all the cells in turn */
+  for (u8 i = 0; i < n_cells; i++, in_bit += 20, out_bit += 15) {
+    s32 fine_pr = getbits(in, in_bit, 20);
+    setbits(out, out_bit, 15, reduce_signed(fine_pr, 20, 15, 5));
+  }
+  for (u8 i = 0; i < n_cells; i++, in_bit += 24, out_bit += 22) {
+    s32 fine_cp = getbits(in, in_bit, 24);
+    setbits(out, out_bit, 22, reduce_signed(fine_cp, 24, 22, 2));
+  }
+  for (u8 i = 0; i < n_cells; i++, in_bit += 10, out_bit += 4) {
+    setbitu(out, out_bit, 4, lock_ex_to_lock((u16)getbitu(in, in_bit, 10)));
+  }
+  copy_bits(in, in_bit, out, out_bit, n_cells);
+  in_bit += n_cells;
+  out_bit += n_cells;
+  for (u8 i = 0; i < n_cells; i++, in_bit += 10, out_bit += 6) {
+    /* 0 is unavailable in both */
+    u32 cnr = (getbitu(in, in_bit, 10) + 8) / 16;
+    setbitu(out, out_bit, 6, (cnr > 63) ? 63 : cnr);
+  }
+  return out_size;
+}
+
+static void send_frame(u16 message_size, struct rtcm3_rtcm3_state *state) {
+  state->frame[0] = RTCM3_PREAMBLE;
+  state->frame[1] = (message_size >> 8) & 0x3;
+  state->frame[2] = message_size & 0xFF;
+  u16 crc_index = RTCM3_HEADER_SIZE + message_size;
+  u32 crc = crc24q(state->frame, crc_index, 0);
+  state->frame[crc_index] = (crc >> 16) & 0xFF;
+  state->frame[crc_index + 1] = (crc >> 8) & 0xFF;
+  state->frame[crc_index + 2] = crc & 0xFF;
+  state->cb_rtcm_out(state->frame, crc_index + RTCM3_CRC_SIZE, state->context);
+}
+
+void rtcm2rtcm_init(struct rtcm3_rtcm3_state *state,
+                    void (*cb_rtcm_out)(const u8 *frame,
+                                        u16 length,
+                                        void *context),
+                    void *context) {
+  state->cb_rtcm_out = cb_rtcm_out;
+  state->context = context;
+  memset(state->drop_mask, 0, sizeof(state->drop_mask));
+  state->drop_other = false;
+  state->station_id = RTCM2RTCM_KEEP_STATION_ID;
+  state->msm7_to_msm4 = false;
+  rtcm3_frame_reader_init(&state->reader);
+}
+
+/** Drop or pass on the frames of an RTCM message type.
+ *
+ * \param msg_type RTCM message number
+ * \param dropped Whether the frames of the message type are dropped
+ * \param state Passthrough state
+ * \return true if the message type is within the supported range, see
+ *         rtcm2rtcm_set_other_msgs_dropped for the others
+ */
+bool rtcm2rtcm_set_msg_dropped(u16 msg_type,
+                               bool dropped,
+                               struct rtcm3_rtcm3_state *state) {
+  if (msg_type < RTCM3_MSG_TYPE_MIN || msg_type > RTCM3_MSG_TYPE_MAX) {
+    return false;
+  }
+  u16 index = RTCM3_MSG_INDEX(msg_type);
+  u32 bit = 1u << (index % 32);
+  if (dropped) {
+    state->drop_mask[index / 32] |= bit;
+  } else {
+    state->drop_mask[index / 32] &= ~bit;
+  }
+  return true;
+}
+
+/** Drop or pass on the frames of the message types outside of
+ * RTCM3_MSG_TYPE_MIN to RTCM3_MSG_TYPE_MAX, such as the proprietary 4001-4095.
+ *
+ * \param dropped Whether the frames of these message types are dropped
+ * \param state Passthrough state
+ */
+void rtcm2rtcm_set_other_msgs_dropped(bool dropped,
+                                      struct rtcm3_rtcm3_state *state) {
+  state->drop_other = dropped;
+}
+
+/** Set the reference station ID of the output.
+ *
+ * \param station_id 12 bit station ID written into every message that has
+ *        one, or RTCM2RTCM_KEEP_STATION_ID
+ * \param state Passthrough state
+ */
+void rtcm2rtcm_set_station_id(u16 station_id,
+                              struct rtcm3_rtcm3_state *state) {
+  assert(RTCM2RTCM_KEEP_STATION_ID == station_id || station_id <= 0xFFF);
+  state->station_id = station_id;
+}
+
+/** Convert the MSM7 observation messages into MSM4.
+ *
+ * MSM4 drops the Doppler, the extended satellite information and the finer
+ * resolution of the ranges and C/N0, which shrinks the observations by about
+ * a third.
+ *
+ * \param enabled Whether MSM7 is converted
+ * \param state Passthrough state
+ */
+void rtcm2rtcm_set_msm7_to_msm4(bool enabled,
+                                struct rtcm3_rtcm3_state *state) {
+  state->msm7_to_msm4 = enabled;
+}
+
+/** Pass on a single RTCM3 frame.
+ *
+ * \param frame Frame, including the transport layer header and CRC, which is
+ *        expected to be checked already
+ * \param length Length of the frame
+ * \param state Passthrough state
+ */
+void rtcm2rtcm_process_frame(const u8 *frame,
+                             u16 length,
+                             struct rtcm3_rtcm3_state *state) {
+  if (length < RTCM3_HEADER_SIZE + RTCM3_CRC_SIZE + 2) {
+    return;
+  }
+  const u8 *message = &frame[RTCM3_HEADER_SIZE];
+  u16 message_size = length - RTCM3_HEADER_SIZE - RTCM3_CRC_SIZE;
+  u16 msg_num = (u16)getbitu(message, 0, 12);
+  if (msg_dropped(msg_num, state)) {
+    return;
+  }
+
+  u8 *out = &state->frame[RTCM3_HEADER_SIZE];
+  u16 out_size = 0;
+  if (state->msm7_to_msm4 && MSM7 == msg_msm_type(msg_num)) {
+    out_size = msm7_to_msm4(message, message_size, out);
+  }
+  bool new_station_id = RTCM2RTCM_KEEP_STATION_ID != state->station_id &&
+                        has_station_id(msg_num) &&
+                        message_size * 8u >= STATION_ID_BIT_END &&
+                        getbitu(message, 12, 12) != state->station_id;
+  if (0 == out_size) {
+    if (!new_station_id) {
+      /* unchanged, the original bytes go out */
+      state->cb_rtcm_out(frame, length, state->context);
+      return;
+    }
+    memcpy(out, message, message_size);
+    out_size = message_size;
+  }
+  if (new_station_id) {
+    setbitu(out, 12, 12, state->station_id);
+  }
+  send_frame(out_size, state);
+}
+
+static void process_frame_cb(const u8 *frame, u16 length, void *context) {
+  rtcm2rtcm_process_frame(frame, length, (struct rtcm3_rtcm3_state *)context);
+}
+
+/** Feed a chunk of a raw RTCM3 byte stream into the passthrough.
+ *
+ * The frames are found the same way as by rtcm2sbp_process_bytes, bytes
+ * outside of valid frames are dropped.
+ *
+ * \param buf Chunk of the RTCM3 stream
+ * \param len Number of bytes in the chunk
+ * \param state Passthrough state
+ */
+void rtcm2rtcm_process_bytes(const u8 *buf,
+                             u32 len,
+                             struct rtcm3_rtcm3_state *state) {
+  rtcm3_read_frames(buf, len, &state->reader, process_frame_cb, state);
+}
@@ -21,9 +21,110 @@
 #include <string.h>
 #include "rtcm3_sbp_internal.h"
 
-static void validate_base_obs_sanity(struct rtcm3_sbp_state *state,
-                                     const gps_time_sec_t *obs_time,
-                                     const gps_time_sec_t *rover_time);
+/* Converter state of the frame being decoded on this thread. librtcm only
+ * has a single process wide log hook, so its messages are routed to the
+ * state that triggered them through this. */
+static THREAD_LOCAL struct rtcm3_sbp_state *decoding_state = NULL;
+
+/* Install the librtcm log hook, it does not depend on the converter state so
+ * it only needs to be done once */
+static void init_rtcm_logging(void) {
+  static bool logging_initialized = false;
+  if (!__atomic_test_and_set(&logging_initialized, __ATOMIC_ACQ_REL)) {
+    rtcm_init_logging(&rtcm_log_callback_fn, NULL);
+  }
+}
+
+static void init_msg_handlers(struct rtcm3_sbp_state *state);
+static bool build_glo_bias_matcher(
+    const struct rtcm2sbp_glo_bias_entry *entries,
+    u8 n_entries,
+    struct rtcm3_glo_bias_matcher *matcher);
+
+/* Receiver biases applied from the 1033 receiver descriptor, in priority
+ * order. The Geo++ names must come first as they contain the names of the
+ * receivers they simulate. */
+static const struct rtcm2sbp_glo_bias_entry default_glo_biases[] = {
+    {"Geo++ GNSMART (GLO=ASH)", 0x9, GPP_ASH1_BIAS_L1CA_M, 0.0, 0.0,
+     GPP_ASH1_BIAS_L2P_M},
+    {"Geo++ GNSMART (GLO=HEM)", 0x9, GPP_HEM_BIAS_L1CA_M, 0.0, 0.0,
+     GPP_HEM_BIAS_L2P_M},
+    {"Geo++ GNSMART (GLO=JAV)", 0x9, GPP_JAV_BIAS_L1CA_M, 0.0, 0.0,
+     GPP_JAV_BIAS_L2P_M},
+    {"Geo++ GNSMART (GLO=JPS)", 0x9, GPP_JPS_BIAS_L1CA_M, 0.0, 0.0,
+     GPP_JPS_BIAS_L2P_M},
+    {"Geo++ GNSMART (GLO=LEI)", 0x9, GPP_NOV_BIAS_L1CA_M, 0.0, 0.0,
+     GPP_NOV_BIAS_L2P_M},
+    {"Geo++ GNSMART (GLO=NOV)", 0x9, GPP_NOV_BIAS_L1CA_M, 0.0, 0.0,
+     GPP_NOV_BIAS_L2P_M},
+    {"Geo++ GNSMART (GLO=NAV)", 0x9, GPP_NAV_BIAS_L1CA_M, 0.0, 0.0,
+     GPP_NAV_BIAS_L2P_M},
+    {"Geo++ GNSMART (GLO=NVR)", 0x9, GPP_NVR_BIAS_L1CA_M, 0.0, 0.0,
+     GPP_NVR_BIAS_L2P_M},
+    {"Geo++ GNSMART (GLO=SEP)", 0x9, GPP_SEP_BIAS_L1CA_M, 0.0, 0.0,
+     GPP_SEP_BIAS_L2P_M},
+    {"Geo++ GNSMART (GLO=SOK)", 0x9, GPP_SOK_BIAS_L1CA_M, 0.0, 0.0,
+     GPP_SOK_BIAS_L2P_M},
+    {"Geo++ GNSMART (GLO=TPS)", 0x9, GPP_TPS_BIAS_L1CA_M, 0.0, 0.0,
+     GPP_TPS_BIAS_L2P_M},
+    {"Geo++ GNSMART (GLO=TRM)", 0x9, GPP_TRM_BIAS_L1CA_M, 0.0, 0.0,
+     GPP_TRM_BIAS_L2P_M},
+    {"TRIMBLE", 0xF, TRIMBLE_BIAS_M, TRIMBLE_BIAS_M, TRIMBLE_BIAS_M,
+     TRIMBLE_BIAS_M},
+    {"ASHTECH", 0xF, TRIMBLE_BIAS_M, TRIMBLE_BIAS_M, TRIMBLE_BIAS_M,
+     TRIMBLE_BIAS_M},
+    {"LEICA", 0xF, NOVATEL_BIAS_M, NOVATEL_BIAS_M, NOVATEL_BIAS_M,
+     NOVATEL_BIAS_M},
+    {"NOV", 0xF, NOVATEL_BIAS_M, NOVATEL_BIAS_M, NOVATEL_BIAS_M,
+     NOVATEL_BIAS_M},
+    {"GEOMAX", 0xF, NOVATEL_BIAS_M, NOVATEL_BIAS_M, NOVATEL_BIAS_M,
+     NOVATEL_BIAS_M},
+    {"SEPT", 0xF, SEPTENTRIO_BIAS_M, SEPTENTRIO_BIAS_M, SEPTENTRIO_BIAS_M,
+     SEPTENTRIO_BIAS_M},
+    {"TPS", 0x9, TOPCON_BIAS_M, TOPCON_BIAS_M, TOPCON_BIAS_M, TOPCON_BIAS_M},
+    {"JAVAD", 0x9, JAVAD_BIAS_L1CA_M, 0.0, 0.0, JAVAD_BIAS_L2P_M},
+    {"NAVCOM", 0x9, NAVCOM_BIAS_L1CA_M, 0.0, 0.0, NAVCOM_BIAS_L2P_M},
+    {"HEMI", 0x9, HEMISPHERE_BIAS_L1CA_M, 0.0, 0.0, HEMISPHERE_BIAS_L2P_M},
+};
+
+static void station_init(struct rtcm3_station_state *station, u16 stn_id) {
+  station->stn_id = stn_id;
+  station->in_use = false;
+  station->last_used = 0;
+  station->sender_id = 0;
+
+  station->last_gps_time.wn = INVALID_TIME;
+  station->last_gps_time.tow = 0;
+  station->last_glo_time.wn = INVALID_TIME;
+  station->last_glo_time.tow = 0;
+  station->last_1230_received.wn = INVALID_TIME;
+  station->last_1230_received.tow = 0;
+  station->last_msm_received.wn = INVALID_TIME;
+  station->last_msm_received.tow = 0;
+  station->rcv_descriptor_len = 0;
+  station->glo_bias_index = RTCM3_GLO_BIAS_NONE;
+  station->glo_bias_cached = false;
+  station->base_pos_known = false;
+  rtcm3_stats_clear(&station->stats, sizeof(station->stats));
+  station->epoch_msgs = 0;
+  station->epoch_n_msgs = 0;
+  station->expected_msgs = 0;
+  station->expected_n_msgs = 0;
+  station->expected_msgs_count = 0;
+
+  memset(&station->epoch.t, 0, sizeof(station->epoch.t));
+  station->epoch.n_obs = 0;
+}
+
+/* Hand a pool slot to a station, its statistics start over */
+static void station_take(struct rtcm3_station_state *station,
+                         u16 stn_id,
+                         struct rtcm3_sbp_state *state) {
+  rtcm3_stats_write_begin(state);
+  station_init(station, stn_id);
+  station->in_use = true;
+  rtcm3_stats_write_end(state);
+}
 
 void rtcm2sbp_init(
     struct rtcm3_sbp_state *state,
@@ -34,21 +135,31 @@ void rtcm2sbp_init(
 
   state->leap_seconds = 0;
   state->leap_second_known = false;
+  memset(&state->time_anchor, 0, sizeof(state->time_anchor));
 
-  state->sender_id = 0;
   state->cb_rtcm_to_sbp = cb_rtcm_to_sbp;
   state->cb_base_obs_invalid = cb_base_obs_invalid;
 
-  state->last_gps_time.wn = INVALID_TIME;
-  state->last_gps_time.tow = 0;
-  state->last_glo_time.wn = INVALID_TIME;
-  state->last_glo_time.tow = 0;
-  state->last_1230_received.wn = INVALID_TIME;
-  state->last_1230_received.tow = 0;
-  state->last_msm_received.wn = INVALID_TIME;
-  state->last_msm_received.tow = 0;
+  state->cb_batch = NULL;
+  state->batch_context = NULL;
+  state->batch_n_msgs = 0;
+  state->batch_buffer_used = 0;
+  state->frame_ring = NULL;
+
+  state->cb_epoch = NULL;
+  state->epoch_context = NULL;
+  state->obs_msg_used = 0;
+
+  state->epoch_deadline_ms = 0;
+  memset(&state->merger, 0, sizeof(state->merger));
+  memset(state->eph_sent, 0, sizeof(state->eph_sent));
+  state->ssr_store = NULL;
+  state->orbit_store = NULL;
 
   state->sent_msm_warning = false;
+  for (u8 i = 0; i < RTCM3_MSM_CONSTELLATIONS; i++) {
+    state->msm_code_mask[i] = RTCM3_ALL_CODES;
+  }
   for (u8 i = 0; i < UNSUPPORTED_CODE_MAX; i++) {
     state->sent_code_warning[i] = false;
   }
@@ -57,18 +168,20 @@ void rtcm2sbp_init(
     state->glo_sv_id_fcn_map[i] = MSM_GLO_FCN_UNKNOWN;
   }
 
-  memset(state->obs_buffer, 0, OBS_BUFFER_SIZE);
+  station_init(&state->station, 0);
+  state->stations = NULL;
+  state->max_stations = 0;
+  state->station_use_count = 0;
 
-  rtcm_init_logging(&rtcm_log_callback_fn, state);
-}
+  rtcm3_frame_reader_init(&state->reader);
 
-static void normalize_gps_time(gps_time_sec_t *t) {
-  /* note that tow is unsigned so no need to check tow<0 */
+  state->stats_seq = 0;
+  rtcm3_stats_clear(&state->stats, sizeof(state->stats));
 
-  while (t->tow >= SEC_IN_WEEK) {
-    t->tow -= SEC_IN_WEEK;
-    t->wn += 1;
-  }
+  init_msg_handlers(state);
+  build_glo_bias_matcher(NULL, 0, &state->glo_bias_matcher);
+
+  init_rtcm_logging();
 }
 
 static bool gps_time_valid(const gps_time_sec_t *t) {
@@ -77,13 +190,13 @@ static bool gps_time_valid(const gps_time_sec_t *t) {
 
 s32 gps_diff_time_sec(const gps_time_sec_t *end,
                       const gps_time_sec_t *beginning) {
-  assert(gps_time_valid(beginning));
-  assert(gps_time_valid(end));
+  RTCM3_CHECK(gps_time_valid(beginning));
+  RTCM3_CHECK(gps_time_valid(end));
 
   s16 week_diff = end->wn - beginning->wn;
-  /* assert the total difference in seconds is represantable by s32 (works out
+  /* the total difference in seconds must be represantable by s32 (works out
    * to 3549 weeks) */
-  assert(week_diff > -MAX_WEEK_DIFF && week_diff < MAX_WEEK_DIFF);
+  RTCM3_CHECK(week_diff > -MAX_WEEK_DIFF && week_diff < MAX_WEEK_DIFF);
 
   s32 dt = (s32)end->tow - (s32)beginning->tow;
   dt += week_diff * SEC_IN_WEEK;
@@ -96,209 +209,704 @@ static u16 rtcm_2_sbp_sender_id(u16 rtcm_id) {
   return rtcm_id | 0xF000;
 }
 
-void rtcm2sbp_decode_frame(const uint8_t *frame,
-                           uint32_t frame_length,
-                           struct rtcm3_sbp_state *state) {
-  if (!gps_time_valid(&state->time_from_rover_obs) || frame_length < 1) {
-    return;
+/** Set up the converter for streams that interleave several stations.
+ *
+ * Each station gets its own epoch buffer and time keeping, so observations
+ * from different stations no longer flush each other's epochs. When more
+ * than max_stations stations are seen, the least recently used station is
+ * flushed and its slot reused. Passing a NULL pool returns to the default
+ * single station behaviour.
+ *
+ * \param stations Caller owned storage for the station states
+ * \param max_stations Number of elements in the storage
+ * \param state Converter state
+ */
+void rtcm2sbp_set_station_pool(struct rtcm3_station_state *stations,
+                               u8 max_stations,
+                               struct rtcm3_sbp_state *state) {
+  rtcm3_stats_write_begin(state);
+  state->stations = (max_stations > 0) ? stations : NULL;
+  state->max_stations = (NULL != stations) ? max_stations : 0;
+  for (u8 i = 0; i < state->max_stations; i++) {
+    station_init(&state->stations[i], 0);
   }
+  rtcm3_stats_write_end(state);
+}
 
-  uint16_t byte = 1;
-  uint16_t message_size = ((frame[byte] & 0x3) << 8) | frame[byte + 1];
+/** Hand out the converted SBP messages in batches instead of one by one.
+ *
+ * Once set, cb_rtcm_to_sbp is no longer called. Instead the messages are
+ * collected and passed to cb_batch together when an observation epoch has
+ * been sent, so that a whole epoch can be written out with a single call.
+ * The observation payloads point directly into the output buffer of the
+ * converter, so the batch is only valid for the duration of the callback.
+ * Passing a NULL callback returns to one call per message.
+ *
+ * \param cb_batch Callback receiving the batch of messages
+ * \param context Caller context passed on to cb_batch
+ * \param state Converter state
+ */
+void rtcm2sbp_set_batch_callback(
+    void (*cb_batch)(const struct rtcm3_sbp_batch_msg *msgs,
+                     u8 n_msgs,
+                     void *context),
+    void *context,
+    struct rtcm3_sbp_state *state) {
+  rtcm2sbp_flush_batch(state);
+  state->cb_batch = cb_batch;
+  state->batch_context = context;
+}
 
-  if (frame_length < message_size) {
+/** Hand out the observation epochs as they are, without packing them into
+ * SBP messages.
+ *
+ * Once set, complete epochs are passed to cb_epoch instead of being sent out
+ * as SBP_MSG_OBS, all the other messages are still sent as SBP. The epoch is
+ * only valid for the duration of the callback, its values can be read with
+ * the rtcm2sbp_obs_* accessors. Passing a NULL callback returns to sending
+ * SBP_MSG_OBS.
+ *
+ * \param cb_epoch Callback receiving the epochs
+ * \param context Caller context passed on to cb_epoch
+ * \param state Converter state
+ */
+void rtcm2sbp_set_epoch_callback(
+    void (*cb_epoch)(const struct rtcm3_obs_epoch *epoch,
+                     u16 sender_id,
+                     void *context),
+    void *context,
+    struct rtcm3_sbp_state *state) {
+  state->cb_epoch = cb_epoch;
+  state->epoch_context = context;
+}
+
+/** Pass on any messages collected for the batch callback straight away.
+ *
+ * \param state Converter state
+ */
+void rtcm2sbp_flush_batch(struct rtcm3_sbp_state *state) {
+  if (NULL != state->cb_batch && state->batch_n_msgs > 0) {
+    state->cb_batch(state->batch, state->batch_n_msgs, state->batch_context);
+  }
+  state->batch_n_msgs = 0;
+  state->batch_buffer_used = 0;
+  state->obs_msg_used = 0;
+}
+
+/* Send out a converted SBP message, frame it into the output ring, or queue
+ * a copy of it when batching */
+void send_sbp_message(u16 msg_id,
+                      u8 len,
+                      u8 *buff,
+                      u16 sender_id,
+                      struct rtcm3_sbp_state *state) {
+  if (NULL != state->frame_ring) {
+    if (!rtcm2sbp_ring_write(state->frame_ring, msg_id, sender_id, len, buff)) {
+      rtcm3_count_state_event(RTCM2SBP_EVENT_OUTPUT_FULL, state);
+    }
+    return;
+  }
+  if (NULL == state->cb_batch) {
+    state->cb_rtcm_to_sbp(msg_id, len, buff, sender_id);
     return;
   }
 
-  byte += 2;
-  uint16_t message_type = (frame[byte] << 4) | ((frame[byte + 1] >> 4) & 0xf);
+  if (state->batch_n_msgs >= SBP_BATCH_MAX_MSGS ||
+      state->batch_buffer_used + len > SBP_BATCH_BUFFER_SIZE) {
+    rtcm2sbp_flush_batch(state);
+  }
 
-  switch (message_type) {
-    case 1001:
-    case 1003:
-      break;
-    case 1002: {
-      rtcm_obs_message new_rtcm_obs;
-      if (RC_OK == rtcm3_decode_1002(&frame[byte], &new_rtcm_obs)) {
-        /* Need to check if we've got obs in the buffer from the previous epoch
-         and send before accepting the new message */
-        add_gps_obs_to_buffer(&new_rtcm_obs, state);
-      }
-      break;
-    }
-    case 1004: {
-      rtcm_obs_message new_rtcm_obs;
-      if (RC_OK == rtcm3_decode_1004(&frame[byte], &new_rtcm_obs)) {
-        /* Need to check if we've got obs in the buffer from the previous epoch
-         and send before accepting the new message */
-        add_gps_obs_to_buffer(&new_rtcm_obs, state);
-      }
-      break;
-    }
-    case 1005: {
-      rtcm_msg_1005 msg_1005;
-      if (RC_OK == rtcm3_decode_1005(&frame[byte], &msg_1005)) {
-        msg_base_pos_ecef_t sbp_base_pos;
-        rtcm3_1005_to_sbp(&msg_1005, &sbp_base_pos);
-        state->cb_rtcm_to_sbp(SBP_MSG_BASE_POS_ECEF,
-                              (u8)sizeof(sbp_base_pos),
-                              (u8 *)&sbp_base_pos,
-                              rtcm_2_sbp_sender_id(msg_1005.stn_id));
-      }
-      break;
-    }
-    case 1006: {
-      rtcm_msg_1006 msg_1006;
-      if (RC_OK == rtcm3_decode_1006(&frame[byte], &msg_1006)) {
-        msg_base_pos_ecef_t sbp_base_pos;
-        rtcm3_1006_to_sbp(&msg_1006, &sbp_base_pos);
-        state->cb_rtcm_to_sbp(SBP_MSG_BASE_POS_ECEF,
-                              (u8)sizeof(sbp_base_pos),
-                              (u8 *)&sbp_base_pos,
-                              rtcm_2_sbp_sender_id(msg_1006.msg_1005.stn_id));
-      }
-      break;
-    }
-    case 1007:
-    case 1008:
-      break;
-    case 1010: {
-      rtcm_obs_message new_rtcm_obs;
-      if (RC_OK == rtcm3_decode_1010(&frame[byte], &new_rtcm_obs) &&
-          state->leap_second_known) {
-        add_glo_obs_to_buffer(&new_rtcm_obs, state);
-      }
-      break;
-    }
-    case 1012: {
-      rtcm_obs_message new_rtcm_obs;
-      if (RC_OK == rtcm3_decode_1012(&frame[byte], &new_rtcm_obs) &&
-          state->leap_second_known) {
-        add_glo_obs_to_buffer(&new_rtcm_obs, state);
-      }
-      break;
-    }
-    case 1029: {
-      rtcm_msg_1029 msg_1029;
-      if (RC_OK == rtcm3_decode_1029(&frame[byte], &msg_1029)) {
-        send_1029(&msg_1029, state);
-      }
-      break;
-    }
-    case 1033: {
-      rtcm_msg_1033 msg_1033;
-      if (RC_OK == rtcm3_decode_1033(&frame[byte], &msg_1033) &&
-          no_1230_received(state)) {
-        msg_glo_biases_t sbp_glo_cpb;
-        rtcm3_1033_to_sbp(&msg_1033, &sbp_glo_cpb);
-        state->cb_rtcm_to_sbp(SBP_MSG_GLO_BIASES,
-                              (u8)sizeof(sbp_glo_cpb),
-                              (u8 *)&sbp_glo_cpb,
-                              rtcm_2_sbp_sender_id(msg_1033.stn_id));
-      }
+  u8 *payload = &state->batch_buffer[state->batch_buffer_used];
+  memcpy(payload, buff, len);
+  state->batch_buffer_used += len;
+
+  struct rtcm3_sbp_batch_msg *msg = &state->batch[state->batch_n_msgs++];
+  msg->msg_id = msg_id;
+  msg->sender_id = sender_id;
+  msg->len = len;
+  msg->payload = payload;
+}
+
+/* Find the state of the given station. The pool is an open addressed hash
+ * table keyed on the station ID; once it is full, the least recently used
+ * station is evicted to make room. */
+struct rtcm3_station_state *rtcm3_get_station(u16 stn_id,
+                                              struct rtcm3_sbp_state *state) {
+  if (NULL == state->stations) {
+    return &state->station;
+  }
+
+  struct rtcm3_station_state *found = NULL;
+  struct rtcm3_station_state *lru = NULL;
+  for (u8 i = 0; i < state->max_stations; i++) {
+    struct rtcm3_station_state *station =
+        &state->stations[(stn_id + i) % state->max_stations];
+    if (!station->in_use) {
+      /* station not seen before, take the free slot */
+      station_take(station, stn_id, state);
+      found = station;
       break;
     }
-    case 1230: {
-      rtcm_msg_1230 msg_1230;
-      if (RC_OK == rtcm3_decode_1230(&frame[byte], &msg_1230)) {
-        msg_glo_biases_t sbp_glo_cpb;
-        rtcm3_1230_to_sbp(&msg_1230, &sbp_glo_cpb);
-        state->cb_rtcm_to_sbp(SBP_MSG_GLO_BIASES,
-                              (u8)sizeof(sbp_glo_cpb),
-                              (u8 *)&sbp_glo_cpb,
-                              rtcm_2_sbp_sender_id(msg_1230.stn_id));
-        state->last_1230_received = state->time_from_rover_obs;
-      }
+    if (station->stn_id == stn_id) {
+      found = station;
       break;
     }
-    case 1074:
-    case 1084:
-    case 1094:
-    case 1124: {
-      rtcm_msm_message new_rtcm_msm;
-      if (RC_OK == rtcm3_decode_msm4(
-                       &frame[byte], state->glo_sv_id_fcn_map, &new_rtcm_msm)) {
-        add_msm_obs_to_buffer(&new_rtcm_msm, state);
-      }
-      break;
+    if (NULL == lru || station->last_used < lru->last_used) {
+      lru = station;
     }
-    case 1075:
-    case 1085:
-    case 1095:
-    case 1125: {
-      rtcm_msm_message new_rtcm_msm;
-      if (RC_OK == rtcm3_decode_msm5(&frame[byte], &new_rtcm_msm)) {
-        add_msm_obs_to_buffer(&new_rtcm_msm, state);
-      }
+  }
+
+  if (NULL == found) {
+    /* pool full, flush out the least recently used station and reuse it */
+    assert(NULL != lru);
+    send_observations(lru, state);
+    station_take(lru, stn_id, state);
+    found = lru;
+  }
+
+  found->last_used = ++state->station_use_count;
+  return found;
+}
+
+/* Find the state of the given station without adding it to the pool, returns
+ * NULL if the station is not in the pool */
+struct rtcm3_station_state *rtcm3_find_station(u16 stn_id,
+                                               struct rtcm3_sbp_state *state) {
+  if (NULL == state->stations) {
+    return &state->station;
+  }
+
+  for (u8 i = 0; i < state->max_stations; i++) {
+    struct rtcm3_station_state *station =
+        &state->stations[(stn_id + i) % state->max_stations];
+    if (!station->in_use) {
       break;
     }
-    case 1076:
-    case 1086:
-    case 1096:
-    case 1126: {
-      rtcm_msm_message new_rtcm_msm;
-      if (RC_OK == rtcm3_decode_msm6(
-                       &frame[byte], state->glo_sv_id_fcn_map, &new_rtcm_msm)) {
-        add_msm_obs_to_buffer(&new_rtcm_msm, state);
-      }
-      break;
+    if (station->stn_id == stn_id) {
+      return station;
     }
-    case 1077:
-    case 1087:
-    case 1097:
-    case 1127: {
-      rtcm_msm_message new_rtcm_msm;
-      if (RC_OK == rtcm3_decode_msm7(&frame[byte], &new_rtcm_msm)) {
-        add_msm_obs_to_buffer(&new_rtcm_msm, state);
-      }
-      break;
+  }
+  return NULL;
+}
+
+static void handle_1002(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_obs_message new_rtcm_obs;
+  if (RC_OK == rtcm3_decode_1002(msg, &new_rtcm_obs)) {
+    /* Need to check if we've got obs in the buffer from the previous epoch
+     and send before accepting the new message */
+    add_gps_obs_to_buffer(&new_rtcm_obs, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_1004(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_obs_message new_rtcm_obs;
+  if (RC_OK == rtcm3_decode_1004(msg, &new_rtcm_obs)) {
+    /* Need to check if we've got obs in the buffer from the previous epoch
+     and send before accepting the new message */
+    add_gps_obs_to_buffer(&new_rtcm_obs, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+/* Keep the station position for the MSM1-3 conversion */
+static void store_base_pos(u16 stn_id,
+                           const msg_base_pos_ecef_t *sbp_base_pos,
+                           struct rtcm3_sbp_state *state) {
+  struct rtcm3_station_state *station = rtcm3_get_station(stn_id, state);
+  station->base_pos_ecef[0] = sbp_base_pos->x;
+  station->base_pos_ecef[1] = sbp_base_pos->y;
+  station->base_pos_ecef[2] = sbp_base_pos->z;
+  station->base_pos_known = true;
+}
+
+static void handle_1005(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msg_1005 msg_1005;
+  if (RC_OK == rtcm3_decode_1005(msg, &msg_1005)) {
+    msg_base_pos_ecef_t sbp_base_pos;
+    rtcm3_1005_to_sbp(&msg_1005, &sbp_base_pos);
+    send_sbp_message(SBP_MSG_BASE_POS_ECEF,
+                     (u8)sizeof(sbp_base_pos),
+                     (u8 *)&sbp_base_pos,
+                     rtcm_2_sbp_sender_id(msg_1005.stn_id),
+                     state);
+    store_base_pos(msg_1005.stn_id, &sbp_base_pos, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_1006(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msg_1006 msg_1006;
+  if (RC_OK == rtcm3_decode_1006(msg, &msg_1006)) {
+    msg_base_pos_ecef_t sbp_base_pos;
+    rtcm3_1006_to_sbp(&msg_1006, &sbp_base_pos);
+    send_sbp_message(SBP_MSG_BASE_POS_ECEF,
+                     (u8)sizeof(sbp_base_pos),
+                     (u8 *)&sbp_base_pos,
+                     rtcm_2_sbp_sender_id(msg_1006.msg_1005.stn_id),
+                     state);
+    store_base_pos(msg_1006.msg_1005.stn_id, &sbp_base_pos, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_1010(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_obs_message new_rtcm_obs;
+  if (RC_OK != rtcm3_decode_1010(msg, &new_rtcm_obs)) {
+    rtcm3_count_decode_error(msg, state);
+  } else if (state->leap_second_known) {
+    add_glo_obs_to_buffer(&new_rtcm_obs, state);
+  }
+}
+
+static void handle_1012(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_obs_message new_rtcm_obs;
+  if (RC_OK != rtcm3_decode_1012(msg, &new_rtcm_obs)) {
+    rtcm3_count_decode_error(msg, state);
+  } else if (state->leap_second_known) {
+    add_glo_obs_to_buffer(&new_rtcm_obs, state);
+  }
+}
+
+static void handle_1029(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msg_1029 msg_1029;
+  if (RC_OK == rtcm3_decode_1029(msg, &msg_1029)) {
+    send_1029(&msg_1029, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_1033(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msg_1033 msg_1033;
+  if (RC_OK != rtcm3_decode_1033(msg, &msg_1033)) {
+    rtcm3_count_decode_error(msg, state);
+    return;
+  }
+  struct rtcm3_station_state *station =
+      rtcm3_get_station(msg_1033.stn_id, state);
+  if (no_1230_received(station, state)) {
+    msg_glo_biases_t sbp_glo_cpb;
+    rtcm3_1033_to_sbp(&msg_1033, station, &sbp_glo_cpb, state);
+    send_sbp_message(SBP_MSG_GLO_BIASES,
+                     (u8)sizeof(sbp_glo_cpb),
+                     (u8 *)&sbp_glo_cpb,
+                     rtcm_2_sbp_sender_id(msg_1033.stn_id),
+                     state);
+  }
+}
+
+static void handle_1230(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msg_1230 msg_1230;
+  if (RC_OK == rtcm3_decode_1230(msg, &msg_1230)) {
+    msg_glo_biases_t sbp_glo_cpb;
+    rtcm3_1230_to_sbp(&msg_1230, &sbp_glo_cpb);
+    send_sbp_message(SBP_MSG_GLO_BIASES,
+                     (u8)sizeof(sbp_glo_cpb),
+                     (u8 *)&sbp_glo_cpb,
+                     rtcm_2_sbp_sender_id(msg_1230.stn_id),
+                     state);
+    rtcm3_get_station(msg_1230.stn_id, state)->last_1230_received =
+        state->time_from_rover_obs;
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_1019(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msg_eph msg_eph;
+  if (RC_OK == rtcm3_decode_gps_eph(msg, &msg_eph)) {
+    rtcm3_send_eph(&msg_eph, 1019, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_1020(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msg_eph msg_eph;
+  if (RC_OK == rtcm3_decode_glo_eph(msg, &msg_eph)) {
+    rtcm3_send_eph(&msg_eph, 1020, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_1042(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msg_eph msg_eph;
+  if (RC_OK == rtcm3_decode_bds_eph(msg, &msg_eph)) {
+    rtcm3_send_eph(&msg_eph, 1042, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_1045(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msg_eph msg_eph;
+  if (RC_OK == rtcm3_decode_gal_eph_fnav(msg, &msg_eph)) {
+    rtcm3_send_eph(&msg_eph, 1045, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_1046(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msg_eph msg_eph;
+  if (RC_OK == rtcm3_decode_gal_eph_inav(msg, &msg_eph)) {
+    rtcm3_send_eph(&msg_eph, 1046, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_ssr_orbit_clock(const uint8_t *msg,
+                                   struct rtcm3_sbp_state *state) {
+  rtcm_msg_orbit_clock msg_orbit_clock;
+  if (RC_OK == rtcm3_decode_orbit_clock(msg, &msg_orbit_clock)) {
+    rtcm3_ssr_orbit_clock_to_sbp(&msg_orbit_clock, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_ssr_code_bias(const uint8_t *msg,
+                                 struct rtcm3_sbp_state *state) {
+  rtcm_msg_code_bias msg_code_bias;
+  if (RC_OK == rtcm3_decode_code_bias(msg, &msg_code_bias)) {
+    rtcm3_ssr_code_bias_to_sbp(&msg_code_bias, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_ssr_phase_bias(const uint8_t *msg,
+                                  struct rtcm3_sbp_state *state) {
+  rtcm_msg_phase_bias msg_phase_bias;
+  if (RC_OK == rtcm3_decode_phase_bias(msg, &msg_phase_bias)) {
+    rtcm3_ssr_phase_bias_to_sbp(&msg_phase_bias, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_msm4(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msm_message new_rtcm_msm;
+  if (RC_OK ==
+      rtcm3_decode_msm4(msg, state->glo_sv_id_fcn_map, &new_rtcm_msm)) {
+    add_msm_obs_to_buffer(&new_rtcm_msm, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_msm5(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msm_message new_rtcm_msm;
+  if (RC_OK == rtcm3_decode_msm5(msg, &new_rtcm_msm)) {
+    add_msm_obs_to_buffer(&new_rtcm_msm, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_msm6(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msm_message new_rtcm_msm;
+  if (RC_OK ==
+      rtcm3_decode_msm6(msg, state->glo_sv_id_fcn_map, &new_rtcm_msm)) {
+    add_msm_obs_to_buffer(&new_rtcm_msm, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_msm7(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  rtcm_msm_message new_rtcm_msm;
+  if (RC_OK == rtcm3_decode_msm7(msg, &new_rtcm_msm)) {
+    add_msm_obs_to_buffer(&new_rtcm_msm, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+static void handle_msm1_3(const uint8_t *msg, struct rtcm3_sbp_state *state) {
+  if (NULL == state->orbit_store) {
+    /* MSM1-3 ranges cannot be completed without the satellite orbits, warn
+     * the user once - only once as these messages can be present in streams
+     * that contain MSM4-7 or 1004 and 1012 so are valid */
+    send_MSM_warning(msg, state);
+    return;
+  }
+  rtcm_msm_message new_rtcm_msm;
+  if (RC_OK ==
+      rtcm3_decode_msm1_3(msg, state->glo_sv_id_fcn_map, &new_rtcm_msm)) {
+    add_msm_obs_to_buffer(&new_rtcm_msm, state);
+  } else {
+    rtcm3_count_decode_error(msg, state);
+  }
+}
+
+#define RTCM3_MSG_INDEX(msg_type) ((msg_type)-RTCM3_MSG_TYPE_MIN)
+
+/* Default handlers of the supported message types. Types without a handler
+ * are ignored, this includes 1001/1003/1007/1008. */
+static const rtcm2sbp_msg_handler_t
+    default_msg_handlers[RTCM3_NUM_MSG_TYPES] = {
+        [RTCM3_MSG_INDEX(1002)] = handle_1002,
+        [RTCM3_MSG_INDEX(1004)] = handle_1004,
+        [RTCM3_MSG_INDEX(1005)] = handle_1005,
+        [RTCM3_MSG_INDEX(1006)] = handle_1006,
+        [RTCM3_MSG_INDEX(1010)] = handle_1010,
+        [RTCM3_MSG_INDEX(1012)] = handle_1012,
+        [RTCM3_MSG_INDEX(1019)] = handle_1019,
+        [RTCM3_MSG_INDEX(1020)] = handle_1020,
+        [RTCM3_MSG_INDEX(1029)] = handle_1029,
+        [RTCM3_MSG_INDEX(1033)] = handle_1033,
+        [RTCM3_MSG_INDEX(1042)] = handle_1042,
+        [RTCM3_MSG_INDEX(1045)] = handle_1045,
+        [RTCM3_MSG_INDEX(1046)] = handle_1046,
+        [RTCM3_MSG_INDEX(1059)] = handle_ssr_code_bias,
+        [RTCM3_MSG_INDEX(1060)] = handle_ssr_orbit_clock,
+        [RTCM3_MSG_INDEX(1065)] = handle_ssr_code_bias,
+        [RTCM3_MSG_INDEX(1066)] = handle_ssr_orbit_clock,
+        [RTCM3_MSG_INDEX(1230)] = handle_1230,
+        [RTCM3_MSG_INDEX(1071)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1072)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1073)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1074)] = handle_msm4,
+        [RTCM3_MSG_INDEX(1075)] = handle_msm5,
+        [RTCM3_MSG_INDEX(1076)] = handle_msm6,
+        [RTCM3_MSG_INDEX(1077)] = handle_msm7,
+        [RTCM3_MSG_INDEX(1081)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1082)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1083)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1084)] = handle_msm4,
+        [RTCM3_MSG_INDEX(1085)] = handle_msm5,
+        [RTCM3_MSG_INDEX(1086)] = handle_msm6,
+        [RTCM3_MSG_INDEX(1087)] = handle_msm7,
+        [RTCM3_MSG_INDEX(1091)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1092)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1093)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1094)] = handle_msm4,
+        [RTCM3_MSG_INDEX(1095)] = handle_msm5,
+        [RTCM3_MSG_INDEX(1096)] = handle_msm6,
+        [RTCM3_MSG_INDEX(1097)] = handle_msm7,
+        [RTCM3_MSG_INDEX(1101)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1102)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1103)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1104)] = handle_msm4,
+        [RTCM3_MSG_INDEX(1105)] = handle_msm5,
+        [RTCM3_MSG_INDEX(1106)] = handle_msm6,
+        [RTCM3_MSG_INDEX(1107)] = handle_msm7,
+        [RTCM3_MSG_INDEX(1111)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1112)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1113)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1114)] = handle_msm4,
+        [RTCM3_MSG_INDEX(1115)] = handle_msm5,
+        [RTCM3_MSG_INDEX(1116)] = handle_msm6,
+        [RTCM3_MSG_INDEX(1117)] = handle_msm7,
+        [RTCM3_MSG_INDEX(1121)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1122)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1123)] = handle_msm1_3,
+        [RTCM3_MSG_INDEX(1124)] = handle_msm4,
+        [RTCM3_MSG_INDEX(1125)] = handle_msm5,
+        [RTCM3_MSG_INDEX(1126)] = handle_msm6,
+        [RTCM3_MSG_INDEX(1127)] = handle_msm7,
+        [RTCM3_MSG_INDEX(1265)] = handle_ssr_phase_bias,
+        [RTCM3_MSG_INDEX(1266)] = handle_ssr_phase_bias,
+};
+
+static void init_msg_handlers(struct rtcm3_sbp_state *state) {
+  for (u16 i = 0; i < RTCM3_NUM_MSG_TYPES; i++) {
+    state->msg_handlers[i].handler = default_msg_handlers[i];
+    state->msg_handlers[i].enabled = true;
+  }
+}
+
+/** Replace the handler of an RTCM message type.
+ *
+ * The handler is called with the message following the frame header. A NULL
+ * handler makes the message type ignored, and the default handler of the
+ * type can be restored with rtcm2sbp_get_default_msg_handler.
+ *
+ * \param msg_type RTCM message number
+ * \param handler New handler for the message type
+ * \param state Converter state
+ * \return true if the message type is within the supported range
+ */
+bool rtcm2sbp_set_msg_handler(u16 msg_type,
+                              rtcm2sbp_msg_handler_t handler,
+                              struct rtcm3_sbp_state *state) {
+  if (msg_type < RTCM3_MSG_TYPE_MIN || msg_type > RTCM3_MSG_TYPE_MAX) {
+    return false;
+  }
+  state->msg_handlers[RTCM3_MSG_INDEX(msg_type)].handler = handler;
+  return true;
+}
+
+/** Get the handler the library provides for an RTCM message type.
+ *
+ * \param msg_type RTCM message number
+ * \return The default handler, or NULL if the type is not converted
+ */
+rtcm2sbp_msg_handler_t rtcm2sbp_get_default_msg_handler(u16 msg_type) {
+  if (msg_type < RTCM3_MSG_TYPE_MIN || msg_type > RTCM3_MSG_TYPE_MAX) {
+    return NULL;
+  }
+  return default_msg_handlers[RTCM3_MSG_INDEX(msg_type)];
+}
+
+/** Enable or disable the conversion of an RTCM message type.
+ *
+ * Frames of a disabled message type are dropped without being decoded, and
+ * are not counted in the statistics.
+ *
+ * \param msg_type RTCM message number
+ * \param enabled Whether the message type should be converted
+ * \param state Converter state
+ * \return true if the message type is within the supported range
+ */
+bool rtcm2sbp_set_msg_enabled(u16 msg_type,
+                              bool enabled,
+                              struct rtcm3_sbp_state *state) {
+  if (msg_type < RTCM3_MSG_TYPE_MIN || msg_type > RTCM3_MSG_TYPE_MAX) {
+    return false;
+  }
+  state->msg_handlers[RTCM3_MSG_INDEX(msg_type)].enabled = enabled;
+  return true;
+}
+
+/** Set the signals converted from the MSM messages of a constellation.
+ *
+ * Every signal with an SBP code is converted by default. The cells of the
+ * other signals are dropped and counted as RTCM2SBP_EVENT_UNSUPPORTED_SIGNAL.
+ * The mask is applied once per message when the signals of the message are
+ * resolved, so it costs nothing per cell.
+ *
+ * \param constellation librtcm constellation_t of the MSM messages
+ * \param code_mask Bit ((u64)1 << code) set for every SBP code to convert, or
+ *        RTCM3_ALL_CODES
+ * \param state Converter state
+ * \return false if the constellation is invalid
+ */
+bool rtcm2sbp_set_msm_code_mask(u8 constellation,
+                                u64 code_mask,
+                                struct rtcm3_sbp_state *state) {
+  if (constellation >= RTCM3_MSM_CONSTELLATIONS) {
+    return false;
+  }
+  state->msm_code_mask[constellation] = code_mask;
+  return true;
+}
+
+/* Convert the frame, returns its message number or 0 if it was not
+ * converted, which includes the frames of a disabled message type */
+static u16 decode_frame(const uint8_t *frame,
+                        uint32_t frame_length,
+                        struct rtcm3_sbp_state *state) {
+  if (!state->time_anchor.valid || frame_length < 1) {
+    return 0;
+  }
+
+  uint16_t byte = 1;
+  uint16_t message_size = ((frame[byte] & 0x3) << 8) | frame[byte + 1];
+
+  if (frame_length < message_size) {
+    return 0;
+  }
+
+  byte += 2;
+  uint16_t message_type = (frame[byte] << 4) | ((frame[byte + 1] >> 4) & 0xf);
+
+  bool handled = false;
+  if (message_type >= RTCM3_MSG_TYPE_MIN &&
+      message_type <= RTCM3_MSG_TYPE_MAX) {
+    const struct rtcm3_msg_handler *entry =
+        &state->msg_handlers[RTCM3_MSG_INDEX(message_type)];
+    if (!entry->enabled) {
+      return 0;
     }
-    case 1104:
-    case 1105:
-    case 1106:
-    case 1107:
-      /* SBAS messages suppressed for now */
-      break;
-    case 1114:
-    case 1115:
-    case 1116:
-    case 1117:
-      /* QZSS messages suppressed for now */
-      break;
-    case 1071:
-    case 1072:
-    case 1073:
-    case 1081:
-    case 1082:
-    case 1083:
-    case 1091:
-    case 1092:
-    case 1093:
-    case 1101:
-    case 1102:
-    case 1103:
-    case 1111:
-    case 1112:
-    case 1113:
-    case 1121:
-    case 1122:
-    case 1123: {
-      /* MSM1-3 messages (1xx3) are currently not supported, warn the user once
-       * if these messages are seen - only warn once as these messages can be
-       * present in streams that contain MSM4-7 or 1004 and 1012 so are valid */
-      send_MSM_warning(&frame[byte], state);
-      break;
+    if (NULL != entry->handler) {
+      entry->handler(&frame[byte], state);
+      handled = true;
     }
-    default:
-      break;
   }
 
   /* check if the message was the final MSM message in the epoch, and if so send
-   * out the SBP buffer */
-  if (message_type >= MSM_MSG_TYPE_MIN && message_type <= MSM_MSG_TYPE_MAX) {
+   * out the SBP buffer. A station the handler did not take in has nothing to
+   * send. */
+  if (handled && message_type >= MSM_MSG_TYPE_MIN &&
+      message_type <= MSM_MSG_TYPE_MAX) {
     /* The Multiple message bit DF393 is the same regardless of MSM msg type */
     if (getbitu(&frame[byte], MSM_MULTIPLE_BIT_OFFSET, 1) == 0) {
-      send_observations(state);
+      u16 stn_id = getbitu(&frame[byte], MSM_STATION_ID_BIT_OFFSET, 12);
+      struct rtcm3_station_state *station = rtcm3_find_station(stn_id, state);
+      if (NULL != station) {
+        send_observations(station, state);
+      }
+    }
+  }
+  return message_type;
+}
+
+void rtcm2sbp_decode_frame(const uint8_t *frame,
+                           uint32_t frame_length,
+                           struct rtcm3_sbp_state *state) {
+  /* route any log messages from librtcm to this state while decoding */
+  struct rtcm3_sbp_state *previous_state = decoding_state;
+  decoding_state = state;
+  u64 start_ns = rtcm3_monotonic_ns();
+  u16 message_type = decode_frame(frame, frame_length, state);
+  if (0 != message_type) {
+    u64 elapsed_ns = rtcm3_monotonic_ns() - start_ns;
+    rtcm3_record_frame(message_type,
+                       &frame[RTCM3_HEADER_SIZE],
+                       (elapsed_ns < UINT32_MAX) ? elapsed_ns : UINT32_MAX,
+                       state);
+  }
+  decoding_state = previous_state;
+}
+
+/* Whether a legacy observation message is newer than the last one of its
+ * constellation. A message at the same time is still taken while the epoch
+ * it belongs to is being collected, as the station may send the other
+ * signals of the epoch in MSM: the duplicated signals are filtered out as
+ * they are converted. */
+static bool legacy_obs_is_new(const rtcm_obs_message *new_rtcm_obs,
+                              const gps_time_sec_t *obs_time,
+                              const gps_time_sec_t *last_time,
+                              const struct rtcm3_station_state *station) {
+  if (!gps_time_valid(last_time)) {
+    return true;
+  }
+  s32 dt = gps_diff_time_sec(obs_time, last_time);
+  if (0 != dt) {
+    return dt > 0;
+  }
+  return station->epoch.n_obs != 0 && station->epoch.t.wn == obs_time->wn &&
+         station->epoch.t.tow == obs_time->tow * SECS_MS &&
+         station->sender_id ==
+             rtcm_2_sbp_sender_id(new_rtcm_obs->header.stn_id);
+}
+
+static u16 legacy_msg_bit(u16 msg_num) {
+  assert(msg_num >= 1001 && msg_num <= 1012);
+  return 1u << (msg_num - 1001);
+}
+
+/* Account for a legacy message dropped for arriving after its epoch was sent
+ * out, so that the learned message set of the station takes it in */
+static void note_late_legacy_msg(const rtcm_obs_message *new_rtcm_obs,
+                                 const gps_time_sec_t *obs_time,
+                                 struct rtcm3_station_state *station) {
+  if (station->epoch.t.wn == obs_time->wn &&
+      station->epoch.t.tow == obs_time->tow * SECS_MS &&
+      station->sender_id ==
+          rtcm_2_sbp_sender_id(new_rtcm_obs->header.stn_id)) {
+    station->epoch_msgs |= legacy_msg_bit(new_rtcm_obs->header.msg_num);
+    if (station->epoch_n_msgs < UINT8_MAX) {
+      station->epoch_n_msgs++;
     }
   }
 }
@@ -306,149 +914,226 @@ void rtcm2sbp_decode_frame(const uint8_t *frame,
 void add_glo_obs_to_buffer(const rtcm_obs_message *new_rtcm_obs,
                            struct rtcm3_sbp_state *state) {
   gps_time_sec_t obs_time;
-  compute_glo_time(new_rtcm_obs->header.tow_ms,
-                   &obs_time,
-                   &state->time_from_rover_obs,
-                   state);
+  compute_glo_time(new_rtcm_obs->header.tow_ms, &obs_time, state);
 
-  if (!gps_time_valid(&obs_time)) {
+  if (INVALID_TIME == obs_time.wn) {
     /* invalid GLO time */
     return;
   }
 
-  if (gps_time_valid(&state->last_msm_received) &&
-      gps_diff_time_sec(&obs_time, &state->last_msm_received) <
-          MSM_TIMEOUT_SEC) {
-    /* Stream potentially contains also MSM observations, so discard the legacy
-     * observation messages */
-    return;
-  }
+  struct rtcm3_station_state *station =
+      rtcm3_get_station(new_rtcm_obs->header.stn_id, state);
 
-  if (!gps_time_valid(&state->last_glo_time) ||
-      gps_diff_time_sec(&obs_time, &state->last_glo_time) > 0) {
-    state->last_glo_time = obs_time;
-    add_obs_to_buffer(new_rtcm_obs, &obs_time, state);
+  if (legacy_obs_is_new(new_rtcm_obs,
+                        &obs_time,
+                        &station->last_glo_time,
+                        station)) {
+    station->last_glo_time = obs_time;
+    add_obs_to_buffer(new_rtcm_obs, &obs_time, station, state);
+  } else {
+    note_late_legacy_msg(new_rtcm_obs, &obs_time, station);
+    rtcm3_count_event(RTCM2SBP_EVENT_LEGACY_MSG_DROPPED, station, state);
   }
 }
 
 void add_gps_obs_to_buffer(const rtcm_obs_message *new_rtcm_obs,
                            struct rtcm3_sbp_state *state) {
   gps_time_sec_t obs_time;
-  compute_gps_time(new_rtcm_obs->header.tow_ms,
-                   &obs_time,
-                   &state->time_from_rover_obs,
-                   state);
-  assert(gps_time_valid(&obs_time));
+  compute_gps_time(new_rtcm_obs->header.tow_ms, &obs_time, state);
+  if (INVALID_TIME == obs_time.wn) {
+    return;
+  }
 
-  if (gps_time_valid(&state->last_msm_received) &&
-      gps_diff_time_sec(&obs_time, &state->last_msm_received) <
-          MSM_TIMEOUT_SEC) {
-    /* Stream potentially contains also MSM observations, so discard the legacy
-     * observation messages */
+  struct rtcm3_station_state *station =
+      rtcm3_get_station(new_rtcm_obs->header.stn_id, state);
+
+  if (legacy_obs_is_new(new_rtcm_obs,
+                        &obs_time,
+                        &station->last_gps_time,
+                        station)) {
+    station->last_gps_time = obs_time;
+    add_obs_to_buffer(new_rtcm_obs, &obs_time, station, state);
+  } else {
+    note_late_legacy_msg(new_rtcm_obs, &obs_time, station);
+    rtcm3_count_event(RTCM2SBP_EVENT_LEGACY_MSG_DROPPED, station, state);
+  }
+}
+
+/* Update the learned message set of the station with the epoch that ended */
+static void learn_epoch_msgs(struct rtcm3_station_state *station) {
+  if (0 == station->epoch_msgs) {
     return;
   }
+  if (station->epoch_msgs == station->expected_msgs &&
+      station->epoch_n_msgs == station->expected_n_msgs) {
+    if (station->expected_msgs_count < EPOCH_LEARN_COUNT) {
+      station->expected_msgs_count++;
+    }
+  } else {
+    station->expected_msgs = station->epoch_msgs;
+    station->expected_n_msgs = station->epoch_n_msgs;
+    station->expected_msgs_count = 1;
+  }
+  station->epoch_msgs = 0;
+  station->epoch_n_msgs = 0;
+}
 
-  if (!gps_time_valid(&state->last_gps_time) ||
-      gps_diff_time_sec(&obs_time, &state->last_gps_time) > 0) {
-    state->last_gps_time = obs_time;
-    add_obs_to_buffer(new_rtcm_obs, &obs_time, state);
+/* Whether the buffered epoch has all the messages the station has sent in
+ * its recent epochs. A message arriving after the epoch was sent out anyway
+ * changes the learned set, so early sending stops until it is learned
+ * again. The set only covers the legacy messages, so a station that also
+ * sends MSM ends its epochs with the MSM multiple message bit instead. */
+static bool epoch_complete(const struct rtcm3_station_state *station,
+                           const gps_time_sec_t *obs_time) {
+  if (gps_time_valid(&station->last_msm_received) &&
+      gps_diff_time_sec(obs_time, &station->last_msm_received) <
+          MSM_TIMEOUT_SEC) {
+    return false;
   }
+  return station->epoch.n_obs != 0 &&
+         station->expected_msgs_count >= EPOCH_LEARN_COUNT &&
+         station->epoch_msgs == station->expected_msgs &&
+         station->epoch_n_msgs >= station->expected_n_msgs;
 }
 
 void add_obs_to_buffer(const rtcm_obs_message *new_rtcm_obs,
                        gps_time_sec_t *obs_time,
+                       struct rtcm3_station_state *station,
                        struct rtcm3_sbp_state *state) {
-  /* Transform the newly received obs to sbp */
-  u8 new_obs[OBS_BUFFER_SIZE];
-  memset(new_obs, 0, OBS_BUFFER_SIZE);
-  msg_obs_t *new_sbp_obs = (msg_obs_t *)(new_obs);
-
-  /* Find the buffer of obs to be sent */
-  msg_obs_t *sbp_obs_buffer = (msg_obs_t *)state->obs_buffer;
-
   /* Build an SBP time stamp */
-  new_sbp_obs->header.t.wn = obs_time->wn;
-  new_sbp_obs->header.t.tow = obs_time->tow * S_TO_MS;
-  new_sbp_obs->header.t.ns_residual = 0;
+  sbp_gps_time_t sbp_time;
+  sbp_time.wn = obs_time->wn;
+  sbp_time.tow = obs_time->tow * S_TO_MS;
+  sbp_time.ns_residual = 0;
 
-  rtcm3_to_sbp(new_rtcm_obs, new_sbp_obs, state);
+  u16 sender_id = rtcm_2_sbp_sender_id(new_rtcm_obs->header.stn_id);
+  bool new_epoch = (station->epoch.t.tow != sbp_time.tow ||
+                    station->epoch.t.wn != sbp_time.wn ||
+                    station->sender_id != sender_id);
 
   /* Check if the buffer already has obs of the same time */
-  if (sbp_obs_buffer->header.n_obs != 0 &&
-      (sbp_obs_buffer->header.t.tow != new_sbp_obs->header.t.tow ||
-       state->sender_id != rtcm_2_sbp_sender_id(new_rtcm_obs->header.stn_id))) {
+  if (station->epoch.n_obs != 0 && new_epoch) {
     /* We either have missed a message, or we have a new station. Either way,
      send through the current buffer and clear before adding new obs */
-    send_observations(state);
+    send_observations(station, state);
+  }
+  if (new_epoch) {
+    learn_epoch_msgs(station);
   }
 
-  /* Copy new obs into buffer */
-  u8 obs_index_buffer = sbp_obs_buffer->header.n_obs;
-  state->sender_id = rtcm_2_sbp_sender_id(new_rtcm_obs->header.stn_id);
-  for (u8 obs_count = 0; obs_count < new_sbp_obs->header.n_obs; obs_count++) {
-    if (obs_index_buffer >= MAX_OBS_PER_EPOCH) {
-      send_buffer_full_error(state);
-      break;
-    }
-
-    sbp_obs_buffer->obs[obs_index_buffer] = new_sbp_obs->obs[obs_count];
-    obs_index_buffer++;
+  station->sender_id = sender_id;
+  station->epoch.t = sbp_time;
+  station->epoch_msgs |= legacy_msg_bit(new_rtcm_obs->header.msg_num);
+  if (station->epoch_n_msgs < UINT8_MAX) {
+    station->epoch_n_msgs++;
   }
-  sbp_obs_buffer->header.n_obs = obs_index_buffer;
-  sbp_obs_buffer->header.t = new_sbp_obs->header.t;
 
-  /* If we aren't expecting another message, send the buffer */
-  if (0 == new_rtcm_obs->header.sync) {
-    send_observations(state);
+  /* Transform the newly received obs to sbp directly into the epoch */
+  rtcm3_to_sbp(new_rtcm_obs, station, state);
+
+  /* If we aren't expecting another message, or all the messages the station
+   * usually sends are in, send the buffer */
+  if (0 == new_rtcm_obs->header.sync || epoch_complete(station, obs_time)) {
+    send_observations(station, state);
   }
 }
 
 /**
- * Split the observation buffer into SBP messages and send them
+ * Send out the epoch of the station, or hand it to the epoch merger
  */
-void send_observations(struct rtcm3_sbp_state *state) {
-  const msg_obs_t *sbp_obs_buffer = (msg_obs_t *)state->obs_buffer;
+void send_observations(struct rtcm3_station_state *station,
+                       struct rtcm3_sbp_state *state) {
+  const u8 n_obs = station->epoch.n_obs;
 
-  if (sbp_obs_buffer->header.n_obs == 0) {
+  if (n_obs == 0) {
     return;
   }
 
-  /* We want the ceiling of n_obs divided by max obs in a single message to get
-   * total number of messages needed */
-  const u8 total_messages =
-      1 + ((sbp_obs_buffer->header.n_obs - 1) / MAX_OBS_IN_SBP);
-
-  assert(sbp_obs_buffer->header.n_obs <= MAX_OBS_PER_EPOCH);
-  assert(total_messages <= SBP_MAX_OBS_SEQ);
-
-  /* Write the SBP observation messages */
-  u8 buffer_obs_index = 0;
-  for (u8 msg_num = 0; msg_num < total_messages; ++msg_num) {
-    u8 obs_data[SBP_FRAMING_MAX_PAYLOAD_SIZE];
-    memset(obs_data, 0, SBP_FRAMING_MAX_PAYLOAD_SIZE);
-    msg_obs_t *sbp_obs = (msg_obs_t *)obs_data;
-
-    /* Write the header */
-    sbp_obs->header.t = sbp_obs_buffer->header.t;
-    /* Note: SBP n_obs puts total messages in the first nibble and msg_num in
-     * the second. This differs from all the other instances of n_obs in this
-     * module where it is used as observation count. */
-    sbp_obs->header.n_obs = (total_messages << 4) + msg_num;
-
-    /* Write the observations */
-    u8 obs_index = 0;
-    while (obs_index < MAX_OBS_IN_SBP &&
-           buffer_obs_index < sbp_obs_buffer->header.n_obs) {
-      sbp_obs->obs[obs_index++] = sbp_obs_buffer->obs[buffer_obs_index++];
-    }
+  if (NULL != state->merger.slots) {
+    rtcm3_merger_add(station, state);
+  } else {
+    rtcm3_send_obs_epoch(&station->epoch, station->sender_id, state);
+  }
+  /* clear the epoch, the stale contents are overwritten as new obs come in */
+  station->epoch.n_obs = 0;
 
-    u16 len = SBP_HDR_SIZE + obs_index * SBP_OBS_SIZE;
-    assert(len <= SBP_FRAMING_MAX_PAYLOAD_SIZE);
+  /* the epoch is complete, send out everything converted so far */
+  rtcm2sbp_flush_batch(state);
+}
+
+/* Round to the nearest integer, halfway cases away from zero. Matches
+ * roundl() without the long double path as long as the value fits in an
+ * s64, which the observation ranges do: the truncation is then an integer
+ * multiple of the unit in the last place of the value, so the fraction left
+ * by subtracting it is below one and exactly representable. */
+static s64 round_half_away(double value) {
+  s64 whole = (s64)value;
+  double frac = value - (double)whole;
+  if (frac >= 0.5) {
+    whole++;
+  } else if (frac <= -0.5) {
+    whole--;
+  }
+  return whole;
+}
 
-    state->cb_rtcm_to_sbp(SBP_MSG_OBS, len, obs_data, state->sender_id);
+/* Split a value into whole units and the nearest 1/256th fraction. The
+ * fraction is taken against the floor of the value the same way as the
+ * original floor() and roundl() code, so that the rounding of the
+ * subtraction for negative values is reproduced bit for bit */
+static s64 round_to_q8(double value) {
+  s64 whole = (s64)value;
+  if ((double)whole > value) {
+    /* truncation rounded a negative value up, correct to the floor */
+    whole--;
   }
-  /* clear the observation buffer, so also header.n_obs is set to zero */
-  memset(state->obs_buffer, 0, OBS_BUFFER_SIZE);
+  /* frac is in [0, 1] and its scaling by 256 is exact */
+  double frac = (value - (double)whole) * 256.0;
+  s64 fixed = (s64)frac;
+  if (frac - (double)fixed >= 0.5) {
+    fixed++;
+  }
+  return whole * 256 + fixed;
+}
+
+/** Pack a pseudorange into the SBP observation format.
+ *
+ * \param pseudorange_m Pseudorange [m]
+ * \return Pseudorange [2 cm]
+ */
+u32 pack_pseudorange(double pseudorange_m) {
+  return (u32)round_half_away(pseudorange_m * MSG_OBS_P_MULTIPLIER);
+}
+
+/** Pack a carrier phase into the SBP observation format.
+ *
+ * \param carrier_phase_cyc Carrier phase [cycles]
+ * \param L Packed carrier phase, whole cycles and 1/256th fraction
+ */
+void pack_carrier_phase(double carrier_phase_cyc, carrier_phase_t *L) {
+  s64 fixed = round_to_q8(carrier_phase_cyc);
+  L->i = (s32)((fixed - (fixed & 0xff)) / 256);
+  L->f = (u8)(fixed & 0xff);
+}
+
+/** Pack a Doppler into the SBP observation format.
+ *
+ * \param doppler_Hz Doppler [Hz]
+ * \param D Packed Doppler, whole Hz and 1/256th fraction
+ */
+void pack_doppler(double doppler_Hz, doppler_t *D) {
+  s64 fixed = round_to_q8(doppler_Hz);
+  D->i = (s16)((fixed - (fixed & 0xff)) / 256);
+  D->f = (u8)(fixed & 0xff);
+}
+
+/** Pack a carrier to noise ratio into the SBP observation format.
+ *
+ * \param cnr_dbhz Carrier to noise ratio [dB-Hz]
+ * \return Carrier to noise ratio [0.25 dB-Hz]
+ */
+u8 pack_cn0(double cnr_dbhz) {
+  return (u8)round_half_away(cnr_dbhz * MSG_OBS_CN0_MULTIPLIER);
 }
 
 /** Convert navigation_measurement_t.lock_time into SBP lock time.
@@ -570,53 +1255,148 @@ code_t get_glo_sbp_code(u8 freq, u8 rtcm_code, struct rtcm3_sbp_state *state) {
   return code;
 }
 
+/* Rank of the observations of a message, higher for more precise or more
+ * complete observations. A signal found in several messages of an epoch is
+ * kept from the highest ranked one. */
+static u8 obs_precision(u16 msg_num) {
+  switch (msg_num) {
+    case 1001:
+    case 1003:
+    case 1009:
+    case 1011:
+      /* no carrier to noise ratio */
+      return 1;
+    case 1002:
+    case 1004:
+    case 1010:
+    case 1012:
+      return 2;
+    default:
+      break;
+  }
+  msm_enum msm_type = to_msm_type(msg_num);
+  switch (msm_type) {
+    case MSM4:
+      return 3;
+    case MSM5:
+      /* adds the Doppler */
+      return 4;
+    case MSM6:
+      /* extended resolution */
+      return 5;
+    case MSM7:
+      return 6;
+    case MSM1:
+    case MSM2:
+    case MSM3:
+    case MSM_UNKNOWN:
+    default:
+      return 0;
+  }
+}
+
+typedef enum {
+  OBS_SLOT_NEW,
+  OBS_SLOT_REPLACE,
+  OBS_SLOT_DUPLICATE,
+  OBS_SLOT_FULL
+} obs_slot_t;
+
+_Static_assert(CODE_COUNT <= RTCM3_SIGNAL_CODES,
+               "RTCM3_SIGNAL_CODES does not cover every SBP code");
+
+/* Find where an observation of the signal goes in the epoch of the station.
+ * A new signal is appended, a signal already in the epoch is only replaced
+ * when the message is ranked higher than the one it came from. */
+static obs_slot_t epoch_obs_slot(const sbp_gnss_signal_t *sid,
+                                 u8 precision,
+                                 struct rtcm3_station_state *station,
+                                 u8 *index) {
+  struct rtcm3_obs_epoch *epoch = &station->epoch;
+  assert(sid->code < RTCM3_SIGNAL_CODES);
+  if (0 == epoch->n_obs) {
+    memset(station->epoch_signals, 0, sizeof(station->epoch_signals));
+  }
+
+  const u8 sat = sid->sat % RTCM3_SIGNAL_SATS;
+  const u64 sat_bit = (u64)1 << sat;
+  if (0 != (station->epoch_signals[sid->code] & sat_bit)) {
+    *index = station->signal_obs[sid->code][sat];
+    assert(*index < epoch->n_obs);
+    if (precision <= station->obs_precision[*index]) {
+      return OBS_SLOT_DUPLICATE;
+    }
+    station->obs_precision[*index] = precision;
+    return OBS_SLOT_REPLACE;
+  }
+
+  if (epoch->n_obs >= MAX_OBS_PER_EPOCH) {
+    return OBS_SLOT_FULL;
+  }
+  *index = epoch->n_obs++;
+  station->epoch_signals[sid->code] |= sat_bit;
+  station->signal_obs[sid->code][sat] = *index;
+  station->obs_precision[*index] = precision;
+  epoch->sid[*index] = *sid;
+  return OBS_SLOT_NEW;
+}
+
+/* Find the slot of an observation, counting the duplicates and a full
+ * epoch */
+static obs_slot_t claim_obs_slot(const sbp_gnss_signal_t *sid,
+                                 u8 precision,
+                                 struct rtcm3_station_state *station,
+                                 u8 *index,
+                                 struct rtcm3_sbp_state *state) {
+  obs_slot_t slot = epoch_obs_slot(sid, precision, station, index);
+  switch (slot) {
+    case OBS_SLOT_REPLACE:
+    case OBS_SLOT_DUPLICATE:
+      rtcm3_count_event(RTCM2SBP_EVENT_DUPLICATE_SIGNAL, station, state);
+      break;
+    case OBS_SLOT_FULL:
+      send_buffer_full_error(state);
+      rtcm3_count_event(RTCM2SBP_EVENT_BUFFER_FULL, station, state);
+      break;
+    case OBS_SLOT_NEW:
+    default:
+      break;
+  }
+  return slot;
+}
+
 void rtcm3_to_sbp(const rtcm_obs_message *rtcm_obs,
-                  msg_obs_t *new_sbp_obs,
+                  struct rtcm3_station_state *station,
                   struct rtcm3_sbp_state *state) {
+  const u8 precision = obs_precision(rtcm_obs->header.msg_num);
   for (u8 sat = 0; sat < rtcm_obs->header.n_sat; ++sat) {
     for (u8 freq = 0; freq < NUM_FREQS; ++freq) {
       const rtcm_freq_data *rtcm_freq = &rtcm_obs->sats[sat].obs[freq];
       if (rtcm_freq->flags.valid_pr == 1 && rtcm_freq->flags.valid_cp == 1) {
-        if (new_sbp_obs->header.n_obs >= MAX_OBS_PER_EPOCH) {
-          send_buffer_full_error(state);
-          return;
-        }
-
-        packed_obs_content_t *sbp_freq =
-            &new_sbp_obs->obs[new_sbp_obs->header.n_obs];
-        sbp_freq->flags = 0;
-        sbp_freq->P = 0.0;
-        sbp_freq->L.i = 0;
-        sbp_freq->L.f = 0.0;
-        sbp_freq->D.i = 0;
-        sbp_freq->D.f = 0.0;
-        sbp_freq->cn0 = 0.0;
-        sbp_freq->lock = 0.0;
-
-        sbp_freq->sid.sat = rtcm_obs->sats[sat].svId;
+        sbp_gnss_signal_t sid;
+        sid.sat = rtcm_obs->sats[sat].svId;
         if (gps_obs_message(rtcm_obs->header.msg_num)) {
-          if (sbp_freq->sid.sat >= 1 && sbp_freq->sid.sat <= 32) {
+          if (sid.sat >= 1 && sid.sat <= 32) {
             /* GPS PRN, see DF009 */
-            sbp_freq->sid.code =
+            sid.code =
                 get_gps_sbp_code(freq, rtcm_obs->sats[sat].obs[freq].code);
-          } else if (sbp_freq->sid.sat >= 40 && sbp_freq->sid.sat <= 58 &&
-                     freq == 0) {
+          } else if (sid.sat >= 40 && sid.sat <= 58 && freq == 0) {
             /* SBAS L1 PRN */
-            sbp_freq->sid.code = CODE_SBAS_L1CA;
-            sbp_freq->sid.sat += 80;
+            sid.code = CODE_SBAS_L1CA;
+            sid.sat += 80;
           } else {
             /* invalid PRN or code */
             continue;
           }
         } else if (glo_obs_message(rtcm_obs->header.msg_num)) {
-          if (sbp_freq->sid.sat >= 1 && sbp_freq->sid.sat <= 24) {
+          if (sid.sat >= 1 && sid.sat <= 24) {
             /* GLO PRN, see DF038 */
             code_t glo_sbp_code = get_glo_sbp_code(
                 freq, rtcm_obs->sats[sat].obs[freq].code, state);
             if (glo_sbp_code == CODE_INVALID) {
               continue;
             } else {
-              sbp_freq->sid.code = glo_sbp_code;
+              sid.code = glo_sbp_code;
             }
           } else {
             /* invalid PRN or slot number uknown*/
@@ -624,36 +1404,44 @@ void rtcm3_to_sbp(const rtcm_obs_message *rtcm_obs,
           }
         }
 
+        u8 i;
+        obs_slot_t slot = claim_obs_slot(&sid, precision, station, &i, state);
+        if (OBS_SLOT_FULL == slot) {
+          return;
+        }
+        if (OBS_SLOT_DUPLICATE == slot) {
+          continue;
+        }
+        struct rtcm3_obs_epoch *epoch = &station->epoch;
+        epoch->flags[i] = 0;
+        epoch->P[i] = 0;
+        epoch->L_i[i] = 0;
+        epoch->L_f[i] = 0;
+        epoch->D_i[i] = 0;
+        epoch->D_f[i] = 0;
+        epoch->cn0[i] = 0;
+        epoch->lock[i] = 0;
+
         if (rtcm_freq->flags.valid_pr == 1) {
-          sbp_freq->P =
-              (u32)roundl(rtcm_freq->pseudorange * MSG_OBS_P_MULTIPLIER);
-          sbp_freq->flags |= MSG_OBS_FLAGS_CODE_VALID;
+          epoch->P[i] = pack_pseudorange(rtcm_freq->pseudorange);
+          epoch->flags[i] |= MSG_OBS_FLAGS_CODE_VALID;
         }
         if (rtcm_freq->flags.valid_cp == 1) {
-          sbp_freq->L.i = (s32)floor(rtcm_freq->carrier_phase);
-          u16 frac_part =
-              (u16)roundl((rtcm_freq->carrier_phase - (double)sbp_freq->L.i) *
-                          MSG_OBS_LF_MULTIPLIER);
-          if (frac_part == 256) {
-            frac_part = 0;
-            sbp_freq->L.i += 1;
-          }
-          sbp_freq->L.f = (u8)frac_part;
-          sbp_freq->flags |= MSG_OBS_FLAGS_PHASE_VALID;
-          sbp_freq->flags |= MSG_OBS_FLAGS_HALF_CYCLE_KNOWN;
+          carrier_phase_t L;
+          pack_carrier_phase(rtcm_freq->carrier_phase, &L);
+          epoch->L_i[i] = L.i;
+          epoch->L_f[i] = L.f;
+          epoch->flags[i] |= MSG_OBS_FLAGS_PHASE_VALID;
+          epoch->flags[i] |= MSG_OBS_FLAGS_HALF_CYCLE_KNOWN;
         }
 
         if (rtcm_freq->flags.valid_cnr == 1) {
-          sbp_freq->cn0 = (u8)roundl(rtcm_freq->cnr * MSG_OBS_CN0_MULTIPLIER);
-        } else {
-          sbp_freq->cn0 = 0;
+          epoch->cn0[i] = pack_cn0(rtcm_freq->cnr);
         }
 
         if (rtcm_freq->flags.valid_lock == 1) {
-          sbp_freq->lock = encode_lock_time(rtcm_freq->lock);
+          epoch->lock[i] = encode_lock_time(rtcm_freq->lock);
         }
-
-        new_sbp_obs->header.n_obs++;
       }
     }
   }
@@ -688,136 +1476,117 @@ void sbp_to_rtcm3_1006(const msg_base_pos_ecef_t *sbp_base_pos,
   rtcm_1006->ant_height = 0.0;
 }
 
+/* Build the descriptor matcher over the caller provided entries followed by
+ * the built in ones, earlier entries take priority */
+static bool build_glo_bias_matcher(
+    const struct rtcm2sbp_glo_bias_entry *entries,
+    u8 n_entries,
+    struct rtcm3_glo_bias_matcher *matcher) {
+  u8 n_default = sizeof(default_glo_biases) / sizeof(default_glo_biases[0]);
+  if ((u16)n_entries + n_default > RTCM3_MAX_GLO_BIAS_ENTRIES) {
+    return false;
+  }
+
+  matcher->n_entries = 0;
+  for (u8 i = 0; i < n_entries; i++) {
+    matcher->entries[matcher->n_entries++] = &entries[i];
+  }
+  for (u8 i = 0; i < n_default; i++) {
+    matcher->entries[matcher->n_entries++] = &default_glo_biases[i];
+  }
+
+  memset(matcher->first, RTCM3_GLO_BIAS_NONE, sizeof(matcher->first));
+  /* link the chains back to front so that they stay in priority order */
+  for (u8 i = matcher->n_entries; i-- > 0;) {
+    const char *pattern = matcher->entries[i]->pattern;
+    assert(NULL != pattern);
+    size_t len = strnlen(pattern, RTCM_MAX_STRING_LEN);
+    matcher->pattern_len[i] = (u8)len;
+    matcher->next[i] = RTCM3_GLO_BIAS_NONE;
+    if (len == 0 || len >= RTCM_MAX_STRING_LEN) {
+      /* can never match a descriptor */
+      continue;
+    }
+    u8 c = (u8)pattern[0];
+    matcher->next[i] = matcher->first[c];
+    matcher->first[c] = i;
+  }
+  return true;
+}
+
+/** Use additional receiver bias entries for the 1033 message.
+ *
+ * The entries are matched against the receiver descriptor before the built
+ * in ones, so they can also override them. The first entry whose pattern is
+ * found anywhere in the descriptor is used.
+ *
+ * \param entries Caller owned entries, must stay valid while in use
+ * \param n_entries Number of entries, 0 to go back to the built in ones
+ * \param state Converter state
+ * \return false if there are too many entries, the table is then unchanged
+ */
+bool rtcm2sbp_set_glo_bias_table(const struct rtcm2sbp_glo_bias_entry *entries,
+                                 u8 n_entries,
+                                 struct rtcm3_sbp_state *state) {
+  if (!build_glo_bias_matcher(entries, n_entries, &state->glo_bias_matcher)) {
+    return false;
+  }
+  /* the cached matches may refer to the old table */
+  state->station.glo_bias_cached = false;
+  for (u8 i = 0; i < state->max_stations; i++) {
+    state->stations[i].glo_bias_cached = false;
+  }
+  return true;
+}
+
+/* Find the highest priority entry whose pattern occurs in the descriptor */
+u8 rtcm3_match_glo_bias(const char *descriptor,
+                        u8 descriptor_len,
+                        const struct rtcm3_glo_bias_matcher *matcher) {
+  u8 best = RTCM3_GLO_BIAS_NONE;
+  for (u8 pos = 0; pos < descriptor_len; pos++) {
+    u8 remaining = descriptor_len - pos;
+    for (u8 i = matcher->first[(u8)descriptor[pos]];
+         i < best && i != RTCM3_GLO_BIAS_NONE;
+         i = matcher->next[i]) {
+      if (matcher->pattern_len[i] <= remaining &&
+          memcmp(&descriptor[pos],
+                 matcher->entries[i]->pattern,
+                 matcher->pattern_len[i]) == 0) {
+        best = i;
+        break;
+      }
+    }
+  }
+  return best;
+}
+
 void rtcm3_1033_to_sbp(const rtcm_msg_1033 *rtcm_1033,
-                       msg_glo_biases_t *sbp_glo_bias) {
-  sbp_glo_bias->mask = 0;
-  /* Resolution 2cm */
-  /* GEO++ RCV NAMES MUST COME FIRST TO AVOID FALSE POSITIVE */
-  if (strstr(rtcm_1033->rcv_descriptor, "Geo++ GNSMART (GLO=ASH)") != NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(GPP_ASH1_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(GPP_ASH1_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "Geo++ GNSMART (GLO=HEM)") !=
-             NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(GPP_HEM_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(GPP_HEM_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "Geo++ GNSMART (GLO=JAV)") !=
-             NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(GPP_JAV_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(GPP_JAV_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "Geo++ GNSMART (GLO=JPS)") !=
-             NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(GPP_JPS_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(GPP_JPS_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "Geo++ GNSMART (GLO=LEI)") !=
-                 NULL ||
-             strstr(rtcm_1033->rcv_descriptor, "Geo++ GNSMART (GLO=NOV)") !=
-                 NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(GPP_NOV_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(GPP_NOV_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "Geo++ GNSMART (GLO=NAV)") !=
-             NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(GPP_NAV_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(GPP_NAV_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "Geo++ GNSMART (GLO=NVR)") !=
-             NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(GPP_NVR_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(GPP_NVR_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "Geo++ GNSMART (GLO=SEP)") !=
-             NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(GPP_SEP_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(GPP_SEP_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "Geo++ GNSMART (GLO=SOK)") !=
-             NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(GPP_SOK_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(GPP_SOK_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "Geo++ GNSMART (GLO=TPS)") !=
-             NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(GPP_TPS_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(GPP_TPS_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "Geo++ GNSMART (GLO=TRM)") !=
-             NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(GPP_TRM_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(GPP_TRM_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "TRIMBLE") != NULL ||
-             strstr(rtcm_1033->rcv_descriptor, "ASHTECH") != NULL) {
-    sbp_glo_bias->mask = 0xF;
-    sbp_glo_bias->l1ca_bias = round(TRIMBLE_BIAS_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = round(TRIMBLE_BIAS_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l2ca_bias = round(TRIMBLE_BIAS_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l2p_bias = round(TRIMBLE_BIAS_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "LEICA") != NULL ||
-             strstr(rtcm_1033->rcv_descriptor, "NOV") != NULL ||
-             strstr(rtcm_1033->rcv_descriptor, "GEOMAX") != NULL) {
-    sbp_glo_bias->mask = 0xF;
-    sbp_glo_bias->l1ca_bias = round(NOVATEL_BIAS_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = round(NOVATEL_BIAS_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l2ca_bias = round(NOVATEL_BIAS_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l2p_bias = round(NOVATEL_BIAS_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "SEPT") != NULL) {
-    sbp_glo_bias->mask = 0xF;
-    sbp_glo_bias->l1ca_bias = round(SEPTENTRIO_BIAS_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = round(SEPTENTRIO_BIAS_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l2ca_bias = round(SEPTENTRIO_BIAS_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l2p_bias = round(SEPTENTRIO_BIAS_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "TPS") != NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(TOPCON_BIAS_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = round(TOPCON_BIAS_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l2ca_bias = round(TOPCON_BIAS_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l2p_bias = round(TOPCON_BIAS_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "JAVAD") != NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(JAVAD_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(JAVAD_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "NAVCOM") != NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias = round(NAVCOM_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(NAVCOM_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
-  } else if (strstr(rtcm_1033->rcv_descriptor, "HEMI") != NULL) {
-    sbp_glo_bias->mask = 0x9;
-    sbp_glo_bias->l1ca_bias =
-        round(HEMISPHERE_BIAS_L1CA_M * GLO_BIAS_RESOLUTION);
-    sbp_glo_bias->l1p_bias = 0.0;
-    sbp_glo_bias->l2ca_bias = 0.0;
-    sbp_glo_bias->l2p_bias = round(HEMISPHERE_BIAS_L2P_M * GLO_BIAS_RESOLUTION);
+                       struct rtcm3_station_state *station,
+                       msg_glo_biases_t *sbp_glo_bias,
+                       const struct rtcm3_sbp_state *state) {
+  u8 len = (u8)strnlen(rtcm_1033->rcv_descriptor, RTCM_MAX_STRING_LEN);
+  if (!station->glo_bias_cached || station->rcv_descriptor_len != len ||
+      memcmp(station->rcv_descriptor, rtcm_1033->rcv_descriptor, len) != 0) {
+    station->glo_bias_index = rtcm3_match_glo_bias(
+        rtcm_1033->rcv_descriptor, len, &state->glo_bias_matcher);
+    memcpy(station->rcv_descriptor, rtcm_1033->rcv_descriptor, len);
+    station->rcv_descriptor_len = len;
+    station->glo_bias_cached = true;
   }
+
+  if (RTCM3_GLO_BIAS_NONE == station->glo_bias_index) {
+    memset(sbp_glo_bias, 0, sizeof(*sbp_glo_bias));
+    return;
+  }
+  const struct rtcm2sbp_glo_bias_entry *entry =
+      state->glo_bias_matcher.entries[station->glo_bias_index];
+  /* Resolution 2cm */
+  sbp_glo_bias->mask = entry->mask;
+  sbp_glo_bias->l1ca_bias = round(entry->l1ca_bias_m * GLO_BIAS_RESOLUTION);
+  sbp_glo_bias->l1p_bias = round(entry->l1p_bias_m * GLO_BIAS_RESOLUTION);
+  sbp_glo_bias->l2ca_bias = round(entry->l2ca_bias_m * GLO_BIAS_RESOLUTION);
+  sbp_glo_bias->l2p_bias = round(entry->l2p_bias_m * GLO_BIAS_RESOLUTION);
 }
 
 void rtcm3_1230_to_sbp(const rtcm_msg_1230 *rtcm_1230,
@@ -845,16 +1614,95 @@ void sbp_to_rtcm3_1230(const msg_glo_biases_t *sbp_glo_bias,
   rtcm_1230->L2_P_cpb_meter = sbp_glo_bias->l2p_bias / GLO_BIAS_RESOLUTION;
 }
 
+/* Send out the buffered epoch of the station if it is older than the
+ * deadline */
+static void flush_expired_epoch(struct rtcm3_station_state *station,
+                                struct rtcm3_sbp_state *state) {
+  if (0 == station->epoch.n_obs) {
+    return;
+  }
+  s64 age_ms = ((s64)state->time_from_rover_obs.wn - station->epoch.t.wn) *
+                   SEC_IN_WEEK * SECS_MS +
+               (s64)state->time_from_rover_obs.tow * SECS_MS -
+               station->epoch.t.tow;
+  if (age_ms >= state->epoch_deadline_ms) {
+    rtcm3_count_event(RTCM2SBP_EVENT_EPOCH_DEADLINE, station, state);
+    send_observations(station, state);
+  }
+}
+
+/* Bring the anchor to the rover time and the leap seconds. The rover time
+ * mostly moves forward within its day, so the day is only looked up again
+ * once it leaves it. */
+static void update_time_anchor(struct rtcm3_sbp_state *state) {
+  struct rtcm3_time_anchor *anchor = &state->time_anchor;
+  const gps_time_sec_t *rover_time = &state->time_from_rover_obs;
+  s32 tow = (s32)rover_time->tow;
+  if (!anchor->valid || anchor->wn != rover_time->wn ||
+      tow < anchor->day_start || tow >= anchor->day_start + SEC_IN_DAY) {
+    anchor->day_start = tow / SEC_IN_DAY * SEC_IN_DAY;
+  }
+  anchor->wn = rover_time->wn;
+  anchor->tow = tow;
+  anchor->glo_day_start =
+      anchor->day_start - UTC_SU_OFFSET * SEC_IN_HOUR + state->leap_seconds;
+  anchor->valid = true;
+}
+
+/** Set the rover time, used to resolve the ambiguities of the RTCM times.
+ *
+ * With an epoch deadline or an epoch merger set, this also sends out the
+ * buffered epochs that are older than the deadline.
+ *
+ * \param current_time Current GPS time
+ * \param state Converter state
+ */
 void rtcm2sbp_set_gps_time(const gps_time_sec_t *current_time,
                            struct rtcm3_sbp_state *state) {
-  if (gps_time_valid(current_time)) {
-    state->time_from_rover_obs = *current_time;
+  if (!gps_time_valid(current_time)) {
+    return;
+  }
+  state->time_from_rover_obs = *current_time;
+  update_time_anchor(state);
+
+  if (NULL != state->merger.slots) {
+    rtcm3_merger_expire(state);
+  }
+  if (0 == state->epoch_deadline_ms) {
+    return;
   }
+  if (NULL == state->stations) {
+    flush_expired_epoch(&state->station, state);
+  }
+  for (u8 i = 0; i < state->max_stations; i++) {
+    if (state->stations[i].in_use) {
+      flush_expired_epoch(&state->stations[i], state);
+    }
+  }
+}
+
+/** Set how long an epoch waits for its remaining messages.
+ *
+ * A buffered epoch is normally sent out when its last message arrives, or
+ * when the first message of the next epoch does. If the last message is lost
+ * the epoch is late by a whole epoch interval; with a deadline the epoch is
+ * sent out by rtcm2sbp_set_gps_time once the rover time is the deadline past
+ * the epoch time.
+ *
+ * \param deadline_ms Deadline after the epoch time, 0 to disable
+ * \param state Converter state
+ */
+void rtcm2sbp_set_epoch_deadline(u16 deadline_ms,
+                                 struct rtcm3_sbp_state *state) {
+  state->epoch_deadline_ms = deadline_ms;
 }
 
 void rtcm2sbp_set_leap_second(s8 leap_seconds, struct rtcm3_sbp_state *state) {
   state->leap_seconds = leap_seconds;
   state->leap_second_known = true;
+  if (state->time_anchor.valid) {
+    update_time_anchor(state);
+  }
 }
 
 void rtcm2sbp_set_glo_fcn(sbp_gnss_signal_t sid,
@@ -875,82 +1723,109 @@ void rtcm2sbp_set_glo_fcn(sbp_gnss_signal_t sid,
   }
 }
 
-void compute_gps_time(u32 tow_ms,
-                      gps_time_sec_t *obs_time,
-                      const gps_time_sec_t *rover_time,
-                      struct rtcm3_sbp_state *state) {
-  assert(gps_time_valid(rover_time));
-  obs_time->tow = (u32)(tow_ms * MS_TO_S);
-  obs_time->wn = rover_time->wn;
-  s32 timediff = gps_diff_time_sec(obs_time, rover_time);
-  if (timediff < -SEC_IN_WEEK / 2) {
-    obs_time->wn = rover_time->wn + 1;
-  } else if (timediff > SEC_IN_WEEK / 2) {
-    obs_time->wn = rover_time->wn - 1;
+/* Place a time of week in the week of the anchor, moved to the neighbouring
+ * week when closer */
+static FORCE_INLINE s32 anchor_time(s32 tow,
+                                    s32 half_period,
+                                    s32 period,
+                                    gps_time_sec_t *t,
+                                    const struct rtcm3_time_anchor *anchor) {
+  s32 diff = tow - anchor->tow;
+  if (diff > half_period) {
+    tow -= period;
+    diff -= period;
+  } else if (diff < -half_period) {
+    tow += period;
+    diff += period;
   }
-  assert(gps_time_valid(obs_time));
-  validate_base_obs_sanity(state, obs_time, rover_time);
+  t->wn = anchor->wn;
+  if (tow < 0) {
+    tow += SEC_IN_WEEK;
+    t->wn--;
+  } else if (tow >= SEC_IN_WEEK) {
+    tow -= SEC_IN_WEEK;
+    t->wn++;
+  }
+  t->tow = (u32)tow;
+  return diff;
 }
 
-/* Compute full GLO time stamp from the time-of-day count, so that the result
- * is close to the supplied reference gps time */
-void compute_glo_time(u32 tod_ms,
+/** GPS time of a time of week, in the week closest to the rover time.
+ *
+ * \param tow_s GPS time of week, less than a week [s]
+ * \param t GPS time
+ * \param state Converter state, with the rover time known
+ * \return Difference of the time from the rover time [s]
+ */
+s32 rtcm3_gps_tow_to_gps_time(u32 tow_s,
+                              gps_time_sec_t *t,
+                              const struct rtcm3_sbp_state *state) {
+  RTCM3_CHECK(state->time_anchor.valid);
+  RTCM3_CHECK(tow_s < SEC_IN_WEEK);
+  return anchor_time(
+      (s32)tow_s, SEC_IN_WEEK / 2, SEC_IN_WEEK, t, &state->time_anchor);
+}
+
+/** GPS time of a GLONASS time of day, in the day closest to the rover time.
+ *
+ * \param glo_tod_s GLONASS (Moscow) time of day [s]
+ * \param t GPS time
+ * \param state Converter state, with the rover time and leap seconds known
+ * \return Difference of the time from the rover time [s]
+ */
+s32 rtcm3_glo_tod_to_gps_time(s32 glo_tod_s,
+                              gps_time_sec_t *t,
+                              const struct rtcm3_sbp_state *state) {
+  RTCM3_CHECK(state->time_anchor.valid);
+  RTCM3_CHECK(state->leap_second_known);
+  const struct rtcm3_time_anchor *anchor = &state->time_anchor;
+  return anchor_time(
+      anchor->glo_day_start + glo_tod_s, SEC_IN_DAY / 2, SEC_IN_DAY, t, anchor);
+}
+
+void compute_gps_time(u32 tow_ms,
                       gps_time_sec_t *obs_time,
-                      const gps_time_sec_t *rover_time,
                       struct rtcm3_sbp_state *state) {
-  if (!state->leap_second_known) {
+  u32 tow_s = tow_ms / SECS_MS;
+  if (tow_s >= SEC_IN_WEEK) {
     obs_time->wn = INVALID_TIME;
     return;
   }
-  assert(gps_time_valid(rover_time));
+  s32 timediff = rtcm3_gps_tow_to_gps_time(tow_s, obs_time, state);
 
-  /* Approximate DOW from the reference GPS time */
-  u8 glo_dow = rover_time->tow / SEC_IN_DAY;
-  s32 glo_tod_sec = (u32)(tod_ms * MS_TO_S) - UTC_SU_OFFSET * SEC_IN_HOUR;
+  /* exclude base measurements with time stamp too far in the future */
+  if (-timediff >= BASE_FUTURE_THRESHOLD_S &&
+      state->cb_base_obs_invalid != NULL) {
+    state->cb_base_obs_invalid(-timediff);
+  }
+}
 
-  if (glo_tod_sec >= SEC_IN_DAY) {
+/* Compute full GLO time stamp from the time-of-day count, so that the result
+ * is close to the rover time */
+void compute_glo_time(u32 tod_ms,
+                      gps_time_sec_t *obs_time,
+                      struct rtcm3_sbp_state *state) {
+  u32 tod_s = tod_ms / SECS_MS;
+  if (!state->leap_second_known ||
+      tod_s >= SEC_IN_DAY + UTC_SU_OFFSET * SEC_IN_HOUR) {
     /* Time of day overflows, can possibly happen during leap second event.
      * Return as invalid. */
     obs_time->wn = INVALID_TIME;
     return;
   }
 
-  obs_time->wn = rover_time->wn;
-  obs_time->tow = glo_dow * SEC_IN_DAY + glo_tod_sec + state->leap_seconds;
-  normalize_gps_time(obs_time);
-
-  /* check for day rollover against reference time */
-  s32 timediff = gps_diff_time_sec(obs_time, rover_time);
-  if (abs(timediff) > SEC_IN_DAY / 2) {
-    obs_time->tow += (timediff < 0 ? 1 : -1) * SEC_IN_DAY;
-    normalize_gps_time(obs_time);
-    timediff = gps_diff_time_sec(obs_time, rover_time);
-  }
-
+  s32 timediff = rtcm3_glo_tod_to_gps_time((s32)tod_s, obs_time, state);
   if (abs(timediff - state->leap_seconds) > GLO_SANITY_THRESHOLD_S) {
     /* time too far from rover time, invalidate */
     obs_time->wn = INVALID_TIME;
   }
 }
 
-static void validate_base_obs_sanity(struct rtcm3_sbp_state *state,
-                                     const gps_time_sec_t *obs_time,
-                                     const gps_time_sec_t *rover_time) {
-  assert(gps_time_valid(obs_time));
-  assert(gps_time_valid(rover_time));
-  s32 timediff = gps_diff_time_sec(rover_time, obs_time);
-
-  /* exclude base measurements with time stamp too far in the future */
-  if (timediff >= BASE_FUTURE_THRESHOLD_S &&
-      state->cb_base_obs_invalid != NULL) {
-    state->cb_base_obs_invalid(timediff);
-  }
-}
-
-bool no_1230_received(struct rtcm3_sbp_state *state) {
-  if (!gps_time_valid(&state->last_1230_received) ||
+bool no_1230_received(const struct rtcm3_station_state *station,
+                      const struct rtcm3_sbp_state *state) {
+  if (!gps_time_valid(&station->last_1230_received) ||
       gps_diff_time_sec(&state->time_from_rover_obs,
-                        &state->last_1230_received) > MSG_1230_TIMEOUT_SEC) {
+                        &station->last_1230_received) > MSG_1230_TIMEOUT_SEC) {
     return true;
   }
   return false;
@@ -995,15 +1870,16 @@ void send_sbp_log_message(const uint8_t level,
                           const uint8_t *message,
                           const uint16_t length,
                           const uint16_t stn_id,
-                          const struct rtcm3_sbp_state *state) {
+                          struct rtcm3_sbp_state *state) {
   u8 frame_buffer[SBP_FRAMING_MAX_PAYLOAD_SIZE];
   msg_log_t *sbp_log_msg = (msg_log_t *)frame_buffer;
   sbp_log_msg->level = level;
   memcpy(sbp_log_msg->text, message, length);
-  state->cb_rtcm_to_sbp(SBP_MSG_LOG,
-                        sizeof(*sbp_log_msg) + length,
-                        (u8 *)frame_buffer,
-                        rtcm_2_sbp_sender_id(stn_id));
+  send_sbp_message(SBP_MSG_LOG,
+                   sizeof(*sbp_log_msg) + length,
+                   (u8 *)frame_buffer,
+                   rtcm_2_sbp_sender_id(stn_id),
+                   state);
 }
 
 void send_MSM_warning(const uint8_t *frame, struct rtcm3_sbp_state *state) {
@@ -1015,27 +1891,27 @@ void send_MSM_warning(const uint8_t *frame, struct rtcm3_sbp_state *state) {
     for (uint32_t i = 12; i < 24; i++) {
       stn_id = (stn_id << 1) + ((frame[i / 8] >> (7 - i % 8)) & 1u);
     }
-    uint8_t msg[39] = "MSM1-3 Messages currently not supported";
+    uint8_t msg[] = "MSM1-3 Messages need the orbit store to be set";
     send_sbp_log_message(
         RTCM_MSM_LOGGING_LEVEL, msg, sizeof(msg), stn_id, state);
   }
 }
 
-void send_buffer_full_error(const struct rtcm3_sbp_state *state) {
+void send_buffer_full_error(struct rtcm3_sbp_state *state) {
   /* TODO: Get the stn ID as well */
   uint8_t log_msg[] = "Too many RTCM observations received!";
   send_sbp_log_message(
       RTCM_BUFFER_FULL_LOGGING_LEVEL, log_msg, sizeof(log_msg), 0, state);
 }
 
-void send_buffer_not_empty_warning(const struct rtcm3_sbp_state *state) {
+void send_buffer_not_empty_warning(struct rtcm3_sbp_state *state) {
   uint8_t log_msg[] =
       "RTCM MSM sequence not properly finished, sending incomplete message";
   send_sbp_log_message(
       RTCM_MSM_LOGGING_LEVEL, log_msg, sizeof(log_msg), 0, state);
 }
 
-const char *unsupported_code_desc[UNSUPPORTED_CODE_MAX] = {
+static const char *const unsupported_code_desc[UNSUPPORTED_CODE_MAX] = {
     "Unknown or Unrecognized Code", /* UNSUPPORTED_CODE_UNKNOWN */
     "GLONASS L1P",                  /* UNSUPPORTED_CODE_GLO_L1P */
     "GLONASS L2P"                   /* UNSUPPORTED_CODE_GLO_L2P */
@@ -1064,8 +1940,10 @@ void rtcm_log_callback_fn(uint8_t level,
                           uint8_t *message,
                           uint16_t length,
                           void *context) {
-  const struct rtcm3_sbp_state *state = (const struct rtcm3_sbp_state *)context;
-  send_sbp_log_message(level, message, length, 0, state);
+  (void)context;
+  if (NULL != decoding_state) {
+    send_sbp_log_message(level, message, length, 0, decoding_state);
+  }
 }
 
 void add_msm_obs_to_buffer(const rtcm_msm_message *new_rtcm_obs,
@@ -1074,11 +1952,8 @@ void add_msm_obs_to_buffer(const rtcm_msm_message *new_rtcm_obs,
 
   gps_time_sec_t obs_time;
   if (CONSTELLATION_GLO == cons) {
-    compute_glo_time(new_rtcm_obs->header.tow_ms,
-                     &obs_time,
-                     &state->time_from_rover_obs,
-                     state);
-    if (!gps_time_valid(&obs_time)) {
+    compute_glo_time(new_rtcm_obs->header.tow_ms, &obs_time, state);
+    if (INVALID_TIME == obs_time.wn) {
       /* time invalid because of missing leap second info or ongoing leap second
        * event, skip these measurements */
       return;
@@ -1095,199 +1970,231 @@ void add_msm_obs_to_buffer(const rtcm_msm_message *new_rtcm_obs,
       }
     }
 
-    compute_gps_time(tow_ms, &obs_time, &state->time_from_rover_obs, state);
-  }
-
-  if (!gps_time_valid(&state->last_gps_time) ||
-      gps_diff_time_sec(&obs_time, &state->last_gps_time) >= 0) {
-    if (!gps_time_valid(&state->last_msm_received) &&
-        gps_time_valid(&state->last_gps_time)) {
-      /* First MSM observation but last_gps_time is already set: possibly
-       * switched to MSM from legacy stream, so clear the buffer to avoid
-       * duplicate observations */
-      memset(state->obs_buffer, 0, OBS_BUFFER_SIZE);
+    compute_gps_time(tow_ms, &obs_time, state);
+    if (INVALID_TIME == obs_time.wn) {
+      return;
     }
-    state->last_gps_time = obs_time;
-    state->last_glo_time = obs_time;
-    state->last_msm_received = obs_time;
+  }
 
-    /* Transform the newly received obs to sbp */
-    u8 new_obs[OBS_BUFFER_SIZE];
-    memset(new_obs, 0, OBS_BUFFER_SIZE);
-    msg_obs_t *new_sbp_obs = (msg_obs_t *)(new_obs);
+  struct rtcm3_station_state *station =
+      rtcm3_get_station(new_rtcm_obs->header.stn_id, state);
 
-    /* Find the buffer of obs to be sent */
-    msg_obs_t *sbp_obs_buffer = (msg_obs_t *)state->obs_buffer;
+  if (!gps_time_valid(&station->last_gps_time) ||
+      gps_diff_time_sec(&obs_time, &station->last_gps_time) >= 0) {
+    station->last_gps_time = obs_time;
+    station->last_glo_time = obs_time;
+    station->last_msm_received = obs_time;
 
     /* Build an SBP time stamp */
-    new_sbp_obs->header.t.wn = obs_time.wn;
-    new_sbp_obs->header.t.tow = obs_time.tow * S_TO_MS;
-    new_sbp_obs->header.t.ns_residual = 0;
+    sbp_gps_time_t sbp_time;
+    sbp_time.wn = obs_time.wn;
+    sbp_time.tow = obs_time.tow * S_TO_MS;
+    sbp_time.ns_residual = 0;
 
-    rtcm3_msm_to_sbp(new_rtcm_obs, new_sbp_obs, state);
+    u16 sender_id = rtcm_2_sbp_sender_id(new_rtcm_obs->header.stn_id);
 
     /* Check if the buffer already has obs of the same time */
-    if (sbp_obs_buffer->header.n_obs != 0 &&
-        (sbp_obs_buffer->header.t.tow != new_sbp_obs->header.t.tow ||
-         state->sender_id !=
-             rtcm_2_sbp_sender_id(new_rtcm_obs->header.stn_id))) {
+    if (station->epoch.n_obs != 0 &&
+        (station->epoch.t.tow != sbp_time.tow ||
+         station->sender_id != sender_id)) {
       /* We either have missed a message, or we have a new station. Either way,
        send through the current buffer and clear before adding new obs */
       send_buffer_not_empty_warning(state);
-      send_observations(state);
+      rtcm3_count_event(RTCM2SBP_EVENT_MSM_INCOMPLETE, station, state);
+      send_observations(station, state);
     }
 
-    /* Copy new obs into buffer */
-    u8 obs_index_buffer = sbp_obs_buffer->header.n_obs;
-    state->sender_id = rtcm_2_sbp_sender_id(new_rtcm_obs->header.stn_id);
-    for (u8 obs_count = 0; obs_count < new_sbp_obs->header.n_obs; obs_count++) {
-      if (obs_index_buffer >= MAX_OBS_PER_EPOCH) {
-        send_buffer_full_error(state);
-        break;
-      }
-
-      assert(SBP_HDR_SIZE + (obs_index_buffer + 1) * SBP_OBS_SIZE <=
-             OBS_BUFFER_SIZE);
+    station->sender_id = sender_id;
+    station->epoch.t = sbp_time;
 
-      sbp_obs_buffer->obs[obs_index_buffer] = new_sbp_obs->obs[obs_count];
-      obs_index_buffer++;
-    }
-    sbp_obs_buffer->header.n_obs = obs_index_buffer;
-    sbp_obs_buffer->header.t = new_sbp_obs->header.t;
+    /* Transform the newly received obs to sbp directly into the epoch */
+    rtcm3_msm_to_sbp(new_rtcm_obs, station, state);
   }
 }
 
-/* return true if conversion to SID succeeded, and the SID as a pointer */
-static bool get_sid_from_msm(const rtcm_msm_header *header,
-                             u8 satellite_index,
-                             u8 signal_index,
-                             sbp_gnss_signal_t *sid,
+/* Lookup table entries of the MSM signals that are not converted */
+#define MSM_CODE_UNKNOWN 0xFF
+#define MSM_CODE_UNSUPPORTED 0xFE
+
+/* Build the SBP code of every signal of an MSM message. The constellation
+ * and the signal mask are fixed for the whole message, so the signals are
+ * resolved and checked against the converted codes of the constellation once
+ * here instead of for every cell. */
+static void msm_signal_codes(const rtcm_msm_header *header,
+                             u8 num_sigs,
+                             u64 code_mask,
+                             u8 codes[],
                              struct rtcm3_sbp_state *state) {
-  code_t code = msm_signal_to_code(header, signal_index);
-  u8 sat = msm_sat_to_prn(header, satellite_index);
-  if (CODE_INVALID != code && PRN_INVALID != sat) {
-    sid->code = code;
-    sid->sat = sat;
-    return true;
-  } else {
+  for (u8 sig = 0; sig < num_sigs; sig++) {
+    code_t code = msm_signal_to_code(header, sig);
     if (CODE_INVALID == code) {
       /* should have specific code warning but this requires modifiying librtcm
        */
       send_unsupported_code_warning(UNSUPPORTED_CODE_UNKNOWN, state);
+      codes[sig] = MSM_CODE_UNKNOWN;
+    } else if (0 == (code_mask & ((u64)1 << code))) {
+      codes[sig] = MSM_CODE_UNSUPPORTED;
+    } else {
+      codes[sig] = code;
     }
-    return false;
   }
 }
 
-bool unsupported_signal(sbp_gnss_signal_t *sid) {
-  switch (sid->code) {
-    case CODE_GPS_L5I:
-    case CODE_GPS_L5X:
-    case CODE_GPS_L5Q:
-    case CODE_GAL_E6B:
-    case CODE_GAL_E6C:
-    case CODE_GAL_E6X:
-    case CODE_GAL_E5I:
-    case CODE_GAL_E5Q:
-    case CODE_GAL_E5X:
-    case CODE_GAL_E8:
-    case CODE_QZS_L1CA:
-    case CODE_QZS_L2CM:
-    case CODE_QZS_L2CL:
-    case CODE_QZS_L2CX:
-    case CODE_QZS_L5I:
-    case CODE_QZS_L5Q:
-    case CODE_QZS_L5X:
-      return true;
-    default:
-      return false;
+/* Convert the cells of an MSM message into the epoch. It is inlined into
+ * one converter per MSM type so that has_doppler and compact are known at
+ * compile time, and the cell loop only does table lookups. The compact
+ * MSM1-3 cells may have only a pseudorange or only a carrier phase, both
+ * within the millisecond until the whole milliseconds are added. */
+static FORCE_INLINE void msm_cells_to_sbp(const rtcm_msm_message *msg,
+                                          bool has_doppler,
+                                          bool compact,
+                                          struct rtcm3_station_state *station,
+                                          struct rtcm3_sbp_state *state) {
+  const rtcm_msm_header *header = &msg->header;
+  const u8 num_sats =
+      count_mask_values(MSM_SATELLITE_MASK_SIZE, header->satellite_mask);
+  const u8 num_sigs =
+      count_mask_values(MSM_SIGNAL_MASK_SIZE, header->signal_mask);
+  const u8 precision = obs_precision(header->msg_num);
+  struct rtcm3_obs_epoch *epoch = &station->epoch;
+
+  const constellation_t cons = to_constellation(header->msg_num);
+  assert((u8)cons < RTCM3_MSM_CONSTELLATIONS);
+  u8 codes[MSM_SIGNAL_MASK_SIZE];
+  msm_signal_codes(header, num_sigs, state->msm_code_mask[cons], codes, state);
+  u8 whole_ms[MSM_SATELLITE_MASK_SIZE];
+  if (compact) {
+    rtcm3_msm_compact_ms(msg, station, state, whole_ms);
   }
-}
-
-void rtcm3_msm_to_sbp(const rtcm_msm_message *msg,
-                      msg_obs_t *new_sbp_obs,
-                      struct rtcm3_sbp_state *state) {
-  uint8_t num_sats =
-      count_mask_values(MSM_SATELLITE_MASK_SIZE, msg->header.satellite_mask);
-  uint8_t num_sigs =
-      count_mask_values(MSM_SIGNAL_MASK_SIZE, msg->header.signal_mask);
 
   u8 cell_index = 0;
   for (u8 sat = 0; sat < num_sats; sat++) {
+    const u8 prn = msm_sat_to_prn(header, sat);
+    const bool *cell_mask = &header->cell_mask[sat * num_sigs];
     for (u8 sig = 0; sig < num_sigs; sig++) {
-      if (msg->header.cell_mask[sat * num_sigs + sig]) {
-        sbp_gnss_signal_t sid;
-        const rtcm_msm_signal_data *data = &msg->signals[cell_index];
-        if (get_sid_from_msm(&msg->header, sat, sig, &sid, state) &&
-            data->flags.valid_pr && data->flags.valid_cp &&
-            !unsupported_signal(&sid)) {
-          if (new_sbp_obs->header.n_obs >= MAX_OBS_PER_EPOCH) {
-            send_buffer_full_error(state);
-            return;
-          }
-
-          packed_obs_content_t *sbp_freq =
-              &new_sbp_obs->obs[new_sbp_obs->header.n_obs];
-          sbp_freq->flags = 0;
-          sbp_freq->P = 0.0;
-          sbp_freq->L.i = 0;
-          sbp_freq->L.f = 0.0;
-          sbp_freq->D.i = 0;
-          sbp_freq->D.f = 0.0;
-          sbp_freq->cn0 = 0.0;
-          sbp_freq->lock = 0.0;
-
-          sbp_freq->sid = sid;
-
-          if (data->flags.valid_pr) {
-            sbp_freq->P =
-                (u32)roundl(data->pseudorange_m * MSG_OBS_P_MULTIPLIER);
-            sbp_freq->flags |= MSG_OBS_FLAGS_CODE_VALID;
-          }
-          if (data->flags.valid_cp) {
-            sbp_freq->L.i = (s32)floor(data->carrier_phase_cyc);
-            u16 frac_part =
-                (u16)roundl((data->carrier_phase_cyc - (double)sbp_freq->L.i) *
-                            MSG_OBS_LF_MULTIPLIER);
-            if (256 == frac_part) {
-              frac_part = 0;
-              sbp_freq->L.i += 1;
-            }
-            sbp_freq->L.f = (u8)frac_part;
-            sbp_freq->flags |= MSG_OBS_FLAGS_PHASE_VALID;
-            if (!data->hca_indicator) {
-              sbp_freq->flags |= MSG_OBS_FLAGS_HALF_CYCLE_KNOWN;
-            }
-          }
-
-          if (data->flags.valid_cnr) {
-            sbp_freq->cn0 = (u8)roundl(data->cnr * MSG_OBS_CN0_MULTIPLIER);
-          } else {
-            sbp_freq->cn0 = 0;
-          }
+      if (!cell_mask[sig]) {
+        continue;
+      }
+      const rtcm_msm_signal_data *data = &msg->signals[cell_index++];
+      const u8 code = codes[sig];
+      if (code >= CODE_COUNT || PRN_INVALID == prn) {
+        if (MSM_CODE_UNSUPPORTED == code && PRN_INVALID != prn) {
+          rtcm3_count_event(RTCM2SBP_EVENT_UNSUPPORTED_SIGNAL, station, state);
+        }
+        continue;
+      }
+      if (compact) {
+        if (!data->flags.valid_pr && !data->flags.valid_cp) {
+          continue;
+        }
+        if (0 == whole_ms[sat]) {
+          rtcm3_count_event(RTCM2SBP_EVENT_MSM_NO_RANGE, station, state);
+          continue;
+        }
+      } else if (!data->flags.valid_pr || !data->flags.valid_cp) {
+        continue;
+      }
 
-          if (data->flags.valid_lock) {
-            sbp_freq->lock = encode_lock_time(data->lock_time_s);
-          }
+      sbp_gnss_signal_t sid;
+      sid.sat = prn;
+      sid.code = code;
+      u8 i;
+      obs_slot_t slot = claim_obs_slot(&sid, precision, station, &i, state);
+      if (OBS_SLOT_FULL == slot) {
+        return;
+      }
+      if (OBS_SLOT_DUPLICATE == slot) {
+        continue;
+      }
 
-          if (data->flags.valid_dop) {
-            /* flip Doppler sign to Piksi sign convention */
-            double doppler_Hz = -data->range_rate_Hz;
-            sbp_freq->D.i = (s16)floor(doppler_Hz);
-            u16 frac_part = (u16)roundl((doppler_Hz - (double)sbp_freq->D.i) *
-                                        MSG_OBS_DF_MULTIPLIER);
-            if (256 == frac_part) {
-              frac_part = 0;
-              sbp_freq->D.i += 1;
-            }
-            sbp_freq->D.f = (u8)frac_part;
-            sbp_freq->flags |= MSG_OBS_FLAGS_DOPPLER_VALID;
-          }
+      double pseudorange_m = data->pseudorange_m;
+      double carrier_phase_cyc = data->carrier_phase_cyc;
+      if (compact) {
+        pseudorange_m += whole_ms[sat] * RANGE_MS;
+        if (data->flags.valid_cp) {
+          const u8 glo_fcn = msg->sats[sat].glo_fcn;
+          carrier_phase_cyc +=
+              whole_ms[sat] * MS_TO_S *
+              msm_signal_frequency(
+                  header, sig, glo_fcn, MSM_GLO_FCN_UNKNOWN != glo_fcn);
+        }
+      }
 
-          new_sbp_obs->header.n_obs++;
+      epoch->P[i] = 0;
+      epoch->L_i[i] = 0;
+      epoch->L_f[i] = 0;
+      epoch->flags[i] = 0;
+      if (data->flags.valid_pr) {
+        epoch->P[i] = pack_pseudorange(pseudorange_m);
+        epoch->flags[i] |= MSG_OBS_FLAGS_CODE_VALID;
+      }
+      if (data->flags.valid_cp) {
+        carrier_phase_t L;
+        pack_carrier_phase(carrier_phase_cyc, &L);
+        epoch->L_i[i] = L.i;
+        epoch->L_f[i] = L.f;
+        epoch->flags[i] |= MSG_OBS_FLAGS_PHASE_VALID;
+        if (!data->hca_indicator) {
+          epoch->flags[i] |= MSG_OBS_FLAGS_HALF_CYCLE_KNOWN;
         }
-        cell_index++;
+      }
+      epoch->cn0[i] = data->flags.valid_cnr ? pack_cn0(data->cnr) : 0;
+      epoch->lock[i] =
+          data->flags.valid_lock ? encode_lock_time(data->lock_time_s) : 0;
+
+      epoch->D_i[i] = 0;
+      epoch->D_f[i] = 0;
+      if (has_doppler && data->flags.valid_dop) {
+        /* flip Doppler sign to Piksi sign convention */
+        doppler_t D;
+        pack_doppler(-data->range_rate_Hz, &D);
+        epoch->D_i[i] = D.i;
+        epoch->D_f[i] = D.f;
+        epoch->flags[i] |= MSG_OBS_FLAGS_DOPPLER_VALID;
       }
     }
   }
 }
+
+/* MSM4 and MSM6 carry no Doppler */
+static void msm4_6_to_sbp(const rtcm_msm_message *msg,
+                          struct rtcm3_station_state *station,
+                          struct rtcm3_sbp_state *state) {
+  msm_cells_to_sbp(msg, false, false, station, state);
+}
+
+static void msm5_7_to_sbp(const rtcm_msm_message *msg,
+                          struct rtcm3_station_state *station,
+                          struct rtcm3_sbp_state *state) {
+  msm_cells_to_sbp(msg, true, false, station, state);
+}
+
+/* MSM1-3 ranges are only known modulo one millisecond */
+static void msm1_3_to_sbp(const rtcm_msm_message *msg,
+                          struct rtcm3_station_state *station,
+                          struct rtcm3_sbp_state *state) {
+  msm_cells_to_sbp(msg, false, true, station, state);
+}
+
+void rtcm3_msm_to_sbp(const rtcm_msm_message *msg,
+                      struct rtcm3_station_state *station,
+                      struct rtcm3_sbp_state *state) {
+  switch (to_msm_type(msg->header.msg_num)) {
+    case MSM4:
+    case MSM6:
+      msm4_6_to_sbp(msg, station, state);
+      break;
+    case MSM5:
+    case MSM7:
+      msm5_7_to_sbp(msg, station, state);
+      break;
+    case MSM1:
+    case MSM2:
+    case MSM3:
+      msm1_3_to_sbp(msg, station, state);
+      break;
+    case MSM_UNKNOWN:
+    default:
+      break;
+  }
+}
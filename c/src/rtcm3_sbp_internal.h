@@ -13,6 +13,7 @@
 #ifndef GNSS_CONVERTERS_RTCM3_SBP_H
 #define GNSS_CONVERTERS_RTCM3_SBP_H
 
+#include <assert.h>
 #include <rtcm3_messages.h>
 #include <rtcm3_sbp.h>
 
@@ -28,6 +29,8 @@
 /* message type range reserved for MSM */
 #define MSM_MSG_TYPE_MIN 1070
 #define MSM_MSG_TYPE_MAX 1229
+/* bit offset of the station ID, regardless of MSM type */
+#define MSM_STATION_ID_BIT_OFFSET 12
 /* bit offset of the multiple message flag, regardless of MSM type */
 #define MSM_MULTIPLE_BIT_OFFSET 54
 
@@ -42,7 +45,27 @@
 #define MS_TO_S 1e-3
 #define S_TO_MS 1e3
 
-extern bool rtcm3_debug;
+#define CLIGHT 299792458.0
+/* Distance light travels in one millisecond, the unit of the MSM ranges */
+#define RANGE_MS (CLIGHT * 1e-3)
+
+/* Storage class for data that is private to each thread */
+#ifndef THREAD_LOCAL
+#define THREAD_LOCAL __thread
+#endif
+
+/* Inlining of the functions that are specialised by constant arguments */
+#ifndef FORCE_INLINE
+#define FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+/* Validation of the internal invariants of the hot paths, such as the time
+ * arithmetic, is only compiled into the checked builds */
+#ifdef GNSS_CONVERTERS_CHECKED
+#define RTCM3_CHECK(cond) assert(cond)
+#else
+#define RTCM3_CHECK(cond) ((void)sizeof(cond))
+#endif
 
 /** Number of milliseconds in a second. */
 #define SECS_MS 1000
@@ -79,6 +102,24 @@ extern bool rtcm3_debug;
  * 1002/1004/1010/1012 observation messages again */
 #define MSM_TIMEOUT_SEC 60
 
+/* Number of consecutive epochs with the same set of legacy observation
+ * messages after which an epoch is sent out as soon as the set is complete */
+#define EPOCH_LEARN_COUNT 3
+
+/* An unchanged ephemeris is sent again once in each slot of GPS time this
+ * long, for the rovers that connected since it was last sent. The slots are
+ * fixed so that whether it is sent only depends on the stream since the
+ * start of the slot, not on when it was first seen [s] */
+#define EPH_REPEAT_SEC 300
+
+/* Ephemerides and SSR corrections carry no station ID, they are sent with
+ * the sender ID the Haskell converter uses */
+#define GLOBAL_SENDER_ID 61568
+
+/* SBP Galileo ephemeris sources */
+#define GAL_SOURCE_INAV 0
+#define GAL_SOURCE_FNAV 1
+
 /* Third party receiver bias value - these have been sourced from RTCM1230
  * message, the data can be found with the unit tests*/
 #define TRIMBLE_BIAS_M 19.06
@@ -123,12 +164,20 @@ extern bool rtcm3_debug;
 #define GPP_TRM_BIAS_L1CA_M 18.8
 #define GPP_TRM_BIAS_L2P_M 23.2
 
+u32 pack_pseudorange(double pseudorange_m);
+void pack_carrier_phase(double carrier_phase_cyc, carrier_phase_t *L);
+void pack_doppler(double doppler_Hz, doppler_t *D);
+u8 pack_cn0(double cnr_dbhz);
 u8 encode_lock_time(double nm_lock_time);
 double decode_lock_time(u8 sbp_lock_time);
 
-void sbp_to_rtcm3_obs(const msg_obs_t *sbp_obs,
-                      const u8 msg_size,
-                      rtcm_obs_message *rtcm_obs);
+bool gps_obs_message(u16 msg_num);
+bool glo_obs_message(u16 msg_num);
+
+u8 sbp_to_rtcm3_obs(const packed_obs_content_t *sbp_obs,
+                    u8 n_obs,
+                    const u8 glo_sv_id_fcn_map[],
+                    rtcm_obs_message *rtcm_obs);
 
 void rtcm3_1005_to_sbp(const rtcm_msg_1005 *rtcm_1005,
                        msg_base_pos_ecef_t *sbp_base_pos);
@@ -140,18 +189,25 @@ void rtcm3_1006_to_sbp(const rtcm_msg_1006 *rtcm_1006,
 void sbp_to_rtcm3_1006(const msg_base_pos_ecef_t *sbp_base_pos,
                        rtcm_msg_1006 *rtcm_1006);
 
+u8 rtcm3_match_glo_bias(const char *descriptor,
+                        u8 descriptor_len,
+                        const struct rtcm3_glo_bias_matcher *matcher);
 void rtcm3_1033_to_sbp(const rtcm_msg_1033 *rtcm_1033,
-                       msg_glo_biases_t *sbp_glo_bias);
+                       struct rtcm3_station_state *station,
+                       msg_glo_biases_t *sbp_glo_bias,
+                       const struct rtcm3_sbp_state *state);
 
 void rtcm3_1230_to_sbp(const rtcm_msg_1230 *rtcm_1230,
                        msg_glo_biases_t *sbp_glo_bias);
 void sbp_to_rtcm3_1230(const msg_glo_biases_t *sbp_glo_bias,
                        rtcm_msg_1230 *rtcm_1230);
 
-void encode_RTCM_obs(const rtcm_obs_message *rtcm_msg);
+u16 encode_RTCM_obs(const rtcm_obs_message *rtcm_msg, u8 *buff);
+u16 encode_RTCM_1005(const rtcm_msg_1005 *rtcm_msg, u8 *buff);
+u16 encode_RTCM_1230(const rtcm_msg_1230 *rtcm_msg, u8 *buff);
 
 void rtcm3_to_sbp(const rtcm_obs_message *rtcm_obs,
-                  msg_obs_t *sbp_obs,
+                  struct rtcm3_station_state *station,
                   struct rtcm3_sbp_state *state);
 
 void add_gps_obs_to_buffer(const rtcm_obs_message *new_rtcm_obs,
@@ -162,21 +218,92 @@ void add_glo_obs_to_buffer(const rtcm_obs_message *new_rtcm_obs,
 
 void add_obs_to_buffer(const rtcm_obs_message *new_rtcm_obs,
                        gps_time_sec_t *new_sbp_obs,
+                       struct rtcm3_station_state *station,
                        struct rtcm3_sbp_state *state);
 
 void compute_gps_time(u32 tow_ms,
-                      gps_time_sec_t *new_sbp_obs,
-                      const gps_time_sec_t *rover_time,
+                      gps_time_sec_t *obs_time,
                       struct rtcm3_sbp_state *state);
 
 void compute_glo_time(u32 tod_ms,
                       gps_time_sec_t *obs_time,
-                      const gps_time_sec_t *rover_time,
                       struct rtcm3_sbp_state *state);
 
-void send_observations(struct rtcm3_sbp_state *state);
+s32 rtcm3_gps_tow_to_gps_time(u32 tow_s,
+                              gps_time_sec_t *t,
+                              const struct rtcm3_sbp_state *state);
+
+s32 rtcm3_glo_tod_to_gps_time(s32 glo_tod_s,
+                              gps_time_sec_t *t,
+                              const struct rtcm3_sbp_state *state);
+
+void send_observations(struct rtcm3_station_state *station,
+                       struct rtcm3_sbp_state *state);
+
+void rtcm3_send_obs_epoch(const struct rtcm3_obs_epoch *epoch,
+                          u16 sender_id,
+                          struct rtcm3_sbp_state *state);
+void rtcm3_obs_epoch_copy(struct rtcm3_obs_epoch *dst,
+                          const struct rtcm3_obs_epoch *src);
+void rtcm3_obs_epoch_merge(struct rtcm3_obs_epoch *dst,
+                           const struct rtcm3_obs_epoch *src);
 
-bool no_1230_received(struct rtcm3_sbp_state *state);
+void rtcm3_merger_add(struct rtcm3_station_state *station,
+                      struct rtcm3_sbp_state *state);
+void rtcm3_merger_expire(struct rtcm3_sbp_state *state);
+
+bool rtcm3_gps_eph_to_sbp(const rtcm_msg_eph *msg_eph,
+                          msg_ephemeris_gps_t *sbp_gps_eph,
+                          const struct rtcm3_sbp_state *state);
+bool rtcm3_glo_eph_to_sbp(const rtcm_msg_eph *msg_eph,
+                          msg_ephemeris_glo_t *sbp_glo_eph,
+                          const struct rtcm3_sbp_state *state);
+bool rtcm3_gal_eph_to_sbp(const rtcm_msg_eph *msg_eph,
+                          u8 source,
+                          msg_ephemeris_gal_t *sbp_gal_eph,
+                          const struct rtcm3_sbp_state *state);
+bool rtcm3_bds_eph_to_sbp(const rtcm_msg_eph *msg_eph,
+                          msg_ephemeris_bds_t *sbp_bds_eph,
+                          const struct rtcm3_sbp_state *state);
+void rtcm3_send_eph(const rtcm_msg_eph *msg_eph,
+                    u16 msg_type,
+                    struct rtcm3_sbp_state *state);
+
+void rtcm3_store_gps_orbit(const msg_ephemeris_gps_t *eph,
+                           struct rtcm3_sbp_state *state);
+void rtcm3_store_glo_orbit(const msg_ephemeris_glo_t *eph,
+                           struct rtcm3_sbp_state *state);
+void rtcm3_store_gal_orbit(const msg_ephemeris_gal_t *eph,
+                           struct rtcm3_sbp_state *state);
+void rtcm3_store_bds_orbit(const msg_ephemeris_bds_t *eph,
+                           struct rtcm3_sbp_state *state);
+bool rtcm3_sat_pseudorange_ms(u8 constellation,
+                              u8 sat_id,
+                              const sbp_gps_time_t *t,
+                              const double pos_ecef[3],
+                              const struct rtcm3_sbp_state *state,
+                              double *pseudorange_ms);
+
+rtcm3_rc rtcm3_decode_msm1_3(const uint8_t *buff,
+                             const uint8_t glo_sv_id_fcn_map[],
+                             rtcm_msm_message *msg);
+void rtcm3_msm_compact_ms(const rtcm_msm_message *msg,
+                          const struct rtcm3_station_state *station,
+                          const struct rtcm3_sbp_state *state,
+                          u8 whole_ms[]);
+
+void rtcm3_ssr_orbit_clock_to_sbp(const rtcm_msg_orbit_clock *msg,
+                                  struct rtcm3_sbp_state *state);
+void rtcm3_ssr_code_bias_to_sbp(const rtcm_msg_code_bias *msg,
+                                struct rtcm3_sbp_state *state);
+void rtcm3_ssr_phase_bias_to_sbp(const rtcm_msg_phase_bias *msg,
+                                 struct rtcm3_sbp_state *state);
+
+bool no_1230_received(const struct rtcm3_station_state *station,
+                      const struct rtcm3_sbp_state *state);
+
+struct rtcm3_station_state *rtcm3_get_station(u16 stn_id,
+                                              struct rtcm3_sbp_state *state);
 
 void send_1029(rtcm_msg_1029 *msg_1029, struct rtcm3_sbp_state *state);
 
@@ -184,11 +311,19 @@ void send_sbp_log_message(const uint8_t level,
                           const uint8_t *message,
                           const uint16_t length,
                           const uint16_t stn_id,
-                          const struct rtcm3_sbp_state *state);
+                          struct rtcm3_sbp_state *state);
 
 void send_MSM_warning(const uint8_t *frame, struct rtcm3_sbp_state *state);
 
-void send_buffer_full_error(const struct rtcm3_sbp_state *state);
+void send_buffer_full_error(struct rtcm3_sbp_state *state);
+
+void send_buffer_not_empty_warning(struct rtcm3_sbp_state *state);
+
+void send_sbp_message(u16 msg_id,
+                      u8 len,
+                      u8 *buff,
+                      u16 sender_id,
+                      struct rtcm3_sbp_state *state);
 
 void send_unsupported_code_warning(const unsupported_code_t unsupported_code,
                                    struct rtcm3_sbp_state *state);
@@ -197,7 +332,7 @@ void add_msm_obs_to_buffer(const rtcm_msm_message *new_rtcm_obs,
                            struct rtcm3_sbp_state *state);
 
 void rtcm3_msm_to_sbp(const rtcm_msm_message *msg,
-                      msg_obs_t *new_sbp_obs,
+                      struct rtcm3_station_state *station,
                       struct rtcm3_sbp_state *state);
 
 void rtcm_log_callback_fn(uint8_t level,
@@ -205,6 +340,39 @@ void rtcm_log_callback_fn(uint8_t level,
                           uint16_t length,
                           void *context);
 
+u32 crc24q(const u8 *buf, u32 len, u32 crc);
+void rtcm3_frame_reader_init(struct rtcm3_frame_reader *reader);
+void rtcm3_read_frames(const u8 *buf,
+                       u32 len,
+                       struct rtcm3_frame_reader *reader,
+                       void (*cb_frame)(const u8 *frame,
+                                        u16 length,
+                                        void *context),
+                       void *context);
+u16 sbp_crc16(const u8 *buf, u32 len, u16 crc);
+
+struct rtcm3_station_state *rtcm3_find_station(u16 stn_id,
+                                               struct rtcm3_sbp_state *state);
+
+void rtcm3_stats_inc(u32 *counter);
+void rtcm3_stats_clear(void *stats, size_t size);
+void rtcm3_stats_write_begin(struct rtcm3_sbp_state *state);
+void rtcm3_stats_write_end(struct rtcm3_sbp_state *state);
+void rtcm3_count_event(rtcm2sbp_event_t event,
+                       struct rtcm3_station_state *station,
+                       struct rtcm3_sbp_state *state);
+void rtcm3_count_state_event(rtcm2sbp_event_t event,
+                             struct rtcm3_sbp_state *state);
+void rtcm3_count_decode_error(const uint8_t *msg,
+                              struct rtcm3_sbp_state *state);
+void rtcm3_record_frame(u16 msg_type,
+                        const uint8_t *msg,
+                        u32 elapsed_ns,
+                        struct rtcm3_sbp_state *state);
+u16 rtcm3_latency_bucket(u32 elapsed_ns);
+u32 rtcm3_latency_bucket_ns(u16 bucket);
+u64 rtcm3_monotonic_ns(void);
+
 s32 gps_diff_time_sec(const gps_time_sec_t *end,
                       const gps_time_sec_t *beginning);
 
@@ -0,0 +1,423 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <rtcm3_msm_utils.h>
+#include <string.h>
+#include "rtcm3_sbp_internal.h"
+
+/* Without a store the corrections of every SSR message are sent out as they
+ * arrive. With one they are merged per satellite and an SSR epoch of a
+ * constellation is sent out once the last message of every kind it is
+ * expected to contain arrived. The expected kinds are the ones of the
+ * previous epoch, so that providers sending the biases less often than the
+ * orbits and clocks only delay the epochs that change the set. */
+
+/* Store index of the constellation of an SSR message,
+ * RTCM3_SSR_CONSTELLATIONS if it is not converted */
+static u8 ssr_constellation(u16 message_num) {
+  if ((message_num >= 1057 && message_num <= 1062) || 1265 == message_num) {
+    return RTCM3_SSR_GPS;
+  }
+  if ((message_num >= 1063 && message_num <= 1068) || 1266 == message_num) {
+    return RTCM3_SSR_GLO;
+  }
+  return RTCM3_SSR_CONSTELLATIONS;
+}
+
+/* GPS time of an SSR epoch, false if it cannot be placed yet */
+static bool ssr_time(const rtcm_msg_ssr_header *header,
+                     u8 constellation,
+                     gps_time_sec_t *t,
+                     const struct rtcm3_sbp_state *state) {
+  if (!state->time_anchor.valid) {
+    return false;
+  }
+
+  switch (constellation) {
+    case RTCM3_SSR_GPS:
+      /* time of week, in the week closest to the rover time */
+      if (header->epoch_time >= SEC_IN_WEEK) {
+        return false;
+      }
+      rtcm3_gps_tow_to_gps_time(header->epoch_time, t, state);
+      return true;
+    case RTCM3_SSR_GLO:
+      /* Moscow time of day */
+      if (!state->leap_second_known || header->epoch_time >= SEC_IN_DAY) {
+        return false;
+      }
+      rtcm3_glo_tod_to_gps_time(header->epoch_time, t, state);
+      return true;
+    default:
+      return false;
+  }
+}
+
+static u8 ssr_code(u8 constellation) {
+  return (RTCM3_SSR_GLO == constellation) ? CODE_GLO_L1OF : CODE_GPS_L1CA;
+}
+
+static void orbit_clock_to_sbp(const rtcm_msg_ssr_header *header,
+                               const rtcm_msg_ssr_orbit_clock_sat *sat,
+                               const gps_time_sec_t *t,
+                               u8 constellation,
+                               msg_ssr_orbit_clock_t *sbp_orbit_clock) {
+  sbp_orbit_clock->time = *t;
+  sbp_orbit_clock->sid.sat = sat->sat_id;
+  sbp_orbit_clock->sid.code = ssr_code(constellation);
+  sbp_orbit_clock->update_interval = header->update_interval;
+  sbp_orbit_clock->iod_ssr = header->iod_ssr;
+  sbp_orbit_clock->iod = sat->orbit.iode;
+  sbp_orbit_clock->radial = sat->orbit.radial;
+  sbp_orbit_clock->along = sat->orbit.along_track;
+  sbp_orbit_clock->cross = sat->orbit.cross_track;
+  sbp_orbit_clock->dot_radial = sat->orbit.dot_radial;
+  sbp_orbit_clock->dot_along = sat->orbit.dot_along_track;
+  sbp_orbit_clock->dot_cross = sat->orbit.dot_cross_track;
+  sbp_orbit_clock->c0 = sat->clock.c0;
+  sbp_orbit_clock->c1 = sat->clock.c1;
+  sbp_orbit_clock->c2 = sat->clock.c2;
+}
+
+/* Pack the code biases of a satellite, returns the payload length */
+static u8 code_biases_to_sbp(const rtcm_msg_ssr_header *header,
+                             const rtcm_msg_ssr_code_bias_sat *sat,
+                             const gps_time_sec_t *t,
+                             u8 constellation,
+                             u8 *buffer) {
+  msg_ssr_code_biases_t *sbp_code_biases = (msg_ssr_code_biases_t *)buffer;
+  sbp_code_biases->time = *t;
+  sbp_code_biases->sid.sat = sat->sat_id;
+  sbp_code_biases->sid.code = ssr_code(constellation);
+  sbp_code_biases->update_interval = header->update_interval;
+  sbp_code_biases->iod_ssr = header->iod_ssr;
+
+  u8 n_biases = sat->num_code_biases;
+  if (n_biases > MAX_SSR_SIGNALS) {
+    n_biases = MAX_SSR_SIGNALS;
+  }
+  for (u8 i = 0; i < n_biases; i++) {
+    /* the SBP code of a bias is the RTCM signal ID */
+    sbp_code_biases->biases[i].code = sat->signals[i].signal_id;
+    sbp_code_biases->biases[i].value = sat->signals[i].code_bias;
+  }
+  return sizeof(*sbp_code_biases) + n_biases * sizeof(code_biases_content_t);
+}
+
+/* Pack the phase biases of a satellite, returns the payload length */
+static u8 phase_biases_to_sbp(const rtcm_msg_phase_bias *msg,
+                              const rtcm_msg_ssr_phase_bias_sat *sat,
+                              const gps_time_sec_t *t,
+                              u8 constellation,
+                              u8 *buffer) {
+  msg_ssr_phase_biases_t *sbp_phase_biases = (msg_ssr_phase_biases_t *)buffer;
+  sbp_phase_biases->time = *t;
+  sbp_phase_biases->sid.sat = sat->sat_id;
+  sbp_phase_biases->sid.code = ssr_code(constellation);
+  sbp_phase_biases->update_interval = msg->header.update_interval;
+  sbp_phase_biases->iod_ssr = msg->header.iod_ssr;
+  sbp_phase_biases->dispersive_bias = msg->dispersive_bias_consistency;
+  sbp_phase_biases->mw_consistency = msg->mw_consistency;
+  sbp_phase_biases->yaw = sat->yaw_angle;
+  sbp_phase_biases->yaw_rate = sat->yaw_rate;
+
+  u8 n_biases = sat->num_phase_biases;
+  if (n_biases > RTCM3_SSR_MAX_PHASE_BIASES) {
+    n_biases = RTCM3_SSR_MAX_PHASE_BIASES;
+  }
+  for (u8 i = 0; i < n_biases; i++) {
+    const rtcm_msg_ssr_phase_bias_sig *signal = &sat->signals[i];
+    phase_biases_content_t *bias = &sbp_phase_biases->biases[i];
+    bias->code = signal->signal_id;
+    bias->integer_indicator = signal->integer_indicator;
+    bias->widelane_integer_indicator = signal->widelane_indicator;
+    bias->discontinuity_counter = signal->discontinuity_indicator;
+    bias->bias = signal->phase_bias;
+  }
+  return sizeof(*sbp_phase_biases) +
+         n_biases * sizeof(phase_biases_content_t);
+}
+
+/* Stored corrections of a satellite for an update of the given IOD SSR, NULL
+ * if the satellite cannot be stored */
+static struct rtcm3_ssr_sat *store_sat(u8 constellation,
+                                       u8 sat_id,
+                                       u8 iod_ssr,
+                                       struct rtcm3_ssr_store *store) {
+  if (sat_id >= RTCM3_SSR_MAX_SATS) {
+    return NULL;
+  }
+  struct rtcm3_ssr_sat *sat = &store->sats[constellation][sat_id];
+
+  /* corrections of another issue of the SSR solution are not consistent
+   * with the new one */
+  const msg_ssr_code_biases_t *code_biases =
+      (const msg_ssr_code_biases_t *)sat->code_biases;
+  const msg_ssr_phase_biases_t *phase_biases =
+      (const msg_ssr_phase_biases_t *)sat->phase_biases;
+  if ((sat->has_orbit_clock && sat->orbit_clock.iod_ssr != iod_ssr) ||
+      (0 != sat->code_biases_len && code_biases->iod_ssr != iod_ssr) ||
+      (0 != sat->phase_biases_len && phase_biases->iod_ssr != iod_ssr)) {
+    sat->has_orbit_clock = false;
+    sat->code_biases_len = 0;
+    sat->phase_biases_len = 0;
+  }
+  sat->updated = true;
+  return sat;
+}
+
+/* Send out the satellites updated in the open epoch of a constellation, with
+ * all their corrections. A late part of an epoch already sent out only
+ * carries the kinds it brought, the rest went out with the epoch. */
+static void send_ssr_epoch(u8 constellation, struct rtcm3_sbp_state *state) {
+  struct rtcm3_ssr_store *store = state->ssr_store;
+  struct rtcm3_ssr_epoch *epoch = &store->epochs[constellation];
+  assert(epoch->open);
+  u8 kinds = epoch->sent ? epoch->kinds
+                         : (RTCM3_SSR_ORBIT_CLOCK | RTCM3_SSR_CODE_BIASES |
+                            RTCM3_SSR_PHASE_BIASES);
+
+  for (u8 sat_id = 0; sat_id < RTCM3_SSR_MAX_SATS; sat_id++) {
+    struct rtcm3_ssr_sat *sat = &store->sats[constellation][sat_id];
+    if (!sat->updated) {
+      continue;
+    }
+    sat->updated = false;
+    if (sat->has_orbit_clock && 0 != (kinds & RTCM3_SSR_ORBIT_CLOCK)) {
+      send_sbp_message(SBP_MSG_SSR_ORBIT_CLOCK,
+                       (u8)sizeof(sat->orbit_clock),
+                       (u8 *)&sat->orbit_clock,
+                       GLOBAL_SENDER_ID,
+                       state);
+    }
+    if (0 != sat->code_biases_len && 0 != (kinds & RTCM3_SSR_CODE_BIASES)) {
+      send_sbp_message(SBP_MSG_SSR_CODE_BIASES,
+                       sat->code_biases_len,
+                       sat->code_biases,
+                       GLOBAL_SENDER_ID,
+                       state);
+    }
+    if (0 != sat->phase_biases_len &&
+        0 != (kinds & RTCM3_SSR_PHASE_BIASES)) {
+      send_sbp_message(SBP_MSG_SSR_PHASE_BIASES,
+                       sat->phase_biases_len,
+                       sat->phase_biases,
+                       GLOBAL_SENDER_ID,
+                       state);
+    }
+  }
+
+  /* the kinds of a late part of the epoch are expected along with the rest */
+  if (epoch->sent) {
+    epoch->expected_kinds |= epoch->kinds;
+  } else {
+    epoch->expected_kinds = epoch->kinds;
+  }
+  epoch->sent = true;
+  epoch->open = false;
+
+  /* the corrections of the epoch go out in a single batch where possible */
+  rtcm2sbp_flush_batch(state);
+}
+
+/* Open the epoch of an SSR message, sending out the previous one */
+static void ssr_epoch_begin(u8 constellation,
+                            u32 epoch_time,
+                            struct rtcm3_sbp_state *state) {
+  struct rtcm3_ssr_epoch *epoch = &state->ssr_store->epochs[constellation];
+  if (epoch->open && epoch->epoch_time != epoch_time) {
+    send_ssr_epoch(constellation, state);
+  }
+  if (!epoch->open) {
+    if (epoch->epoch_time != epoch_time) {
+      epoch->sent = false;
+    }
+    epoch->open = true;
+    epoch->epoch_time = epoch_time;
+    epoch->kinds = 0;
+    epoch->kinds_done = 0;
+  }
+}
+
+/* Account for an SSR message in its epoch, sending the epoch out once it is
+ * complete */
+static void ssr_epoch_end(u8 constellation,
+                          u8 kind,
+                          bool multi_message,
+                          struct rtcm3_sbp_state *state) {
+  struct rtcm3_ssr_epoch *epoch = &state->ssr_store->epochs[constellation];
+  epoch->kinds |= kind;
+  if (!multi_message) {
+    epoch->kinds_done |= kind;
+  }
+
+  /* a late part of an epoch already sent out goes out on its own */
+  u8 expected = epoch->sent ? 0 : epoch->expected_kinds;
+  if (epoch->kinds_done == epoch->kinds &&
+      (epoch->kinds & expected) == expected) {
+    send_ssr_epoch(constellation, state);
+  }
+}
+
+void rtcm3_ssr_orbit_clock_to_sbp(const rtcm_msg_orbit_clock *msg,
+                                  struct rtcm3_sbp_state *state) {
+  const rtcm_msg_ssr_header *header = &msg->header;
+  u8 constellation = ssr_constellation(header->message_num);
+  gps_time_sec_t t;
+  if (!ssr_time(header, constellation, &t, state)) {
+    return;
+  }
+
+  struct rtcm3_ssr_store *store = state->ssr_store;
+  if (NULL != store) {
+    ssr_epoch_begin(constellation, header->epoch_time, state);
+  }
+  for (u8 i = 0; i < header->num_sats && i < MAX_SSR_SATELLITES; i++) {
+    const rtcm_msg_ssr_orbit_clock_sat *sat = &msg->orbit_clock[i];
+    if (NULL == store) {
+      msg_ssr_orbit_clock_t sbp_orbit_clock;
+      orbit_clock_to_sbp(header, sat, &t, constellation, &sbp_orbit_clock);
+      send_sbp_message(SBP_MSG_SSR_ORBIT_CLOCK,
+                       (u8)sizeof(sbp_orbit_clock),
+                       (u8 *)&sbp_orbit_clock,
+                       GLOBAL_SENDER_ID,
+                       state);
+      continue;
+    }
+    struct rtcm3_ssr_sat *stored =
+        store_sat(constellation, sat->sat_id, header->iod_ssr, store);
+    if (NULL != stored) {
+      orbit_clock_to_sbp(header, sat, &t, constellation, &stored->orbit_clock);
+      stored->has_orbit_clock = true;
+    }
+  }
+  if (NULL != store) {
+    ssr_epoch_end(
+        constellation, RTCM3_SSR_ORBIT_CLOCK, header->multi_message, state);
+  }
+}
+
+void rtcm3_ssr_code_bias_to_sbp(const rtcm_msg_code_bias *msg,
+                                struct rtcm3_sbp_state *state) {
+  const rtcm_msg_ssr_header *header = &msg->header;
+  u8 constellation = ssr_constellation(header->message_num);
+  gps_time_sec_t t;
+  if (!ssr_time(header, constellation, &t, state)) {
+    return;
+  }
+
+  struct rtcm3_ssr_store *store = state->ssr_store;
+  if (NULL != store) {
+    ssr_epoch_begin(constellation, header->epoch_time, state);
+  }
+  for (u8 i = 0; i < header->num_sats && i < MAX_SSR_SATELLITES; i++) {
+    const rtcm_msg_ssr_code_bias_sat *sat = &msg->sats[i];
+    if (NULL == store) {
+      u8 buffer[RTCM3_SSR_CODE_BIASES_SIZE];
+      u8 len = code_biases_to_sbp(header, sat, &t, constellation, buffer);
+      send_sbp_message(
+          SBP_MSG_SSR_CODE_BIASES, len, buffer, GLOBAL_SENDER_ID, state);
+      continue;
+    }
+    struct rtcm3_ssr_sat *stored =
+        store_sat(constellation, sat->sat_id, header->iod_ssr, store);
+    if (NULL != stored) {
+      stored->code_biases_len = code_biases_to_sbp(
+          header, sat, &t, constellation, stored->code_biases);
+    }
+  }
+  if (NULL != store) {
+    ssr_epoch_end(
+        constellation, RTCM3_SSR_CODE_BIASES, header->multi_message, state);
+  }
+}
+
+void rtcm3_ssr_phase_bias_to_sbp(const rtcm_msg_phase_bias *msg,
+                                 struct rtcm3_sbp_state *state) {
+  const rtcm_msg_ssr_header *header = &msg->header;
+  u8 constellation = ssr_constellation(header->message_num);
+  gps_time_sec_t t;
+  if (!ssr_time(header, constellation, &t, state)) {
+    return;
+  }
+
+  struct rtcm3_ssr_store *store = state->ssr_store;
+  if (NULL != store) {
+    ssr_epoch_begin(constellation, header->epoch_time, state);
+  }
+  for (u8 i = 0; i < header->num_sats && i < MAX_SSR_SATELLITES; i++) {
+    const rtcm_msg_ssr_phase_bias_sat *sat = &msg->sats[i];
+    if (NULL == store) {
+      u8 buffer[RTCM3_SSR_PHASE_BIASES_SIZE];
+      u8 len = phase_biases_to_sbp(msg, sat, &t, constellation, buffer);
+      send_sbp_message(
+          SBP_MSG_SSR_PHASE_BIASES, len, buffer, GLOBAL_SENDER_ID, state);
+      continue;
+    }
+    struct rtcm3_ssr_sat *stored =
+        store_sat(constellation, sat->sat_id, header->iod_ssr, store);
+    if (NULL != stored) {
+      stored->phase_biases_len = phase_biases_to_sbp(
+          msg, sat, &t, constellation, stored->phase_biases);
+    }
+  }
+  if (NULL != store) {
+    ssr_epoch_end(
+        constellation, RTCM3_SSR_PHASE_BIASES, header->multi_message, state);
+  }
+}
+
+/** Keep the SSR corrections per satellite and send them out as consistent
+ * sets.
+ *
+ * Without a store the orbit and clock, code bias and phase bias corrections
+ * of the 1059, 1060, 1065, 1066, 1265 and 1266 messages are sent out as they
+ * arrive. With one they are merged per satellite and held until the SSR epoch
+ * of the constellation is complete, that is until the last message of every
+ * kind the previous epoch contained arrived. Every satellite with new
+ * corrections is then sent out with all its corrections of the same IOD SSR,
+ * in a single batch with a batch callback. Messages of an epoch arriving after
+ * it was sent out are sent on their own, without repeating the corrections
+ * already sent. Corrections of another IOD SSR are dropped when a satellite
+ * is updated. An epoch is also sent out when the next one starts.
+ *
+ * The storage is provided by the caller, nothing is allocated while
+ * converting. The previous store is flushed first. Passing NULL turns the
+ * store off.
+ *
+ * \param store Correction store
+ * \param state Converter state
+ */
+void rtcm2sbp_set_ssr_store(struct rtcm3_ssr_store *store,
+                            struct rtcm3_sbp_state *state) {
+  rtcm2sbp_flush_ssr_store(state);
+  if (NULL != store) {
+    memset(store, 0, sizeof(*store));
+  }
+  state->ssr_store = store;
+}
+
+/** Send out the SSR epochs being collected by the correction store.
+ *
+ * \param state Converter state
+ */
+void rtcm2sbp_flush_ssr_store(struct rtcm3_sbp_state *state) {
+  if (NULL == state->ssr_store) {
+    return;
+  }
+  for (u8 i = 0; i < RTCM3_SSR_CONSTELLATIONS; i++) {
+    if (state->ssr_store->epochs[i].open) {
+      send_ssr_epoch(i, state);
+    }
+  }
+}
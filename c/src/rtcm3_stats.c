@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <bits.h>
+#include <string.h>
+#include <time.h>
+#include "rtcm3_sbp_internal.h"
+
+/* The statistics are written only by the thread decoding frames and read by
+ * any thread through a sequence lock: the writer makes stats_seq odd while it
+ * updates a group of counters, a reader copies the counters and retries if
+ * the count was odd or changed meanwhile. The write sections only cover the
+ * counter updates and never a callback, so a reader waits at most for a few
+ * stores and a callback may read the statistics itself. The counters
+ * themselves are accessed with relaxed atomics so that no access is torn. */
+
+#define LATENCY_SUB_BUCKETS (1u << RTCM2SBP_LATENCY_SUB_BUCKET_BITS)
+
+/* Increment a counter, within a write section */
+void rtcm3_stats_inc(u32 *counter) {
+  __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+/* Clear a statistics structure, which consists of u32 counters only */
+void rtcm3_stats_clear(void *stats, size_t size) {
+  assert(size % sizeof(u32) == 0);
+  u32 *counters = stats;
+  for (size_t i = 0; i < size / sizeof(u32); i++) {
+    __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+  }
+}
+
+static void stats_copy(void *dst, const void *src, size_t size) {
+  assert(size % sizeof(u32) == 0);
+  u32 *to = dst;
+  const u32 *from = src;
+  for (size_t i = 0; i < size / sizeof(u32); i++) {
+    to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+  }
+}
+
+/* Start updating the statistics, the write sections do not nest */
+void rtcm3_stats_write_begin(struct rtcm3_sbp_state *state) {
+  assert(0 == (state->stats_seq & 1));
+  __atomic_store_n(&state->stats_seq, state->stats_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void rtcm3_stats_write_end(struct rtcm3_sbp_state *state) {
+  __atomic_store_n(&state->stats_seq, state->stats_seq + 1, __ATOMIC_RELEASE);
+}
+
+static u32 stats_read_begin(const struct rtcm3_sbp_state *state) {
+  u32 seq;
+  while ((seq = __atomic_load_n(&state->stats_seq, __ATOMIC_ACQUIRE)) & 1) {
+    /* counters are being updated */
+  }
+  return seq;
+}
+
+static bool stats_read_valid(const struct rtcm3_sbp_state *state, u32 seq) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&state->stats_seq, __ATOMIC_RELAXED) == seq;
+}
+
+void rtcm3_count_event(rtcm2sbp_event_t event,
+                       struct rtcm3_station_state *station,
+                       struct rtcm3_sbp_state *state) {
+  assert(event < RTCM2SBP_EVENT_COUNT);
+  rtcm3_stats_write_begin(state);
+  rtcm3_stats_inc(&state->stats.events[event]);
+  rtcm3_stats_inc(&station->stats.events[event]);
+  rtcm3_stats_write_end(state);
+}
+
+/* Count an event that does not belong to a station */
+void rtcm3_count_state_event(rtcm2sbp_event_t event,
+                             struct rtcm3_sbp_state *state) {
+  assert(event < RTCM2SBP_EVENT_COUNT);
+  rtcm3_stats_write_begin(state);
+  rtcm3_stats_inc(&state->stats.events[event]);
+  rtcm3_stats_write_end(state);
+}
+
+void rtcm3_count_decode_error(const uint8_t *msg,
+                              struct rtcm3_sbp_state *state) {
+  u16 msg_type = getbitu(msg, 0, 12);
+  if (msg_type >= RTCM3_MSG_TYPE_MIN && msg_type <= RTCM3_MSG_TYPE_MAX) {
+    rtcm3_stats_write_begin(state);
+    rtcm3_stats_inc(&state->stats.decode_errors[msg_type - RTCM3_MSG_TYPE_MIN]);
+    rtcm3_stats_write_end(state);
+  }
+}
+
+u16 rtcm3_latency_bucket(u32 elapsed_ns) {
+  if (elapsed_ns < LATENCY_SUB_BUCKETS) {
+    return elapsed_ns;
+  }
+  u8 msb = 31 - __builtin_clz(elapsed_ns);
+  u8 shift = msb - RTCM2SBP_LATENCY_SUB_BUCKET_BITS;
+  u32 bucket = (shift + 1) * LATENCY_SUB_BUCKETS +
+               ((elapsed_ns >> shift) & (LATENCY_SUB_BUCKETS - 1));
+  return (bucket < RTCM2SBP_LATENCY_BUCKETS) ? bucket
+                                             : RTCM2SBP_LATENCY_BUCKETS - 1;
+}
+
+/* Lowest conversion time counted in the bucket */
+u32 rtcm3_latency_bucket_ns(u16 bucket) {
+  assert(bucket < RTCM2SBP_LATENCY_BUCKETS);
+  if (bucket < LATENCY_SUB_BUCKETS) {
+    return bucket;
+  }
+  u8 shift = bucket / LATENCY_SUB_BUCKETS - 1;
+  return (LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << shift;
+}
+
+u64 rtcm3_monotonic_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u64)now.tv_sec * 1000000000u + (u64)now.tv_nsec;
+}
+
+/* Message types that carry the station ID right after the message number */
+static bool has_station_id(u16 msg_type) {
+  return (msg_type >= 1001 && msg_type <= 1013) || msg_type == 1029 ||
+         msg_type == 1033 || msg_type == 1230 ||
+         (msg_type >= MSM_MSG_TYPE_MIN && msg_type <= MSM_MSG_TYPE_MAX);
+}
+
+/* Count a converted frame and its conversion time */
+void rtcm3_record_frame(u16 msg_type,
+                        const uint8_t *msg,
+                        u32 elapsed_ns,
+                        struct rtcm3_sbp_state *state) {
+  rtcm3_stats_write_begin(state);
+  if (msg_type >= RTCM3_MSG_TYPE_MIN && msg_type <= RTCM3_MSG_TYPE_MAX) {
+    rtcm3_stats_inc(&state->stats.frames[msg_type - RTCM3_MSG_TYPE_MIN]);
+  } else {
+    rtcm3_stats_inc(&state->stats.frames_other);
+  }
+  u16 bucket = rtcm3_latency_bucket(elapsed_ns);
+  rtcm3_stats_inc(&state->stats.latency.counts[bucket]);
+
+  if (has_station_id(msg_type)) {
+    u16 stn_id = getbitu(msg, MSM_STATION_ID_BIT_OFFSET, 12);
+    struct rtcm3_station_state *station = rtcm3_find_station(stn_id, state);
+    if (NULL != station) {
+      rtcm3_stats_inc(&station->stats.frames);
+      rtcm3_stats_inc(&station->stats.latency.counts[bucket]);
+    }
+  }
+  rtcm3_stats_write_end(state);
+}
+
+/** Take a snapshot of the converter statistics.
+ *
+ * Can be called from another thread while frames are being decoded, or from
+ * a callback. It only waits for a counter update in progress and never blocks
+ * the decoding thread. The counters of a frame are updated as it is
+ * converted, so a snapshot taken meanwhile may hold part of them.
+ *
+ * \param state Converter state
+ * \param stats Output statistics
+ */
+void rtcm2sbp_get_stats(const struct rtcm3_sbp_state *state,
+                        struct rtcm2sbp_stats *stats) {
+  u32 seq;
+  do {
+    seq = stats_read_begin(state);
+    stats_copy(stats, &state->stats, sizeof(*stats));
+  } while (!stats_read_valid(state, seq));
+}
+
+/** Take a snapshot of the statistics of one station.
+ *
+ * Without a station pool all stations share one state, whose statistics are
+ * returned for any station ID. A station evicted from the pool loses its
+ * statistics.
+ *
+ * \param stn_id RTCM station ID
+ * \param state Converter state
+ * \param stats Output statistics
+ * \return false if the station is not known
+ */
+bool rtcm2sbp_get_station_stats(u16 stn_id,
+                                const struct rtcm3_sbp_state *state,
+                                struct rtcm2sbp_station_stats *stats) {
+  u32 seq;
+  bool found;
+  do {
+    seq = stats_read_begin(state);
+    const struct rtcm3_station_state *station = NULL;
+    if (NULL == state->stations) {
+      station = &state->station;
+    }
+    for (u8 i = 0; i < state->max_stations && NULL == station; i++) {
+      const struct rtcm3_station_state *candidate = &state->stations[i];
+      if (__atomic_load_n(&candidate->in_use, __ATOMIC_RELAXED) &&
+          __atomic_load_n(&candidate->stn_id, __ATOMIC_RELAXED) == stn_id) {
+        station = candidate;
+      }
+    }
+    found = (NULL != station);
+    if (found) {
+      stats_copy(stats, &station->stats, sizeof(*stats));
+    }
+  } while (!stats_read_valid(state, seq));
+  return found;
+}
+
+/** Clear the statistics of the converter and all its stations.
+ *
+ * Must be called from the thread decoding the frames.
+ *
+ * \param state Converter state
+ */
+void rtcm2sbp_reset_stats(struct rtcm3_sbp_state *state) {
+  rtcm3_stats_write_begin(state);
+  rtcm3_stats_clear(&state->stats, sizeof(state->stats));
+  rtcm3_stats_clear(&state->station.stats, sizeof(state->station.stats));
+  for (u8 i = 0; i < state->max_stations; i++) {
+    rtcm3_stats_clear(&state->stations[i].stats,
+                      sizeof(state->stations[i].stats));
+  }
+  rtcm3_stats_write_end(state);
+}
+
+/** Conversion time below which the given fraction of the frames fall.
+ *
+ * \param histogram Conversion time histogram
+ * \param percentile Percentile in the range 0 to 100
+ * \return Upper bound of the histogram bucket the percentile falls in, in ns,
+ *         or 0 if the histogram is empty
+ */
+u32 rtcm2sbp_latency_percentile_ns(
+    const struct rtcm2sbp_latency_histogram *histogram, double percentile) {
+  u64 total = 0;
+  for (u16 i = 0; i < RTCM2SBP_LATENCY_BUCKETS; i++) {
+    total += histogram->counts[i];
+  }
+  if (0 == total) {
+    return 0;
+  }
+
+  u64 count = 0;
+  for (u16 i = 0; i < RTCM2SBP_LATENCY_BUCKETS - 1; i++) {
+    count += histogram->counts[i];
+    if (count * 100.0 >= percentile * total) {
+      return rtcm3_latency_bucket_ns(i + 1);
+    }
+  }
+  return UINT32_MAX;
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "rtcm3_sbp_internal.h"
+
+/* CRC-16-CCITT lookup table, polynomial 0x1021 */
+static const u16 crc16tab[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7, 0x8108,
+    0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF, 0x1231, 0x0210,
+    0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6, 0x9339, 0x8318, 0xB37B,
+    0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE, 0x2462, 0x3443, 0x0420, 0x1401,
+    0x64E6, 0x74C7, 0x44A4, 0x5485, 0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE,
+    0xF5CF, 0xC5AC, 0xD58D, 0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6,
+    0x5695, 0x46B4, 0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D,
+    0xC7BC, 0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B, 0x5AF5,
+    0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12, 0xDBFD, 0xCBDC,
+    0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A, 0x6CA6, 0x7C87, 0x4CE4,
+    0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41, 0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD,
+    0xAD2A, 0xBD0B, 0x8D68, 0x9D49, 0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13,
+    0x2E32, 0x1E51, 0x0E70, 0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A,
+    0x9F59, 0x8F78, 0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E,
+    0xE16F, 0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E, 0x02B1,
+    0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256, 0xB5EA, 0xA5CB,
+    0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D, 0x34E2, 0x24C3, 0x14A0,
+    0x0481, 0x7466, 0x6447, 0x5424, 0x4405, 0xA7DB, 0xB7FA, 0x8799, 0x97B8,
+    0xE75F, 0xF77E, 0xC71D, 0xD73C, 0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657,
+    0x7676, 0x4615, 0x5634, 0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9,
+    0xB98A, 0xA9AB, 0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882,
+    0x28A3, 0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92, 0xFD2E,
+    0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9, 0x7C26, 0x6C07,
+    0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1, 0xEF1F, 0xFF3E, 0xCF5D,
+    0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8, 0x6E17, 0x7E36, 0x4E55, 0x5E74,
+    0x2E93, 0x3EB2, 0x0ED1, 0x1EF0};
+
+/** Calculate the CRC-16-CCITT of a buffer, continuing from a previous value.
+ *
+ * \param buf Buffer to calculate the CRC over
+ * \param len Number of bytes in the buffer
+ * \param crc CRC of the preceding data, 0 for a new calculation
+ * \return Updated CRC
+ */
+u16 sbp_crc16(const u8 *buf, u32 len, u16 crc) {
+  for (u32 i = 0; i < len; i++) {
+    crc = (u16)(crc << 8) ^ crc16tab[((crc >> 8) ^ buf[i]) & 0xff];
+  }
+  return crc;
+}
+
+/* Move the reader to the start of the buffer once it has read everything
+ * before the end, and to the start of an empty buffer so that the frames
+ * have the most room before the end */
+static void ring_wrap(struct rtcm3_sbp_ring *ring) {
+  if (ring->write < ring->read && ring->read == ring->wrap_end) {
+    ring->read = 0;
+  }
+  if (ring->read == ring->write && !ring->reserved) {
+    ring->read = 0;
+    ring->write = 0;
+  }
+}
+
+/** Set up a ring buffer for framed SBP output.
+ *
+ * \param ring Ring buffer
+ * \param buffer Storage of the ring, used as is without any allocation
+ * \param size Size of the storage, at least SBP_FRAME_MAX_SIZE for any
+ *             message to fit
+ */
+void rtcm2sbp_ring_init(struct rtcm3_sbp_ring *ring, u8 *buffer, u32 size) {
+  assert(NULL != buffer);
+  memset(ring, 0, sizeof(*ring));
+  ring->buffer = buffer;
+  ring->size = size;
+}
+
+/** Write the converted messages as SBP frames into a ring buffer.
+ *
+ * Once set, neither cb_rtcm_to_sbp nor the batch callback are called.
+ * Instead every message is framed with its preamble, header and CRC straight
+ * into the ring, the observation messages are packed in place. The frames
+ * are read out with rtcm2sbp_ring_peek and rtcm2sbp_ring_consume between
+ * the calls to the converter. When the ring is full the frames are dropped
+ * and counted in ring->dropped and the RTCM2SBP_EVENT_OUTPUT_FULL event.
+ * Passing NULL returns to the callbacks.
+ *
+ * \param ring Ring buffer, see rtcm2sbp_ring_init
+ * \param state Converter state
+ */
+void rtcm2sbp_set_frame_ring(struct rtcm3_sbp_ring *ring,
+                             struct rtcm3_sbp_state *state) {
+  rtcm2sbp_flush_batch(state);
+  state->frame_ring = ring;
+}
+
+/** Reserve room for a frame in the ring.
+ *
+ * The payload is written straight into the ring and the frame finished with
+ * rtcm2sbp_ring_commit, there can only be one reservation at a time.
+ *
+ * \param ring Ring buffer
+ * \param max_len Largest payload that will be written
+ * \return Where to write the payload, NULL if the ring is full
+ */
+u8 *rtcm2sbp_ring_reserve(struct rtcm3_sbp_ring *ring, u8 max_len) {
+  assert(!ring->reserved);
+  ring_wrap(ring);
+
+  u32 frame_size = SBP_FRAME_HEADER_SIZE + max_len + SBP_FRAME_CRC_SIZE;
+  u32 offset;
+  if (ring->write >= ring->read) {
+    /* free up to the end of the buffer and before the reader, which the
+     * writer must not catch up with */
+    if (ring->size - ring->write >= frame_size) {
+      offset = ring->write;
+    } else if (ring->read > frame_size) {
+      offset = 0;
+    } else {
+      ring->dropped++;
+      return NULL;
+    }
+  } else if (ring->read - ring->write > frame_size) {
+    offset = ring->write;
+  } else {
+    ring->dropped++;
+    return NULL;
+  }
+
+  ring->reserved = true;
+  ring->reserved_offset = offset;
+  ring->reserved_len = max_len;
+  return &ring->buffer[offset + SBP_FRAME_HEADER_SIZE];
+}
+
+/** Finish the frame of the reservation.
+ *
+ * \param ring Ring buffer
+ * \param msg_id SBP message type
+ * \param sender_id SBP sender ID
+ * \param len Length of the payload written, up to the reserved length
+ */
+void rtcm2sbp_ring_commit(struct rtcm3_sbp_ring *ring,
+                          u16 msg_id,
+                          u16 sender_id,
+                          u8 len) {
+  assert(ring->reserved);
+  assert(len <= ring->reserved_len);
+
+  u8 *frame = &ring->buffer[ring->reserved_offset];
+  frame[0] = SBP_FRAME_PREAMBLE;
+  frame[1] = (u8)msg_id;
+  frame[2] = (u8)(msg_id >> 8);
+  frame[3] = (u8)sender_id;
+  frame[4] = (u8)(sender_id >> 8);
+  frame[5] = len;
+  /* the CRC covers everything but the preamble */
+  u16 crc = sbp_crc16(&frame[1], SBP_FRAME_HEADER_SIZE - 1 + len, 0);
+  frame[SBP_FRAME_HEADER_SIZE + len] = (u8)crc;
+  frame[SBP_FRAME_HEADER_SIZE + len + 1] = (u8)(crc >> 8);
+
+  if (ring->reserved_offset != ring->write) {
+    /* the writer went back to the start */
+    ring->wrap_end = ring->write;
+  }
+  ring->write =
+      ring->reserved_offset + SBP_FRAME_HEADER_SIZE + len + SBP_FRAME_CRC_SIZE;
+  ring->reserved = false;
+}
+
+/** Frame a message into the ring.
+ *
+ * \param ring Ring buffer
+ * \param msg_id SBP message type
+ * \param sender_id SBP sender ID
+ * \param len Length of the payload
+ * \param payload Payload
+ * \return false if the ring is full and the message was dropped
+ */
+bool rtcm2sbp_ring_write(struct rtcm3_sbp_ring *ring,
+                         u16 msg_id,
+                         u16 sender_id,
+                         u8 len,
+                         const u8 *payload) {
+  u8 *dest = rtcm2sbp_ring_reserve(ring, len);
+  if (NULL == dest) {
+    return false;
+  }
+  memcpy(dest, payload, len);
+  rtcm2sbp_ring_commit(ring, msg_id, sender_id, len);
+  return true;
+}
+
+/** Next framed bytes to read from the ring.
+ *
+ * \param ring Ring buffer
+ * \param data Start of the bytes
+ * \return Number of bytes that can be read in one go, there may be more
+ *         at the start of the buffer once these are consumed
+ */
+u32 rtcm2sbp_ring_peek(struct rtcm3_sbp_ring *ring, const u8 **data) {
+  ring_wrap(ring);
+  *data = &ring->buffer[ring->read];
+  if (ring->write < ring->read) {
+    return ring->wrap_end - ring->read;
+  }
+  return ring->write - ring->read;
+}
+
+/** Release bytes read from the ring.
+ *
+ * \param ring Ring buffer
+ * \param len Number of bytes read, up to what rtcm2sbp_ring_peek returned
+ */
+void rtcm2sbp_ring_consume(struct rtcm3_sbp_ring *ring, u32 len) {
+  ring->read += len;
+  ring_wrap(ring);
+}
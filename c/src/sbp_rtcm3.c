@@ -0,0 +1,1202 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <rtcm3_msm_utils.h>
+#include <string.h>
+#include "rtcm3_sbp_internal.h"
+#include "sbp_rtcm3.h"
+
+/* Pseudorange ambiguities of the legacy observation messages */
+#define PRUNIT_GPS 299792.458
+#define PRUNIT_GLO 599584.916
+
+#define GPS_L1_HZ 1.57542e9
+#define GPS_L2_HZ 1.22760e9
+#define GPS_L5_HZ 1.17645e9
+#define GLO_L1_HZ 1.602e9
+#define GLO_L1_DELTA_HZ 0.5625e6
+#define GLO_L2_HZ 1.246e9
+#define GLO_L2_DELTA_HZ 0.4375e6
+#define BDS2_B1_HZ 1.561098e9
+#define BDS2_B2_HZ 1.20714e9
+#define GAL_E1_HZ 1.57542e9
+#define GAL_E6_HZ 1.27875e9
+#define GAL_E7_HZ 1.20714e9
+#define GAL_E8_HZ 1.191795e9
+#define GAL_E5_HZ 1.17645e9
+
+/* First SBP satellite numbers of the constellations not starting at 1 */
+#define SBP_SBAS_FIRST_PRN 120
+#define SBP_QZS_FIRST_PRN 193
+
+#define MSM_SAT_INVALID 0xFF
+#define MSM_ROUGH_RANGE_INVALID 0xFF
+#define CELL_EMPTY 0xFF
+
+#define WEEK_MS ((s64)SEC_IN_WEEK * SECS_MS)
+#define DAY_MS ((s64)SEC_IN_DAY * SECS_MS)
+
+/* Bit writer accumulating up to 63 bits and storing them a 32 bit word at a
+ * time */
+struct bit_writer {
+  u8 *buff;
+  u16 size;
+  u16 byte;
+  u64 acc;
+  u8 n_bits;
+  bool overflow;
+};
+
+static void bits_init(struct bit_writer *writer, u8 *buff, u16 size) {
+  writer->buff = buff;
+  writer->size = size;
+  writer->byte = 0;
+  writer->acc = 0;
+  writer->n_bits = 0;
+  writer->overflow = false;
+}
+
+static void bits_store(struct bit_writer *writer, u8 value) {
+  if (writer->byte < writer->size) {
+    writer->buff[writer->byte] = value;
+  } else {
+    writer->overflow = true;
+  }
+  writer->byte++;
+}
+
+static void bits_put(struct bit_writer *writer, u8 len, u32 value) {
+  assert(len > 0 && len <= 32);
+  u64 mask = (1ull << len) - 1;
+  writer->acc = (writer->acc << len) | (value & mask);
+  writer->n_bits += len;
+  if (writer->n_bits >= 32) {
+    writer->n_bits -= 32;
+    u32 word = (u32)(writer->acc >> writer->n_bits);
+    bits_store(writer, (u8)(word >> 24));
+    bits_store(writer, (u8)(word >> 16));
+    bits_store(writer, (u8)(word >> 8));
+    bits_store(writer, (u8)word);
+  }
+}
+
+static void bits_puts(struct bit_writer *writer, u8 len, s32 value) {
+  bits_put(writer, len, (u32)value);
+}
+
+/* fields longer than 32 bits, such as the 38 bit ECEF coordinates */
+static void bits_puts64(struct bit_writer *writer, u8 len, s64 value) {
+  assert(len > 32 && len <= 64);
+  bits_put(writer, len - 32, (u32)((u64)value >> 32));
+  bits_put(writer, 32, (u32)value);
+}
+
+/* Flush the remaining bits padded with zeros to a whole byte, return the
+ * message length or 0 if it did not fit the buffer */
+static u16 bits_finish(struct bit_writer *writer) {
+  while (writer->n_bits >= 8) {
+    writer->n_bits -= 8;
+    bits_store(writer, (u8)(writer->acc >> writer->n_bits));
+  }
+  if (writer->n_bits > 0) {
+    bits_store(writer, (u8)(writer->acc << (8 - writer->n_bits)));
+    writer->n_bits = 0;
+  }
+  return writer->overflow ? 0 : writer->byte;
+}
+
+/* Scale a value to an integer field of the given width, returning the
+ * reserved invalid value (only the sign bit set) if it does not fit */
+static s32 scale_signed(double value, double resolution, u8 bits) {
+  s32 limit = (s32)(1u << (bits - 1));
+  double scaled = round(value / resolution);
+  if (scaled <= -limit || scaled >= limit) {
+    return -limit;
+  }
+  return (s32)scaled;
+}
+
+/* Lock time indicator DF013 of the legacy observation messages */
+static u8 to_legacy_lock(double lock_time_s) {
+  u32 t = (u32)lock_time_s;
+  if (t < 24) {
+    return t;
+  } else if (t < 72) {
+    return (t + 24) / 2;
+  } else if (t < 168) {
+    return (t + 120) / 4;
+  } else if (t < 360) {
+    return (t + 408) / 8;
+  } else if (t < 744) {
+    return (t + 1176) / 16;
+  } else if (t < 937) {
+    return (t + 3096) / 32;
+  }
+  return 127;
+}
+
+/* Extended lock time indicator DF407 of MSM6 and MSM7, each doubling of the
+ * lock time above 64 ms covers 32 indicator values */
+static u16 to_msm_lock_ex(double lock_time_s) {
+  u32 t = (u32)(lock_time_s * SECS_MS);
+  if (t < 64) {
+    return t;
+  }
+  for (u8 k = 0; k < 21; k++) {
+    if (t < (128u << k)) {
+      return (t >> (k + 1)) + 32 * (k + 1);
+    }
+  }
+  return 704;
+}
+
+static double sbp_pseudorange_m(const packed_obs_content_t *obs) {
+  return obs->P / MSG_OBS_P_MULTIPLIER;
+}
+
+static double sbp_carrier_phase_cyc(const packed_obs_content_t *obs) {
+  return obs->L.i + obs->L.f / MSG_OBS_LF_MULTIPLIER;
+}
+
+static double sbp_doppler_hz(const packed_obs_content_t *obs) {
+  return obs->D.i + obs->D.f / MSG_OBS_DF_MULTIPLIER;
+}
+
+static double sbp_cnr_dbhz(const packed_obs_content_t *obs) {
+  return obs->cn0 / MSG_OBS_CN0_MULTIPLIER;
+}
+
+static bool glo_fcn_known(const u8 glo_sv_id_fcn_map[], u8 sat) {
+  return sat >= GLO_FIRST_PRN && sat <= GLO_LAST_PRN &&
+         glo_sv_id_fcn_map[sat] <= MSM_GLO_MAX_FCN;
+}
+
+static double glo_frequency(bool l2, u8 rtcm_fcn) {
+  s8 fcn = (s8)rtcm_fcn - MSM_GLO_FCN_OFFSET;
+  return l2 ? GLO_L2_HZ + fcn * GLO_L2_DELTA_HZ
+            : GLO_L1_HZ + fcn * GLO_L1_DELTA_HZ;
+}
+
+/* MSM location of an SBP signal */
+struct msm_signal {
+  constellation_t cons;
+  /* 0-based index in the satellite mask */
+  u8 sat_index;
+  /* 1-based signal ID of DF395 */
+  u8 signal_id;
+  double wavelength_m;
+};
+
+static bool sbp_to_msm_signal(const sbp_gnss_signal_t *sid,
+                              const u8 glo_sv_id_fcn_map[],
+                              struct msm_signal *signal) {
+  double frequency;
+  u8 first_prn = 1;
+  switch ((code_t)sid->code) {
+    case CODE_GPS_L1CA:
+      signal->cons = CONSTELLATION_GPS;
+      signal->signal_id = 2;
+      frequency = GPS_L1_HZ;
+      break;
+    case CODE_GPS_L1P:
+      signal->cons = CONSTELLATION_GPS;
+      signal->signal_id = 3;
+      frequency = GPS_L1_HZ;
+      break;
+    case CODE_GPS_L2P:
+      signal->cons = CONSTELLATION_GPS;
+      signal->signal_id = 9;
+      frequency = GPS_L2_HZ;
+      break;
+    case CODE_GPS_L2CM:
+      signal->cons = CONSTELLATION_GPS;
+      signal->signal_id = 15;
+      frequency = GPS_L2_HZ;
+      break;
+    case CODE_GPS_L2CL:
+      signal->cons = CONSTELLATION_GPS;
+      signal->signal_id = 16;
+      frequency = GPS_L2_HZ;
+      break;
+    case CODE_GPS_L2CX:
+      signal->cons = CONSTELLATION_GPS;
+      signal->signal_id = 17;
+      frequency = GPS_L2_HZ;
+      break;
+    case CODE_GPS_L5I:
+      signal->cons = CONSTELLATION_GPS;
+      signal->signal_id = 22;
+      frequency = GPS_L5_HZ;
+      break;
+    case CODE_GPS_L5Q:
+      signal->cons = CONSTELLATION_GPS;
+      signal->signal_id = 23;
+      frequency = GPS_L5_HZ;
+      break;
+    case CODE_GPS_L5X:
+      signal->cons = CONSTELLATION_GPS;
+      signal->signal_id = 24;
+      frequency = GPS_L5_HZ;
+      break;
+    case CODE_SBAS_L1CA:
+      signal->cons = CONSTELLATION_SBAS;
+      signal->signal_id = 2;
+      frequency = GPS_L1_HZ;
+      first_prn = SBP_SBAS_FIRST_PRN;
+      break;
+    case CODE_GLO_L1OF:
+    case CODE_GLO_L1P:
+    case CODE_GLO_L2OF:
+    case CODE_GLO_L2P: {
+      if (!glo_fcn_known(glo_sv_id_fcn_map, sid->sat)) {
+        return false;
+      }
+      bool l2 = (sid->code == CODE_GLO_L2OF || sid->code == CODE_GLO_L2P);
+      bool p_code = (sid->code == CODE_GLO_L1P || sid->code == CODE_GLO_L2P);
+      signal->cons = CONSTELLATION_GLO;
+      signal->signal_id = (l2 ? 8 : 2) + (p_code ? 1 : 0);
+      frequency = glo_frequency(l2, glo_sv_id_fcn_map[sid->sat]);
+      break;
+    }
+    case CODE_BDS2_B1:
+      signal->cons = CONSTELLATION_BDS2;
+      signal->signal_id = 2;
+      frequency = BDS2_B1_HZ;
+      break;
+    case CODE_BDS2_B2:
+      signal->cons = CONSTELLATION_BDS2;
+      signal->signal_id = 14;
+      frequency = BDS2_B2_HZ;
+      break;
+    case CODE_GAL_E1B:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 4;
+      frequency = GAL_E1_HZ;
+      break;
+    case CODE_GAL_E1C:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 2;
+      frequency = GAL_E1_HZ;
+      break;
+    case CODE_GAL_E1X:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 5;
+      frequency = GAL_E1_HZ;
+      break;
+    case CODE_GAL_E6B:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 10;
+      frequency = GAL_E6_HZ;
+      break;
+    case CODE_GAL_E6C:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 8;
+      frequency = GAL_E6_HZ;
+      break;
+    case CODE_GAL_E6X:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 11;
+      frequency = GAL_E6_HZ;
+      break;
+    case CODE_GAL_E7I:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 14;
+      frequency = GAL_E7_HZ;
+      break;
+    case CODE_GAL_E7Q:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 15;
+      frequency = GAL_E7_HZ;
+      break;
+    case CODE_GAL_E7X:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 16;
+      frequency = GAL_E7_HZ;
+      break;
+    case CODE_GAL_E8:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 20;
+      frequency = GAL_E8_HZ;
+      break;
+    case CODE_GAL_E5I:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 22;
+      frequency = GAL_E5_HZ;
+      break;
+    case CODE_GAL_E5Q:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 23;
+      frequency = GAL_E5_HZ;
+      break;
+    case CODE_GAL_E5X:
+      signal->cons = CONSTELLATION_GAL;
+      signal->signal_id = 24;
+      frequency = GAL_E5_HZ;
+      break;
+    case CODE_QZS_L1CA:
+      signal->cons = CONSTELLATION_QZS;
+      signal->signal_id = 2;
+      frequency = GPS_L1_HZ;
+      first_prn = SBP_QZS_FIRST_PRN;
+      break;
+    case CODE_QZS_L2CM:
+      signal->cons = CONSTELLATION_QZS;
+      signal->signal_id = 15;
+      frequency = GPS_L2_HZ;
+      first_prn = SBP_QZS_FIRST_PRN;
+      break;
+    case CODE_QZS_L2CL:
+      signal->cons = CONSTELLATION_QZS;
+      signal->signal_id = 16;
+      frequency = GPS_L2_HZ;
+      first_prn = SBP_QZS_FIRST_PRN;
+      break;
+    case CODE_QZS_L2CX:
+      signal->cons = CONSTELLATION_QZS;
+      signal->signal_id = 17;
+      frequency = GPS_L2_HZ;
+      first_prn = SBP_QZS_FIRST_PRN;
+      break;
+    case CODE_QZS_L5I:
+      signal->cons = CONSTELLATION_QZS;
+      signal->signal_id = 22;
+      frequency = GPS_L5_HZ;
+      first_prn = SBP_QZS_FIRST_PRN;
+      break;
+    case CODE_QZS_L5Q:
+      signal->cons = CONSTELLATION_QZS;
+      signal->signal_id = 23;
+      frequency = GPS_L5_HZ;
+      first_prn = SBP_QZS_FIRST_PRN;
+      break;
+    case CODE_QZS_L5X:
+      signal->cons = CONSTELLATION_QZS;
+      signal->signal_id = 24;
+      frequency = GPS_L5_HZ;
+      first_prn = SBP_QZS_FIRST_PRN;
+      break;
+    case CODE_INVALID:
+    case CODE_COUNT:
+    default:
+      return false;
+  }
+
+  if (sid->sat < first_prn ||
+      sid->sat - first_prn >= MSM_SATELLITE_MASK_SIZE) {
+    return false;
+  }
+  signal->sat_index = sid->sat - first_prn;
+  signal->wavelength_m = CLIGHT / frequency;
+  return true;
+}
+
+/* Message number of MSM1 for each constellation */
+static u16 msm_base_msg_num(constellation_t cons) {
+  switch (cons) {
+    case CONSTELLATION_GPS:
+      return 1070;
+    case CONSTELLATION_GLO:
+      return 1080;
+    case CONSTELLATION_GAL:
+      return 1090;
+    case CONSTELLATION_SBAS:
+      return 1100;
+    case CONSTELLATION_QZS:
+      return 1110;
+    case CONSTELLATION_BDS2:
+      return 1120;
+    case CONSTELLATION_INVALID:
+    case CONSTELLATION_COUNT:
+    default:
+      return 0;
+  }
+}
+
+static u32 wrap_week_ms(s64 ms) {
+  ms %= WEEK_MS;
+  if (ms < 0) {
+    ms += WEEK_MS;
+  }
+  return (u32)ms;
+}
+
+/* GLO time of day in ms, and day of week when requested */
+static u32 glo_tod_ms(u32 gps_tow_ms, s8 leap_seconds, u8 *day_of_week) {
+  u32 glo_ms = wrap_week_ms((s64)gps_tow_ms +
+                            (s64)UTC_SU_OFFSET * SEC_IN_HOUR * SECS_MS -
+                            (s64)leap_seconds * SECS_MS);
+  if (NULL != day_of_week) {
+    *day_of_week = (u8)(glo_ms / DAY_MS);
+  }
+  return (u32)(glo_ms % DAY_MS);
+}
+
+/* Epoch time field of the MSM header, DF004 and its equivalents */
+static u32 msm_epoch_time(constellation_t cons,
+                          u32 gps_tow_ms,
+                          const struct sbp_rtcm3_state *state) {
+  switch (cons) {
+    case CONSTELLATION_GLO: {
+      u8 day_of_week;
+      u32 tod = glo_tod_ms(gps_tow_ms, state->leap_seconds, &day_of_week);
+      return ((u32)day_of_week << 27) | tod;
+    }
+    case CONSTELLATION_BDS2:
+      return wrap_week_ms((s64)gps_tow_ms - BDS_SECOND_TO_GPS_SECOND * SECS_MS);
+    case CONSTELLATION_GPS:
+    case CONSTELLATION_SBAS:
+    case CONSTELLATION_QZS:
+    case CONSTELLATION_GAL:
+    case CONSTELLATION_INVALID:
+    case CONSTELLATION_COUNT:
+    default:
+      return gps_tow_ms;
+  }
+}
+
+/** Convert the GPS or GLO observations of an SBP epoch into a legacy RTCM
+ * observation message.
+ *
+ * The constellation is selected by rtcm_obs->header.msg_num, which has to be
+ * set by the caller. Satellites without a valid L1 pseudorange cannot be
+ * expressed in the legacy messages and are left out.
+ *
+ * \param sbp_obs Observations of the epoch
+ * \param n_obs Number of observations
+ * \param glo_sv_id_fcn_map GLO FCN map in RTCM representation
+ * \param rtcm_obs Message to fill in
+ * \return Number of satellites in the message
+ */
+u8 sbp_to_rtcm3_obs(const packed_obs_content_t *sbp_obs,
+                    u8 n_obs,
+                    const u8 glo_sv_id_fcn_map[],
+                    rtcm_obs_message *rtcm_obs) {
+  bool glo = glo_obs_message(rtcm_obs->header.msg_num);
+  u8 n_sat = 0;
+
+  for (u8 i = 0; i < n_obs; i++) {
+    const packed_obs_content_t *obs = &sbp_obs[i];
+    u8 freq;
+    u8 code;
+    switch (obs->sid.code) {
+      case CODE_GPS_L1CA:
+      case CODE_GLO_L1OF:
+        freq = L1_FREQ;
+        code = 0;
+        break;
+      case CODE_GPS_L1P:
+      case CODE_GLO_L1P:
+        freq = L1_FREQ;
+        code = 1;
+        break;
+      case CODE_GPS_L2CM:
+      case CODE_GPS_L2CL:
+      case CODE_GPS_L2CX:
+      case CODE_GLO_L2OF:
+        freq = L2_FREQ;
+        code = 0;
+        break;
+      case CODE_GPS_L2P:
+      case CODE_GLO_L2P:
+        freq = L2_FREQ;
+        code = 1;
+        break;
+      default:
+        continue;
+    }
+    bool glo_code = (obs->sid.code == CODE_GLO_L1OF ||
+                     obs->sid.code == CODE_GLO_L1P ||
+                     obs->sid.code == CODE_GLO_L2OF ||
+                     obs->sid.code == CODE_GLO_L2P);
+    if (glo != glo_code) {
+      continue;
+    }
+    if (glo && !glo_fcn_known(glo_sv_id_fcn_map, obs->sid.sat)) {
+      continue;
+    }
+    if (!glo && (obs->sid.sat < 1 || obs->sid.sat > 32)) {
+      continue;
+    }
+
+    rtcm_sat_data *sat = NULL;
+    for (u8 j = 0; j < n_sat; j++) {
+      if (rtcm_obs->sats[j].svId == obs->sid.sat) {
+        sat = &rtcm_obs->sats[j];
+        break;
+      }
+    }
+    if (NULL == sat) {
+      /* the satellite count is a 5 bit field */
+      if (n_sat >= RTCM_MAX_SATS - 1) {
+        continue;
+      }
+      sat = &rtcm_obs->sats[n_sat++];
+      memset(sat, 0, sizeof(*sat));
+      sat->svId = obs->sid.sat;
+      sat->fcn = glo ? glo_sv_id_fcn_map[obs->sid.sat] : 0;
+    }
+
+    rtcm_freq_data *freq_data = &sat->obs[freq];
+    bool filled = freq_data->flags.valid_pr || freq_data->flags.valid_cp;
+    if (filled && (code != 0 || freq_data->code == 0)) {
+      /* prefer the C/A code when both codes are tracked */
+      continue;
+    }
+
+    freq_data->code = code;
+    freq_data->pseudorange = sbp_pseudorange_m(obs);
+    freq_data->carrier_phase = sbp_carrier_phase_cyc(obs);
+    freq_data->lock = decode_lock_time(obs->lock);
+    freq_data->cnr = sbp_cnr_dbhz(obs);
+    freq_data->flags.valid_pr = (obs->flags & MSG_OBS_FLAGS_CODE_VALID) != 0;
+    freq_data->flags.valid_cp = (obs->flags & MSG_OBS_FLAGS_PHASE_VALID) != 0;
+    freq_data->flags.valid_cnr = obs->cn0 != 0;
+    freq_data->flags.valid_lock = freq_data->flags.valid_cp;
+    freq_data->flags.valid_dop =
+        (obs->flags & MSG_OBS_FLAGS_DOPPLER_VALID) != 0;
+  }
+
+  /* the L1 pseudorange is the reference of all the other observables */
+  u8 n_valid = 0;
+  for (u8 j = 0; j < n_sat; j++) {
+    if (rtcm_obs->sats[j].obs[L1_FREQ].flags.valid_pr) {
+      rtcm_obs->sats[n_valid++] = rtcm_obs->sats[j];
+    }
+  }
+  rtcm_obs->header.n_sat = n_valid;
+  return n_valid;
+}
+
+static void encode_legacy_sat(const rtcm_sat_data *sat,
+                              bool glo,
+                              struct bit_writer *writer) {
+  const rtcm_freq_data *l1 = &sat->obs[L1_FREQ];
+  const rtcm_freq_data *l2 = &sat->obs[L2_FREQ];
+  double prunit = glo ? PRUNIT_GLO : PRUNIT_GPS;
+  double l1_wavelength = CLIGHT / (glo ? glo_frequency(false, sat->fcn)
+                                       : GPS_L1_HZ);
+  double l2_wavelength = CLIGHT / (glo ? glo_frequency(true, sat->fcn)
+                                       : GPS_L2_HZ);
+
+  u32 amb = (u32)floor(l1->pseudorange / prunit);
+  u32 pr1 = (u32)round((l1->pseudorange - amb * prunit) / 0.02);
+  double l1_pseudorange = amb * prunit + pr1 * 0.02;
+
+  s32 ppr1 = -(1 << 19);
+  if (l1->flags.valid_cp) {
+    ppr1 = scale_signed(
+        l1->carrier_phase * l1_wavelength - l1_pseudorange, 0.0005, 20);
+  }
+  s32 pr21 = -(1 << 13);
+  s32 ppr2 = -(1 << 19);
+  if (l2->flags.valid_pr) {
+    pr21 = scale_signed(l2->pseudorange - l1_pseudorange, 0.02, 14);
+  }
+  if (l2->flags.valid_cp) {
+    ppr2 = scale_signed(
+        l2->carrier_phase * l2_wavelength - l1_pseudorange, 0.0005, 20);
+  }
+  u8 cnr1 = l1->flags.valid_cnr ? (u8)fmin(round(l1->cnr * 4), 255) : 0;
+  u8 cnr2 = l2->flags.valid_cnr ? (u8)fmin(round(l2->cnr * 4), 255) : 0;
+  u8 lock1 = l1->flags.valid_lock ? to_legacy_lock(l1->lock) : 0;
+  u8 lock2 = l2->flags.valid_lock ? to_legacy_lock(l2->lock) : 0;
+
+  bits_put(writer, 6, sat->svId);
+  bits_put(writer, 1, l1->code);
+  if (glo) {
+    bits_put(writer, 5, sat->fcn);
+    bits_put(writer, 25, pr1);
+  } else {
+    bits_put(writer, 24, pr1);
+  }
+  bits_puts(writer, 20, ppr1);
+  bits_put(writer, 7, lock1);
+  bits_put(writer, glo ? 7 : 8, amb);
+  bits_put(writer, 8, cnr1);
+  bits_put(writer, 2, l2->code);
+  bits_puts(writer, 14, pr21);
+  bits_puts(writer, 20, ppr2);
+  bits_put(writer, 7, lock2);
+  bits_put(writer, 8, cnr2);
+}
+
+/** Encode a 1004 or 1012 observation message.
+ *
+ * \param rtcm_msg Message to encode
+ * \param buff Output buffer of RTCM3_MAX_MSG_SIZE bytes
+ * \return Length of the message in bytes, 0 if it could not be encoded
+ */
+u16 encode_RTCM_obs(const rtcm_obs_message *rtcm_msg, u8 *buff) {
+  bool glo = glo_obs_message(rtcm_msg->header.msg_num);
+  if (!glo && rtcm_msg->header.msg_num != 1004) {
+    return 0;
+  }
+  if (glo && rtcm_msg->header.msg_num != 1012) {
+    return 0;
+  }
+
+  struct bit_writer writer;
+  bits_init(&writer, buff, RTCM3_MAX_MSG_SIZE);
+  bits_put(&writer, 12, rtcm_msg->header.msg_num);
+  bits_put(&writer, 12, rtcm_msg->header.stn_id);
+  bits_put(&writer, glo ? 27 : 30, rtcm_msg->header.tow_ms);
+  bits_put(&writer, 1, rtcm_msg->header.sync);
+  bits_put(&writer, 5, rtcm_msg->header.n_sat);
+  bits_put(&writer, 1, rtcm_msg->header.div_free);
+  bits_put(&writer, 3, rtcm_msg->header.smooth);
+  for (u8 i = 0; i < rtcm_msg->header.n_sat; i++) {
+    encode_legacy_sat(&rtcm_msg->sats[i], glo, &writer);
+  }
+  return bits_finish(&writer);
+}
+
+/** Encode a 1005 stationary antenna reference point message.
+ *
+ * \param rtcm_msg Message to encode
+ * \param buff Output buffer of RTCM3_MAX_MSG_SIZE bytes
+ * \return Length of the message in bytes
+ */
+u16 encode_RTCM_1005(const rtcm_msg_1005 *rtcm_msg, u8 *buff) {
+  struct bit_writer writer;
+  bits_init(&writer, buff, RTCM3_MAX_MSG_SIZE);
+  bits_put(&writer, 12, 1005);
+  bits_put(&writer, 12, rtcm_msg->stn_id);
+  bits_put(&writer, 6, rtcm_msg->ITRF);
+  bits_put(&writer, 1, rtcm_msg->GPS_ind);
+  bits_put(&writer, 1, rtcm_msg->GLO_ind);
+  bits_put(&writer, 1, rtcm_msg->GAL_ind);
+  bits_put(&writer, 1, rtcm_msg->ref_stn_ind);
+  bits_puts64(&writer, 38, (s64)round(rtcm_msg->arp_x / 0.0001));
+  bits_put(&writer, 1, rtcm_msg->osc_ind);
+  bits_put(&writer, 1, 0);
+  bits_puts64(&writer, 38, (s64)round(rtcm_msg->arp_y / 0.0001));
+  bits_put(&writer, 2, rtcm_msg->quart_cycle_ind);
+  bits_puts64(&writer, 38, (s64)round(rtcm_msg->arp_z / 0.0001));
+  return bits_finish(&writer);
+}
+
+/** Encode a 1230 GLONASS code-phase bias message.
+ *
+ * \param rtcm_msg Message to encode
+ * \param buff Output buffer of RTCM3_MAX_MSG_SIZE bytes
+ * \return Length of the message in bytes
+ */
+u16 encode_RTCM_1230(const rtcm_msg_1230 *rtcm_msg, u8 *buff) {
+  const double biases[] = {rtcm_msg->L1_CA_cpb_meter,
+                           rtcm_msg->L1_P_cpb_meter,
+                           rtcm_msg->L2_CA_cpb_meter,
+                           rtcm_msg->L2_P_cpb_meter};
+  struct bit_writer writer;
+  bits_init(&writer, buff, RTCM3_MAX_MSG_SIZE);
+  bits_put(&writer, 12, 1230);
+  bits_put(&writer, 12, rtcm_msg->stn_id);
+  bits_put(&writer, 1, rtcm_msg->bias_indicator);
+  bits_put(&writer, 3, 0);
+  bits_put(&writer, 4, rtcm_msg->fdma_signal_mask);
+  for (u8 i = 0; i < 4; i++) {
+    /* the mask lists L1 C/A first, in the most significant bit */
+    if (rtcm_msg->fdma_signal_mask & (0x8 >> i)) {
+      bits_puts(&writer, 16, scale_signed(biases[i], 0.02, 16));
+    }
+  }
+  return bits_finish(&writer);
+}
+
+/* Observations of one MSM message, cells are ordered by satellite then
+ * signal as in the cell mask */
+struct msm_cells {
+  u8 n_sats;
+  u8 n_sigs;
+  u8 sat_index[MSM_SATELLITE_MASK_SIZE];
+  u8 signal_id[MSM_SIGNAL_MASK_SIZE];
+  u8 obs[MSM_MAX_CELLS];
+  double wavelength_m[MSM_MAX_CELLS];
+};
+
+static u16 encode_msm(const struct msm_cells *cells,
+                      constellation_t cons,
+                      msm_enum msm_type,
+                      bool multiple,
+                      const struct sbp_rtcm3_state *state,
+                      u8 *buff) {
+  bool msm7 = (MSM7 == msm_type);
+  u64 sat_mask = 0;
+  for (u8 i = 0; i < cells->n_sats; i++) {
+    sat_mask |= 1ull << (MSM_SATELLITE_MASK_SIZE - 1 - cells->sat_index[i]);
+  }
+  u32 sig_mask = 0;
+  for (u8 i = 0; i < cells->n_sigs; i++) {
+    sig_mask |= 1u << (MSM_SIGNAL_MASK_SIZE - cells->signal_id[i]);
+  }
+
+  struct bit_writer writer;
+  bits_init(&writer, buff, RTCM3_MAX_MSG_SIZE);
+  bits_put(&writer, 12, msm_base_msg_num(cons) + (u16)msm_type);
+  bits_put(&writer, 12, state->sender_id & 0xFFF);
+  bits_put(&writer, 30, msm_epoch_time(cons, state->obs_time.tow, state));
+  bits_put(&writer, 1, multiple);
+  /* IODS, reserved, clock steering, external clock, divergence free and
+   * smoothing interval are not known from the SBP observations */
+  bits_put(&writer, 3, 0);
+  bits_put(&writer, 7, 0);
+  bits_put(&writer, 2, 0);
+  bits_put(&writer, 2, 0);
+  bits_put(&writer, 1, 0);
+  bits_put(&writer, 3, 0);
+  bits_put(&writer, 32, (u32)(sat_mask >> 32));
+  bits_put(&writer, 32, (u32)sat_mask);
+  bits_put(&writer, 32, sig_mask);
+  u8 n_cells = cells->n_sats * cells->n_sigs;
+  for (u8 i = 0; i < n_cells; i++) {
+    bits_put(&writer, 1, cells->obs[i] != CELL_EMPTY);
+  }
+
+  /* satellite data: the rough range and rate are taken from the first
+   * signal of the satellite that has them */
+  double rough_range_ms[MSM_SATELLITE_MASK_SIZE];
+  s32 rough_rate_m_s[MSM_SATELLITE_MASK_SIZE];
+  for (u8 sat = 0; sat < cells->n_sats; sat++) {
+    rough_range_ms[sat] = -1;
+    rough_rate_m_s[sat] = -(1 << 13);
+    for (u8 sig = 0; sig < cells->n_sigs; sig++) {
+      u8 cell = sat * cells->n_sigs + sig;
+      if (CELL_EMPTY == cells->obs[cell]) {
+        continue;
+      }
+      const packed_obs_content_t *obs = &state->obs[cells->obs[cell]];
+      if (rough_range_ms[sat] < 0 && (obs->flags & MSG_OBS_FLAGS_CODE_VALID)) {
+        double range_ms =
+            round(sbp_pseudorange_m(obs) / RANGE_MS * 1024) / 1024;
+        if (range_ms < MSM_ROUGH_RANGE_INVALID) {
+          rough_range_ms[sat] = range_ms;
+        }
+      }
+      if (rough_rate_m_s[sat] == -(1 << 13) &&
+          (obs->flags & MSG_OBS_FLAGS_DOPPLER_VALID)) {
+        rough_rate_m_s[sat] = scale_signed(
+            -sbp_doppler_hz(obs) * cells->wavelength_m[cell], 1.0, 14);
+      }
+    }
+  }
+
+  for (u8 sat = 0; sat < cells->n_sats; sat++) {
+    bits_put(&writer,
+             8,
+             rough_range_ms[sat] < 0 ? MSM_ROUGH_RANGE_INVALID
+                                     : (u32)floor(rough_range_ms[sat]));
+  }
+  if (msm7) {
+    for (u8 sat = 0; sat < cells->n_sats; sat++) {
+      u8 prn = cells->sat_index[sat] + GLO_FIRST_PRN;
+      bool glo = (CONSTELLATION_GLO == cons);
+      bits_put(&writer, 4, glo ? state->glo_sv_id_fcn_map[prn] : 0);
+    }
+  }
+  for (u8 sat = 0; sat < cells->n_sats; sat++) {
+    double range_ms = rough_range_ms[sat] < 0 ? 0 : rough_range_ms[sat];
+    bits_put(&writer, 10, (u32)round((range_ms - floor(range_ms)) * 1024));
+  }
+  if (msm7) {
+    for (u8 sat = 0; sat < cells->n_sats; sat++) {
+      bits_puts(&writer, 14, rough_rate_m_s[sat]);
+    }
+  }
+
+  /* signal data, each field is written for all the cells in turn */
+  s32 fine_pr[MSM_MAX_CELLS];
+  s32 fine_cp[MSM_MAX_CELLS];
+  u16 lock[MSM_MAX_CELLS];
+  bool hca[MSM_MAX_CELLS];
+  u16 cnr[MSM_MAX_CELLS];
+  s32 fine_rate[MSM_MAX_CELLS];
+  u8 n_signals = 0;
+  u8 pr_bits = msm7 ? 20 : 15;
+  u8 cp_bits = msm7 ? 24 : 22;
+  double pr_res = msm7 ? pow(2, -29) : pow(2, -24);
+  double cp_res = msm7 ? pow(2, -31) : pow(2, -29);
+  for (u8 cell = 0; cell < n_cells; cell++) {
+    if (CELL_EMPTY == cells->obs[cell]) {
+      continue;
+    }
+    const packed_obs_content_t *obs = &state->obs[cells->obs[cell]];
+    u8 sat = cell / cells->n_sigs;
+    bool range_valid = rough_range_ms[sat] >= 0;
+    bool phase_valid = (obs->flags & MSG_OBS_FLAGS_PHASE_VALID) != 0;
+
+    fine_pr[n_signals] = -(1 << (pr_bits - 1));
+    if (range_valid && (obs->flags & MSG_OBS_FLAGS_CODE_VALID)) {
+      fine_pr[n_signals] =
+          scale_signed(sbp_pseudorange_m(obs) / RANGE_MS - rough_range_ms[sat],
+                       pr_res,
+                       pr_bits);
+    }
+    fine_cp[n_signals] = -(1 << (cp_bits - 1));
+    if (range_valid && phase_valid) {
+      double phase_ms =
+          sbp_carrier_phase_cyc(obs) * cells->wavelength_m[cell] / RANGE_MS;
+      fine_cp[n_signals] =
+          scale_signed(phase_ms - rough_range_ms[sat], cp_res, cp_bits);
+    }
+    lock[n_signals] = 0;
+    if (phase_valid) {
+      lock[n_signals] = msm7 ? to_msm_lock_ex(decode_lock_time(obs->lock))
+                             : (obs->lock & 0x0F);
+    }
+    hca[n_signals] =
+        phase_valid && !(obs->flags & MSG_OBS_FLAGS_HALF_CYCLE_KNOWN);
+    cnr[n_signals] = msm7 ? (u16)obs->cn0 * 4
+                          : (u16)fmin(round(sbp_cnr_dbhz(obs)), 63);
+    fine_rate[n_signals] = -(1 << 14);
+    if (rough_rate_m_s[sat] != -(1 << 13) &&
+        (obs->flags & MSG_OBS_FLAGS_DOPPLER_VALID)) {
+      double rate_m_s = -sbp_doppler_hz(obs) * cells->wavelength_m[cell];
+      fine_rate[n_signals] =
+          scale_signed(rate_m_s - rough_rate_m_s[sat], 0.0001, 15);
+    }
+    n_signals++;
+  }
+
+  for (u8 i = 0; i < n_signals; i++) {
+    bits_puts(&writer, pr_bits, fine_pr[i]);
+  }
+  for (u8 i = 0; i < n_signals; i++) {
+    bits_puts(&writer, cp_bits, fine_cp[i]);
+  }
+  for (u8 i = 0; i < n_signals; i++) {
+    bits_put(&writer, msm7 ? 10 : 4, lock[i]);
+  }
+  for (u8 i = 0; i < n_signals; i++) {
+    bits_put(&writer, 1, hca[i]);
+  }
+  for (u8 i = 0; i < n_signals; i++) {
+    bits_put(&writer, msm7 ? 10 : 6, cnr[i]);
+  }
+  if (msm7) {
+    for (u8 i = 0; i < n_signals; i++) {
+      bits_puts(&writer, 15, fine_rate[i]);
+    }
+  }
+  return bits_finish(&writer);
+}
+
+static void send_frame(u16 message_size, struct sbp_rtcm3_state *state) {
+  if (0 == message_size) {
+    return;
+  }
+  state->frame[0] = RTCM3_PREAMBLE;
+  state->frame[1] = (message_size >> 8) & 0x3;
+  state->frame[2] = message_size & 0xFF;
+  u16 crc_index = RTCM3_HEADER_SIZE + message_size;
+  u32 crc = crc24q(state->frame, crc_index, 0);
+  state->frame[crc_index] = (crc >> 16) & 0xFF;
+  state->frame[crc_index + 1] = (crc >> 8) & 0xFF;
+  state->frame[crc_index + 2] = crc & 0xFF;
+  state->cb_sbp_to_rtcm(
+      state->frame, crc_index + RTCM3_CRC_SIZE, state->context);
+}
+
+static void send_legacy_epoch(struct sbp_rtcm3_state *state) {
+  rtcm_obs_message gps_obs;
+  rtcm_obs_message glo_obs;
+  u8 *message = &state->frame[RTCM3_HEADER_SIZE];
+
+  gps_obs.header.msg_num = 1004;
+  glo_obs.header.msg_num = 1012;
+  u8 n_gps = sbp_to_rtcm3_obs(
+      state->obs, state->n_obs, state->glo_sv_id_fcn_map, &gps_obs);
+  u8 n_glo = 0;
+  if (state->leap_second_known) {
+    n_glo = sbp_to_rtcm3_obs(
+        state->obs, state->n_obs, state->glo_sv_id_fcn_map, &glo_obs);
+  }
+
+  if (n_gps > 0) {
+    gps_obs.header.stn_id = state->sender_id & 0xFFF;
+    gps_obs.header.tow_ms = state->obs_time.tow;
+    /* the synchronous flag tells that more messages of the epoch follow */
+    gps_obs.header.sync = n_glo > 0;
+    gps_obs.header.div_free = 0;
+    gps_obs.header.smooth = 0;
+    send_frame(encode_RTCM_obs(&gps_obs, message), state);
+  }
+  if (n_glo > 0) {
+    glo_obs.header.stn_id = state->sender_id & 0xFFF;
+    glo_obs.header.tow_ms =
+        glo_tod_ms(state->obs_time.tow, state->leap_seconds, NULL);
+    glo_obs.header.sync = 0;
+    glo_obs.header.div_free = 0;
+    glo_obs.header.smooth = 0;
+    send_frame(encode_RTCM_obs(&glo_obs, message), state);
+  }
+}
+
+static const constellation_t msm_constellations[] = {CONSTELLATION_GPS,
+                                                     CONSTELLATION_GLO,
+                                                     CONSTELLATION_GAL,
+                                                     CONSTELLATION_SBAS,
+                                                     CONSTELLATION_QZS,
+                                                     CONSTELLATION_BDS2};
+#define N_MSM_CONSTELLATIONS \
+  (sizeof(msm_constellations) / sizeof(msm_constellations[0]))
+
+/* Send one constellation of the epoch, split into as many messages as needed
+ * to stay within 64 cells. Returns the number of messages. */
+static u8 send_msm_constellation(constellation_t cons,
+                                 const struct msm_signal *signals,
+                                 bool dry_run,
+                                 u8 remaining_msgs,
+                                 struct sbp_rtcm3_state *state) {
+  u64 sat_mask = 0;
+  u32 sig_mask = 0;
+  for (u8 i = 0; i < state->n_obs; i++) {
+    if (signals[i].cons == cons) {
+      sat_mask |= 1ull << signals[i].sat_index;
+      sig_mask |= 1u << (signals[i].signal_id - 1);
+    }
+  }
+  if (0 == sat_mask) {
+    return 0;
+  }
+
+  struct msm_cells cells;
+  cells.n_sigs = 0;
+  u8 sig_pos[MSM_SIGNAL_MASK_SIZE + 1];
+  for (u8 id = 1; id <= MSM_SIGNAL_MASK_SIZE; id++) {
+    if (sig_mask & (1u << (id - 1))) {
+      sig_pos[id] = cells.n_sigs;
+      cells.signal_id[cells.n_sigs++] = id;
+    }
+  }
+  u8 sats_per_msg = MSM_MAX_CELLS / cells.n_sigs;
+
+  u8 n_msgs = 0;
+  u8 sat_index = 0;
+  while (sat_index < MSM_SATELLITE_MASK_SIZE) {
+    /* collect the next group of satellites */
+    u8 sat_pos[MSM_SATELLITE_MASK_SIZE];
+    memset(sat_pos, MSM_SAT_INVALID, sizeof(sat_pos));
+    cells.n_sats = 0;
+    for (; sat_index < MSM_SATELLITE_MASK_SIZE && cells.n_sats < sats_per_msg;
+         sat_index++) {
+      if (sat_mask & (1ull << sat_index)) {
+        sat_pos[sat_index] = cells.n_sats;
+        cells.sat_index[cells.n_sats++] = sat_index;
+      }
+    }
+    if (0 == cells.n_sats) {
+      break;
+    }
+    n_msgs++;
+    if (dry_run) {
+      continue;
+    }
+
+    memset(cells.obs, CELL_EMPTY, sizeof(cells.obs));
+    for (u8 i = 0; i < state->n_obs; i++) {
+      if (signals[i].cons != cons ||
+          MSM_SAT_INVALID == sat_pos[signals[i].sat_index]) {
+        continue;
+      }
+      u8 cell = sat_pos[signals[i].sat_index] * cells.n_sigs +
+                sig_pos[signals[i].signal_id];
+      if (CELL_EMPTY == cells.obs[cell]) {
+        cells.obs[cell] = i;
+        cells.wavelength_m[cell] = signals[i].wavelength_m;
+      }
+    }
+
+    msm_enum msm_type = (SBP2RTCM_OUT_MSM7 == state->out_mode) ? MSM7 : MSM4;
+    bool multiple = n_msgs < remaining_msgs;
+    send_frame(encode_msm(&cells,
+                          cons,
+                          msm_type,
+                          multiple,
+                          state,
+                          &state->frame[RTCM3_HEADER_SIZE]),
+               state);
+  }
+  return n_msgs;
+}
+
+static void send_msm_epoch(struct sbp_rtcm3_state *state) {
+  struct msm_signal signals[MAX_OBS_PER_EPOCH];
+  for (u8 i = 0; i < state->n_obs; i++) {
+    if (!sbp_to_msm_signal(
+            &state->obs[i].sid, state->glo_sv_id_fcn_map, &signals[i]) ||
+        (CONSTELLATION_GLO == signals[i].cons && !state->leap_second_known)) {
+      signals[i].cons = CONSTELLATION_INVALID;
+    }
+  }
+
+  /* the multiple message bit is set on all but the last message of the
+   * epoch, so count the messages first */
+  u8 total_msgs = 0;
+  for (u8 i = 0; i < N_MSM_CONSTELLATIONS; i++) {
+    total_msgs +=
+        send_msm_constellation(msm_constellations[i], signals, true, 0, state);
+  }
+  u8 sent_msgs = 0;
+  for (u8 i = 0; i < N_MSM_CONSTELLATIONS; i++) {
+    sent_msgs += send_msm_constellation(
+        msm_constellations[i], signals, false, total_msgs - sent_msgs, state);
+  }
+}
+
+void sbp2rtcm_init(struct sbp_rtcm3_state *state,
+                   void (*cb_sbp_to_rtcm)(u8 *buffer, u16 length, void *context),
+                   void *context) {
+  state->cb_sbp_to_rtcm = cb_sbp_to_rtcm;
+  state->context = context;
+  state->out_mode = SBP2RTCM_OUT_MSM4;
+  state->leap_seconds = 0;
+  state->leap_second_known = false;
+  for (u8 i = 0; i < GLO_LAST_PRN + 1; i++) {
+    state->glo_sv_id_fcn_map[i] = MSM_GLO_FCN_UNKNOWN;
+  }
+  state->sender_id = 0;
+  state->next_seq = 0;
+  state->n_obs = 0;
+}
+
+void sbp2rtcm_set_rtcm_out_mode(sbp2rtcm_out_mode_t out_mode,
+                                struct sbp_rtcm3_state *state) {
+  state->out_mode = out_mode;
+}
+
+void sbp2rtcm_set_leap_second(s8 leap_seconds, struct sbp_rtcm3_state *state) {
+  state->leap_seconds = leap_seconds;
+  state->leap_second_known = true;
+}
+
+void sbp2rtcm_set_glo_fcn(sbp_gnss_signal_t sid,
+                          u8 sbp_fcn,
+                          struct sbp_rtcm3_state *state) {
+  if (sid.sat < GLO_FIRST_PRN || sid.sat > GLO_LAST_PRN) {
+    /* invalid PRN */
+    return;
+  }
+  if (SBP_GLO_FCN_UNKNOWN == sbp_fcn) {
+    state->glo_sv_id_fcn_map[sid.sat] = MSM_GLO_FCN_UNKNOWN;
+  } else {
+    /* in SBP, FCN is 1..14 and in RTCM 0..13 */
+    s8 fcn = sbp_fcn - SBP_GLO_FCN_OFFSET;
+    state->glo_sv_id_fcn_map[sid.sat] = fcn + MSM_GLO_FCN_OFFSET;
+  }
+}
+
+/** Handle an SBP_MSG_OBS message.
+ *
+ * The messages of an epoch are collected until the last one of the sequence
+ * arrives, at which point the epoch is sent out as RTCM. An epoch with a
+ * missing message is dropped.
+ *
+ * \param sender_id SBP sender ID, the RTCM station ID is its lower 12 bits
+ * \param len Length of the message
+ * \param msg SBP_MSG_OBS payload
+ * \param state Converter state
+ */
+void sbp2rtcm_sbp_obs_cb(u16 sender_id,
+                         u8 len,
+                         const u8 msg[],
+                         struct sbp_rtcm3_state *state) {
+  if (len < SBP_HDR_SIZE) {
+    return;
+  }
+  observation_header_t header;
+  memcpy(&header, msg, SBP_HDR_SIZE);
+  u8 count = header.n_obs >> 4;
+  u8 index = header.n_obs & 0x0F;
+  u8 n_obs = (len - SBP_HDR_SIZE) / SBP_OBS_SIZE;
+
+  if (0 == index) {
+    /* start of a new epoch, anything incomplete is dropped */
+    state->obs_time = header.t;
+    state->sender_id = sender_id;
+    state->n_obs = 0;
+  } else if (index != state->next_seq || sender_id != state->sender_id ||
+             header.t.tow != state->obs_time.tow ||
+             header.t.wn != state->obs_time.wn) {
+    state->next_seq = 0;
+    state->n_obs = 0;
+    return;
+  }
+
+  if (state->n_obs + n_obs > MAX_OBS_PER_EPOCH) {
+    n_obs = MAX_OBS_PER_EPOCH - state->n_obs;
+  }
+  memcpy(&state->obs[state->n_obs], &msg[SBP_HDR_SIZE], n_obs * SBP_OBS_SIZE);
+  state->n_obs += n_obs;
+  state->next_seq = index + 1;
+
+  if (state->next_seq >= count) {
+    if (SBP2RTCM_OUT_LEGACY == state->out_mode) {
+      send_legacy_epoch(state);
+    } else {
+      send_msm_epoch(state);
+    }
+    state->next_seq = 0;
+    state->n_obs = 0;
+  }
+}
+
+/** Handle an SBP_MSG_BASE_POS_ECEF message, sent out as a 1005 message.
+ *
+ * \param sender_id SBP sender ID, the RTCM station ID is its lower 12 bits
+ * \param len Length of the message
+ * \param msg SBP_MSG_BASE_POS_ECEF payload
+ * \param state Converter state
+ */
+void sbp2rtcm_base_pos_ecef_cb(u16 sender_id,
+                               u8 len,
+                               const u8 msg[],
+                               struct sbp_rtcm3_state *state) {
+  msg_base_pos_ecef_t sbp_base_pos;
+  if (len < sizeof(sbp_base_pos)) {
+    return;
+  }
+  memcpy(&sbp_base_pos, msg, sizeof(sbp_base_pos));
+
+  rtcm_msg_1005 msg_1005;
+  memset(&msg_1005, 0, sizeof(msg_1005));
+  sbp_to_rtcm3_1005(&sbp_base_pos, &msg_1005);
+  msg_1005.stn_id = sender_id & 0xFFF;
+  msg_1005.GPS_ind = 1;
+  msg_1005.GLO_ind = 1;
+  send_frame(encode_RTCM_1005(&msg_1005, &state->frame[RTCM3_HEADER_SIZE]),
+             state);
+}
+
+/** Handle an SBP_MSG_GLO_BIASES message, sent out as a 1230 message.
+ *
+ * \param sender_id SBP sender ID, the RTCM station ID is its lower 12 bits
+ * \param len Length of the message
+ * \param msg SBP_MSG_GLO_BIASES payload
+ * \param state Converter state
+ */
+void sbp2rtcm_glo_biases_cb(u16 sender_id,
+                            u8 len,
+                            const u8 msg[],
+                            struct sbp_rtcm3_state *state) {
+  msg_glo_biases_t sbp_glo_bias;
+  if (len < sizeof(sbp_glo_bias)) {
+    return;
+  }
+  memcpy(&sbp_glo_bias, msg, sizeof(sbp_glo_bias));
+
+  rtcm_msg_1230 msg_1230;
+  sbp_to_rtcm3_1230(&sbp_glo_bias, &msg_1230);
+  msg_1230.stn_id = sender_id & 0xFFF;
+  send_frame(encode_RTCM_1230(&msg_1230, &state->frame[RTCM3_HEADER_SIZE]),
+             state);
+}
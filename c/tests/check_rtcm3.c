@@ -16,15 +16,18 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <bits.h>
 #include <config.h>
+#include <rtcm3_msm_utils.h>
 #include "../src/rtcm3_sbp_internal.h"
+#include "rtcm3_rtcm3.h"
+#include "sbp_rtcm3.h"
 
 #include "check_suites.h"
 
 /* rtcm helper defines and functions */
 
 #define MAX_FILE_SIZE 2337772
-#define RTCM3_PREAMBLE 0xD3
 
 static double expected_L1CA_bias = 0.0;
 static double expected_L1P_bias = 0.0;
@@ -37,44 +40,8 @@ static u8 previous_num_obs = 0;
 
 static struct rtcm3_sbp_state state;
 
-static const uint32_t crc24qtab[256] = {
-    0x000000, 0x864CFB, 0x8AD50D, 0x0C99F6, 0x93E6E1, 0x15AA1A, 0x1933EC,
-    0x9F7F17, 0xA18139, 0x27CDC2, 0x2B5434, 0xAD18CF, 0x3267D8, 0xB42B23,
-    0xB8B2D5, 0x3EFE2E, 0xC54E89, 0x430272, 0x4F9B84, 0xC9D77F, 0x56A868,
-    0xD0E493, 0xDC7D65, 0x5A319E, 0x64CFB0, 0xE2834B, 0xEE1ABD, 0x685646,
-    0xF72951, 0x7165AA, 0x7DFC5C, 0xFBB0A7, 0x0CD1E9, 0x8A9D12, 0x8604E4,
-    0x00481F, 0x9F3708, 0x197BF3, 0x15E205, 0x93AEFE, 0xAD50D0, 0x2B1C2B,
-    0x2785DD, 0xA1C926, 0x3EB631, 0xB8FACA, 0xB4633C, 0x322FC7, 0xC99F60,
-    0x4FD39B, 0x434A6D, 0xC50696, 0x5A7981, 0xDC357A, 0xD0AC8C, 0x56E077,
-    0x681E59, 0xEE52A2, 0xE2CB54, 0x6487AF, 0xFBF8B8, 0x7DB443, 0x712DB5,
-    0xF7614E, 0x19A3D2, 0x9FEF29, 0x9376DF, 0x153A24, 0x8A4533, 0x0C09C8,
-    0x00903E, 0x86DCC5, 0xB822EB, 0x3E6E10, 0x32F7E6, 0xB4BB1D, 0x2BC40A,
-    0xAD88F1, 0xA11107, 0x275DFC, 0xDCED5B, 0x5AA1A0, 0x563856, 0xD074AD,
-    0x4F0BBA, 0xC94741, 0xC5DEB7, 0x43924C, 0x7D6C62, 0xFB2099, 0xF7B96F,
-    0x71F594, 0xEE8A83, 0x68C678, 0x645F8E, 0xE21375, 0x15723B, 0x933EC0,
-    0x9FA736, 0x19EBCD, 0x8694DA, 0x00D821, 0x0C41D7, 0x8A0D2C, 0xB4F302,
-    0x32BFF9, 0x3E260F, 0xB86AF4, 0x2715E3, 0xA15918, 0xADC0EE, 0x2B8C15,
-    0xD03CB2, 0x567049, 0x5AE9BF, 0xDCA544, 0x43DA53, 0xC596A8, 0xC90F5E,
-    0x4F43A5, 0x71BD8B, 0xF7F170, 0xFB6886, 0x7D247D, 0xE25B6A, 0x641791,
-    0x688E67, 0xEEC29C, 0x3347A4, 0xB50B5F, 0xB992A9, 0x3FDE52, 0xA0A145,
-    0x26EDBE, 0x2A7448, 0xAC38B3, 0x92C69D, 0x148A66, 0x181390, 0x9E5F6B,
-    0x01207C, 0x876C87, 0x8BF571, 0x0DB98A, 0xF6092D, 0x7045D6, 0x7CDC20,
-    0xFA90DB, 0x65EFCC, 0xE3A337, 0xEF3AC1, 0x69763A, 0x578814, 0xD1C4EF,
-    0xDD5D19, 0x5B11E2, 0xC46EF5, 0x42220E, 0x4EBBF8, 0xC8F703, 0x3F964D,
-    0xB9DAB6, 0xB54340, 0x330FBB, 0xAC70AC, 0x2A3C57, 0x26A5A1, 0xA0E95A,
-    0x9E1774, 0x185B8F, 0x14C279, 0x928E82, 0x0DF195, 0x8BBD6E, 0x872498,
-    0x016863, 0xFAD8C4, 0x7C943F, 0x700DC9, 0xF64132, 0x693E25, 0xEF72DE,
-    0xE3EB28, 0x65A7D3, 0x5B59FD, 0xDD1506, 0xD18CF0, 0x57C00B, 0xC8BF1C,
-    0x4EF3E7, 0x426A11, 0xC426EA, 0x2AE476, 0xACA88D, 0xA0317B, 0x267D80,
-    0xB90297, 0x3F4E6C, 0x33D79A, 0xB59B61, 0x8B654F, 0x0D29B4, 0x01B042,
-    0x87FCB9, 0x1883AE, 0x9ECF55, 0x9256A3, 0x141A58, 0xEFAAFF, 0x69E604,
-    0x657FF2, 0xE33309, 0x7C4C1E, 0xFA00E5, 0xF69913, 0x70D5E8, 0x4E2BC6,
-    0xC8673D, 0xC4FECB, 0x42B230, 0xDDCD27, 0x5B81DC, 0x57182A, 0xD154D1,
-    0x26359F, 0xA07964, 0xACE092, 0x2AAC69, 0xB5D37E, 0x339F85, 0x3F0673,
-    0xB94A88, 0x87B4A6, 0x01F85D, 0x0D61AB, 0x8B2D50, 0x145247, 0x921EBC,
-    0x9E874A, 0x18CBB1, 0xE37B16, 0x6537ED, 0x69AE1B, 0xEFE2E0, 0x709DF7,
-    0xF6D10C, 0xFA48FA, 0x7C0401, 0x42FA2F, 0xC4B6D4, 0xC82F22, 0x4E63D9,
-    0xD11CCE, 0x575035, 0x5BC9C3, 0xDD8538};
+static u32 sbp_msg_count = 0;
+static u32 sbp_msg_digest = 0;
 
 /* difference between two sbp time stamps */
 static double sbp_diff_time(const sbp_gps_time_t *end,
@@ -85,12 +52,6 @@ static double sbp_diff_time(const sbp_gps_time_t *end,
   return dt;
 }
 
-static uint32_t crc24q(const uint8_t *buf, uint32_t len, uint32_t crc) {
-  for (uint32_t i = 0; i < len; i++)
-    crc = ((crc << 8) & 0xFFFFFF) ^ crc24qtab[((crc >> 16) ^ buf[i]) & 0xff];
-  return crc;
-}
-
 static void update_obs_time(const msg_obs_t *msg) {
   gps_time_sec_t obs_time = {.tow = msg[0].header.t.tow * MS_TO_S,
                              .wn = msg[0].header.t.wn};
@@ -245,6 +206,69 @@ void sbp_callback_msm_no_gaps(u16 msg_id,
   }
 }
 
+/* keep a running digest of all the SBP messages output */
+void sbp_callback_digest(u16 msg_id, u8 length, u8 *buffer, u16 sender_id) {
+  sbp_msg_count++;
+  sbp_msg_digest = crc24q((u8 *)&msg_id, sizeof(msg_id), sbp_msg_digest);
+  sbp_msg_digest = crc24q((u8 *)&sender_id, sizeof(sender_id), sbp_msg_digest);
+  sbp_msg_digest = crc24q(buffer, length, sbp_msg_digest);
+  if (msg_id == SBP_MSG_OBS) {
+    update_obs_time((msg_obs_t *)buffer);
+  }
+}
+
+/* count the batches and pass the messages on to the digest */
+void sbp_batch_callback_digest(const struct rtcm3_sbp_batch_msg *msgs,
+                               u8 n_msgs,
+                               void *context) {
+  ck_assert_uint_gt(n_msgs, 0);
+  ck_assert_uint_le(n_msgs, SBP_BATCH_MAX_MSGS);
+  (*(u32 *)context)++;
+  for (u8 i = 0; i < n_msgs; i++) {
+    sbp_callback_digest(msgs[i].msg_id,
+                        msgs[i].len,
+                        (u8 *)msgs[i].payload,
+                        msgs[i].sender_id);
+  }
+}
+
+static u32 glo_bias_count = 0;
+static u32 custom_handler_count = 0;
+
+void sbp_callback_count_glo_biases(u16 msg_id,
+                                   u8 length,
+                                   u8 *buffer,
+                                   u16 sender_id) {
+  (void)length;
+  (void)buffer;
+  (void)sender_id;
+  if (msg_id == SBP_MSG_GLO_BIASES) {
+    glo_bias_count++;
+  }
+}
+
+/* count the observation epochs sent out */
+static u32 obs_epoch_count = 0;
+
+void sbp_callback_count_epochs(u16 msg_id,
+                               u8 length,
+                               u8 *buffer,
+                               u16 sender_id) {
+  (void)length;
+  (void)sender_id;
+  if (msg_id == SBP_MSG_OBS &&
+      (((msg_obs_t *)buffer)->header.n_obs & 0x0F) == 0) {
+    obs_epoch_count++;
+  }
+}
+
+void custom_1230_handler(const uint8_t *msg,
+                         struct rtcm3_sbp_state *handler_state) {
+  (void)msg;
+  (void)handler_state;
+  custom_handler_count++;
+}
+
 /* sanity check the length and CRC of the message */
 bool verify_crc(uint8_t *buffer, uint32_t buffer_length) {
   if (buffer_length < 6) {
@@ -265,6 +289,85 @@ bool verify_crc(uint8_t *buffer, uint32_t buffer_length) {
   return (frame_crc == computed_crc);
 }
 
+/* SBP observations of the current epoch going into the SBP to RTCM encoder,
+ * and the decoder of the frames it sends out */
+static struct sbp_rtcm3_state encoder_state;
+static struct rtcm3_sbp_state roundtrip_state;
+static packed_obs_content_t roundtrip_obs[MAX_OBS_PER_EPOCH];
+static u8 roundtrip_n_obs = 0;
+static u32 roundtrip_matched = 0;
+
+/* the legacy messages do not tell the GPS L2 civil codes apart */
+static bool same_signal_code(u8 code, u8 decoded_code) {
+  bool l2c = (code == CODE_GPS_L2CM || code == CODE_GPS_L2CL ||
+              code == CODE_GPS_L2CX);
+  return code == decoded_code || (l2c && decoded_code == CODE_GPS_L2CM);
+}
+
+void sbp_callback_roundtrip_check(u16 msg_id,
+                                  u8 length,
+                                  u8 *buffer,
+                                  u16 sender_id) {
+  (void)sender_id;
+  if (msg_id != SBP_MSG_OBS) {
+    return;
+  }
+  u8 n_obs = (length - sizeof(observation_header_t)) /
+             sizeof(packed_obs_content_t);
+  packed_obs_content_t *obs =
+      (packed_obs_content_t *)(buffer + sizeof(observation_header_t));
+  for (u8 i = 0; i < n_obs; i++) {
+    const packed_obs_content_t *orig = NULL;
+    for (u8 j = 0; j < roundtrip_n_obs; j++) {
+      if (roundtrip_obs[j].sid.sat == obs[i].sid.sat &&
+          same_signal_code(roundtrip_obs[j].sid.code, obs[i].sid.code)) {
+        orig = &roundtrip_obs[j];
+      }
+    }
+    ck_assert_ptr_ne(orig, NULL);
+    ck_assert_int_le(abs((s32)obs[i].P - (s32)orig->P), 1);
+    if ((obs[i].flags & MSG_OBS_FLAGS_PHASE_VALID) &&
+        (orig->flags & MSG_OBS_FLAGS_PHASE_VALID)) {
+      s64 L = (s64)obs[i].L.i * 256 + obs[i].L.f;
+      s64 orig_L = (s64)orig->L.i * 256 + orig->L.f;
+      ck_assert_int_le(llabs(L - orig_L), 2);
+    }
+    if ((obs[i].flags & MSG_OBS_FLAGS_DOPPLER_VALID) &&
+        (orig->flags & MSG_OBS_FLAGS_DOPPLER_VALID)) {
+      s32 D = (s32)obs[i].D.i * 256 + obs[i].D.f;
+      s32 orig_D = (s32)orig->D.i * 256 + orig->D.f;
+      ck_assert_int_le(abs(D - orig_D), 2);
+    }
+    ck_assert_int_le(abs((s32)obs[i].cn0 - (s32)orig->cn0), 4);
+    roundtrip_matched++;
+  }
+}
+
+void rtcm_callback_roundtrip(u8 *frame, u16 length, void *context) {
+  (void)context;
+  ck_assert(verify_crc(frame, length));
+  rtcm2sbp_decode_frame(frame, length - 6, &roundtrip_state);
+}
+
+/* collect the epoch and pass it on to the encoder */
+void sbp_callback_roundtrip(u16 msg_id, u8 length, u8 *buffer, u16 sender_id) {
+  if (msg_id != SBP_MSG_OBS) {
+    return;
+  }
+  observation_header_t *header = (observation_header_t *)buffer;
+  if ((header->n_obs & 0x0F) == 0) {
+    roundtrip_n_obs = 0;
+  }
+  u8 n_obs = (length - sizeof(observation_header_t)) /
+             sizeof(packed_obs_content_t);
+  ck_assert_uint_le(roundtrip_n_obs + n_obs, MAX_OBS_PER_EPOCH);
+  memcpy(&roundtrip_obs[roundtrip_n_obs],
+         buffer + sizeof(observation_header_t),
+         n_obs * sizeof(packed_obs_content_t));
+  roundtrip_n_obs += n_obs;
+  sbp2rtcm_sbp_obs_cb(sender_id, length, buffer, &encoder_state);
+}
+
 void test_RTCM3(
     const char *filename,
     void (*cb_rtcm_to_sbp)(u16 msg_id, u8 length, u8 *buffer, u16 sender_id),
@@ -321,6 +424,39 @@ void test_RTCM3(
   return;
 }
 
+/* feed the file through the streaming framer in fixed size chunks, preceded by
+ * some garbage that looks like the start of a frame */
+void stream_RTCM3(const char *filename, uint32_t chunk_size) {
+  FILE *fp = fopen(filename, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "Can't open input file! %s\n", filename);
+    exit(1);
+  }
+
+  const uint8_t garbage[] = {RTCM3_PREAMBLE, 0x00, RTCM3_PREAMBLE, 0x02, 0x34};
+  rtcm2sbp_process_bytes(garbage, sizeof(garbage), &state);
+
+  uint8_t chunk[4096];
+  ck_assert_uint_le(chunk_size, sizeof(chunk));
+  size_t chunk_length;
+  while ((chunk_length = fread(chunk, 1, chunk_size, fp)) > 0) {
+    rtcm2sbp_process_bytes(chunk, chunk_length, &state);
+  }
+  fclose(fp);
+}
+
+void test_RTCM3_stream(
+    const char *filename,
+    void (*cb_rtcm_to_sbp)(u16 msg_id, u8 length, u8 *buffer, u16 sender_id),
+    gps_time_sec_t current_time,
+    uint32_t chunk_size) {
+  rtcm2sbp_init(&state, cb_rtcm_to_sbp, NULL);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_leap_second(18, &state);
+
+  stream_RTCM3(filename, chunk_size);
+}
+
 void set_expected_bias(double L1CA_bias,
                        double L1P_bias,
                        double L2CA_bias,
@@ -605,6 +741,1178 @@ START_TEST(test_bias_gpp_trm) {
 }
 END_TEST
 
+START_TEST(test_process_bytes) {
+  const char *files[] = {RELATIVE_PATH_PREFIX "/data/RTCM3.bin",
+                         RELATIVE_PATH_PREFIX "/data/msm7.rtcm",
+                         RELATIVE_PATH_PREFIX "/data/jenoba-jrr32m.rtcm3"};
+  const uint32_t chunk_sizes[] = {1, 5, 64, RTCM3_MAX_FRAME_SIZE, 4096};
+
+  for (u8 i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+    sbp_msg_count = 0;
+    sbp_msg_digest = 0;
+    test_RTCM3(files[i], sbp_callback_digest, current_time);
+    u32 expected_count = sbp_msg_count;
+    u32 expected_digest = sbp_msg_digest;
+    ck_assert_uint_gt(expected_count, 0);
+
+    for (u8 j = 0; j < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); j++) {
+      sbp_msg_count = 0;
+      sbp_msg_digest = 0;
+      test_RTCM3_stream(
+          files[i], sbp_callback_digest, current_time, chunk_sizes[j]);
+      ck_assert_uint_eq(sbp_msg_count, expected_count);
+      ck_assert_uint_eq(sbp_msg_digest, expected_digest);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_station_pool) {
+  struct rtcm3_station_state stations[2];
+  rtcm2sbp_init(&state, sbp_callback_digest, NULL);
+  rtcm2sbp_set_station_pool(stations, 2, &state);
+
+  struct rtcm3_station_state *station_1 = rtcm3_get_station(1, &state);
+  struct rtcm3_station_state *station_2 = rtcm3_get_station(2, &state);
+  ck_assert_ptr_ne(station_1, station_2);
+  ck_assert_ptr_eq(rtcm3_get_station(1, &state), station_1);
+
+  /* station 2 is now the least recently used one, so 3 takes its place */
+  struct rtcm3_station_state *station_3 = rtcm3_get_station(3, &state);
+  ck_assert_ptr_eq(station_3, station_2);
+  ck_assert_uint_eq(station_3->stn_id, 3);
+  ck_assert_ptr_eq(rtcm3_get_station(1, &state), station_1);
+  ck_assert_uint_eq(station_1->stn_id, 1);
+
+  /* a pooled converter gives the same output as the default one on a single
+   * station stream */
+  sbp_msg_count = 0;
+  sbp_msg_digest = 0;
+  test_RTCM3(RELATIVE_PATH_PREFIX "/data/msm7.rtcm",
+             sbp_callback_digest,
+             current_time);
+  u32 expected_count = sbp_msg_count;
+  u32 expected_digest = sbp_msg_digest;
+
+  sbp_msg_count = 0;
+  sbp_msg_digest = 0;
+  rtcm2sbp_init(&state, sbp_callback_digest, NULL);
+  rtcm2sbp_set_station_pool(stations, 2, &state);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_leap_second(18, &state);
+  stream_RTCM3(RELATIVE_PATH_PREFIX "/data/msm7.rtcm", RTCM3_MAX_FRAME_SIZE);
+  ck_assert_uint_eq(sbp_msg_count, expected_count);
+  ck_assert_uint_eq(sbp_msg_digest, expected_digest);
+}
+END_TEST
+
+START_TEST(test_batch_callback) {
+  sbp_msg_count = 0;
+  sbp_msg_digest = 0;
+  test_RTCM3(RELATIVE_PATH_PREFIX "/data/RTCM3.bin",
+             sbp_callback_digest,
+             current_time);
+  u32 expected_count = sbp_msg_count;
+  u32 expected_digest = sbp_msg_digest;
+
+  u32 n_batches = 0;
+  sbp_msg_count = 0;
+  sbp_msg_digest = 0;
+  rtcm2sbp_init(&state, NULL, NULL);
+  rtcm2sbp_set_batch_callback(sbp_batch_callback_digest, &n_batches, &state);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_leap_second(18, &state);
+  stream_RTCM3(RELATIVE_PATH_PREFIX "/data/RTCM3.bin", RTCM3_MAX_FRAME_SIZE);
+  rtcm2sbp_flush_batch(&state);
+
+  /* same messages in the same order, in fewer calls */
+  ck_assert_uint_eq(sbp_msg_count, expected_count);
+  ck_assert_uint_eq(sbp_msg_digest, expected_digest);
+  ck_assert_uint_gt(n_batches, 0);
+  ck_assert_uint_lt(n_batches, expected_count);
+}
+END_TEST
+
+START_TEST(test_msg_handlers) {
+  glo_bias_count = 0;
+  test_RTCM3(RELATIVE_PATH_PREFIX "/data/trimble.rtcm",
+             sbp_callback_count_glo_biases,
+             current_time);
+  ck_assert_uint_gt(glo_bias_count, 0);
+
+  /* disabled message types are not converted */
+  glo_bias_count = 0;
+  rtcm2sbp_init(&state, sbp_callback_count_glo_biases, NULL);
+  ck_assert(rtcm2sbp_set_msg_enabled(1033, false, &state));
+  ck_assert(rtcm2sbp_set_msg_enabled(1230, false, &state));
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_leap_second(18, &state);
+  stream_RTCM3(RELATIVE_PATH_PREFIX "/data/trimble.rtcm", RTCM3_MAX_FRAME_SIZE);
+  ck_assert_uint_eq(glo_bias_count, 0);
+
+  /* a custom handler replaces the default one */
+  glo_bias_count = 0;
+  custom_handler_count = 0;
+  rtcm2sbp_init(&state, sbp_callback_count_glo_biases, NULL);
+  ck_assert(rtcm2sbp_set_msg_handler(1230, custom_1230_handler, &state));
+  ck_assert(rtcm2sbp_set_msg_enabled(1033, false, &state));
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_leap_second(18, &state);
+  stream_RTCM3(RELATIVE_PATH_PREFIX "/data/trimble.rtcm", RTCM3_MAX_FRAME_SIZE);
+  ck_assert_uint_eq(glo_bias_count, 0);
+  ck_assert_uint_gt(custom_handler_count, 0);
+
+  ck_assert(rtcm2sbp_get_default_msg_handler(1230) != NULL);
+  ck_assert(rtcm2sbp_get_default_msg_handler(1001) == NULL);
+  ck_assert(!rtcm2sbp_set_msg_enabled(999, false, &state));
+  ck_assert(!rtcm2sbp_set_msg_handler(4094, custom_1230_handler, &state));
+}
+END_TEST
+
+START_TEST(test_disabled_msg_types) {
+  struct rtcm3_station_state stations[2];
+  rtcm2sbp_init(&state, sbp_callback_count_epochs, NULL);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_station_pool(stations, 2, &state);
+  ck_assert(rtcm2sbp_set_msg_enabled(1077, false, &state));
+
+  /* the last MSM message of an epoch from a station sending only disabled
+   * types neither takes the station into the pool nor counts as converted */
+  u8 frame[RTCM3_HEADER_SIZE + 20 + RTCM3_CRC_SIZE];
+  memset(frame, 0, sizeof(frame));
+  frame[0] = RTCM3_PREAMBLE;
+  frame[2] = 20;
+  setbitu(&frame[RTCM3_HEADER_SIZE], 0, 12, 1077);
+  setbitu(&frame[RTCM3_HEADER_SIZE], 12, 12, 5);
+  rtcm2sbp_decode_frame(frame, sizeof(frame), &state);
+  ck_assert(!stations[0].in_use);
+  ck_assert(!stations[1].in_use);
+
+  struct rtcm2sbp_stats stats;
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert_uint_eq(stats.frames[1077 - RTCM3_MSG_TYPE_MIN], 0);
+}
+END_TEST
+
+START_TEST(test_sbp_to_rtcm_roundtrip) {
+  const char *files[] = {RELATIVE_PATH_PREFIX "/data/RTCM3.bin",
+                         RELATIVE_PATH_PREFIX "/data/msm7.rtcm"};
+  const sbp2rtcm_out_mode_t modes[] = {
+      SBP2RTCM_OUT_LEGACY, SBP2RTCM_OUT_MSM4, SBP2RTCM_OUT_MSM7};
+
+  for (u8 i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+    for (u8 j = 0; j < sizeof(modes) / sizeof(modes[0]); j++) {
+      sbp2rtcm_init(&encoder_state, rtcm_callback_roundtrip, NULL);
+      sbp2rtcm_set_rtcm_out_mode(modes[j], &encoder_state);
+      sbp2rtcm_set_leap_second(18, &encoder_state);
+      rtcm2sbp_init(&roundtrip_state, sbp_callback_roundtrip_check, NULL);
+      rtcm2sbp_set_gps_time(&current_time, &roundtrip_state);
+      rtcm2sbp_set_leap_second(18, &roundtrip_state);
+
+      roundtrip_n_obs = 0;
+      roundtrip_matched = 0;
+      test_RTCM3(files[i], sbp_callback_roundtrip, current_time);
+      ck_assert_uint_gt(roundtrip_matched, 0);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_glo_bias_table) {
+  rtcm2sbp_init(&state, NULL, NULL);
+  rtcm_msg_1033 msg_1033;
+  memset(&msg_1033, 0, sizeof(msg_1033));
+  msg_glo_biases_t sbp_glo_bias;
+
+  /* the Geo++ names win over the receiver names they contain */
+  strcpy(msg_1033.rcv_descriptor, "Geo++ GNSMART (GLO=NOV)");
+  rtcm3_1033_to_sbp(&msg_1033, &state.station, &sbp_glo_bias, &state);
+  ck_assert_uint_eq(sbp_glo_bias.mask, 0x9);
+  ck_assert_int_eq(sbp_glo_bias.l1ca_bias,
+                   round(GPP_NOV_BIAS_L1CA_M * GLO_BIAS_RESOLUTION));
+
+  strcpy(msg_1033.rcv_descriptor, "NOV OEM7");
+  rtcm3_1033_to_sbp(&msg_1033, &state.station, &sbp_glo_bias, &state);
+  ck_assert_uint_eq(sbp_glo_bias.mask, 0xF);
+  ck_assert_int_eq(sbp_glo_bias.l1ca_bias,
+                   round(NOVATEL_BIAS_M * GLO_BIAS_RESOLUTION));
+
+  strcpy(msg_1033.rcv_descriptor, "UNKNOWN");
+  rtcm3_1033_to_sbp(&msg_1033, &state.station, &sbp_glo_bias, &state);
+  ck_assert_uint_eq(sbp_glo_bias.mask, 0);
+
+  /* caller provided entries come first and invalidate the cached match */
+  static const struct rtcm2sbp_glo_bias_entry entries[] = {
+      {"OEM7", 0x1, 1.0, 0.0, 0.0, 0.0},
+      {"UNKNOWN", 0xF, 2.0, 2.0, 2.0, 2.0},
+  };
+  ck_assert(rtcm2sbp_set_glo_bias_table(entries, 2, &state));
+  rtcm3_1033_to_sbp(&msg_1033, &state.station, &sbp_glo_bias, &state);
+  ck_assert_uint_eq(sbp_glo_bias.mask, 0xF);
+  ck_assert_int_eq(sbp_glo_bias.l1ca_bias, round(2.0 * GLO_BIAS_RESOLUTION));
+
+  strcpy(msg_1033.rcv_descriptor, "NOV OEM7");
+  rtcm3_1033_to_sbp(&msg_1033, &state.station, &sbp_glo_bias, &state);
+  ck_assert_uint_eq(sbp_glo_bias.mask, 0x1);
+  ck_assert_int_eq(sbp_glo_bias.l1ca_bias, round(1.0 * GLO_BIAS_RESOLUTION));
+
+  /* back to the built in table */
+  ck_assert(rtcm2sbp_set_glo_bias_table(NULL, 0, &state));
+  rtcm3_1033_to_sbp(&msg_1033, &state.station, &sbp_glo_bias, &state);
+  ck_assert_uint_eq(sbp_glo_bias.mask, 0xF);
+
+  ck_assert(!rtcm2sbp_set_glo_bias_table(
+      entries, RTCM3_MAX_GLO_BIAS_ENTRIES, &state));
+}
+END_TEST
+
+static u32 latency_total(const struct rtcm2sbp_latency_histogram *histogram) {
+  u32 total = 0;
+  for (u16 i = 0; i < RTCM2SBP_LATENCY_BUCKETS; i++) {
+    total += histogram->counts[i];
+  }
+  return total;
+}
+
+/* read the statistics from within the conversion */
+static u32 stats_reads = 0;
+
+static void sbp_callback_read_stats(u16 msg_id,
+                                    u8 length,
+                                    u8 *buffer,
+                                    u16 sender_id) {
+  struct rtcm2sbp_stats stats;
+  struct rtcm2sbp_station_stats station_stats;
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert(rtcm2sbp_get_station_stats(0, &state, &station_stats));
+  stats_reads++;
+  sbp_callback_digest(msg_id, length, buffer, sender_id);
+}
+
+START_TEST(test_stats) {
+  test_RTCM3(RELATIVE_PATH_PREFIX "/data/msm7.rtcm",
+             sbp_callback_digest,
+             current_time);
+
+  struct rtcm2sbp_stats stats;
+  rtcm2sbp_get_stats(&state, &stats);
+  u32 frames = stats.frames_other;
+  for (u16 i = 0; i < RTCM3_NUM_MSG_TYPES; i++) {
+    frames += stats.frames[i];
+    ck_assert_uint_le(stats.decode_errors[i], stats.frames[i]);
+  }
+  ck_assert_uint_gt(stats.frames[1077 - RTCM3_MSG_TYPE_MIN], 0);
+  ck_assert_uint_eq(latency_total(&stats.latency), frames);
+  ck_assert_uint_gt(rtcm2sbp_latency_percentile_ns(&stats.latency, 99.0), 0);
+  ck_assert_uint_le(rtcm2sbp_latency_percentile_ns(&stats.latency, 50.0),
+                    rtcm2sbp_latency_percentile_ns(&stats.latency, 99.0));
+
+  /* without a station pool all the stations share the statistics */
+  struct rtcm2sbp_station_stats station_stats;
+  ck_assert(rtcm2sbp_get_station_stats(0, &state, &station_stats));
+  ck_assert_uint_gt(station_stats.frames, 0);
+  ck_assert_uint_le(station_stats.frames, frames);
+  ck_assert_uint_eq(latency_total(&station_stats.latency),
+                    station_stats.frames);
+
+  rtcm2sbp_reset_stats(&state);
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert_uint_eq(stats.frames[1077 - RTCM3_MSG_TYPE_MIN], 0);
+  ck_assert_uint_eq(latency_total(&stats.latency), 0);
+  ck_assert_uint_eq(rtcm2sbp_latency_percentile_ns(&stats.latency, 50.0), 0);
+
+  /* the callbacks can read the statistics without waiting for the frame */
+  stats_reads = 0;
+  test_RTCM3(RELATIVE_PATH_PREFIX "/data/msm7.rtcm",
+             sbp_callback_read_stats,
+             current_time);
+  ck_assert_uint_gt(stats_reads, 0);
+
+  /* the signals of a stream with both legacy and MSM observations are only
+   * sent once */
+  current_time.wn = 2002;
+  current_time.tow = 375900;
+  test_RTCM3(RELATIVE_PATH_PREFIX "/data/mixed-msm-legacy.rtcm",
+             sbp_callback_digest,
+             current_time);
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert_uint_gt(stats.events[RTCM2SBP_EVENT_DUPLICATE_SIGNAL], 0);
+
+  /* a station pool keeps the statistics of each station */
+  struct rtcm3_station_state stations[2];
+  rtcm2sbp_init(&state, sbp_callback_digest, NULL);
+  rtcm2sbp_set_station_pool(stations, 2, &state);
+  ck_assert(!rtcm2sbp_get_station_stats(1, &state, &station_stats));
+}
+END_TEST
+
+START_TEST(test_latency_buckets) {
+  for (u32 ns = 0; ns < (1u << 20); ns++) {
+    u16 bucket = rtcm3_latency_bucket(ns);
+    ck_assert_uint_le(rtcm3_latency_bucket_ns(bucket), ns);
+    ck_assert_uint_gt(rtcm3_latency_bucket_ns(bucket + 1), ns);
+  }
+  ck_assert_uint_eq(rtcm3_latency_bucket(UINT32_MAX),
+                    RTCM2SBP_LATENCY_BUCKETS - 1);
+}
+END_TEST
+
+/* a single satellite legacy GPS message */
+static void add_gps_legacy(u16 msg_num, u32 tow_ms, u8 sync) {
+  rtcm_obs_message msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.header.msg_num = msg_num;
+  msg.header.tow_ms = tow_ms;
+  msg.header.sync = sync;
+  msg.header.n_sat = 1;
+  msg.sats[0].svId = 1;
+  msg.sats[0].obs[L1_FREQ].pseudorange = 2e7;
+  msg.sats[0].obs[L1_FREQ].carrier_phase = 1e8;
+  msg.sats[0].obs[L1_FREQ].flags.valid_pr = 1;
+  msg.sats[0].obs[L1_FREQ].flags.valid_cp = 1;
+  add_gps_obs_to_buffer(&msg, &state);
+}
+
+/* a single satellite 1004 message with the sync flag set */
+static void add_1004(u32 tow_ms) {
+  add_gps_legacy(1004, tow_ms, 1);
+}
+
+START_TEST(test_epoch_completeness) {
+  u32 tow_ms = current_time.tow * SECS_MS;
+
+  /* the sync flag is never cleared, so each epoch waits for the next one
+   * until the message set of the station is learned */
+  rtcm2sbp_init(&state, sbp_callback_count_epochs, NULL);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  obs_epoch_count = 0;
+  for (u8 i = 0; i < EPOCH_LEARN_COUNT; i++) {
+    add_1004(tow_ms + i * SECS_MS);
+    ck_assert_uint_eq(obs_epoch_count, i);
+  }
+  add_1004(tow_ms + EPOCH_LEARN_COUNT * SECS_MS);
+  ck_assert_uint_eq(obs_epoch_count, EPOCH_LEARN_COUNT + 1);
+
+  /* a message arriving after the epoch was sent out is dropped, but the
+   * station now sends more messages, so early sending stops */
+  add_gps_legacy(1002, tow_ms + EPOCH_LEARN_COUNT * SECS_MS, 0);
+  ck_assert_uint_eq(obs_epoch_count, EPOCH_LEARN_COUNT + 1);
+  add_1004(tow_ms + (EPOCH_LEARN_COUNT + 1) * SECS_MS);
+  ck_assert_uint_eq(obs_epoch_count, EPOCH_LEARN_COUNT + 1);
+  add_gps_legacy(1002, tow_ms + (EPOCH_LEARN_COUNT + 1) * SECS_MS, 0);
+  ck_assert_uint_eq(obs_epoch_count, EPOCH_LEARN_COUNT + 2);
+  struct rtcm2sbp_stats stats;
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert_uint_eq(stats.events[RTCM2SBP_EVENT_LEGACY_MSG_DROPPED], 1);
+
+  /* an epoch missing its last message is sent out on the deadline */
+  rtcm2sbp_init(&state, sbp_callback_count_epochs, NULL);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_epoch_deadline(500, &state);
+  obs_epoch_count = 0;
+  add_1004(tow_ms);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  ck_assert_uint_eq(obs_epoch_count, 0);
+  gps_time_sec_t later = current_time;
+  later.tow++;
+  rtcm2sbp_set_gps_time(&later, &state);
+  ck_assert_uint_eq(obs_epoch_count, 1);
+
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert_uint_eq(stats.events[RTCM2SBP_EVENT_EPOCH_DEADLINE], 1);
+}
+END_TEST
+
+/* a single satellite 1004 message from the given station */
+static void add_station_1004_sync(u16 stn_id, u32 tow_ms, u8 sync) {
+  rtcm_obs_message msg_1004;
+  memset(&msg_1004, 0, sizeof(msg_1004));
+  msg_1004.header.msg_num = 1004;
+  msg_1004.header.stn_id = stn_id;
+  msg_1004.header.tow_ms = tow_ms;
+  msg_1004.header.sync = sync;
+  msg_1004.header.n_sat = 1;
+  msg_1004.sats[0].svId = 1;
+  msg_1004.sats[0].obs[L1_FREQ].pseudorange = 2e7;
+  msg_1004.sats[0].obs[L1_FREQ].carrier_phase = 1e8;
+  msg_1004.sats[0].obs[L1_FREQ].flags.valid_pr = 1;
+  msg_1004.sats[0].obs[L1_FREQ].flags.valid_cp = 1;
+  add_gps_obs_to_buffer(&msg_1004, &state);
+}
+
+/* a complete single satellite 1004 epoch from the given station */
+static void add_station_1004(u16 stn_id, u32 tow_ms) {
+  add_station_1004_sync(stn_id, tow_ms, 0);
+}
+
+/* sender and time of the observation epochs sent out */
+#define MAX_MERGED_EPOCHS 16
+static u16 merged_senders[MAX_MERGED_EPOCHS];
+static u32 merged_tows[MAX_MERGED_EPOCHS];
+static u8 merged_n_obs[MAX_MERGED_EPOCHS];
+static u8 n_merged = 0;
+
+static void sbp_callback_merged(u16 msg_id,
+                                u8 length,
+                                u8 *buffer,
+                                u16 sender_id) {
+  const msg_obs_t *sbp_obs = (const msg_obs_t *)buffer;
+  if (msg_id == SBP_MSG_OBS && (sbp_obs->header.n_obs & 0x0F) == 0 &&
+      n_merged < MAX_MERGED_EPOCHS) {
+    merged_senders[n_merged] = sender_id;
+    merged_tows[n_merged] = sbp_obs->header.t.tow;
+    merged_n_obs[n_merged] = (length - SBP_HDR_SIZE) / SBP_OBS_SIZE;
+    n_merged++;
+  }
+}
+
+START_TEST(test_epoch_merger) {
+  u32 tow_ms = current_time.tow * SECS_MS;
+  static struct rtcm3_station_state stations[2];
+  struct rtcm3_merger_slot slots[2];
+  static struct rtcm3_merger_entry entries[2 * 2];
+  /* RTCM station IDs map to SBP sender IDs with the top nibble set */
+  u16 sender_1 = 0xF001;
+  u16 sender_2 = 0xF002;
+
+  rtcm2sbp_init(&state, sbp_callback_merged, NULL);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_station_pool(stations, 2, &state);
+  ck_assert(!rtcm2sbp_set_epoch_merger(
+      slots, 2, entries, RTCM3_MERGER_MAX_STATIONS + 1, 0, &state));
+  ck_assert(rtcm2sbp_set_epoch_merger(slots, 2, entries, 2, 500, &state));
+  n_merged = 0;
+
+  /* the first station is the only one known so its epoch goes straight out,
+   * the second station arrives too late for it */
+  add_station_1004(1, tow_ms);
+  add_station_1004(2, tow_ms);
+  ck_assert_uint_eq(n_merged, 2);
+
+  /* from then on each epoch waits for both stations, even with the second
+   * station still arriving last */
+  add_station_1004(1, tow_ms + SECS_MS);
+  ck_assert_uint_eq(n_merged, 2);
+  add_station_1004(2, tow_ms + SECS_MS);
+  ck_assert_uint_eq(n_merged, 4);
+  ck_assert_uint_eq(merged_senders[2], sender_1);
+  ck_assert_uint_eq(merged_senders[3], sender_2);
+  ck_assert_uint_eq(merged_tows[2], tow_ms + SECS_MS);
+  ck_assert_uint_eq(merged_tows[3], tow_ms + SECS_MS);
+
+  /* a missing station holds the epoch until the deadline, then is no longer
+   * waited for */
+  add_station_1004(1, tow_ms + 2 * SECS_MS);
+  ck_assert_uint_eq(n_merged, 4);
+  gps_time_sec_t later = current_time;
+  later.tow += 3;
+  rtcm2sbp_set_gps_time(&later, &state);
+  ck_assert_uint_eq(n_merged, 5);
+  add_station_1004(1, tow_ms + 3 * SECS_MS);
+  ck_assert_uint_eq(n_merged, 6);
+
+  /* epochs held when the merger is turned off are sent out */
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  add_station_1004(2, tow_ms + 4 * SECS_MS);
+  ck_assert_uint_eq(n_merged, 6);
+  ck_assert(rtcm2sbp_set_epoch_merger(NULL, 0, NULL, 0, 0, &state));
+  ck_assert_uint_eq(n_merged, 7);
+
+  struct rtcm2sbp_stats stats;
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert_uint_eq(stats.events[RTCM2SBP_EVENT_MERGE_LATE], 1);
+  /* the deadline and the last epoch missing the first station */
+  ck_assert_uint_eq(stats.events[RTCM2SBP_EVENT_MERGE_INCOMPLETE], 2);
+
+  /* an epoch a station flushes twice is combined into a single entry, which
+   * leaves the room of the other station, here the second station is held
+   * waiting for the first one */
+  ck_assert(rtcm2sbp_set_epoch_merger(slots, 2, entries, 2, 0, &state));
+  add_station_1004(1, tow_ms + 5 * SECS_MS);
+  add_station_1004(2, tow_ms + 6 * SECS_MS);
+  n_merged = 0;
+  struct rtcm3_station_state *station = rtcm3_get_station(1, &state);
+  station->epoch.t.tow = tow_ms + 7 * SECS_MS;
+  station->epoch.n_obs = 1;
+  station->epoch.sid[0].sat = 1;
+  station->epoch.sid[0].code = CODE_GPS_L1CA;
+  rtcm3_merger_add(station, &state);
+  station->epoch.n_obs = 2;
+  station->epoch.sid[1].sat = 2;
+  station->epoch.sid[1].code = CODE_GPS_L1CA;
+  rtcm3_merger_add(station, &state);
+  station->epoch.n_obs = 0;
+  ck_assert_uint_eq(n_merged, 0);
+  add_station_1004(2, tow_ms + 7 * SECS_MS);
+  ck_assert_uint_eq(n_merged, 3);
+  ck_assert_uint_eq(merged_senders[0], sender_2);
+  ck_assert_uint_eq(merged_senders[1], sender_1);
+  ck_assert_uint_eq(merged_n_obs[1], 2);
+  ck_assert_uint_eq(merged_senders[2], sender_2);
+  ck_assert_uint_eq(merged_tows[2], tow_ms + 7 * SECS_MS);
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert_uint_eq(stats.events[RTCM2SBP_EVENT_MERGE_LATE], 1);
+}
+END_TEST
+
+static u8 n_callback_epochs = 0;
+
+static void epoch_callback_check(const struct rtcm3_obs_epoch *epoch,
+                                 u16 sender_id,
+                                 void *context) {
+  ck_assert_ptr_eq(context, &n_callback_epochs);
+  ck_assert_uint_eq(sender_id, 0xF001);
+  ck_assert_uint_eq(epoch->n_obs, 1);
+  ck_assert_uint_eq(epoch->sid[0].sat, 1);
+  ck_assert_uint_eq(epoch->sid[0].code, CODE_GPS_L1CA);
+
+  double value;
+  ck_assert(rtcm2sbp_obs_pseudorange_m(epoch, 0, &value));
+  ck_assert(fabs(value - 2e7) < 0.02);
+  ck_assert(rtcm2sbp_obs_carrier_phase_cyc(epoch, 0, &value));
+  ck_assert(fabs(value - 1e8) < 1.0 / 256);
+  ck_assert(!rtcm2sbp_obs_doppler_hz(epoch, 0, &value));
+  ck_assert(rtcm2sbp_obs_half_cycle_known(epoch, 0));
+  ck_assert(rtcm2sbp_obs_cn0_dbhz(epoch, 0) == 0.0);
+  n_callback_epochs++;
+}
+
+START_TEST(test_epoch_callback) {
+  u32 tow_ms = current_time.tow * SECS_MS;
+
+  /* the epochs go to the epoch callback instead of SBP_MSG_OBS */
+  rtcm2sbp_init(&state, sbp_callback_count_epochs, NULL);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_epoch_callback(
+      epoch_callback_check, &n_callback_epochs, &state);
+  obs_epoch_count = 0;
+  n_callback_epochs = 0;
+  add_station_1004(1, tow_ms);
+  ck_assert_uint_eq(n_callback_epochs, 1);
+  ck_assert_uint_eq(obs_epoch_count, 0);
+
+  rtcm2sbp_set_epoch_callback(NULL, NULL, &state);
+  add_station_1004(1, tow_ms + SECS_MS);
+  ck_assert_uint_eq(n_callback_epochs, 1);
+  ck_assert_uint_eq(obs_epoch_count, 1);
+}
+END_TEST
+
+/* GPS MSM7 of satellite 1 with L1CA and L2CM observations */
+static void add_station_1077(u16 stn_id, u32 tow_ms, double pseudorange) {
+  rtcm_msm_message msg_1077;
+  memset(&msg_1077, 0, sizeof(msg_1077));
+  msg_1077.header.msg_num = 1077;
+  msg_1077.header.stn_id = stn_id;
+  msg_1077.header.tow_ms = tow_ms;
+  msg_1077.header.satellite_mask[0] = true;
+  /* signals 1C and 2S */
+  msg_1077.header.signal_mask[1] = true;
+  msg_1077.header.signal_mask[14] = true;
+  for (u8 cell = 0; cell < 2; cell++) {
+    msg_1077.header.cell_mask[cell] = true;
+    msg_1077.signals[cell].pseudorange_m = pseudorange;
+    msg_1077.signals[cell].carrier_phase_cyc = 1e8;
+    msg_1077.signals[cell].range_rate_Hz = 100;
+    msg_1077.signals[cell].flags.valid_pr = 1;
+    msg_1077.signals[cell].flags.valid_cp = 1;
+    msg_1077.signals[cell].flags.valid_dop = 1;
+  }
+  add_msm_obs_to_buffer(&msg_1077, &state);
+}
+
+static struct rtcm3_obs_epoch last_epoch;
+static u8 n_stored_epochs = 0;
+
+static void epoch_callback_store(const struct rtcm3_obs_epoch *epoch,
+                                 u16 sender_id,
+                                 void *context) {
+  (void)sender_id;
+  (void)context;
+  last_epoch = *epoch;
+  n_stored_epochs++;
+}
+
+START_TEST(test_duplicate_signals) {
+  u32 tow_ms = current_time.tow * SECS_MS;
+  struct rtcm2sbp_stats stats;
+  double value;
+
+  rtcm2sbp_init(&state, sbp_callback_count_epochs, NULL);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_epoch_callback(epoch_callback_store, NULL, &state);
+  n_stored_epochs = 0;
+
+  /* the MSM observation replaces the legacy one of the same signal, and the
+   * signal only in MSM is added */
+  add_station_1004_sync(1, tow_ms, 1);
+  add_station_1077(1, tow_ms, 2e7 + 1);
+  send_observations(rtcm3_get_station(1, &state), &state);
+  ck_assert_uint_eq(n_stored_epochs, 1);
+  ck_assert_uint_eq(last_epoch.n_obs, 2);
+  ck_assert_uint_eq(last_epoch.sid[0].code, CODE_GPS_L1CA);
+  ck_assert_uint_eq(last_epoch.sid[1].code, CODE_GPS_L2CM);
+  ck_assert(rtcm2sbp_obs_pseudorange_m(&last_epoch, 0, &value));
+  ck_assert(fabs(value - (2e7 + 1)) < 0.02);
+  ck_assert(rtcm2sbp_obs_doppler_hz(&last_epoch, 0, &value));
+
+  /* the legacy observation arriving after the MSM one is dropped, the
+   * legacy message is still taken for the epoch */
+  add_station_1077(1, tow_ms + SECS_MS, 2e7 + 1);
+  add_station_1004_sync(1, tow_ms + SECS_MS, 0);
+  ck_assert_uint_eq(n_stored_epochs, 2);
+  ck_assert_uint_eq(last_epoch.n_obs, 2);
+  ck_assert(rtcm2sbp_obs_pseudorange_m(&last_epoch, 0, &value));
+  ck_assert(fabs(value - (2e7 + 1)) < 0.02);
+
+  /* a new epoch starts with no signals */
+  add_station_1004_sync(1, tow_ms + 2 * SECS_MS, 0);
+  ck_assert_uint_eq(n_stored_epochs, 3);
+  ck_assert_uint_eq(last_epoch.n_obs, 1);
+
+  /* a legacy message for an epoch already sent out is dropped */
+  add_station_1004_sync(1, tow_ms + 2 * SECS_MS, 0);
+  ck_assert_uint_eq(n_stored_epochs, 3);
+
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert_uint_eq(stats.events[RTCM2SBP_EVENT_DUPLICATE_SIGNAL], 2);
+  ck_assert_uint_eq(stats.events[RTCM2SBP_EVENT_LEGACY_MSG_DROPPED], 1);
+}
+END_TEST
+
+START_TEST(test_msm_code_mask) {
+  u32 tow_ms = current_time.tow * SECS_MS;
+  struct rtcm2sbp_stats stats;
+
+  rtcm2sbp_init(&state, sbp_callback_count_epochs, NULL);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_epoch_callback(epoch_callback_store, NULL, &state);
+  n_stored_epochs = 0;
+
+  ck_assert(!rtcm2sbp_set_msm_code_mask(RTCM3_MSM_CONSTELLATIONS, 0, &state));
+  ck_assert(rtcm2sbp_set_msm_code_mask(
+      CONSTELLATION_GPS, RTCM3_ALL_CODES & ~((u64)1 << CODE_GPS_L2CM), &state));
+  add_station_1077(1, tow_ms, 2e7);
+  send_observations(rtcm3_get_station(1, &state), &state);
+  ck_assert_uint_eq(n_stored_epochs, 1);
+  ck_assert_uint_eq(last_epoch.n_obs, 1);
+  ck_assert_uint_eq(last_epoch.sid[0].code, CODE_GPS_L1CA);
+
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert_uint_eq(stats.events[RTCM2SBP_EVENT_UNSUPPORTED_SIGNAL], 1);
+
+  ck_assert(rtcm2sbp_set_msm_code_mask(
+      CONSTELLATION_GPS, RTCM3_ALL_CODES, &state));
+  add_station_1077(1, tow_ms + SECS_MS, 2e7);
+  send_observations(rtcm3_get_station(1, &state), &state);
+  ck_assert_uint_eq(last_epoch.n_obs, 2);
+}
+END_TEST
+
+/* MSM3 message of GPS satellite 1 signal 1C, with the range within the
+ * millisecond */
+static void encode_1073(u32 tow_ms, double range_ms, u8 *buff) {
+  memset(buff, 0, 28);
+  setbitu(buff, 0, 12, 1073);
+  setbitu(buff, 12, 12, 1);
+  setbitu(buff, 24, 30, tow_ms);
+  /* satellite, signal and cell masks */
+  setbitu(buff, 73, 1, 1);
+  setbitu(buff, 138, 1, 1);
+  setbitu(buff, 169, 1, 1);
+  double frac_ms = range_ms - floor(range_ms);
+  u32 rough = (u32)floor(frac_ms * 1024);
+  setbitu(buff, 170, 10, rough);
+  double fine_ms = frac_ms - rough / 1024.0;
+  setbits(buff, 180, 15, (s32)lround(ldexp(fine_ms, 24)));
+  setbits(buff, 195, 22, (s32)lround(ldexp(fine_ms, 29)));
+  setbitu(buff, 217, 4, 5);
+}
+
+/* Check the framing of an SBP frame in the output ring */
+static void check_sbp_frame(const u8 *frame, u16 msg_id, u16 sender_id, u8 len) {
+  ck_assert_uint_eq(frame[0], SBP_FRAME_PREAMBLE);
+  ck_assert_uint_eq(frame[1] | (frame[2] << 8), msg_id);
+  ck_assert_uint_eq(frame[3] | (frame[4] << 8), sender_id);
+  ck_assert_uint_eq(frame[5], len);
+  u16 crc = sbp_crc16(&frame[1], SBP_FRAME_HEADER_SIZE - 1 + len, 0);
+  ck_assert_uint_eq(frame[SBP_FRAME_HEADER_SIZE + len], crc & 0xff);
+  ck_assert_uint_eq(frame[SBP_FRAME_HEADER_SIZE + len + 1], crc >> 8);
+}
+
+START_TEST(test_frame_ring) {
+  struct rtcm3_sbp_ring ring;
+  u8 ring_buffer[100];
+  u8 payload[24];
+  const u8 *data;
+  struct rtcm2sbp_stats stats;
+
+  /* CRC-16-CCITT check value, with a zero initial value as in SBP */
+  ck_assert_uint_eq(sbp_crc16((const u8 *)"123456789", 9, 0), 0x31C3);
+
+  memset(payload, 0xA5, sizeof(payload));
+  rtcm2sbp_ring_init(&ring, ring_buffer, sizeof(ring_buffer));
+  ck_assert(rtcm2sbp_ring_write(&ring, 0x48, 1, sizeof(payload), payload));
+  ck_assert(rtcm2sbp_ring_write(&ring, 0x48, 2, sizeof(payload), payload));
+  ck_assert_uint_eq(rtcm2sbp_ring_peek(&ring, &data), 64);
+  check_sbp_frame(data, 0x48, 1, sizeof(payload));
+  check_sbp_frame(&data[32], 0x48, 2, sizeof(payload));
+  rtcm2sbp_ring_consume(&ring, 32);
+
+  /* the third frame fits before the end, the fourth only at the start once
+   * the second is read */
+  ck_assert(rtcm2sbp_ring_write(&ring, 0x48, 3, sizeof(payload), payload));
+  ck_assert(!rtcm2sbp_ring_write(&ring, 0x48, 4, sizeof(payload), payload));
+  ck_assert_uint_eq(ring.dropped, 1);
+  rtcm2sbp_ring_consume(&ring, 32);
+  ck_assert(rtcm2sbp_ring_write(&ring, 0x48, 4, sizeof(payload), payload));
+  ck_assert_uint_eq(rtcm2sbp_ring_peek(&ring, &data), 32);
+  check_sbp_frame(data, 0x48, 3, sizeof(payload));
+  rtcm2sbp_ring_consume(&ring, 32);
+  ck_assert_uint_eq(rtcm2sbp_ring_peek(&ring, &data), 32);
+  ck_assert(data == ring_buffer);
+  check_sbp_frame(data, 0x48, 4, sizeof(payload));
+  rtcm2sbp_ring_consume(&ring, 32);
+  ck_assert_uint_eq(rtcm2sbp_ring_peek(&ring, &data), 0);
+
+  /* a reservation can be committed shorter */
+  u8 *dest = rtcm2sbp_ring_reserve(&ring, 40);
+  ck_assert(NULL != dest);
+  memset(dest, 0x5A, 10);
+  rtcm2sbp_ring_commit(&ring, 0x102, 3, 10);
+  ck_assert_uint_eq(rtcm2sbp_ring_peek(&ring, &data), 18);
+  check_sbp_frame(data, 0x102, 3, 10);
+  rtcm2sbp_ring_consume(&ring, 18);
+
+  /* the converter packs the observations straight into the ring */
+  u8 obs_ring_buffer[4 * SBP_FRAME_MAX_SIZE];
+  rtcm2sbp_ring_init(&ring, obs_ring_buffer, sizeof(obs_ring_buffer));
+  rtcm2sbp_init(&state, NULL, NULL);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_frame_ring(&ring, &state);
+  add_station_1077(1, current_time.tow * SECS_MS, 2e7);
+  send_observations(rtcm3_get_station(1, &state), &state);
+  u8 len = SBP_HDR_SIZE + 2 * SBP_OBS_SIZE;
+  ck_assert_uint_eq(rtcm2sbp_ring_peek(&ring, &data),
+                    SBP_FRAME_HEADER_SIZE + len + SBP_FRAME_CRC_SIZE);
+  check_sbp_frame(data, SBP_MSG_OBS, 0xF001, len);
+  const msg_obs_t *sbp_obs = (const msg_obs_t *)&data[SBP_FRAME_HEADER_SIZE];
+  ck_assert_uint_eq(sbp_obs->header.n_obs, 0x10);
+  ck_assert_uint_eq(sbp_obs->obs[0].P, 2e7 * MSG_OBS_P_MULTIPLIER);
+
+  /* dropped frames are counted once the ring is full */
+  for (u8 i = 1; i < 32; i++) {
+    add_station_1077(1, (current_time.tow + i) * SECS_MS, 2e7);
+    send_observations(rtcm3_get_station(1, &state), &state);
+  }
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert_uint_gt(stats.events[RTCM2SBP_EVENT_OUTPUT_FULL], 0);
+}
+END_TEST
+
+/* Last RTCM frame sent out by the SBP to RTCM encoder or the passthrough */
+struct rtcm_capture {
+  u8 frame[RTCM3_MAX_FRAME_SIZE];
+  u16 length;
+  const u8 *last;
+  u8 count;
+};
+
+static void rtcm_callback_capture(const u8 *frame, u16 length, void *context) {
+  struct rtcm_capture *capture = (struct rtcm_capture *)context;
+  ck_assert(verify_crc((u8 *)frame, length));
+  memcpy(capture->frame, frame, length);
+  capture->length = length;
+  capture->last = frame;
+  capture->count++;
+}
+
+static void encoder_callback_capture(u8 *frame, u16 length, void *context) {
+  rtcm_callback_capture(frame, length, context);
+}
+
+START_TEST(test_rtcm_passthrough) {
+  static struct sbp_rtcm3_state encoder;
+  static struct rtcm3_rtcm3_state passthrough;
+  static struct rtcm_capture msm7;
+  static struct rtcm_capture msm4;
+  static struct rtcm_capture out;
+
+  u8 obs_buffer[SBP_HDR_SIZE + 2 * SBP_OBS_SIZE];
+  msg_obs_t *sbp_obs = (msg_obs_t *)obs_buffer;
+  memset(obs_buffer, 0, sizeof(obs_buffer));
+  sbp_obs->header.t.wn = current_time.wn;
+  sbp_obs->header.t.tow = current_time.tow * SECS_MS;
+  sbp_obs->header.n_obs = 0x10;
+  for (u8 i = 0; i < 2; i++) {
+    double pseudorange_m = 21234567.89 + i * 1234567.8;
+    double carrier_phase = (pseudorange_m + 0.7) / (299792458.0 / 1.57542e9);
+    packed_obs_content_t *obs = &sbp_obs->obs[i];
+    obs->sid.sat = 3 + i * 10;
+    obs->sid.code = CODE_GPS_L1CA;
+    obs->P = (u32)(pseudorange_m * MSG_OBS_P_MULTIPLIER);
+    obs->L.i = (s32)floor(carrier_phase);
+    obs->L.f = (u8)((carrier_phase - floor(carrier_phase)) * 256);
+    obs->D.i = -1234;
+    obs->cn0 = 181;
+    obs->lock = 5 + i;
+    obs->flags = MSG_OBS_FLAGS_CODE_VALID | MSG_OBS_FLAGS_PHASE_VALID |
+                 MSG_OBS_FLAGS_HALF_CYCLE_KNOWN | MSG_OBS_FLAGS_DOPPLER_VALID;
+  }
+  sbp2rtcm_init(&encoder, encoder_callback_capture, &msm7);
+  sbp2rtcm_set_rtcm_out_mode(SBP2RTCM_OUT_MSM7, &encoder);
+  sbp2rtcm_sbp_obs_cb(0x1234, sizeof(obs_buffer), obs_buffer, &encoder);
+  sbp2rtcm_init(&encoder, encoder_callback_capture, &msm4);
+  sbp2rtcm_set_rtcm_out_mode(SBP2RTCM_OUT_MSM4, &encoder);
+  sbp2rtcm_sbp_obs_cb(0x1234, sizeof(obs_buffer), obs_buffer, &encoder);
+  ck_assert_uint_eq(msm7.count, 1);
+  ck_assert_uint_eq(msm4.count, 1);
+
+  /* unchanged frames go out as they came in */
+  rtcm2rtcm_init(&passthrough, rtcm_callback_capture, &out);
+  rtcm2rtcm_process_bytes(msm7.frame, msm7.length, &passthrough);
+  ck_assert_uint_eq(out.count, 1);
+  ck_assert(out.last == msm7.frame);
+
+  /* MSM7 comes out as the MSM4 the encoder makes of the same observations,
+   * also when the frame arrives a byte at a time */
+  rtcm2rtcm_set_msm7_to_msm4(true, &passthrough);
+  for (u16 i = 0; i < msm7.length; i++) {
+    rtcm2rtcm_process_bytes(&msm7.frame[i], 1, &passthrough);
+  }
+  ck_assert_uint_eq(out.count, 2);
+  ck_assert_uint_lt(out.length, msm7.length);
+  ck_assert_uint_eq(out.length, msm4.length);
+  ck_assert(0 == memcmp(out.frame, msm4.frame, msm4.length));
+
+  /* the station ID is rewritten, other messages pass */
+  rtcm2rtcm_set_station_id(42, &passthrough);
+  rtcm2rtcm_process_frame(msm4.frame, msm4.length, &passthrough);
+  ck_assert_uint_eq(out.count, 3);
+  ck_assert_uint_eq(getbitu(&out.frame[RTCM3_HEADER_SIZE], 0, 12), 1074);
+  ck_assert_uint_eq(getbitu(&out.frame[RTCM3_HEADER_SIZE], 12, 12), 42);
+  ck_assert(0 == memcmp(&out.frame[RTCM3_HEADER_SIZE + 3],
+                        &msm4.frame[RTCM3_HEADER_SIZE + 3],
+                        msm4.length - RTCM3_HEADER_SIZE - 3 - RTCM3_CRC_SIZE));
+
+  /* dropped message types */
+  ck_assert(!rtcm2rtcm_set_msg_dropped(4062, true, &passthrough));
+  ck_assert(rtcm2rtcm_set_msg_dropped(1077, true, &passthrough));
+  rtcm2rtcm_process_frame(msm7.frame, msm7.length, &passthrough);
+  ck_assert_uint_eq(out.count, 3);
+  ck_assert(rtcm2rtcm_set_msg_dropped(1077, false, &passthrough));
+  rtcm2rtcm_process_frame(msm7.frame, msm7.length, &passthrough);
+  ck_assert_uint_eq(out.count, 4);
+
+  /* a truncated MSM7 message is passed on as it is, without reading past
+   * the end of the frame for the masks */
+  u8 truncated[RTCM3_HEADER_SIZE + 10 + RTCM3_CRC_SIZE];
+  memcpy(truncated, msm7.frame, RTCM3_HEADER_SIZE + 10);
+  truncated[1] = 0;
+  truncated[2] = 10;
+  u32 crc = crc24q(truncated, RTCM3_HEADER_SIZE + 10, 0);
+  truncated[RTCM3_HEADER_SIZE + 10] = (crc >> 16) & 0xFF;
+  truncated[RTCM3_HEADER_SIZE + 11] = (crc >> 8) & 0xFF;
+  truncated[RTCM3_HEADER_SIZE + 12] = crc & 0xFF;
+  rtcm2rtcm_set_station_id(RTCM2RTCM_KEEP_STATION_ID, &passthrough);
+  rtcm2rtcm_process_bytes(truncated, sizeof(truncated), &passthrough);
+  ck_assert_uint_eq(out.count, 5);
+  ck_assert(out.last == truncated);
+}
+END_TEST
+
+START_TEST(test_msm_compact) {
+  u32 tow_ms = current_time.tow * SECS_MS;
+  static struct rtcm3_orbit_store orbit_store;
+  struct rtcm2sbp_stats stats;
+  rtcm_msm_message msg;
+  u8 buff[28];
+  double value;
+
+  rtcm2sbp_init(&state, sbp_callback_count_epochs, NULL);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm2sbp_set_epoch_callback(epoch_callback_store, NULL, &state);
+  rtcm2sbp_set_orbit_store(&orbit_store, &state);
+  n_stored_epochs = 0;
+
+  /* circular orbit with the satellite above the station at the epoch */
+  msg_ephemeris_gps_t eph;
+  memset(&eph, 0, sizeof(eph));
+  eph.common.sid.sat = 1;
+  eph.common.toe = current_time;
+  eph.sqrta = 5153.7;
+  rtcm3_store_gps_orbit(&eph, &state);
+  double omega = -7.2921151467e-5 * current_time.tow;
+  double range_m = 5153.7 * 5153.7 - 6378137.0;
+  /* the range measured with a receiver clock offset of 0.3 ms */
+  double range_ms = range_m / RANGE_MS + 0.3;
+  encode_1073(tow_ms, range_ms, buff);
+  ck_assert_int_eq(rtcm3_decode_msm1_3(buff, state.glo_sv_id_fcn_map, &msg),
+                   RC_OK);
+  ck_assert(msg.signals[0].flags.valid_pr);
+  ck_assert(msg.signals[0].flags.valid_cp);
+  ck_assert(msg.sats[0].rough_range_ms < 1);
+  ck_assert(fabs(msg.signals[0].pseudorange_m / RANGE_MS -
+                 (range_ms - floor(range_ms))) < 1e-6);
+
+  /* nothing is converted before the station position is known */
+  add_msm_obs_to_buffer(&msg, &state);
+  send_observations(rtcm3_get_station(1, &state), &state);
+  ck_assert_uint_eq(n_stored_epochs, 0);
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert_uint_eq(stats.events[RTCM2SBP_EVENT_MSM_NO_RANGE], 1);
+
+  struct rtcm3_station_state *station = rtcm3_get_station(1, &state);
+  station->base_pos_ecef[0] = 6378137.0 * cos(omega);
+  station->base_pos_ecef[1] = 6378137.0 * sin(omega);
+  station->base_pos_ecef[2] = 0;
+  station->base_pos_known = true;
+  encode_1073(tow_ms + SECS_MS, range_ms, buff);
+  ck_assert_int_eq(rtcm3_decode_msm1_3(buff, state.glo_sv_id_fcn_map, &msg),
+                   RC_OK);
+  add_msm_obs_to_buffer(&msg, &state);
+  send_observations(rtcm3_get_station(1, &state), &state);
+  ck_assert_uint_eq(n_stored_epochs, 1);
+  ck_assert_uint_eq(last_epoch.n_obs, 1);
+  ck_assert(rtcm2sbp_obs_pseudorange_m(&last_epoch, 0, &value));
+  ck_assert(fabs(value - range_ms * RANGE_MS) < 0.05);
+  ck_assert(last_epoch.flags[0] & MSG_OBS_FLAGS_PHASE_VALID);
+}
+END_TEST
+
+/* last ephemeris sent out and the number of them */
+static u8 eph_payload[SBP_FRAMING_MAX_PAYLOAD_SIZE];
+static u16 eph_msg_id = 0;
+static u8 n_eph = 0;
+
+static void sbp_callback_eph(u16 msg_id,
+                             u8 length,
+                             u8 *buffer,
+                             u16 sender_id) {
+  (void)sender_id;
+  if (msg_id == SBP_MSG_EPHEMERIS_GPS || msg_id == SBP_MSG_EPHEMERIS_GLO ||
+      msg_id == SBP_MSG_EPHEMERIS_GAL || msg_id == SBP_MSG_EPHEMERIS_BDS) {
+    memcpy(eph_payload, buffer, length);
+    eph_msg_id = msg_id;
+    n_eph++;
+  }
+}
+
+START_TEST(test_ephemeris) {
+  u32 tow = current_time.tow;
+  struct rtcm2sbp_stats stats;
+
+  rtcm2sbp_init(&state, sbp_callback_eph, NULL);
+  n_eph = 0;
+
+  rtcm_msg_eph msg_eph;
+  memset(&msg_eph, 0, sizeof(msg_eph));
+  msg_eph.constellation = RTCM_CONSTELLATION_GPS;
+  msg_eph.sat_id = 5;
+  msg_eph.wn = current_time.wn % 1024;
+  msg_eph.toe = 211200 / 16;
+  msg_eph.data.kepler.toc = 211200 / 16;
+  msg_eph.data.kepler.iode = 45;
+  msg_eph.data.kepler.iodc = 45;
+  msg_eph.data.kepler.sqrta = (u32)ldexp(5153.7, 19);
+
+  /* the week is not known without the rover time */
+  rtcm3_send_eph(&msg_eph, 1019, &state);
+  ck_assert_uint_eq(n_eph, 0);
+
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  rtcm3_send_eph(&msg_eph, 1019, &state);
+  ck_assert_uint_eq(n_eph, 1);
+  ck_assert_uint_eq(eph_msg_id, SBP_MSG_EPHEMERIS_GPS);
+  const msg_ephemeris_gps_t *gps_eph = (msg_ephemeris_gps_t *)eph_payload;
+  ck_assert_uint_eq(gps_eph->common.sid.sat, 5);
+  ck_assert_uint_eq(gps_eph->common.toe.wn, current_time.wn);
+  ck_assert_uint_eq(gps_eph->common.toe.tow, 211200);
+  ck_assert_uint_eq(gps_eph->toc.tow, 211200);
+  ck_assert_uint_eq(gps_eph->common.valid, 1);
+  ck_assert_uint_eq(gps_eph->common.fit_interval, 4 * 3600);
+  ck_assert(fabs(gps_eph->sqrta - 5153.7) < 1e-5);
+
+  /* repeated ephemerides are only sent again once they change */
+  rtcm3_send_eph(&msg_eph, 1019, &state);
+  ck_assert_uint_eq(n_eph, 1);
+  msg_eph.data.kepler.iode = 46;
+  msg_eph.data.kepler.iodc = 46;
+  rtcm3_send_eph(&msg_eph, 1019, &state);
+  ck_assert_uint_eq(n_eph, 2);
+
+  /* or after a while for the rovers that missed them */
+  gps_time_sec_t later = {.tow = tow + EPH_REPEAT_SEC, .wn = current_time.wn};
+  rtcm2sbp_set_gps_time(&later, &state);
+  rtcm3_send_eph(&msg_eph, 1019, &state);
+  ck_assert_uint_eq(n_eph, 3);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+
+  rtcm2sbp_get_stats(&state, &stats);
+  ck_assert_uint_eq(stats.events[RTCM2SBP_EVENT_EPH_UNCHANGED], 1);
+
+  /* GLONASS time of ephemeris is the Moscow time of day in 15 minutes */
+  memset(&msg_eph, 0, sizeof(msg_eph));
+  msg_eph.constellation = RTCM_CONSTELLATION_GLO;
+  msg_eph.sat_id = 3;
+  msg_eph.data.glo.t_b = 55;
+  msg_eph.data.glo.fcn = 7;
+  msg_eph.data.glo.pos[0] = 1 << 11;
+  rtcm3_send_eph(&msg_eph, 1020, &state);
+  ck_assert_uint_eq(n_eph, 3);
+  rtcm2sbp_set_leap_second(18, &state);
+  rtcm3_send_eph(&msg_eph, 1020, &state);
+  ck_assert_uint_eq(n_eph, 4);
+  ck_assert_uint_eq(eph_msg_id, SBP_MSG_EPHEMERIS_GLO);
+  const msg_ephemeris_glo_t *glo_eph = (msg_ephemeris_glo_t *)eph_payload;
+  ck_assert_uint_eq(glo_eph->common.toe.wn, current_time.wn);
+  ck_assert_uint_eq(glo_eph->common.toe.tow,
+                    2 * 86400 + 55 * 900 - 3 * 3600 + 18);
+  ck_assert_uint_eq(glo_eph->fcn, 8);
+  ck_assert(glo_eph->pos[0] == 1000.0);
+
+  /* Galileo and BeiDou weeks start at GPS weeks 1024 and 1356, BeiDou time
+   * is 14 seconds behind GPS time */
+  memset(&msg_eph, 0, sizeof(msg_eph));
+  msg_eph.constellation = RTCM_CONSTELLATION_GAL;
+  msg_eph.sat_id = 11;
+  msg_eph.wn = current_time.wn - 1024;
+  msg_eph.toe = 211200 / 60;
+  rtcm3_send_eph(&msg_eph, 1045, &state);
+  ck_assert_uint_eq(n_eph, 5);
+  const msg_ephemeris_gal_t *gal_eph = (msg_ephemeris_gal_t *)eph_payload;
+  ck_assert_uint_eq(gal_eph->common.toe.wn, current_time.wn);
+  ck_assert_uint_eq(gal_eph->common.toe.tow, 211200);
+  ck_assert_uint_eq(gal_eph->source, GAL_SOURCE_FNAV);
+
+  /* the I/NAV ephemeris of the same issue is sent apart from the F/NAV one */
+  rtcm3_send_eph(&msg_eph, 1046, &state);
+  ck_assert_uint_eq(n_eph, 6);
+  ck_assert_uint_eq(gal_eph->source, GAL_SOURCE_INAV);
+  rtcm3_send_eph(&msg_eph, 1045, &state);
+  rtcm3_send_eph(&msg_eph, 1046, &state);
+  ck_assert_uint_eq(n_eph, 6);
+
+  memset(&msg_eph, 0, sizeof(msg_eph));
+  msg_eph.constellation = RTCM_CONSTELLATION_BDS;
+  msg_eph.sat_id = 11;
+  msg_eph.wn = current_time.wn - 1356;
+  msg_eph.toe = 211184 / 8;
+  rtcm3_send_eph(&msg_eph, 1042, &state);
+  ck_assert_uint_eq(n_eph, 7);
+  const msg_ephemeris_bds_t *bds_eph = (msg_ephemeris_bds_t *)eph_payload;
+  ck_assert_uint_eq(bds_eph->common.toe.wn, current_time.wn);
+  ck_assert_uint_eq(bds_eph->common.toe.tow, 211184 + 14);
+}
+END_TEST
+
+static u8 n_ssr[3] = {0};
+static u8 ssr_payload[SBP_FRAMING_MAX_PAYLOAD_SIZE];
+
+static void sbp_callback_ssr(u16 msg_id,
+                             u8 length,
+                             u8 *buffer,
+                             u16 sender_id) {
+  ck_assert_uint_eq(sender_id, GLOBAL_SENDER_ID);
+  if (msg_id == SBP_MSG_SSR_ORBIT_CLOCK) {
+    n_ssr[0]++;
+  } else if (msg_id == SBP_MSG_SSR_CODE_BIASES) {
+    n_ssr[1]++;
+  } else if (msg_id == SBP_MSG_SSR_PHASE_BIASES) {
+    n_ssr[2]++;
+  }
+  memcpy(ssr_payload, buffer, length);
+}
+
+static void ssr_header(rtcm_msg_ssr_header *header,
+                       u16 message_num,
+                       u32 epoch_time,
+                       u8 iod_ssr,
+                       u8 num_sats) {
+  memset(header, 0, sizeof(*header));
+  header->message_num = message_num;
+  header->epoch_time = epoch_time;
+  header->iod_ssr = iod_ssr;
+  header->num_sats = num_sats;
+}
+
+START_TEST(test_ssr_store) {
+  static struct rtcm3_ssr_store store;
+  static rtcm_msg_orbit_clock orbit_clock;
+  static rtcm_msg_code_bias code_bias;
+  u32 tow = current_time.tow;
+
+  rtcm2sbp_init(&state, sbp_callback_ssr, NULL);
+  rtcm2sbp_set_gps_time(&current_time, &state);
+  memset(n_ssr, 0, sizeof(n_ssr));
+
+  memset(&orbit_clock, 0, sizeof(orbit_clock));
+  ssr_header(&orbit_clock.header, 1060, tow, 1, 2);
+  orbit_clock.orbit_clock[0].sat_id = 3;
+  orbit_clock.orbit_clock[0].orbit.iode = 40;
+  orbit_clock.orbit_clock[0].clock.c0 = -1234;
+  orbit_clock.orbit_clock[1].sat_id = 7;
+  memset(&code_bias, 0, sizeof(code_bias));
+  ssr_header(&code_bias.header, 1059, tow, 1, 1);
+  code_bias.sats[0].sat_id = 3;
+  code_bias.sats[0].num_code_biases = 2;
+  code_bias.sats[0].signals[1].signal_id = 11;
+  code_bias.sats[0].signals[1].code_bias = -56;
+
+  /* without a store every message is sent out as it arrives */
+  rtcm3_ssr_orbit_clock_to_sbp(&orbit_clock, &state);
+  ck_assert_uint_eq(n_ssr[0], 2);
+  const msg_ssr_orbit_clock_t *sbp_orbit_clock =
+      (msg_ssr_orbit_clock_t *)ssr_payload;
+  ck_assert_uint_eq(sbp_orbit_clock->sid.sat, 7);
+  ck_assert_uint_eq(sbp_orbit_clock->time.tow, tow);
+  ck_assert_uint_eq(sbp_orbit_clock->time.wn, current_time.wn);
+  rtcm3_ssr_code_bias_to_sbp(&code_bias, &state);
+  ck_assert_uint_eq(n_ssr[1], 1);
+  const msg_ssr_code_biases_t *sbp_code_biases =
+      (msg_ssr_code_biases_t *)ssr_payload;
+  ck_assert_uint_eq(sbp_code_biases->biases[1].code, 11);
+  ck_assert_int_eq(sbp_code_biases->biases[1].value, -56);
+
+  /* the first epoch of the store goes out as soon as its messages end, the
+   * biases arriving after it go out on their own */
+  rtcm2sbp_set_ssr_store(&store, &state);
+  memset(n_ssr, 0, sizeof(n_ssr));
+  rtcm3_ssr_orbit_clock_to_sbp(&orbit_clock, &state);
+  ck_assert_uint_eq(n_ssr[0], 2);
+  rtcm3_ssr_code_bias_to_sbp(&code_bias, &state);
+  ck_assert_uint_eq(n_ssr[0], 2);
+  ck_assert_uint_eq(n_ssr[1], 1);
+
+  /* from then on the orbits and clocks wait for the biases */
+  orbit_clock.header.epoch_time = tow + 5;
+  code_bias.header.epoch_time = tow + 5;
+  rtcm3_ssr_orbit_clock_to_sbp(&orbit_clock, &state);
+  ck_assert_uint_eq(n_ssr[0], 2);
+  rtcm3_ssr_code_bias_to_sbp(&code_bias, &state);
+  ck_assert_uint_eq(n_ssr[0], 4);
+  ck_assert_uint_eq(n_ssr[1], 2);
+  sbp_code_biases = (msg_ssr_code_biases_t *)ssr_payload;
+  ck_assert_uint_eq(sbp_code_biases->time.tow, tow + 5);
+
+  /* an epoch without biases goes out when the next one starts, and a new
+   * IOD SSR drops the biases of the previous one */
+  orbit_clock.header.epoch_time = tow + 10;
+  orbit_clock.header.iod_ssr = 2;
+  rtcm3_ssr_orbit_clock_to_sbp(&orbit_clock, &state);
+  ck_assert_uint_eq(n_ssr[0], 4);
+  orbit_clock.header.epoch_time = tow + 15;
+  orbit_clock.header.multi_message = 1;
+  rtcm3_ssr_orbit_clock_to_sbp(&orbit_clock, &state);
+  ck_assert_uint_eq(n_ssr[0], 6);
+  ck_assert_uint_eq(n_ssr[1], 2);
+  rtcm2sbp_flush_ssr_store(&state);
+  ck_assert_uint_eq(n_ssr[0], 8);
+  ck_assert_uint_eq(n_ssr[1], 2);
+  rtcm2sbp_set_ssr_store(NULL, &state);
+}
+END_TEST
+
 START_TEST(test_compute_glo_time) {
   for (u8 day = 0; day < 7; day++) {
     for (u8 hour = 0; hour < 24; hour++) {
@@ -623,7 +1931,7 @@ START_TEST(test_compute_glo_time) {
           }
 
           gps_time_sec_t obs_time;
-          compute_glo_time(glo_tod_ms, &obs_time, &rover_time, &state);
+          compute_glo_time(glo_tod_ms, &obs_time, &state);
           ck_assert_uint_eq(obs_time.wn, expected_time.wn);
           ck_assert_uint_eq(obs_time.tow, expected_time.tow);
         }
@@ -638,14 +1946,66 @@ START_TEST(test_compute_glo_time) {
   u8 sec = 60;
   u32 tod = hour * SEC_IN_HOUR + min * SEC_IN_MINUTE + sec;
   gps_time_sec_t rover_time = {.tow = day * SEC_IN_DAY + tod, .wn = 1945};
+  rtcm2sbp_set_gps_time(&rover_time, &state);
   u32 glo_tod_ms = (tod + UTC_SU_OFFSET * SEC_IN_HOUR) * S_TO_MS;
 
   gps_time_sec_t obs_time;
-  compute_glo_time(glo_tod_ms, &obs_time, &rover_time, &state);
+  compute_glo_time(glo_tod_ms, &obs_time, &state);
   ck_assert_uint_eq(obs_time.wn, INVALID_TIME);
 }
 END_TEST
 
+/* the packing reference is the original floor() and roundl() conversion */
+static void check_obs_packing(double value) {
+  carrier_phase_t L;
+  pack_carrier_phase(value, &L);
+  s32 L_i = (s32)floor(value);
+  u16 L_f = (u16)roundl((value - (double)L_i) * MSG_OBS_LF_MULTIPLIER);
+  if (L_f == 256) {
+    L_f = 0;
+    L_i += 1;
+  }
+  ck_assert_int_eq(L.i, L_i);
+  ck_assert_uint_eq(L.f, L_f);
+
+  if (fabs(value) < INT16_MAX) {
+    doppler_t D;
+    pack_doppler(value, &D);
+    s16 D_i = (s16)floor(value);
+    u16 D_f = (u16)roundl((value - (double)D_i) * MSG_OBS_DF_MULTIPLIER);
+    if (D_f == 256) {
+      D_f = 0;
+      D_i += 1;
+    }
+    ck_assert_int_eq(D.i, D_i);
+    ck_assert_uint_eq(D.f, D_f);
+  }
+
+  double pseudorange = fabs(value);
+  ck_assert_uint_eq(pack_pseudorange(pseudorange),
+                    (u32)roundl(pseudorange * MSG_OBS_P_MULTIPLIER));
+  double cnr = fmod(pseudorange, 63.0);
+  ck_assert_uint_eq(pack_cn0(cnr), (u8)roundl(cnr * MSG_OBS_CN0_MULTIPLIER));
+}
+
+START_TEST(test_obs_packing) {
+  /* the rounding boundaries of the 1/256th fractions and their neighbours */
+  for (s32 i = -20000; i < 20000; i++) {
+    double value = i / 512.0;
+    check_obs_packing(value);
+    check_obs_packing(nextafter(value, INFINITY));
+    check_obs_packing(nextafter(value, -INFINITY));
+  }
+
+  srand(1);
+  for (u32 i = 0; i < 100000; i++) {
+    double value = ((double)rand() / RAND_MAX - 0.5) * 2.5e8;
+    check_obs_packing(value);
+    check_obs_packing(nextafter(floor(value * 512.0) / 512.0, 0.0));
+  }
+}
+END_TEST
+
 START_TEST(test_gps_diff_time_sec) {
   gps_time_sec_t start = {.wn = 2009, .tow = 1000};
   gps_time_sec_t end = {.wn = 2009, .tow = 1001};
@@ -661,6 +2021,47 @@ START_TEST(test_gps_diff_time_sec) {
 }
 END_TEST
 
+START_TEST(test_time_anchor) {
+  gps_time_sec_t rover_time = {.wn = 1945, .tow = SEC_IN_WEEK - 60};
+  gps_time_sec_t obs_time;
+
+  rtcm2sbp_init(&state, NULL, NULL);
+  rtcm2sbp_set_leap_second(18, &state);
+  rtcm2sbp_set_gps_time(&rover_time, &state);
+
+  /* times of week across the week boundary from the rover time */
+  compute_gps_time(5 * SECS_MS, &obs_time, &state);
+  ck_assert_uint_eq(obs_time.wn, 1946);
+  ck_assert_uint_eq(obs_time.tow, 5);
+  compute_gps_time((SEC_IN_WEEK - 20) * SECS_MS, &obs_time, &state);
+  ck_assert_uint_eq(obs_time.wn, 1945);
+  ck_assert_uint_eq(obs_time.tow, SEC_IN_WEEK - 20);
+  compute_gps_time(SEC_IN_WEEK * SECS_MS, &obs_time, &state);
+  ck_assert_uint_eq(obs_time.wn, INVALID_TIME);
+
+  /* the Moscow time of day 03:00:05 is the GPS time 00:00:23 of the next
+   * week, and too far from the rover time until it is close to it */
+  u32 glo_tod_ms = (3 * SEC_IN_HOUR + 5) * SECS_MS;
+  compute_glo_time(glo_tod_ms, &obs_time, &state);
+  ck_assert_uint_eq(obs_time.wn, INVALID_TIME);
+  rover_time.tow = SEC_IN_WEEK - 1;
+  rtcm2sbp_set_gps_time(&rover_time, &state);
+  compute_glo_time(glo_tod_ms, &obs_time, &state);
+  ck_assert_uint_eq(obs_time.wn, 1946);
+  ck_assert_uint_eq(obs_time.tow, 5 + 18);
+
+  /* the anchor follows the rover time into the next week */
+  rover_time.wn = 1946;
+  rover_time.tow = 30;
+  rtcm2sbp_set_gps_time(&rover_time, &state);
+  compute_gps_time((SEC_IN_WEEK - 10) * SECS_MS, &obs_time, &state);
+  ck_assert_uint_eq(obs_time.wn, 1945);
+  compute_glo_time(glo_tod_ms, &obs_time, &state);
+  ck_assert_uint_eq(obs_time.wn, 1946);
+  ck_assert_uint_eq(obs_time.tow, 5 + 18);
+}
+END_TEST
+
 Suite *rtcm3_suite(void) {
   Suite *s = suite_create("RTCMv3");
 
@@ -712,6 +2113,27 @@ Suite *rtcm3_suite(void) {
   tcase_add_checked_fixture(tc_utils, rtcm3_setup_basic, NULL);
   tcase_add_test(tc_utils, test_compute_glo_time);
   tcase_add_test(tc_utils, test_gps_diff_time_sec);
+  tcase_add_test(tc_utils, test_time_anchor);
+  tcase_add_test(tc_utils, test_obs_packing);
+  tcase_add_test(tc_utils, test_process_bytes);
+  tcase_add_test(tc_utils, test_station_pool);
+  tcase_add_test(tc_utils, test_batch_callback);
+  tcase_add_test(tc_utils, test_msg_handlers);
+  tcase_add_test(tc_utils, test_sbp_to_rtcm_roundtrip);
+  tcase_add_test(tc_utils, test_glo_bias_table);
+  tcase_add_test(tc_utils, test_stats);
+  tcase_add_test(tc_utils, test_latency_buckets);
+  tcase_add_test(tc_utils, test_epoch_completeness);
+  tcase_add_test(tc_utils, test_epoch_merger);
+  tcase_add_test(tc_utils, test_epoch_callback);
+  tcase_add_test(tc_utils, test_duplicate_signals);
+  tcase_add_test(tc_utils, test_msm_code_mask);
+  tcase_add_test(tc_utils, test_msm_compact);
+  tcase_add_test(tc_utils, test_frame_ring);
+  tcase_add_test(tc_utils, test_rtcm_passthrough);
+  tcase_add_test(tc_utils, test_ephemeris);
+  tcase_add_test(tc_utils, test_ssr_store);
+  tcase_add_test(tc_utils, test_disabled_msg_types);
   suite_add_tcase(s, tc_utils);
 
   return s;
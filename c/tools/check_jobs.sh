@@ -0,0 +1,23 @@
+#!/bin/sh
+# Check that converting a file with several jobs gives the same output as
+# converting it on a single thread.
+#
+# Usage: check_jobs.sh rtcm32sbp week tow file
+
+set -e
+
+tool=$1
+week=$2
+tow=$3
+input=$4
+
+serial=$(mktemp)
+parallel=$(mktemp)
+trap 'rm -f "$serial" "$parallel"' EXIT
+
+"$tool" -w "$week" -t "$tow" -l 18 -o "$serial" "$input"
+"$tool" -w "$week" -t "$tow" -l 18 -j 4 -o "$parallel" "$input"
+if ! cmp -s "$serial" "$parallel"; then
+  echo "Output of $input differs with several jobs" >&2
+  exit 1
+fi
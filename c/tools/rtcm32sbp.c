@@ -0,0 +1,648 @@
+/*
+ * Copyright (C) 2018 Swift Navigation Inc.
+ * Contact: Swift Navigation <dev@swiftnav.com>
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/* Batch converter of RTCM3 files into SBP files.
+ *
+ * The input is memory mapped and fed to the converter in slices, the framed
+ * SBP messages are collected into a large output buffer that is written out
+ * only when full. As there is no live rover, the rover time used to resolve
+ * the RTCM time ambiguities starts from the week and time of week given on
+ * the command line and then follows the converted observations.
+ *
+ * With several jobs, each file is split into chunks at the end of MSM epochs
+ * and the chunks are converted on separate threads. A chunk is converted by
+ * a fresh converter that first replays a warm-up stretch of the preceding
+ * data with its output discarded, long enough for the converter state to
+ * become the same as in a serial run: the warm-up spans more than the 1230
+ * and MSM timeouts and the ephemeris repeat slot, and contains a station
+ * position and, when the file has GLONASS observations, a GLONASS FCN
+ * source. The outputs of the chunks are
+ * concatenated in order and match the output of a serial run.
+ */
+
+#include <assert.h>
+#include <bits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libsbp/edc.h>
+#include <libsbp/observation.h>
+#include <libsbp/sbp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rtcm3_sbp_internal.h"
+
+#define OUTPUT_BUFFER_SIZE (1u << 20)
+/* Bytes fed to the converter between two updates of the rover time */
+#define INPUT_SLICE_SIZE (64u * 1024u)
+/* Preamble, message type, sender ID and length, then the CRC */
+#define SBP_HEADER_SIZE 6u
+#define SBP_CRC_SIZE 2u
+#define SBP_MAX_FRAME_SIZE (SBP_HEADER_SIZE + 255u + SBP_CRC_SIZE)
+#define SECS_IN_WEEK 604800
+#define MAX_JOBS 64
+/* Stream time replayed before a chunk, longer than the 1230 and MSM timeouts
+ * of the converter state and than the ephemeris repeat slot */
+#define WARMUP_SEC                                                 \
+  (((MSG_1230_TIMEOUT_SEC > EPH_REPEAT_SEC) ? MSG_1230_TIMEOUT_SEC \
+                                            : EPH_REPEAT_SEC) +    \
+   10)
+/* Bit offset of the GPS epoch time in the legacy and MSM headers */
+#define EPOCH_TIME_BIT_OFFSET 24
+#define NO_FRAME UINT32_MAX
+
+struct sbp_output {
+  u8 *buffer;
+  size_t len;
+  size_t size;
+  /* File the buffer is flushed to when full, or -1 to grow the buffer */
+  int fd;
+  /* Messages are discarded while replaying the warm-up of a chunk */
+  bool enabled;
+  unsigned long long frames;
+};
+
+struct converter {
+  struct rtcm3_sbp_state *state;
+  struct sbp_output out;
+  /* Time of the latest converted observations, in seconds */
+  gps_time_sec_t obs_time;
+  bool obs_time_valid;
+};
+
+/* A CRC checked frame of the mapped input */
+struct scan_frame {
+  size_t offset;
+  u16 size;
+  /* MSM message with the multiple message bit clear */
+  bool epoch_end;
+  /* Latest GPS time seen in the stream, in seconds since the GPS epoch, or
+     -1 if there was none yet */
+  s64 time;
+  /* Index of the latest station position and GLONASS FCN source frames */
+  u32 last_pos;
+  u32 last_fcn;
+  /* Whether GLONASS observations were seen so far */
+  bool glo_seen;
+};
+
+struct chunk {
+  struct converter conv;
+  const u8 *data;
+  size_t size;
+  size_t warmup_begin;
+  size_t begin;
+  size_t end;
+  gps_time_sec_t start_time;
+  pthread_t thread;
+};
+
+static struct rtcm3_sbp_state state;
+static u8 out_buffer[OUTPUT_BUFFER_SIZE];
+static struct converter main_conv = {
+    .state = &state,
+    .out = {.buffer = out_buffer,
+            .size = sizeof(out_buffer),
+            .fd = STDOUT_FILENO,
+            .enabled = true},
+};
+
+/* Converter whose frame is being decoded on this thread */
+static THREAD_LOCAL struct converter *current = NULL;
+
+static gps_time_sec_t start_time;
+static s8 leap_seconds = 0;
+static bool leap_second_known = false;
+/* GPS time reached by the frame scans, carried from one file to the next */
+static s64 scan_time;
+
+static void write_all(int fd, const u8 *buffer, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    ssize_t ret = write(fd, &buffer[written], len - written);
+    if (ret < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      fprintf(stderr, "Can't write output! %s\n", strerror(errno));
+      exit(1);
+    }
+    written += (size_t)ret;
+  }
+}
+
+static void flush_output(struct sbp_output *out) {
+  write_all(out->fd, out->buffer, out->len);
+  out->len = 0;
+}
+
+/* Make room for one more frame in the output buffer */
+static void reserve_output(struct sbp_output *out) {
+  if (out->len + SBP_MAX_FRAME_SIZE <= out->size) {
+    return;
+  }
+  if (out->fd >= 0) {
+    flush_output(out);
+    return;
+  }
+  size_t size = out->size > 0 ? out->size * 2 : OUTPUT_BUFFER_SIZE;
+  u8 *buffer = realloc(out->buffer, size);
+  if (NULL == buffer) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  out->buffer = buffer;
+  out->size = size;
+}
+
+static void put_u16(u8 *buffer, u16 value) {
+  buffer[0] = value & 0xff;
+  buffer[1] = value >> 8;
+}
+
+static void sbp_callback(u16 msg_id, u8 length, u8 *buffer, u16 sender_id) {
+  struct converter *conv = current;
+  assert(NULL != conv);
+
+  if (SBP_MSG_OBS == msg_id && length >= sizeof(observation_header_t)) {
+    const observation_header_t *header = (const observation_header_t *)buffer;
+    conv->obs_time.wn = header->t.wn;
+    conv->obs_time.tow = header->t.tow / 1000;
+    conv->obs_time_valid = true;
+  }
+
+  struct sbp_output *out = &conv->out;
+  if (!out->enabled) {
+    return;
+  }
+  reserve_output(out);
+
+  u8 *frame = &out->buffer[out->len];
+  frame[0] = SBP_PREAMBLE;
+  put_u16(&frame[1], msg_id);
+  put_u16(&frame[3], sender_id);
+  frame[5] = length;
+  memcpy(&frame[SBP_HEADER_SIZE], buffer, length);
+  /* the CRC covers everything but the preamble */
+  u16 crc = crc16_ccitt(&frame[1], SBP_HEADER_SIZE - 1 + length, 0);
+  put_u16(&frame[SBP_HEADER_SIZE + length], crc);
+  out->len += SBP_HEADER_SIZE + length + SBP_CRC_SIZE;
+  out->frames++;
+}
+
+static void init_converter(struct converter *conv,
+                           const gps_time_sec_t *current_time) {
+  rtcm2sbp_init(conv->state, sbp_callback, NULL);
+  rtcm2sbp_set_gps_time(current_time, conv->state);
+  if (leap_second_known) {
+    rtcm2sbp_set_leap_second(leap_seconds, conv->state);
+  }
+}
+
+/* Convert the bytes from begin to end of an input of the given size. The
+ * rover time is moved along after every INPUT_SLICE_SIZE bytes from the start
+ * of the input, rather than from the callback so that the converter is never
+ * re-entered. Keeping the slices aligned to the input rather than to begin
+ * makes the rover time independent of how the input is split into chunks. */
+static void convert(struct converter *conv,
+                    const u8 *data,
+                    size_t begin,
+                    size_t end,
+                    size_t size) {
+  current = conv;
+  while (begin < end) {
+    size_t slice_end = (begin / INPUT_SLICE_SIZE + 1) * INPUT_SLICE_SIZE;
+    if (slice_end > end) {
+      slice_end = end;
+    }
+    rtcm2sbp_process_bytes(
+        &data[begin], (uint32_t)(slice_end - begin), conv->state);
+    begin = slice_end;
+
+    if ((0 == begin % INPUT_SLICE_SIZE || begin == size) &&
+        conv->obs_time_valid) {
+      rtcm2sbp_set_gps_time(&conv->obs_time, conv->state);
+      conv->obs_time_valid = false;
+    }
+  }
+}
+
+static void convert_stream(int fd) {
+  static u8 in_buffer[INPUT_SLICE_SIZE];
+  for (;;) {
+    ssize_t ret = read(fd, in_buffer, sizeof(in_buffer));
+    if (ret < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      fprintf(stderr, "Can't read input! %s\n", strerror(errno));
+      exit(1);
+    }
+    if (0 == ret) {
+      return;
+    }
+    convert(&main_conv, in_buffer, 0, (size_t)ret, (size_t)ret);
+  }
+}
+
+static bool is_glo_obs(u16 msg_type) {
+  return (msg_type >= 1009 && msg_type <= 1012) ||
+         (msg_type >= 1081 && msg_type <= 1087);
+}
+
+/* Messages that give the GLONASS frequency channel numbers */
+static bool is_glo_fcn_source(u16 msg_type) {
+  return 1020 == msg_type || 1085 == msg_type || 1087 == msg_type;
+}
+
+/* Messages with a GPS time of week in ms after the station ID */
+static bool has_gps_epoch_time(u16 msg_type) {
+  return (msg_type >= 1001 && msg_type <= 1004) ||
+         (msg_type >= 1071 && msg_type <= 1077) ||
+         (msg_type >= 1091 && msg_type <= 1097);
+}
+
+/* Resolve a time of week to the time nearest to the latest one */
+static s64 resolve_tow(u32 tow, s64 reference) {
+  s64 time = reference - reference % SECS_IN_WEEK + tow;
+  if (time - reference > SECS_IN_WEEK / 2) {
+    time -= SECS_IN_WEEK;
+  } else if (reference - time > SECS_IN_WEEK / 2) {
+    time += SECS_IN_WEEK;
+  }
+  return time;
+}
+
+/* Find the frames of the input the same way rtcm2sbp_process_bytes does,
+ * returns the number of frames */
+static u32 scan_frames(const u8 *data,
+                       size_t size,
+                       struct scan_frame **frames_out) {
+  size_t max_frames = size / (RTCM3_HEADER_SIZE + 1 + RTCM3_CRC_SIZE) + 1;
+  if (max_frames > NO_FRAME) {
+    max_frames = NO_FRAME;
+  }
+  struct scan_frame *frames = malloc(sizeof(*frames) * max_frames);
+  if (NULL == frames) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+
+  u32 n_frames = 0;
+  u32 last_pos = NO_FRAME;
+  u32 last_fcn = NO_FRAME;
+  bool glo_seen = false;
+  bool time_known = false;
+  size_t index = 0;
+  while (index + RTCM3_HEADER_SIZE <= size && n_frames < max_frames) {
+    const u8 *frame = &data[index];
+    if (frame[0] != RTCM3_PREAMBLE) {
+      const u8 *next = memchr(frame, RTCM3_PREAMBLE, size - index);
+      if (NULL == next) {
+        break;
+      }
+      index = next - data;
+      continue;
+    }
+    u16 message_size = ((frame[1] & 0x3) << 8) | frame[2];
+    size_t frame_size = RTCM3_HEADER_SIZE + message_size + RTCM3_CRC_SIZE;
+    if (0 == message_size || index + frame_size > size) {
+      index++;
+      continue;
+    }
+    const u8 *crc = &frame[RTCM3_HEADER_SIZE + message_size];
+    u32 frame_crc = ((u32)crc[0] << 16) | ((u32)crc[1] << 8) | crc[2];
+    if (crc24q(frame, RTCM3_HEADER_SIZE + message_size, 0) != frame_crc) {
+      index++;
+      continue;
+    }
+
+    const u8 *msg = &frame[RTCM3_HEADER_SIZE];
+    u16 msg_type = getbitu(msg, 0, 12);
+    if (1005 == msg_type || 1006 == msg_type) {
+      last_pos = n_frames;
+    }
+    if (is_glo_fcn_source(msg_type)) {
+      last_fcn = n_frames;
+    }
+    glo_seen = glo_seen || is_glo_obs(msg_type);
+    if (has_gps_epoch_time(msg_type) &&
+        message_size * 8 >= EPOCH_TIME_BIT_OFFSET + 30) {
+      u32 tow = getbitu(msg, EPOCH_TIME_BIT_OFFSET, 30) / SECS_MS;
+      if (tow < (u32)SECS_IN_WEEK) {
+        scan_time = resolve_tow(tow, scan_time);
+        time_known = true;
+      }
+    }
+
+    struct scan_frame *entry = &frames[n_frames++];
+    entry->offset = index;
+    entry->size = frame_size;
+    entry->epoch_end = msg_type >= MSM_MSG_TYPE_MIN &&
+                       msg_type <= MSM_MSG_TYPE_MAX &&
+                       message_size * 8 > MSM_MULTIPLE_BIT_OFFSET &&
+                       0 == getbitu(msg, MSM_MULTIPLE_BIT_OFFSET, 1);
+    entry->time = time_known ? scan_time : -1;
+    entry->last_pos = last_pos;
+    entry->last_fcn = last_fcn;
+    entry->glo_seen = glo_seen;
+    index += frame_size;
+  }
+
+  *frames_out = frames;
+  return n_frames;
+}
+
+/* Find the start of the warm-up for a chunk starting after the given frame,
+ * returns false if the data before the frame is not enough to warm up */
+static bool find_warmup(const struct scan_frame *frames,
+                        u32 split,
+                        u32 *warmup) {
+  const struct scan_frame *frame = &frames[split];
+  if (NO_FRAME == frame->last_pos || frame->time < 0 ||
+      (frame->glo_seen && NO_FRAME == frame->last_fcn)) {
+    return false;
+  }
+
+  /* The warm-up spans at least one whole slice so that the rover time gets
+   * updated from the warm-up observations before the chunk starts */
+  size_t chunk_begin = frame->offset + frame->size;
+  size_t slice_begin = chunk_begin / INPUT_SLICE_SIZE * INPUT_SLICE_SIZE;
+  if (slice_begin < INPUT_SLICE_SIZE) {
+    return false;
+  }
+  slice_begin -= INPUT_SLICE_SIZE;
+
+  u32 i = split;
+  while (frames[i].offset > slice_begin || frames[i].time < 0 ||
+         frame->time - frames[i].time < WARMUP_SEC) {
+    if (0 == i) {
+      return false;
+    }
+    i--;
+  }
+  if (frame->last_pos < i) {
+    i = frame->last_pos;
+  }
+  if (frame->glo_seen && frame->last_fcn < i) {
+    i = frame->last_fcn;
+  }
+  *warmup = i;
+  return true;
+}
+
+static void s64_to_gps_time(s64 time, gps_time_sec_t *gps_time) {
+  gps_time->wn = time / SECS_IN_WEEK;
+  gps_time->tow = time % SECS_IN_WEEK;
+}
+
+/* Split the input into at most n_jobs chunks at the end of MSM epochs,
+ * returns the number of chunks */
+static u8 plan_chunks(const u8 *data,
+                      size_t size,
+                      u8 n_jobs,
+                      struct chunk *chunks) {
+  struct scan_frame *frames;
+  u32 n_frames = scan_frames(data, size, &frames);
+
+  u8 n_chunks = 1;
+  chunks[0].begin = 0;
+  u32 split = 0;
+  for (u8 k = 1; k < n_jobs; k++) {
+    size_t target = size / n_jobs * k;
+    while (split < n_frames && frames[split].offset < target) {
+      split++;
+    }
+    u32 warmup = 0;
+    while (split < n_frames &&
+           !(frames[split].epoch_end && find_warmup(frames, split, &warmup))) {
+      split++;
+    }
+    if (split >= n_frames) {
+      break;
+    }
+
+    struct chunk *chunk = &chunks[n_chunks++];
+    chunk->begin = frames[split].offset + frames[split].size;
+    chunk->warmup_begin = frames[warmup].offset;
+    s64_to_gps_time(frames[warmup].time, &chunk->start_time);
+    split++;
+  }
+
+  for (u8 k = 0; k < n_chunks; k++) {
+    chunks[k].data = data;
+    chunks[k].size = size;
+    chunks[k].end = (k + 1 < n_chunks) ? chunks[k + 1].begin : size;
+  }
+  free(frames);
+  return n_chunks;
+}
+
+static void *convert_chunk(void *arg) {
+  struct chunk *chunk = arg;
+  struct converter *conv = &chunk->conv;
+  init_converter(conv, &chunk->start_time);
+
+  conv->out.enabled = false;
+  convert(conv, chunk->data, chunk->warmup_begin, chunk->begin, chunk->size);
+  conv->out.enabled = true;
+  convert(conv, chunk->data, chunk->begin, chunk->end, chunk->size);
+  return NULL;
+}
+
+/* Convert the chunks of a mapped input on separate threads. The first chunk
+ * continues from the state of the previous input and the state at the end of
+ * the last chunk is kept for the next input. */
+static void convert_parallel(const u8 *data, size_t size, u8 n_jobs) {
+  struct chunk chunks[MAX_JOBS];
+  memset(chunks, 0, sizeof(chunks));
+  u8 n_chunks = plan_chunks(data, size, n_jobs, chunks);
+
+  for (u8 k = 1; k < n_chunks; k++) {
+    struct converter *conv = &chunks[k].conv;
+    conv->state = malloc(sizeof(*conv->state));
+    if (NULL == conv->state) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+    conv->out.fd = -1;
+    if (0 != pthread_create(
+                 &chunks[k].thread, NULL, convert_chunk, &chunks[k])) {
+      fprintf(stderr, "Can't start conversion thread\n");
+      exit(1);
+    }
+  }
+
+  convert(&main_conv, data, 0, chunks[0].end, size);
+  flush_output(&main_conv.out);
+
+  for (u8 k = 1; k < n_chunks; k++) {
+    struct converter *conv = &chunks[k].conv;
+    pthread_join(chunks[k].thread, NULL);
+    write_all(main_conv.out.fd, conv->out.buffer, conv->out.len);
+    main_conv.out.frames += conv->out.frames;
+    free(conv->out.buffer);
+    if (k + 1 == n_chunks) {
+      *main_conv.state = *conv->state;
+      main_conv.obs_time = conv->obs_time;
+      main_conv.obs_time_valid = conv->obs_time_valid;
+    }
+    free(conv->state);
+  }
+}
+
+/* Map the input file, pipes and other files that can't be mapped are read */
+static void convert_file(const char *path, u8 n_jobs) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open input file! %s\n", path);
+    exit(1);
+  }
+
+  struct stat st;
+  if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    convert_stream(fd);
+    close(fd);
+    return;
+  }
+  if (0 == st.st_size) {
+    close(fd);
+    return;
+  }
+
+  size_t size = (size_t)st.st_size;
+  void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (MAP_FAILED == data) {
+    convert_stream(fd);
+    close(fd);
+    return;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+  if (n_jobs > 1) {
+    convert_parallel(data, size, n_jobs);
+  } else {
+    convert(&main_conv, data, 0, size, size);
+  }
+  munmap(data, size);
+  close(fd);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s -w week -t tow [-l leap_seconds] [-j jobs] [-o output] "
+          "[file ...]\n"
+          "  -w week          GPS week of the start of the input\n"
+          "  -t tow           GPS time of week of the start of the input, "
+          "in seconds\n"
+          "  -l leap_seconds  GPS to UTC leap seconds, needed to convert "
+          "the legacy\n"
+          "                   GLONASS observations\n"
+          "  -j jobs          Number of threads converting each input file, "
+          "the output\n"
+          "                   is the same as with a single thread\n"
+          "  -o output        Output file, stdout by default\n"
+          "Reads stdin when no input file is given.\n",
+          name);
+}
+
+static bool parse_long(const char *arg, long min, long max, long *value) {
+  char *end;
+  errno = 0;
+  *value = strtol(arg, &end, 10);
+  return 0 == errno && end != arg && '\0' == *end && *value >= min &&
+         *value <= max;
+}
+
+int main(int argc, char **argv) {
+  long week = -1;
+  long tow = -1;
+  long leap = 0;
+  long n_jobs = 1;
+  const char *output = NULL;
+
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "w:t:l:j:o:h"))) {
+    switch (opt) {
+      case 'w':
+        if (!parse_long(optarg, 0, UINT16_MAX, &week)) {
+          fprintf(stderr, "Invalid week %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 't':
+        if (!parse_long(optarg, 0, SECS_IN_WEEK - 1, &tow)) {
+          fprintf(stderr, "Invalid time of week %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'l':
+        if (!parse_long(optarg, INT8_MIN, INT8_MAX, &leap)) {
+          fprintf(stderr, "Invalid leap seconds %s\n", optarg);
+          return 1;
+        }
+        leap_seconds = (s8)leap;
+        leap_second_known = true;
+        break;
+      case 'j':
+        if (!parse_long(optarg, 1, MAX_JOBS, &n_jobs)) {
+          fprintf(stderr, "Invalid number of jobs %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (week < 0 || tow < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (NULL != output) {
+    main_conv.out.fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (main_conv.out.fd < 0) {
+      fprintf(stderr, "Can't open output file! %s\n", output);
+      return 1;
+    }
+  }
+
+  start_time.wn = (u16)week;
+  start_time.tow = (u32)tow;
+  scan_time = (s64)week * SECS_IN_WEEK + tow;
+  init_converter(&main_conv, &start_time);
+
+  if (optind < argc) {
+    for (int arg = optind; arg < argc; arg++) {
+      convert_file(argv[arg], (u8)n_jobs);
+    }
+  } else {
+    convert_stream(STDIN_FILENO);
+  }
+
+  flush_output(&main_conv.out);
+  if (STDOUT_FILENO != main_conv.out.fd && 0 != close(main_conv.out.fd)) {
+    fprintf(stderr, "Can't write output file! %s\n", output);
+    return 1;
+  }
+
+  fprintf(stderr, "Wrote %llu SBP messages\n", main_conv.out.frames);
+  return 0;
+}